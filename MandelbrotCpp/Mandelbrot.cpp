@@ -16,10 +16,12 @@
 #include "targetver.h"
 
 #define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
 
 #include <windows.h>
 #include <windowsx.h>
 
+#include <algorithm>
 #include <cassert>
 #include <cstdio>
 #include <cwchar>
@@ -37,6 +39,29 @@
 #include <directxmath.h>
 #include <directxcolors.h>
 
+#include "antialias.h"
+#include "area_estimate.h"
+#include "autotune.h"
+#include "benchmark.h"
+#include "buddhabrot.h"
+#include "buffer_pool.h"
+#include "distance_estimate.h"
+#include "equalize.h"
+#include "formulas.h"
+#include "frame_ring.h"
+#include "image_encoder.h"
+#include "inverse_julia.h"
+#include "julia_atlas.h"
+#include "lane_refill.h"
+#include "point_query.h"
+#include "render_scheduler.h"
+#include "resumable.h"
+#include "symmetry.h"
+#include "tiled_layout.h"
+#include "tile_cache.h"
+#include "tile_server.h"
+#include "tile_store.h"
+
 //d3d11.lib;d3dcompiler.lib;dxguid.lib;winmm.lib;comctl32.lib;%(AdditionalDependencies)
 
 #pragma comment (lib, "d3d11")
@@ -432,6 +457,33 @@ namespace
         HINSTANCE                                       hinst         ;
         HWND                                            hwnd          ;
         std::chrono::high_resolution_clock::time_point  then          ;
+        fractal::tile_cache::ptr                        tile_cache    ;
+        fractal::tile_store::ptr                        tile_store    ;
+        // Set once the title said the store is full, it only says so once
+        bool                                            store_full    ;
+        fractal::tile_server::ptr                       tile_server   ;
+        fractal::frame_ring::ptr                        frame_ring    ;
+        // Scratch pixels and iteration counts of the CPU paths, survives resizes
+        fractal::buffer_pool<std::uint32_t>             pixel_pool    ;
+        // Distance estimates of distance_set, one float per texel
+        fractal::buffer_pool<float>                     distance_pool ;
+        fractal::histogram_equalizer                    equalizer     ;
+        fractal::buddhabrot::ptr                        buddhabrot    ;
+        // The Mandelbrot view while its limit is raised past the default
+        fractal::resumable_frame::ptr                   resumable     ;
+        fractal::area_estimator::ptr                    area          ;
+        // Boundary preview of the Julia view by inverse iteration
+        fractal::inverse_julia::ptr                     inverse_julia ;
+        fractal::render_scheduler::ptr                  scheduler     ;
+        // Kernel shape, workers and band height that won on this host
+        fractal::tuned_config                           tuning        ;
+        // Renders the CPU views instead of the scheduler while set
+        fractal::executor::ptr                          executor      ;
+        fractal::render_session::ptr                    snapshot      ;
+        // Set from B until the benchmark task reports back
+        bool                                            benchmarking  ;
+        // Set from T until the tuning task reports back
+        bool                                            tuning_busy   ;
     };
 
     struct device_dependent_resources
@@ -452,20 +504,12 @@ namespace
         com_ptr<ID3D11Device            >   device                  ;
         com_ptr<ID3D11DeviceContext     >   device_context          ;
         com_ptr<IDXGISwapChain          >   swap_chain              ;
-        com_ptr<ID3D11Texture2D         >   back_buffer             ;
-        com_ptr<ID3D11RenderTargetView  >   render_target_view      ;
         com_ptr<ID3D11VertexShader      >   vertex_shader           ;
         com_ptr<ID3D11PixelShader       >   pixel_shader            ;
         com_ptr<ID3D11InputLayout       >   input_layout            ;
 
         com_ptr<ID3D11SamplerState      >   sampler                 ;
 
-        com_ptr<ID3D11Texture2D         >   mandelbrot_texture      ;
-        com_ptr<ID3D11ShaderResourceView>   mandelbrot_texture_view ;
-
-        com_ptr<ID3D11Texture2D         >   julia_texture           ;
-        com_ptr<ID3D11ShaderResourceView>   julia_texture_view      ;
-
         com_ptr<ID3D11Buffer            >   vertex_buffer           ;
         com_ptr<ID3D11Buffer            >   index_buffer            ;
         com_ptr<ID3D11Buffer            >   view_buffer             ;
@@ -476,6 +520,23 @@ namespace
     struct size_dependent_resources
     {
         using ptr = std::unique_ptr<size_dependent_resources>       ;
+        using iterations = std::unique_ptr<array<unsigned int, 2>>  ;
+
+        // Client size these were created for, the window may already be another size
+        //  while a resize waits for the dragging to stop
+        UINT                                width                   = 0;
+        UINT                                height                  = 0;
+
+        com_ptr<ID3D11Texture2D         >   back_buffer             ;
+        com_ptr<ID3D11RenderTargetView  >   render_target_view      ;
+
+        com_ptr<ID3D11Texture2D         >   mandelbrot_texture      ;
+        com_ptr<ID3D11ShaderResourceView>   mandelbrot_texture_view ;
+        iterations                          mandelbrot_iterations   ;
+
+        com_ptr<ID3D11Texture2D         >   julia_texture           ;
+        com_ptr<ID3D11ShaderResourceView>   julia_texture_view      ;
+        iterations                          julia_iterations        ;
 
         ModelViewProjection                 view                    ;
     };
@@ -490,12 +551,64 @@ namespace
     constexpr mtype     munit             {1    };
     mtype_2             mandelbrot_center {     };
     mtype               mandelbrot_zoom   {0.25 };
-    unsigned int const  mandelbrot_iter   {512  };
+    unsigned int const  default_iter      {512  };
+    unsigned int        mandelbrot_iter   {default_iter};
+    // Highest limit the I key raises the Mandelbrot view to
+    unsigned int const  max_iter          {1U << 24};
 
     mtype_2             julia_center      {     };
     mtype               julia_zoom        {0.25 };
     unsigned int const  julia_iter        {512  };
 
+    enum class render_mode
+    {
+        escape_time         ,
+        antialiased         ,
+        distance_estimate   ,
+        buddhabrot          ,
+        inverse_iteration   ,
+    };
+
+    // The CPU views share the scheduler with background snapshots, a frame is due in
+    //  about two display refreshes
+    double const        frame_deadline_ms   {33   };
+    unsigned int const  snapshot_width      {3840 };
+    unsigned int const  snapshot_height     {2160 };
+    // Snapshots are encoded band by band as they render, W cycles the format
+    fractal::image_format snapshot_format   {fractal::image_format::png};
+
+    // Orbits traced per frame while the orbit density view builds up
+    std::uint64_t const buddhabrot_batch    {1U << 17};
+
+    render_mode         mandelbrot_mode     {render_mode::escape_time};
+    render_mode         julia_mode          {render_mode::escape_time};
+    double              mandelbrot_fraction {     };
+    fractal::formula    mandelbrot_formula  {fractal::formula::mandelbrot2};
+    fractal::precision  mandelbrot_precision{fractal::precision::float32};
+    bool                equalized_colors    {false};
+
+    bool                julia_atlas         {false};
+    unsigned int const  julia_atlas_columns {16   };
+    unsigned int const  julia_atlas_rows    {16   };
+
+    // A resize is applied once the size has not changed for this long, until then the
+    //  last frame is stretched over the window
+    UINT_PTR const      resize_timer        {1    };
+    UINT const          resize_debounce_ms  {100  };
+
+    // Posted by the benchmark task when it is done, lParam is the title to show and is
+    //  owned by the message
+    UINT const          benchmark_done      {WM_APP + 1};
+
+    // Posted by the tuning task when it is done, lParam is the new tuned_config, owned by
+    //  the message, or null when tuning failed
+    UINT const          tuning_done         {WM_APP + 2};
+
+    enum formula_id : unsigned int
+    {
+        formula_mandelbrot  = 1 ,
+        formula_julia       = 2 ,
+    };
 
     inline int mandelbrot2 (mtype_2 coord, mtype_2 center, int iter) restrict(amp)
     {
@@ -574,10 +687,30 @@ namespace
 
     std::vector<unorm_4> const color_lookup = create_color_lookup ();
 
+    std::vector<std::uint32_t> create_cpu_color_lookup ()
+    {
+        std::vector<std::uint32_t> result;
+        result.reserve (color_lookup.size ());
+
+        for (auto const & color : color_lookup)
+        {
+            result.push_back (fractal::pack_rgba (color.x, color.y, color.z, color.w));
+        }
+
+        return result;
+    }
+
+    std::vector<std::uint32_t> const cpu_color_lookup = create_cpu_color_lookup ();
+
     template<typename TPredicate>
     void compute_set (
             accelerator_view const &    av
         ,   ID3D11Texture2D *           texture
+        ,   array<unsigned int, 2> &    iterations
+        ,   fractal::tile_cache *       cache
+        ,   fractal::tile_store *       store
+        ,   formula_id                  formula
+        ,   fractal::symmetry           symmetric
         ,   unsigned int                offset
         ,   mtype                       zoom
         ,   unsigned int                iter
@@ -627,186 +760,1308 @@ namespace
 
         mtype_2 center(ix, iy);
 
+        auto colorize = [&] (array_view<unsigned int const, 2> iterations)
+        {
+            parallel_for_each (
+                    av
+                ,   e
+                ,   [=] (index<2> idx) restrict(amp)
+                {
+                    auto color = lookup_view[iterations[idx]];
+
+                    texv.set(idx,color);
+                });
+        };
+
+        fractal::tile_key key   {}                                  ;
+        key.center_x            = cx                                ;
+        key.center_y            = cy                                ;
+        key.zoom                = zoom                              ;
+        key.param_x             = ix                                ;
+        key.param_y             = iy                                ;
+        key.iter                = iter                              ;
+        key.formula             = formula                           ;
+        key.precision           = sizeof (mtype) * 8                ;
+        key.width               = static_cast<unsigned int> (e[1])  ;
+        key.height              = static_cast<unsigned int> (e[0])  ;
+
+        fractal::buffer_pool<std::uint32_t>::buffer host;
+
+        // Recently shown views are kept compressed in memory, older ones are served
+        //  straight out of the mapped store
+        if (cache)
+        {
+            host = dir->pixel_pool.acquire (e.size ());
+            if (cache->find (key, host.data ()))
+            {
+                colorize (array_view<unsigned int const, 2> (e, host.data ()));
+                return;
+            }
+        }
+
+        if (store)
+        {
+            if (!host.data ())
+            {
+                host = dir->pixel_pool.acquire (e.size ());
+            }
+
+            if (store->find (key, host.data ()))
+            {
+                colorize (array_view<unsigned int const, 2> (e, host.data ()));
+                return;
+            }
+        }
+
+        fractal::formula_view grid;
+        grid.center_x           = cx                                ;
+        grid.center_y           = cy                                ;
+        grid.zoom               = zoom                              ;
+        grid.width              = static_cast<unsigned int> (e[1])  ;
+        grid.height             = static_cast<unsigned int> (e[0])  ;
+
+        auto const plan         = fractal::plan_symmetry (grid, symmetric);
+        auto const mirror_begin = static_cast<int> (plan.mirror_begin)  ;
+        auto const mirrored     = static_cast<int> (plan.mirrored ())   ;
+        auto const mirror_x     = static_cast<int> (plan.mirror_x)      ;
+        auto const mirror_y     = static_cast<int> (plan.mirror_y)      ;
+        auto const covered_begin= static_cast<int> (plan.covered_begin) ;
+        auto const covered_end  = static_cast<int> (plan.covered_end)   ;
+        auto const reversed     = plan.kind == fractal::symmetry::origin;
+
+        // Only the rows that are not mirror images of others
         parallel_for_each (
                 av
-            ,   e
-            ,   [=] (index<2> idx) restrict(amp)
+            ,   extent<2> (e[0] - mirrored, e[1])
+            ,   [=, &iterations] (index<2> idx) restrict(amp)
             {
-                mtype_2 texpos (static_cast<mtype> (idx[1]), static_cast<mtype> (idx[0]));
+                auto y = idx[0] < mirror_begin ? idx[0] : idx[0] + mirrored;
+
+                mtype_2 texpos (static_cast<mtype> (idx[1]), static_cast<mtype> (y));
                 auto coord = m * texpos + t;
 
                 auto result = predicate (coord, center, iter);
 
-                auto color = lookup_view[result];
-
-                texv.set(idx,color);
+                iterations (y, idx[1]) = static_cast<unsigned int> (result);
             });
+
+        // The mirrored rows are copied, but for the columns whose mirror image is outside
+        //  the frame
+        if (mirrored > 0)
+        {
+            parallel_for_each (
+                    av
+                ,   extent<2> (mirrored, e[1])
+                ,   [=, &iterations] (index<2> idx) restrict(amp)
+                {
+                    auto y = idx[0] + mirror_begin;
+                    auto x = idx[1];
+
+                    if (!reversed)
+                    {
+                        iterations (y, x) = iterations (mirror_y - y, x);
+                    }
+                    else if (x >= covered_begin && x < covered_end)
+                    {
+                        iterations (y, x) = iterations (mirror_y - y, mirror_x - x);
+                    }
+                    else
+                    {
+                        mtype_2 texpos (static_cast<mtype> (x), static_cast<mtype> (y));
+                        auto coord = m * texpos + t;
+
+                        iterations (y, x) = static_cast<unsigned int> (predicate (coord, center, iter));
+                    }
+                });
+        }
+
+        if (cache || store)
+        {
+            if (!host.data ())
+            {
+                host = dir->pixel_pool.acquire (e.size ());
+            }
+            copy (iterations, host.data ());
+        }
+
+        if (cache)
+        {
+            cache->insert (key, host.data ());
+        }
+
+        if (store)
+        {
+            // Queued, the store writes it on a thread of its own
+            store->insert (key, host.data ());
+
+            if (store->full () && !dir->store_full)
+            {
+                dir->store_full = true;
+                SetWindowText (dir->hwnd, L"Tile store full, new views are no longer saved");
+            }
+        }
+
+        colorize (iterations);
     }
 
-    std::tuple<UINT, UINT> client_rect ()
+    void update_texture (ID3D11DeviceContext * context, ID3D11Texture2D * texture, std::uint32_t const * pixels)
     {
-        RECT rc {};
-        GetClientRect (dir->hwnd, &rc);
-        return std::tuple<UINT, UINT> (rc.right - rc.left, rc.bottom - rc.top);
+        D3D11_TEXTURE2D_DESC desc {};
+        texture->GetDesc (&desc);
+
+        context->UpdateSubresource (
+                texture
+            ,   0
+            ,   nullptr
+            ,   pixels
+            ,   desc.Width * sizeof (std::uint32_t)
+            ,   0
+            );
     }
 
-    mtype_2 screen_to_plane (int x, int y)
+    void update_texture (ID3D11DeviceContext * context, ID3D11Texture2D * texture, std::vector<std::uint32_t> const & pixels)
     {
-        UINT iwidth                 = 0;
-        UINT iheight                = 0;
-        std::tie (iwidth, iheight)  = client_rect ();
+        update_texture (context, texture, pixels.data ());
+    }
 
-        mtype width   = static_cast<mtype> (iwidth );
-        mtype height  = static_cast<mtype> (iheight);
+    // Publication quality Mandelbrot view, rendered on the CPU with adaptive supersampling.
+    //  Returns the fraction of texels that needed more than one sample.
+    double antialias_set (
+            ID3D11DeviceContext *       context
+        ,   ID3D11Texture2D *           texture
+        ,   unsigned int                offset
+        ,   mtype                       zoom
+        ,   unsigned int                iter
+        ,   mtype                       cx
+        ,   mtype                       cy
+        )
+    {
+        if (!texture)
+        {
+            return 0;
+        }
 
-        mtype aspect  = width / height;
+        D3D11_TEXTURE2D_DESC desc {};
+        texture->GetDesc (&desc);
 
-        mtype ax      = clamp (x / width - munit/4 , -munit/4, munit/4) * aspect / mandelbrot_zoom + mandelbrot_center.x;
-        mtype ay      = clamp (y / height- munit/2 , -munit/2, munit/2) / mandelbrot_zoom + mandelbrot_center.y;
+        auto vp         = fractal::make_viewport (cx, cy, zoom, desc.Width, desc.Height);
+        auto palette    = fractal::cyclic_palette (cpu_color_lookup, offset, iter);
 
-        return mtype_2 (ax, ay);
+        auto pixels     = dir->pixel_pool.acquire (desc.Width * desc.Height);
+
+        auto result = fractal::render_antialiased (
+                vp
+            ,   fractal::antialias_options ()
+            ,   [=] (mtype x, mtype y) {return fractal::mandelbrot2_smooth (x, y, x, y, iter);}
+            ,   palette
+            ,   pixels.data ()
+            );
+
+        update_texture (context, texture, pixels.data ());
+
+        return result.refined_fraction ();
     }
 
-}
+    // Mandelbrot view shaded by exterior distance, filaments are drawn at subpixel width.
+    //  Returns the fraction of texels filled without iterating.
+    double distance_set (
+            ID3D11DeviceContext *       context
+        ,   ID3D11Texture2D *           texture
+        ,   mtype                       zoom
+        ,   unsigned int                iter
+        ,   mtype                       cx
+        ,   mtype                       cy
+        )
+    {
+        if (!texture)
+        {
+            return 0;
+        }
 
-//--------------------------------------------------------------------------------------
-// Forward declarations
-//--------------------------------------------------------------------------------------
-HRESULT             init_window     (HINSTANCE hInstance, int nCmdShow);
-HRESULT             init_device     ();
-HRESULT             mouse_rbuttonup ();
-HRESULT             mouse_move      (int x, int y);
-HRESULT             mouse_wheel     (int delta);
-LRESULT CALLBACK    wnd_proc        (HWND, UINT, WPARAM, LPARAM);
-void                render          ();
+        D3D11_TEXTURE2D_DESC desc {};
+        texture->GetDesc (&desc);
 
-//--------------------------------------------------------------------------------------
-// Entry point to the program. Initializes everything and goes into a message processing
-// loop. Idle time is used to render the scene.
-//--------------------------------------------------------------------------------------
-int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPWSTR lpCmdLine, int nCmdShow)
-{
-    UNREFERENCED_PARAMETER (hPrevInstance);
-    UNREFERENCED_PARAMETER (lpCmdLine);
+        auto vp         = fractal::make_viewport (cx, cy, zoom, desc.Width, desc.Height);
+        auto options    = fractal::distance_options ();
 
-    SetProcessDPIAware ();
+        // render_distance writes every texel
+        auto distances = dir->distance_pool.acquire (desc.Width * desc.Height);
 
-    try
-    {
-        dir       = std::make_unique<device_independent_resources> ();
-        dir->then = std::chrono::high_resolution_clock::now ();
+        auto result = fractal::render_distance (vp, mtype (), mtype (), false, iter, options, distances.data ());
 
-        TEST_HR init_window (hInstance, nCmdShow);
+        auto set_color  = fractal::pack_rgba (0.0F, 0.0F, 0.0F, 1.0F);
+        auto near_color = fractal::pack_rgba (1.0F, 1.0F, 0.0F, 1.0F);
+        auto far_color  = fractal::pack_rgba (0.0F, 0.0F, 1.0F, 1.0F);
 
-        TEST_HR init_device ();
+        auto pixels = dir->pixel_pool.acquire (distances.size ());
+        for (auto i = 0U; i < pixels.size (); ++i)
+        {
+            pixels[i] = fractal::shade_distance (distances[i], options, set_color, near_color, far_color);
+        }
 
-        // Main message loop
-        MSG msg {};
-        while (WM_QUIT != msg.message)
+        update_texture (context, texture, pixels.data ());
+
+        return result.filled_fraction ();
+    }
+
+    // Escape time view with the iteration limit raised past the default. The frame is kept
+    //  between frames, raising the limit again only continues the pixels that had not
+    //  escaped, and each frame iterates for about a frame's deadline so a deep limit
+    //  fills in progressively. Pixels still iterating are black.
+    void resumable_set (
+            ID3D11DeviceContext *       context
+        ,   ID3D11Texture2D *           texture
+        ,   fractal::formula            formula
+        ,   unsigned int                offset
+        ,   mtype                       zoom
+        ,   unsigned int                iter
+        ,   mtype                       cx
+        ,   mtype                       cy
+        )
+    {
+        if (!texture)
         {
-            if (PeekMessage (&msg, nullptr, 0, 0, PM_REMOVE))
-            {
-                TranslateMessage (&msg);
-                DispatchMessage (&msg);
-            }
-            else
+            return;
+        }
+
+        D3D11_TEXTURE2D_DESC desc {};
+        texture->GetDesc (&desc);
+
+        auto & frame = dir->resumable;
+        if (
+                !frame
+            ||  frame->options ().kernel_formula    != formula
+            ||  frame->view ().width                != desc.Width
+            ||  frame->view ().height               != desc.Height
+            ||  frame->view ().center_x             != cx
+            ||  frame->view ().center_y             != cy
+            ||  frame->view ().zoom                 != zoom
+            ||  frame->view ().iter                 > iter
+            )
+        {
+            fractal::resumable_options options;
+            options.view.center_x   = cx            ;
+            options.view.center_y   = cy            ;
+            options.view.zoom       = zoom          ;
+            options.view.width      = desc.Width    ;
+            options.view.height     = desc.Height   ;
+            options.view.iter       = iter          ;
+            options.kernel_formula  = formula       ;
+
+            frame = fractal::resumable_frame::create (options);
+            if (!frame)
             {
-                render ();
+                return;
             }
         }
 
-        sdr.release ();
-        ddr.release ();
-        dir.release ();
+        frame->raise_limit (iter);
+        frame->run_for (frame_deadline_ms);
 
-        return (int) msg.wParam;
-    }
-    catch (std::exception const & e)
-    {
-       OutputDebugString (L"Caught exception: ");
-       OutputDebugStringA (e.what ());
-       OutputDebugString (L"\r\n");
-       return 999;
-    }
-    catch (...)
-    {
-       OutputDebugString (L"Caught exception: unknown\r\n");
-       return 999;
-    }
-}
+        auto const palette  = fractal::cyclic_palette (cpu_color_lookup, offset, iter);
+        auto const counts   = frame->counts ();
+        auto const reached  = frame->reached ();
 
+        auto pixels = dir->pixel_pool.acquire (desc.Width * desc.Height);
+        for (auto i = std::size_t (); i < pixels.size (); ++i)
+        {
+            pixels.data ()[i] = counts[i] >= reached ? fractal::opaque_black : palette (counts[i]);
+        }
 
-//--------------------------------------------------------------------------------------
-// Register class and create window
-//--------------------------------------------------------------------------------------
-HRESULT init_window (HINSTANCE hInstance, int nCmdShow)
-{
-    // Register class
-    WNDCLASSEX wcex;
-    wcex.cbSize         = sizeof (WNDCLASSEX)               ;
-    wcex.style          = CS_HREDRAW | CS_VREDRAW           ;
-    wcex.lpfnWndProc    = wnd_proc                          ;
-    wcex.cbClsExtra     = 0                                 ;
-    wcex.cbWndExtra     = 0                                 ;
-    wcex.hInstance      = hInstance                         ;
-    wcex.hIcon          = nullptr                           ;
-    wcex.hCursor        = LoadCursor (nullptr, IDC_ARROW)   ;
-    wcex.hbrBackground  = (HBRUSH)(COLOR_WINDOW + 1)        ;
-    wcex.lpszMenuName   = nullptr                           ;
-    wcex.lpszClassName  = L"MandelbrotWindowClass"          ;
-    wcex.hIconSm        = nullptr                           ;
-    if (!RegisterClassEx (&wcex))
-    {
-        return E_FAIL;
+        update_texture (context, texture, pixels.data ());
     }
 
-    dir->hinst = hInstance;
+    // Orbit density of the Mandelbrot view, refined progressively: every frame traces
+    //  another batch of orbits into the engine and shows the density so far. Moving the
+    //  view starts over with the same engine and escape map, resizing builds a new one.
+    void buddhabrot_set (
+            ID3D11DeviceContext *       context
+        ,   ID3D11Texture2D *           texture
+        ,   mtype                       zoom
+        ,   mtype                       cx
+        ,   mtype                       cy
+        )
+    {
+        if (!texture)
+        {
+            return;
+        }
 
-    RECT rc { 0, 0, 1024, 768 };
-    AdjustWindowRect (&rc, WS_OVERLAPPEDWINDOW, FALSE);
-    dir->hwnd = CreateWindow (
-            L"MandelbrotWindowClass"
-        ,   L"Mandelbrot"
-        ,   WS_OVERLAPPEDWINDOW
-        ,   CW_USEDEFAULT
-        ,   CW_USEDEFAULT
-        ,   rc.right - rc.left
-        ,   rc.bottom - rc.top
-        ,   nullptr
-        ,   nullptr
-        ,   hInstance
-        ,   nullptr
-        );
+        D3D11_TEXTURE2D_DESC desc {};
+        texture->GetDesc (&desc);
 
-    if (!dir->hwnd)
-    {
-        return E_FAIL;
-    }
+        auto & engine = dir->buddhabrot;
+        if (
+                !engine
+            ||  engine->options ().width    != desc.Width
+            ||  engine->options ().height   != desc.Height
+            )
+        {
+            fractal::buddhabrot_options options;
+            options.width       = desc.Width    ;
+            options.height      = desc.Height   ;
+            options.center_x    = cx            ;
+            options.center_y    = cy            ;
+            options.zoom        = zoom          ;
+
+            engine = fractal::buddhabrot::create (options);
+            if (!engine)
+            {
+                return;
+            }
+        }
+        else if (
+                (engine->options ().center_x != cx || engine->options ().center_y != cy || engine->options ().zoom != zoom)
+            &&  !engine->set_view (cx, cy, zoom)
+            )
+        {
+            return;
+        }
 
-    ShowWindow (dir->hwnd, nCmdShow);
+        engine->run (buddhabrot_batch);
 
-    return S_OK;
-}
+        auto pixels = dir->pixel_pool.acquire (desc.Width * desc.Height);
+        engine->to_pixels (pixels.data ());
 
-//--------------------------------------------------------------------------------------
-// Create Direct3D device and swap chain
-//--------------------------------------------------------------------------------------
-HRESULT init_device ()
-{
+        update_texture (context, texture, pixels.data ());
+    }
+
+    // Boundary of the Julia set of c = (cx, cy) by inverse iteration, a fraction of the cost
+    //  of escape time so the pane keeps up with the mouse. z*z + c only.
+    void inverse_julia_set (
+            ID3D11DeviceContext *       context
+        ,   ID3D11Texture2D *           texture
+        ,   mtype                       zoom
+        ,   mtype                       cx
+        ,   mtype                       cy
+        )
+    {
+        if (!texture)
+        {
+            return;
+        }
+
+        D3D11_TEXTURE2D_DESC desc {};
+        texture->GetDesc (&desc);
+
+        // The view is centered on c, moving the mouse moves both. The engine and its
+        //  buffers live as long as the texture size, a mouse move only moves the view.
+        auto & engine = dir->inverse_julia;
+        if (
+                !engine
+            ||  engine->options ().width    != desc.Width
+            ||  engine->options ().height   != desc.Height
+            )
+        {
+            fractal::inverse_julia_options options;
+            options.width       = desc.Width            ;
+            options.height      = desc.Height           ;
+            options.center_x    = cx                    ;
+            options.center_y    = cy                    ;
+            options.zoom        = zoom                  ;
+            options.workers     = dir->tuning.workers   ;
+
+            engine = fractal::inverse_julia::create (options);
+            if (!engine)
+            {
+                return;
+            }
+        }
+        else if (!engine->set_view (cx, cy, zoom))
+        {
+            return;
+        }
+
+        engine->render (cx, cy);
+
+        auto pixels = dir->pixel_pool.acquire (desc.Width * desc.Height);
+        engine->to_pixels (pixels.data (), 0xFFFFFFFFU);
+
+        update_texture (context, texture, pixels.data ());
+    }
+
+    // Julia thumbnails for a grid of c over the Mandelbrot view, all rendered in one pass
+    void julia_atlas_set (
+            ID3D11DeviceContext *       context
+        ,   ID3D11Texture2D *           texture
+        ,   unsigned int                offset
+        ,   mtype                       zoom
+        ,   mtype                       cx
+        ,   mtype                       cy
+        )
+    {
+        if (!texture)
+        {
+            return;
+        }
+
+        D3D11_TEXTURE2D_DESC desc {};
+        texture->GetDesc (&desc);
+
+        fractal::julia_thumbnails<mtype> thumbnails;
+        thumbnails.width    = desc.Width / julia_atlas_columns  ;
+        thumbnails.height   = desc.Height / julia_atlas_rows    ;
+        thumbnails.columns  = julia_atlas_columns               ;
+        thumbnails.zoom     = julia_zoom                        ;
+        thumbnails.iter     = julia_iter                        ;
+
+        if (thumbnails.width == 0 || thumbnails.height == 0)
+        {
+            return;
+        }
+
+        // c is taken at the center of each cell of the Mandelbrot view, which has the same size
+        auto vp = fractal::make_viewport (cx, cy, zoom, desc.Width, desc.Height);
+
+        std::vector<mtype> params_x;
+        std::vector<mtype> params_y;
+        for (auto row = 0U; row < julia_atlas_rows; ++row)
+        {
+            for (auto column = 0U; column < julia_atlas_columns; ++column)
+            {
+                params_x.push_back (vp.x ((column + munit/2) * thumbnails.width ));
+                params_y.push_back (vp.y ((row    + munit/2) * thumbnails.height));
+            }
+        }
+
+        auto atlas_width    = thumbnails.atlas_width ();
+        auto atlas_height   = thumbnails.atlas_height (params_x.size ());
+
+        auto counts = dir->pixel_pool.acquire (atlas_width * atlas_height);
+
+        fractal::render_julia_atlas (
+                params_x.data ()
+            ,   params_y.data ()
+            ,   params_x.size ()
+            ,   thumbnails
+            ,   counts.data ()
+            );
+
+        auto palette = fractal::cyclic_palette (cpu_color_lookup, offset, julia_iter);
+
+        auto pixels = dir->pixel_pool.acquire (desc.Width * desc.Height);
+        std::fill (pixels.data (), pixels.data () + pixels.size (), fractal::opaque_black);
+        for (auto y = 0U; y < atlas_height; ++y)
+        {
+            for (auto x = 0U; x < atlas_width; ++x)
+            {
+                pixels[y * desc.Width + x] = palette (counts[y * atlas_width + x]);
+            }
+        }
+
+        update_texture (context, texture, pixels.data ());
+    }
+
+    // Precision a view needs: mtype until pixels get too close to tell apart, then double
+    //  and fixed point. The center itself is still an mtype.
+    fractal::precision view_precision (mtype zoom, mtype cx, mtype cy, UINT width, UINT height)
+    {
+        auto const native   = sizeof (mtype) == 4 ? fractal::precision::float32 : fractal::precision::float64;
+        auto const required = fractal::required_precision (cx, cy, zoom, width, height);
+
+        return required > native ? required : native;
+    }
+
+    // Escape time view of any formula of the formula library, rendered on the CPU with the
+    //  kernel the dispatch table picks for the precision the zoom needs.
+    //  With an output ring of the texture's size the frame is rendered straight into the
+    //  ring's next slot and published after the texture is updated from it.
+    //  With an equalizer the palette is spread by the histogram of the frame's counts.
+    void formula_set (
+            ID3D11DeviceContext *       context
+        ,   ID3D11Texture2D *           texture
+        ,   fractal::frame_ring *       output
+        ,   fractal::histogram_equalizer * equalizer
+        ,   fractal::formula            formula
+        ,   bool                        julia
+        ,   unsigned int                offset
+        ,   mtype                       zoom
+        ,   unsigned int                iter
+        ,   mtype                       cx
+        ,   mtype                       cy
+        ,   mtype                       px
+        ,   mtype                       py
+        )
+    {
+        if (!texture)
+        {
+            return;
+        }
+
+        D3D11_TEXTURE2D_DESC desc {};
+        texture->GetDesc (&desc);
+
+        auto precision  = view_precision (zoom, cx, cy, desc.Width, desc.Height);
+        auto choice     = dir->tuning.kernel (precision);
+        auto kernel     = fractal::select_kernel (formula, precision, choice);
+        if (!kernel)
+        {
+            return;
+        }
+
+        fractal::formula_view view;
+        view.center_x   = cx            ;
+        view.center_y   = cy            ;
+        view.zoom       = zoom          ;
+        view.width      = desc.Width    ;
+        view.height     = desc.Height   ;
+        view.param_x    = px            ;
+        view.param_y    = py            ;
+        view.julia      = julia         ;
+        view.iter       = iter          ;
+
+        if (output && (output->width () != desc.Width || output->height () != desc.Height))
+        {
+            output = nullptr;
+        }
+
+        fractal::buffer_pool<std::uint32_t>::buffer buffer;
+        if (!output)
+        {
+            buffer = dir->pixel_pool.acquire (desc.Width * desc.Height);
+        }
+        auto pixels = output ? output->begin_frame () : buffer.data ();
+
+        // Rows that mirror rendered ones are copied instead
+        auto const plan = fractal::plan_symmetry (view, fractal::formula_symmetry (formula, julia));
+
+        if (dir->executor)
+        {
+            fractal::render_symmetric (view, plan, kernel, pixels, *dir->executor);
+        }
+        else if (dir->scheduler)
+        {
+            // Interactive sessions for the rows before and after the mirrored ones, batch
+            //  snapshots only get the workers' spare time
+            fractal::session_options options;
+            options.view                = view                  ;
+            options.kernel_formula      = formula               ;
+            options.kernel_precision    = precision             ;
+            options.kernel_width        = choice.width          ;
+            options.kernel_unroll       = choice.unroll         ;
+            options.kernel_refill       = choice.refill         ;
+            options.band_rows           = dir->tuning.band_rows ;
+            options.deadline_ms         = frame_deadline_ms     ;
+            options.counts              = pixels                ;
+
+            options.row_end             = plan.mirror_begin     ;
+            auto before = dir->scheduler->submit (options);
+
+            options.row_begin           = plan.mirror_end       ;
+            options.row_end             = desc.Height           ;
+            auto after  = dir->scheduler->submit (options);
+
+            if (before)
+            {
+                before->wait ();
+            }
+
+            if (after)
+            {
+                after->wait ();
+            }
+
+            fractal::mirror_rows (view, plan, kernel, pixels);
+        }
+        else
+        {
+            fractal::render_symmetric (view, plan, kernel, pixels);
+        }
+
+        if (equalizer)
+        {
+            equalizer->apply (pixels, desc.Width * desc.Height, iter, cpu_color_lookup, offset, pixels);
+        }
+        else
+        {
+            auto palette = fractal::cyclic_palette (cpu_color_lookup, offset, iter);
+            for (auto i = 0U; i < desc.Width * desc.Height; ++i)
+            {
+                pixels[i] = palette (static_cast<unsigned int> (pixels[i]));
+            }
+        }
+
+        update_texture (context, texture, pixels);
+
+        if (output)
+        {
+            output->publish ();
+        }
+    }
+
+    fractal::native_path frame_ring_path ()
+    {
+        return get_root_path () + L"frames.ring";
+    }
+
+    // Starts or stops publishing the Mandelbrot view to the shared memory frame ring
+    void toggle_frame_output ()
+    {
+        if (dir->frame_ring)
+        {
+            dir->frame_ring.reset ();
+            SetWindowText (dir->hwnd, L"Frame output stopped");
+            return;
+        }
+
+        D3D11_TEXTURE2D_DESC desc {};
+        sdr->mandelbrot_texture->GetDesc (&desc);
+
+        dir->frame_ring = fractal::frame_ring::create (frame_ring_path (), desc.Width, desc.Height);
+
+        SetWindowText (
+                dir->hwnd
+            ,   dir->frame_ring
+                ? (L"Publishing frames to " + frame_ring_path ()).c_str ()
+                : L"Frame ring could not be created"
+            );
+    }
+
+    // Starts or stops the local tile server for the current formula
+    void toggle_tile_server ()
+    {
+        if (dir->tile_server)
+        {
+            dir->tile_server.reset ();
+            SetWindowText (dir->hwnd, L"Tile server stopped");
+            return;
+        }
+
+        fractal::tile_server_options options;
+        options.iter            = mandelbrot_iter       ;
+        options.tile_formula    = mandelbrot_formula    ;
+        options.colors          = cpu_color_lookup      ;
+
+        dir->tile_server = fractal::tile_server::open (
+                options
+            ,   fractal::tile_store::open (get_root_path () + L"server_tiles.idx", get_root_path () + L"server_tiles.dat")
+            );
+
+        wchar_t buffer[256] {};
+        if (dir->tile_server)
+        {
+            swprintf_s (buffer, L"Serving http://127.0.0.1:%u/{z}/{x}/{y}.bmp", options.port);
+        }
+        else
+        {
+            swprintf_s (buffer, L"Tile server could not listen on port %u", options.port);
+        }
+        SetWindowText (dir->hwnd, buffer);
+    }
+
+    // Starts rendering the Mandelbrot view at snapshot size as a batch job on the shared
+    //  scheduler, or cancels the one still rendering. The finished snapshot is written
+    //  next to the executable.
+    void toggle_snapshot ()
+    {
+        if (!dir->scheduler)
+        {
+            return;
+        }
+
+        if (dir->snapshot && !dir->snapshot->done ())
+        {
+            dir->scheduler->cancel (dir->snapshot);
+            dir->snapshot.reset ();
+            SetWindowText (dir->hwnd, L"Snapshot cancelled");
+            return;
+        }
+
+        fractal::session_options options;
+        options.view.center_x       = mandelbrot_center.x   ;
+        options.view.center_y       = mandelbrot_center.y   ;
+        options.view.zoom           = mandelbrot_zoom       ;
+        options.view.width          = snapshot_width        ;
+        options.view.height         = snapshot_height       ;
+        options.view.iter           = mandelbrot_iter       ;
+        options.kernel_formula      = mandelbrot_formula    ;
+        options.kernel_precision    = view_precision (mandelbrot_zoom, mandelbrot_center.x, mandelbrot_center.y, snapshot_width, snapshot_height);
+        options.kernel_width        = dir->tuning.kernel (options.kernel_precision).width;
+        options.kernel_unroll       = dir->tuning.kernel (options.kernel_precision).unroll;
+        options.kernel_refill       = dir->tuning.kernel (options.kernel_precision).refill;
+        options.band_rows           = dir->tuning.band_rows;
+        options.priority            = fractal::session_priority::batch;
+
+        auto const path     = get_root_path () + L"snapshot." + fractal::image_format_name (snapshot_format);
+        auto const stream   = fractal::image_stream::create_file (path, snapshot_format, snapshot_width, snapshot_height);
+        if (!stream)
+        {
+            SetWindowText (dir->hwnd, (L"Could not create " + path).c_str ());
+            return;
+        }
+
+        // Every band is colored and encoded on the worker that rendered it, the file is
+        //  complete once the last band is in. Cancelling drops the stream and with it the
+        //  partial file.
+        options.band_completed = [stream] (fractal::render_session const & session, unsigned int row_begin, unsigned int row_end)
+        {
+            auto const & view   = session.options ().view;
+            auto const palette  = fractal::cyclic_palette (cpu_color_lookup, 0, view.iter);
+            auto const counts   = session.counts () + static_cast<std::size_t> (row_begin) * view.width;
+
+            std::vector<std::uint32_t> pixels (static_cast<std::size_t> (row_end - row_begin) * view.width);
+            for (auto i = std::size_t (); i < pixels.size (); ++i)
+            {
+                pixels[i] = palette (static_cast<unsigned int> (counts[i]));
+            }
+
+            stream->put (row_begin, row_end - row_begin, pixels.data ());
+        };
+
+        dir->snapshot = dir->scheduler->submit (options);
+
+        SetWindowText (
+                dir->hwnd
+            ,   dir->snapshot
+                ? (L"Rendering snapshot to " + path).c_str ()
+                : L"Snapshot could not be started"
+            );
+    }
+
+    // Cycles the CPU views through the executor backends compiled in, starting from and
+    //  returning to the shared render scheduler
+    void next_executor ()
+    {
+        auto const count    = static_cast<unsigned int> (fractal::executor_kind::count);
+        auto next           = dir->executor ? static_cast<unsigned int> (dir->executor->kind ()) + 1 : 0U;
+
+        dir->executor.reset ();
+        for (; next < count && !dir->executor; ++next)
+        {
+            dir->executor = fractal::make_executor (static_cast<fractal::executor_kind> (next));
+        }
+
+        SetWindowText (
+                dir->hwnd
+            ,   dir->executor
+                ? (std::wstring (L"Executor: ") + fractal::executor_name (dir->executor->kind ())).c_str ()
+                : L"Executor: render scheduler"
+            );
+    }
+
+    // Starts estimating the area of the set inside the visible Mandelbrot view, or stops
+    //  the estimate still running. It refines a round per frame until converged.
+    void toggle_area_estimate ()
+    {
+        if (dir->area)
+        {
+            dir->area.reset ();
+            SetWindowText (dir->hwnd, L"Area estimate stopped");
+            return;
+        }
+
+        auto const vp = fractal::make_viewport (mandelbrot_center.x, mandelbrot_center.y, mandelbrot_zoom, sdr->width / 2, sdr->height);
+
+        fractal::estimate_options options;
+        options.min_x   = vp.origin_x                            ;
+        options.max_x   = vp.origin_x + vp.step_x * vp.width     ;
+        options.min_y   = vp.origin_y                            ;
+        options.max_y   = vp.origin_y + vp.step_y * vp.height    ;
+        // Rounds are stepped on the UI thread every frame, a raised limit would stall them
+        options.iter    = std::min (mandelbrot_iter, default_iter) ;
+
+        dir->area = fractal::area_estimator::create (options);
+        if (!dir->area)
+        {
+            SetWindowText (dir->hwnd, L"Area estimate could not be started");
+        }
+    }
+
+    void step_area_estimate ()
+    {
+        if (!dir->area)
+        {
+            return;
+        }
+
+        auto const running  = dir->area->step ();
+        auto const & e      = dir->area->estimate ();
+
+        wchar_t buffer[256] {};
+        swprintf_s (
+                buffer
+            ,   L"Area:%.6f +- %.6f, %.1fM points, %.2fM/s%s"
+            ,   e.area
+            ,   e.area_error
+            ,   e.points / 1e6
+            ,   e.points_per_second / 1e6
+            ,   running ? L"" : L", done"
+            );
+        SetWindowText (dir->hwnd, buffer);
+
+        if (!running)
+        {
+            dir->area.reset ();
+        }
+    }
+
+    // The executable may be shared by many hosts, each keeps its own tuning
+    fractal::native_path tuning_path ()
+    {
+        wchar_t host[MAX_COMPUTERNAME_LENGTH + 1] {};
+        DWORD length = MAX_COMPUTERNAME_LENGTH + 1;
+        if (!GetComputerName (host, &length))
+        {
+            length = 0;
+        }
+
+        return get_root_path () + L"autotune_" + std::wstring (host, host + length) + L".txt";
+    }
+
+    void show_tuning ()
+    {
+        auto const shape = [] (fractal::kernel_choice const & choice)
+        {
+            return L"W=" + std::to_wstring (choice.width) + (choice.refill ? std::wstring (L" refill") : L" K=" + std::to_wstring (choice.unroll));
+        };
+
+        wchar_t buffer[256] {};
+        swprintf_s (
+                buffer
+            ,   L"Tuned: float %s, double %s, %u workers, %u rows per band"
+            ,   shape (dir->tuning.float32).c_str ()
+            ,   shape (dir->tuning.float64).c_str ()
+            ,   dir->tuning.workers
+            ,   dir->tuning.band_rows
+            );
+        SetWindowText (dir->hwnd, buffer);
+    }
+
+    // Tunes again on a task so the window keeps rendering meanwhile, the result comes
+    //  back in a tuning_done message and is installed by tuning_finished. A snapshot still
+    //  rendering is cancelled, the timings would be off with it running. A second T while
+    //  tuning is ignored.
+    void retune ()
+    {
+        if (dir->tuning_busy)
+        {
+            SetWindowText (dir->hwnd, L"Tuning already running");
+            return;
+        }
+
+        if (dir->snapshot && dir->scheduler && !dir->snapshot->done ())
+        {
+            dir->scheduler->cancel (dir->snapshot);
+        }
+        dir->snapshot.reset ();
+
+        dir->tuning_busy = true;
+        SetWindowText (dir->hwnd, L"Tuning");
+
+        auto const hwnd = dir->hwnd     ;
+        auto const path = tuning_path ();
+        concurrency::create_task ([hwnd, path] ()
+        {
+            // Owned by the message once posted
+            std::unique_ptr<fractal::tuned_config> config;
+            try
+            {
+                config = std::make_unique<fractal::tuned_config> (fractal::autotune ());
+                fractal::save_config (path, *config);
+            }
+            catch (...)
+            {
+                config.reset ();
+            }
+
+            if (PostMessage (hwnd, tuning_done, 0, reinterpret_cast<LPARAM> (config.get ())))
+            {
+                config.release ();
+            }
+        });
+    }
+
+    // Restarts the scheduler with the config the tuning task posted
+    void tuning_finished (LPARAM config)
+    {
+        std::unique_ptr<fractal::tuned_config> owned (reinterpret_cast<fractal::tuned_config *> (config));
+
+        dir->tuning_busy = false;
+        if (!owned)
+        {
+            SetWindowText (dir->hwnd, L"Tuning failed");
+            return;
+        }
+
+        dir->snapshot.reset ();
+        dir->scheduler.reset ();
+        // Holds as many walkers as the old tuning had workers
+        dir->inverse_julia.reset ();
+
+        dir->tuning     = *owned;
+        dir->scheduler  = fractal::render_scheduler::create (dir->tuning.workers);
+        show_tuning ();
+    }
+
+    std::tuple<UINT, UINT> client_rect ()
+    {
+        RECT rc {};
+        GetClientRect (dir->hwnd, &rc);
+        return std::tuple<UINT, UINT> (rc.right - rc.left, rc.bottom - rc.top);
+    }
+
+    // What the benchmarks need of the window, copied on the UI thread as they run on a
+    //  task of their own
+    struct benchmark_setup
+    {
+        UINT                width               ;
+        UINT                height              ;
+        mtype_2             mandelbrot_center   ;
+        mtype               mandelbrot_zoom     ;
+        unsigned int        mandelbrot_iter     ;
+        fractal::formula    mandelbrot_formula  ;
+        mtype_2             julia_center        ;
+        mtype               julia_zoom          ;
+        // 0 while the tile server is stopped
+        unsigned short      tile_server_port    ;
+        std::wstring        root_path           ;
+    };
+
+    // Runs every benchmark and returns the path of the report
+    std::wstring write_benchmarks (benchmark_setup const & setup)
+    {
+        auto const width    = setup.width   ;
+        auto const height   = setup.height  ;
+
+        fractal::formula_view view;
+        view.width      = width                 ;
+        view.height     = height                ;
+        view.iter       = setup.mandelbrot_iter ;
+
+        fractal::benchmark_report report;
+        for (auto p : {fractal::precision::float32, fractal::precision::float64})
+        {
+            view.center_x   = setup.mandelbrot_center.x ;
+            view.center_y   = setup.mandelbrot_center.y ;
+            view.zoom       = setup.mandelbrot_zoom     ;
+            view.julia      = false                     ;
+            fractal::benchmark_unroll (report, view, setup.mandelbrot_formula, p);
+            fractal::benchmark_lane_refill (report, view, setup.mandelbrot_formula, p);
+
+            view.center_x   = setup.julia_center.x ;
+            view.center_y   = setup.julia_center.y ;
+            view.zoom       = setup.julia_zoom     ;
+            view.param_x    = setup.julia_center.x ;
+            view.param_y    = setup.julia_center.y ;
+            view.julia      = true                 ;
+            fractal::benchmark_unroll (report, view, setup.mandelbrot_formula, p);
+            fractal::benchmark_lane_refill (report, view, setup.mandelbrot_formula, p);
+        }
+
+        view.center_x   = setup.mandelbrot_center.x ;
+        view.center_y   = setup.mandelbrot_center.y ;
+        view.zoom       = setup.mandelbrot_zoom     ;
+        view.julia      = false                     ;
+        fractal::benchmark_precision (report, view, setup.mandelbrot_formula);
+
+        fractal::benchmark_executors (report, view, setup.mandelbrot_formula, fractal::precision::float32);
+
+        {
+            // Views centered on the axis and the origin, where half the rows are mirrored
+            auto axis       = view                  ;
+            axis.center_y   = 0                     ;
+            fractal::benchmark_symmetry (report, axis, setup.mandelbrot_formula, fractal::precision::float32);
+
+            auto origin     = view                 ;
+            origin.center_x = 0                    ;
+            origin.center_y = 0                    ;
+            origin.zoom     = setup.julia_zoom     ;
+            origin.param_x  = setup.julia_center.x ;
+            origin.param_y  = setup.julia_center.y ;
+            origin.julia    = true                 ;
+            fractal::benchmark_symmetry (report, origin, setup.mandelbrot_formula, fractal::precision::float32);
+        }
+
+        fractal::benchmark_coloring (report, view, setup.mandelbrot_formula, cpu_color_lookup);
+        fractal::benchmark_layouts (report, view, setup.mandelbrot_formula, fractal::precision::float32, cpu_color_lookup);
+        fractal::benchmark_perf_counters (report, view, setup.mandelbrot_formula, fractal::precision::float32, cpu_color_lookup);
+
+        {
+            auto resumed    = view                  ;
+            resumed.iter    = default_iter          ;
+            fractal::benchmark_resumable (report, resumed);
+        }
+
+        {
+            auto julia      = view                 ;
+            julia.center_x  = setup.julia_center.x ;
+            julia.center_y  = setup.julia_center.y ;
+            julia.zoom      = setup.julia_zoom     ;
+            julia.iter      = julia_iter           ;
+            julia.param_x   = setup.julia_center.x ;
+            julia.param_y   = setup.julia_center.y ;
+            fractal::benchmark_inverse_julia (report, julia);
+        }
+
+        view.width      = 3840                  ;
+        view.height     = 2160                  ;
+        fractal::benchmark_coloring (report, view, setup.mandelbrot_formula, cpu_color_lookup);
+        fractal::benchmark_layouts (report, view, setup.mandelbrot_formula, fractal::precision::float32, cpu_color_lookup);
+        fractal::benchmark_image_encoders (report, view, setup.mandelbrot_formula, cpu_color_lookup, setup.root_path + L"benchmark.png");
+
+        fractal::buddhabrot_options orbit_options;
+        orbit_options.width     = width / 2                 ;
+        orbit_options.height    = height                    ;
+        orbit_options.center_x  = setup.mandelbrot_center.x ;
+        orbit_options.center_y  = setup.mandelbrot_center.y ;
+        orbit_options.zoom      = setup.mandelbrot_zoom     ;
+        fractal::benchmark_buddhabrot (report, orbit_options);
+
+        fractal::benchmark_point_query (report, setup.mandelbrot_iter);
+        fractal::benchmark_area (report);
+
+        // Every candidate the tuner picks from, without changing the tuning
+        fractal::autotune (fractal::autotune_options (), &report);
+
+        {
+            auto batch      = view                       ;
+            batch.width     = 1920                       ;
+            batch.height    = 1080                       ;
+            batch.iter      = setup.mandelbrot_iter * 16 ;
+
+            view.width      = width / 2             ;
+            view.height     = height                ;
+            fractal::benchmark_scheduler (report, view, batch);
+        }
+
+        if (setup.tile_server_port != 0)
+        {
+            fractal::benchmark_tile_server (report, setup.tile_server_port);
+        }
+
+        fractal::benchmark_frame_ring (report, setup.root_path + L"benchmark.ring", width / 2, height);
+
+        auto path = setup.root_path + L"benchmark.txt";
+        report.write (path);
+
+        return path;
+    }
+
+    // Runs the benchmarks on a task so the window keeps rendering meanwhile, the title to
+    //  show comes back in a benchmark_done message. A second B while they run is ignored.
+    void run_benchmarks ()
+    {
+        if (dir->benchmarking)
+        {
+            SetWindowText (dir->hwnd, L"Benchmark already running");
+            return;
+        }
+
+        benchmark_setup setup;
+        std::tie (setup.width, setup.height) = client_rect ();
+        setup.mandelbrot_center     = mandelbrot_center     ;
+        setup.mandelbrot_zoom       = mandelbrot_zoom       ;
+        setup.mandelbrot_iter       = mandelbrot_iter       ;
+        setup.mandelbrot_formula    = mandelbrot_formula    ;
+        setup.julia_center          = julia_center          ;
+        setup.julia_zoom            = julia_zoom            ;
+        setup.tile_server_port      = dir->tile_server ? dir->tile_server->port () : 0;
+        setup.root_path             = get_root_path ()      ;
+
+        dir->benchmarking = true;
+        SetWindowText (dir->hwnd, L"Benchmark running");
+
+        auto const hwnd = dir->hwnd;
+        concurrency::create_task ([hwnd, setup] ()
+        {
+            // Owned by the message once posted
+            std::unique_ptr<std::wstring> title;
+            try
+            {
+                title = std::make_unique<std::wstring> (L"Benchmark written to " + write_benchmarks (setup));
+            }
+            catch (...)
+            {
+                title = std::make_unique<std::wstring> (L"Benchmark failed");
+            }
+
+            if (PostMessage (hwnd, benchmark_done, 0, reinterpret_cast<LPARAM> (title.get ())))
+            {
+                title.release ();
+            }
+        });
+    }
+
+    void benchmark_finished (LPARAM title)
+    {
+        std::unique_ptr<std::wstring> owned (reinterpret_cast<std::wstring *> (title));
+
+        dir->benchmarking = false;
+        SetWindowText (dir->hwnd, owned->c_str ());
+    }
+
+    mtype_2 screen_to_plane (int x, int y)
+    {
+        UINT iwidth                 = 0;
+        UINT iheight                = 0;
+        std::tie (iwidth, iheight)  = client_rect ();
+
+        mtype width   = static_cast<mtype> (iwidth );
+        mtype height  = static_cast<mtype> (iheight);
+
+        mtype aspect  = width / height;
+
+        mtype ax      = clamp (x / width - munit/4 , -munit/4, munit/4) * aspect / mandelbrot_zoom + mandelbrot_center.x;
+        mtype ay      = clamp (y / height- munit/2 , -munit/2, munit/2) / mandelbrot_zoom + mandelbrot_center.y;
+
+        return mtype_2 (ax, ay);
+    }
+
+}
+
+//--------------------------------------------------------------------------------------
+// Forward declarations
+//--------------------------------------------------------------------------------------
+HRESULT             init_window     (HINSTANCE hInstance, int nCmdShow);
+HRESULT             init_device     ();
+HRESULT             resize_device   ();
+HRESULT             mouse_rbuttonup ();
+HRESULT             mouse_move      (int x, int y);
+HRESULT             mouse_wheel     (int delta);
+HRESULT             key_down        (WPARAM key);
+LRESULT CALLBACK    wnd_proc        (HWND, UINT, WPARAM, LPARAM);
+void                render          ();
+
+//--------------------------------------------------------------------------------------
+// Entry point to the program. Initializes everything and goes into a message processing
+// loop. Idle time is used to render the scene.
+//--------------------------------------------------------------------------------------
+int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPWSTR lpCmdLine, int nCmdShow)
+{
+    UNREFERENCED_PARAMETER (hPrevInstance);
+    UNREFERENCED_PARAMETER (lpCmdLine);
+
+    SetProcessDPIAware ();
+
+    try
+    {
+        dir       = std::make_unique<device_independent_resources> ();
+        dir->then = std::chrono::high_resolution_clock::now ();
+
+        dir->tile_cache = std::make_unique<fractal::tile_cache> (256U << 20);
+
+        // Without a store every view is rendered from scratch, same as before
+        dir->tile_store = fractal::tile_store::open (
+                get_root_path () + L"tiles.idx"
+            ,   get_root_path () + L"tiles.dat"
+            );
+
+        // Tunes on the first start and whenever the CPU changed, otherwise only reads the
+        //  saved config
+        dir->tuning     = fractal::load_or_tune (tuning_path ());
+        dir->scheduler  = fractal::render_scheduler::create (dir->tuning.workers);
+
+        TEST_HR init_window (hInstance, nCmdShow);
+
+        TEST_HR init_device ();
+
+        // Main message loop
+        MSG msg {};
+        while (WM_QUIT != msg.message)
+        {
+            if (PeekMessage (&msg, nullptr, 0, 0, PM_REMOVE))
+            {
+                TranslateMessage (&msg);
+                DispatchMessage (&msg);
+            }
+            else
+            {
+                render ();
+            }
+        }
+
+        sdr.release ();
+        ddr.release ();
+        dir.release ();
+
+        return (int) msg.wParam;
+    }
+    catch (std::exception const & e)
+    {
+       OutputDebugString (L"Caught exception: ");
+       OutputDebugStringA (e.what ());
+       OutputDebugString (L"\r\n");
+       return 999;
+    }
+    catch (...)
+    {
+       OutputDebugString (L"Caught exception: unknown\r\n");
+       return 999;
+    }
+}
+
+
+//--------------------------------------------------------------------------------------
+// Register class and create window
+//--------------------------------------------------------------------------------------
+HRESULT init_window (HINSTANCE hInstance, int nCmdShow)
+{
+    // Register class
+    WNDCLASSEX wcex;
+    wcex.cbSize         = sizeof (WNDCLASSEX)               ;
+    wcex.style          = CS_HREDRAW | CS_VREDRAW           ;
+    wcex.lpfnWndProc    = wnd_proc                          ;
+    wcex.cbClsExtra     = 0                                 ;
+    wcex.cbWndExtra     = 0                                 ;
+    wcex.hInstance      = hInstance                         ;
+    wcex.hIcon          = nullptr                           ;
+    wcex.hCursor        = LoadCursor (nullptr, IDC_ARROW)   ;
+    wcex.hbrBackground  = (HBRUSH)(COLOR_WINDOW + 1)        ;
+    wcex.lpszMenuName   = nullptr                           ;
+    wcex.lpszClassName  = L"MandelbrotWindowClass"          ;
+    wcex.hIconSm        = nullptr                           ;
+    if (!RegisterClassEx (&wcex))
+    {
+        return E_FAIL;
+    }
+
+    dir->hinst = hInstance;
+
+    RECT rc { 0, 0, 1024, 768 };
+    AdjustWindowRect (&rc, WS_OVERLAPPEDWINDOW, FALSE);
+    dir->hwnd = CreateWindow (
+            L"MandelbrotWindowClass"
+        ,   L"Mandelbrot"
+        ,   WS_OVERLAPPEDWINDOW
+        ,   CW_USEDEFAULT
+        ,   CW_USEDEFAULT
+        ,   rc.right - rc.left
+        ,   rc.bottom - rc.top
+        ,   nullptr
+        ,   nullptr
+        ,   hInstance
+        ,   nullptr
+        );
+
+    if (!dir->hwnd)
+    {
+        return E_FAIL;
+    }
+
+    ShowWindow (dir->hwnd, nCmdShow);
+
+    return S_OK;
+}
+
+//--------------------------------------------------------------------------------------
+// Create Direct3D device and swap chain
+//--------------------------------------------------------------------------------------
+HRESULT init_device ()
+{
     UINT width   = 0;
     UINT height  = 0;
     std::tie (width, height) = client_rect ();
 
-    ddr.reset ();
     sdr.reset ();
+    ddr.reset ();
 
+    // Too small to render into, the first resize to a usable size creates the device
     if (width < 16 || height < 16)
     {
       return S_OK;
     }
 
     ddr = std::make_unique<device_dependent_resources> ();
-    sdr = std::make_unique<size_dependent_resources> ();
 
     {
         UINT createDeviceFlags = 0;
@@ -870,50 +2125,12 @@ HRESULT init_device ()
                 break;
             }
         }
-
-        // Create a render target view
-        {
-            TEST_HR ddr->swap_chain->GetBuffer (
-                    0
-                ,   __uuidof (ID3D11Texture2D)
-                ,   ddr->back_buffer.get_out_ptr ()
-                );
-
-            TEST_HR ddr->device->CreateRenderTargetView (
-                    ddr->back_buffer.get ()
-                ,   nullptr
-                ,   ddr->render_target_view.get_out_ptr ()
-                );
-        }
     }
 
     {
         ddr->accelerator_view = std::make_unique<accelerator_view> (concurrency::direct3d::create_accelerator_view (ddr->device.get ()));
     }
 
-    {
-        ID3D11RenderTargetView * render_targets[] =
-        {
-            ddr->render_target_view.get (),
-        };
-
-        ddr->device_context->OMSetRenderTargets (
-                ARRAYSIZE (render_targets)
-            ,   render_targets
-            ,   nullptr
-            );
-
-        // Setup the viewport
-        auto vp = CD3D11_VIEWPORT (
-                0.0f
-            ,   0.0f
-            ,   1.0f * width
-            ,   1.0f * height
-            );
-
-        ddr->device_context->RSSetViewports (1, &vp);
-    }
-
     // Load shaders
     {
         auto vertex_shader_bytes= load_bytes (L"SceneVertexShader.cso");
@@ -1020,15 +2237,95 @@ HRESULT init_device ()
             );
     }
 
+    return resize_device ();
+}
+
+//--------------------------------------------------------------------------------------
+// Recreate what depends on the client size. The device, shaders, caches, palettes and the
+// thread pools stay as they are, only the swap chain buffers and the textures the views
+// are rendered into are reallocated.
+//--------------------------------------------------------------------------------------
+HRESULT resize_device ()
+{
+    UINT width   = 0;
+    UINT height  = 0;
+    std::tie (width, height) = client_rect ();
+
+    if (!ddr)
+    {
+        return init_device ();
+    }
+
+    // Minimized or already this size, the last frame stays on screen
+    if (width < 16 || height < 16 || (sdr && sdr->width == width && sdr->height == height))
+    {
+        return S_OK;
+    }
+
+    // The swap chain only resizes once nothing references its buffers
+    ddr->device_context->OMSetRenderTargets (0, nullptr, nullptr);
+    sdr.reset ();
+    ddr->device_context->Flush ();
+
+    TEST_HR ddr->swap_chain->ResizeBuffers (
+            0
+        ,   width
+        ,   height
+        ,   DXGI_FORMAT_UNKNOWN
+        ,   0
+        );
+
+    sdr         = std::make_unique<size_dependent_resources> ();
+    sdr->width  = width ;
+    sdr->height = height;
+
+    // Create a render target view
+    {
+        TEST_HR ddr->swap_chain->GetBuffer (
+                0
+            ,   __uuidof (ID3D11Texture2D)
+            ,   sdr->back_buffer.get_out_ptr ()
+            );
+
+        TEST_HR ddr->device->CreateRenderTargetView (
+                sdr->back_buffer.get ()
+            ,   nullptr
+            ,   sdr->render_target_view.get_out_ptr ()
+            );
+    }
+
+    {
+        ID3D11RenderTargetView * render_targets[] =
+        {
+            sdr->render_target_view.get (),
+        };
+
+        ddr->device_context->OMSetRenderTargets (
+                ARRAYSIZE (render_targets)
+            ,   render_targets
+            ,   nullptr
+            );
+
+        // Setup the viewport
+        auto vp = CD3D11_VIEWPORT (
+                0.0f
+            ,   0.0f
+            ,   1.0f * width
+            ,   1.0f * height
+            );
+
+        ddr->device_context->RSSetViewports (1, &vp);
+    }
+
     auto ref_pair = [] (auto & f, auto & s)
     {
         return std::make_tuple (std::ref (f), std::ref (s));
     };
 
-    decltype (ref_pair (ddr->mandelbrot_texture, ddr->mandelbrot_texture_view)) tvs [] =
+    decltype (ref_pair (sdr->mandelbrot_texture, sdr->mandelbrot_texture_view)) tvs [] =
     {
-            ref_pair (ddr->mandelbrot_texture, ddr->mandelbrot_texture_view)
-        ,   ref_pair (ddr->julia_texture     , ddr->julia_texture_view     )
+            ref_pair (sdr->mandelbrot_texture, sdr->mandelbrot_texture_view)
+        ,   ref_pair (sdr->julia_texture     , sdr->julia_texture_view     )
     };
 
     for (auto & tv : tvs)
@@ -1069,8 +2366,6 @@ HRESULT init_device ()
                 );
     }
 
-    // Size dependent resources
-
     {
       XMMATRIX perspectiveMatrix = XMMatrixOrthographicRH(
           2,
@@ -1095,6 +2390,15 @@ HRESULT init_device ()
             );
     }
 
+    for (auto iterations : {&sdr->mandelbrot_iterations, &sdr->julia_iterations})
+    {
+        *iterations = std::make_unique<array<unsigned int, 2>> (extent<2> (height, width / 2), *ddr->accelerator_view);
+    }
+
+    // Scratch buffers of the old size are of no use to frames of the new one
+    dir->pixel_pool.trim (static_cast<std::size_t> (width / 2) * height);
+    dir->distance_pool.trim (static_cast<std::size_t> (width / 2) * height);
+
     return S_OK;
 }
 
@@ -1116,7 +2420,39 @@ HRESULT mouse_move (int x, int y)
     auto coord = screen_to_plane (x, y);
 
     wchar_t buffer[256] {};
-    swprintf_s (buffer, L"X:%f, Y:%f", coord.x, coord.y);
+    switch (mandelbrot_mode)
+    {
+        case render_mode::antialiased:
+            swprintf_s (buffer, L"X:%f, Y:%f, Antialiased:%.1f%%", coord.x, coord.y, 100 * mandelbrot_fraction);
+            break;
+
+        case render_mode::distance_estimate:
+            swprintf_s (buffer, L"X:%f, Y:%f, Filled:%.1f%%", coord.x, coord.y, 100 * mandelbrot_fraction);
+            break;
+
+        case render_mode::buddhabrot:
+            swprintf_s (
+                    buffer
+                ,   L"X:%f, Y:%f, Samples:%.1fM, %.2fM/s"
+                ,   coord.x
+                ,   coord.y
+                ,   dir->buddhabrot ? dir->buddhabrot->samples () / 1e6 : 0.0
+                ,   dir->buddhabrot ? dir->buddhabrot->samples_per_second () / 1e6 : 0.0
+                );
+            break;
+
+        default:
+            swprintf_s (
+                    buffer
+                ,   L"X:%f, Y:%f, %s, %u bit, %u iterations"
+                ,   coord.x
+                ,   coord.y
+                ,   fractal::formula_name (mandelbrot_formula)
+                ,   static_cast<unsigned int> (mandelbrot_precision)
+                ,   mandelbrot_iter
+                );
+            break;
+    }
     SetWindowText (dir->hwnd, buffer);
 
     julia_center.x = coord.x;
@@ -1139,6 +2475,104 @@ HRESULT mouse_wheel (int delta)
     return S_OK;
 }
 
+//--------------------------------------------------------------------------------------
+// Called every time a key is pressed
+//--------------------------------------------------------------------------------------
+HRESULT key_down (WPARAM key)
+{
+    switch (key)
+    {
+        case 'A':
+            mandelbrot_mode = mandelbrot_mode == render_mode::antialiased
+                ? render_mode::escape_time
+                : render_mode::antialiased
+                ;
+            break;
+
+        case 'J':
+            julia_atlas = !julia_atlas;
+            break;
+
+        case 'D':
+            mandelbrot_mode = mandelbrot_mode == render_mode::distance_estimate
+                ? render_mode::escape_time
+                : render_mode::distance_estimate
+                ;
+            break;
+
+        case 'B':
+            run_benchmarks ();
+            break;
+
+        case 'S':
+            toggle_tile_server ();
+            break;
+
+        case 'O':
+            toggle_frame_output ();
+            break;
+
+        case 'U':
+            mandelbrot_mode = mandelbrot_mode == render_mode::buddhabrot
+                ? render_mode::escape_time
+                : render_mode::buddhabrot
+                ;
+            // The per worker density buffers are large, keep them only while shown
+            dir->buddhabrot.reset ();
+            break;
+
+        case 'M':
+            toggle_area_estimate ();
+            break;
+
+        case 'T':
+            retune ();
+            break;
+
+        case 'X':
+            next_executor ();
+            break;
+
+        case 'R':
+            toggle_snapshot ();
+            break;
+
+        case 'E':
+            equalized_colors = !equalized_colors;
+            break;
+
+        case 'I':
+            mandelbrot_iter = mandelbrot_iter < max_iter ? mandelbrot_iter * 2 : mandelbrot_iter;
+            break;
+
+        case 'L':
+            mandelbrot_iter = default_iter;
+            dir->resumable.reset ();
+            break;
+
+        case 'P':
+            julia_mode = julia_mode == render_mode::inverse_iteration
+                ? render_mode::escape_time
+                : render_mode::inverse_iteration
+                ;
+            dir->inverse_julia.reset ();
+            break;
+
+        case 'W':
+            snapshot_format = static_cast<fractal::image_format> (
+                (static_cast<unsigned int> (snapshot_format) + 1) % static_cast<unsigned int> (fractal::image_format::count));
+            SetWindowText (dir->hwnd, (std::wstring (L"Snapshot format: ") + fractal::image_format_name (snapshot_format)).c_str ());
+            break;
+
+        case 'F':
+            mandelbrot_formula = static_cast<fractal::formula> (
+                (static_cast<unsigned int> (mandelbrot_formula) + 1) % static_cast<unsigned int> (fractal::formula::count));
+            break;
+    }
+
+    return S_OK;
+}
+
 //--------------------------------------------------------------------------------------
 // Called every time the application receives a message
 //--------------------------------------------------------------------------------------
@@ -1155,7 +2589,21 @@ LRESULT CALLBACK wnd_proc (HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam
             break;
 
         case WM_SIZE:
-            init_device ();
+            // Restarts the wait on every step of a drag
+            SetTimer (hWnd, resize_timer, resize_debounce_ms, nullptr);
+            break;
+
+        case WM_TIMER:
+            if (wParam == resize_timer)
+            {
+                KillTimer (hWnd, resize_timer);
+                resize_device ();
+            }
+            break;
+
+        case WM_EXITSIZEMOVE:
+            KillTimer (hWnd, resize_timer);
+            resize_device ();
             break;
 
         case WM_RBUTTONUP:
@@ -1171,6 +2619,18 @@ LRESULT CALLBACK wnd_proc (HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam
             mouse_wheel (GET_WHEEL_DELTA_WPARAM (wParam));
             break;
 
+        case WM_KEYDOWN:
+            key_down (wParam);
+            break;
+
+        case benchmark_done:
+            benchmark_finished (lParam);
+            break;
+
+        case tuning_done:
+            tuning_finished (lParam);
+            break;
+
         case WM_DESTROY:
             PostQuitMessage (0);
             break;
@@ -1219,34 +2679,178 @@ void render ()
         ,   0
         );
 
-    compute_set (
-            *ddr->accelerator_view
-        ,   ddr->mandelbrot_texture.get ()
-        ,   static_cast<int> (diff_in_ms / 100)
-        ,   mandelbrot_zoom
-        ,   mandelbrot_iter
-        ,   mandelbrot_center.x
-        ,   mandelbrot_center.y
-        ,   mandelbrot_center.x
-        ,   mandelbrot_center.y
-        ,   [=](mtype_2 coord, mtype_2 /*center*/, int iter) restrict(amp) {return mandelbrot2 (coord, coord, iter);}
-        );
+    {
+        auto const width    = sdr->width    ;
+        auto const height   = sdr->height   ;
 
-    compute_set (
-            *ddr->accelerator_view
-        ,   ddr->julia_texture.get ()
-        ,   static_cast<int> (diff_in_ms / 100)
-        ,   julia_zoom
-        ,   julia_iter
-        ,   julia_center.x
-        ,   julia_center.y
-        ,   julia_center.x
-        ,   julia_center.y
-        ,   [=](mtype_2 coord, mtype_2 center, int iter) restrict(amp) {return mandelbrot2 (coord, center, iter);}
-        );
+        // Past what the GPU's floats resolve the view moves to the CPU kernels
+        mandelbrot_precision = view_precision (mandelbrot_zoom, mandelbrot_center.x, mandelbrot_center.y, width, height);
+
+        // Readers follow a resize by attaching again
+        if (dir->frame_ring && (dir->frame_ring->width () != width / 2 || dir->frame_ring->height () != height))
+        {
+            dir->frame_ring = fractal::frame_ring::create (frame_ring_path (), width / 2, height);
+        }
+    }
+
+    step_area_estimate ();
+
+    // Only the resumable view spreads a raised limit over frames, every other mode renders
+    //  its whole frame here and keeps to the default limit
+    auto const frame_iter = std::min (mandelbrot_iter, default_iter);
+
+    if (mandelbrot_mode == render_mode::antialiased)
+    {
+        mandelbrot_fraction = antialias_set (
+                ddr->device_context.get ()
+            ,   sdr->mandelbrot_texture.get ()
+            ,   static_cast<int> (diff_in_ms / 100)
+            ,   mandelbrot_zoom
+            ,   frame_iter
+            ,   mandelbrot_center.x
+            ,   mandelbrot_center.y
+            );
+    }
+    else if (mandelbrot_mode == render_mode::distance_estimate)
+    {
+        mandelbrot_fraction = distance_set (
+                ddr->device_context.get ()
+            ,   sdr->mandelbrot_texture.get ()
+            ,   mandelbrot_zoom
+            ,   frame_iter
+            ,   mandelbrot_center.x
+            ,   mandelbrot_center.y
+            );
+    }
+    else if (mandelbrot_mode == render_mode::buddhabrot)
+    {
+        buddhabrot_set (
+                ddr->device_context.get ()
+            ,   sdr->mandelbrot_texture.get ()
+            ,   mandelbrot_zoom
+            ,   mandelbrot_center.x
+            ,   mandelbrot_center.y
+            );
+    }
+    else if (mandelbrot_iter > default_iter && !fractal::is_fixed (mandelbrot_precision))
+    {
+        resumable_set (
+                ddr->device_context.get ()
+            ,   sdr->mandelbrot_texture.get ()
+            ,   mandelbrot_formula
+            ,   static_cast<int> (diff_in_ms / 100)
+            ,   mandelbrot_zoom
+            ,   mandelbrot_iter
+            ,   mandelbrot_center.x
+            ,   mandelbrot_center.y
+            );
+    }
+    else if (
+                mandelbrot_formula != fractal::formula::mandelbrot2
+            ||  mandelbrot_precision != fractal::precision::float32
+            ||  dir->frame_ring
+            ||  equalized_colors
+            )
+    {
+        formula_set (
+                ddr->device_context.get ()
+            ,   sdr->mandelbrot_texture.get ()
+            ,   dir->frame_ring.get ()
+            ,   equalized_colors ? &dir->equalizer : nullptr
+            ,   mandelbrot_formula
+            ,   false
+            ,   static_cast<int> (diff_in_ms / 100)
+            ,   mandelbrot_zoom
+            ,   frame_iter
+            ,   mandelbrot_center.x
+            ,   mandelbrot_center.y
+            ,   mtype ()
+            ,   mtype ()
+            );
+    }
+    else
+    {
+        compute_set (
+                *ddr->accelerator_view
+            ,   sdr->mandelbrot_texture.get ()
+            ,   *sdr->mandelbrot_iterations
+            ,   dir->tile_cache.get ()
+            ,   dir->tile_store.get ()
+            ,   formula_mandelbrot
+            ,   fractal::symmetry::real_axis
+            ,   static_cast<int> (diff_in_ms / 100)
+            ,   mandelbrot_zoom
+            ,   frame_iter
+            ,   mandelbrot_center.x
+            ,   mandelbrot_center.y
+            ,   mandelbrot_center.x
+            ,   mandelbrot_center.y
+            ,   [=](mtype_2 coord, mtype_2 /*center*/, int iter) restrict(amp) {return mandelbrot2 (coord, coord, iter);}
+            );
+    }
+
+    if (julia_atlas)
+    {
+        julia_atlas_set (
+                ddr->device_context.get ()
+            ,   sdr->julia_texture.get ()
+            ,   static_cast<int> (diff_in_ms / 100)
+            ,   mandelbrot_zoom
+            ,   mandelbrot_center.x
+            ,   mandelbrot_center.y
+            );
+    }
+    else if (julia_mode == render_mode::inverse_iteration && mandelbrot_formula == fractal::formula::mandelbrot2)
+    {
+        inverse_julia_set (
+                ddr->device_context.get ()
+            ,   sdr->julia_texture.get ()
+            ,   julia_zoom
+            ,   julia_center.x
+            ,   julia_center.y
+            );
+    }
+    else if (mandelbrot_formula != fractal::formula::mandelbrot2 || equalized_colors)
+    {
+        formula_set (
+                ddr->device_context.get ()
+            ,   sdr->julia_texture.get ()
+            ,   nullptr
+            ,   equalized_colors ? &dir->equalizer : nullptr
+            ,   mandelbrot_formula
+            ,   true
+            ,   static_cast<int> (diff_in_ms / 100)
+            ,   julia_zoom
+            ,   julia_iter
+            ,   julia_center.x
+            ,   julia_center.y
+            ,   julia_center.x
+            ,   julia_center.y
+            );
+    }
+    else
+    {
+        compute_set (
+                *ddr->accelerator_view
+            ,   sdr->julia_texture.get ()
+            ,   *sdr->julia_iterations
+            ,   dir->tile_cache.get ()
+            ,   nullptr     // The julia view follows the mouse, not worth persisting
+            ,   formula_julia
+            ,   fractal::symmetry::origin
+            ,   static_cast<int> (diff_in_ms / 100)
+            ,   julia_zoom
+            ,   julia_iter
+            ,   julia_center.x
+            ,   julia_center.y
+            ,   julia_center.x
+            ,   julia_center.y
+            ,   [=](mtype_2 coord, mtype_2 center, int iter) restrict(amp) {return mandelbrot2 (coord, center, iter);}
+            );
+    }
 
     // Clear the back buffer
-    ddr->device_context->ClearRenderTargetView (ddr->render_target_view.get (), Colors::MidnightBlue);
+    ddr->device_context->ClearRenderTargetView (sdr->render_target_view.get (), Colors::MidnightBlue);
 
     ID3D11Buffer* buffers[] =
     {
@@ -1304,7 +2908,7 @@ void render ()
     {
       ID3D11ShaderResourceView* ps_shader_resources[] =
       {
-          ddr->mandelbrot_texture_view.get ()    ,
+          sdr->mandelbrot_texture_view.get ()    ,
       };
 
       ddr->device_context->PSSetShaderResources (
@@ -1324,7 +2928,7 @@ void render ()
     {
       ID3D11ShaderResourceView* ps_shader_resources[] =
       {
-          ddr->julia_texture_view.get ()    ,
+          sdr->julia_texture_view.get ()    ,
       };
 
       ddr->device_context->PSSetShaderResources (
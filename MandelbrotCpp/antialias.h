@@ -0,0 +1,149 @@
+// ----------------------------------------------------------------------------------------------
+// Copyright (c) Mrten Rnge.
+// ----------------------------------------------------------------------------------------------
+// This source code is subject to terms and conditions of the Microsoft Public License. A
+// copy of the license can be found in the License.html file at the root of this distribution.
+// If you cannot locate the  Microsoft Public License, please send an email to
+// dlr@microsoft.com. By using this source code in any fashion, you are agreeing to be bound
+//  by the terms of the Microsoft Public License.
+// ----------------------------------------------------------------------------------------------
+// You must not remove this notice, or any other, from this software.
+// ----------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "escape_time.h"
+#include "palette.h"
+
+namespace fractal
+{
+    struct antialias_options
+    {
+        // A pixel is supersampled when any of its 8 neighbours differs by more than this
+        float           threshold   = 1     ;
+        // Upper bound on samples per refined pixel, rounded down to a square grid
+        unsigned int    max_samples = 16    ;
+    };
+
+    struct antialias_result
+    {
+        std::size_t     refined     = 0;
+        std::size_t     pixels      = 0;
+
+        inline double refined_fraction () const noexcept
+        {
+            return pixels > 0
+                ? static_cast<double> (refined) / static_cast<double> (pixels)
+                : 0
+                ;
+        }
+    };
+
+    // Renders at one sample per pixel, then supersamples only the pixels whose value
+    //  (iteration count or smooth value) stands out from a neighbour.
+    //
+    //  sample (x, y)   value at a point in the plane
+    //  shade (value)   packed RGBA color of a value
+    template<typename T, typename TSample, typename TShade>
+    antialias_result render_antialiased (
+            viewport<T> const &         vp
+        ,   antialias_options const &   options
+        ,   TSample const &             sample
+        ,   TShade const &              shade
+        ,   std::uint32_t *             rgba
+        )
+    {
+        auto const width    = vp.width  ;
+        auto const height   = vp.height ;
+
+        antialias_result result;
+        result.pixels = static_cast<std::size_t> (width) * height;
+
+        if (result.pixels == 0)
+        {
+            return result;
+        }
+
+        std::vector<float> values (result.pixels);
+
+        parallel_for_rows (height, [&] (unsigned int y)
+        {
+            auto row = &values[static_cast<std::size_t> (y) * width];
+            auto py  = vp.y (static_cast<T> (y));
+
+            for (auto x = 0U; x < width; ++x)
+            {
+                row[x] = static_cast<float> (sample (vp.x (static_cast<T> (x)), py));
+            }
+        });
+
+        auto const grid     = static_cast<unsigned int> (std::sqrt (static_cast<double> (options.max_samples)));
+        auto const weight   = 1.0F / static_cast<float> (grid * grid);
+
+        // Per row counters so the refinement pass needs no atomics
+        std::vector<std::size_t> refined (height);
+
+        parallel_for_rows (height, [&] (unsigned int y)
+        {
+            auto const y0 = y > 0 ? y - 1 : y;
+            auto const y1 = y + 1 < height ? y + 1 : y;
+
+            for (auto x = 0U; x < width; ++x)
+            {
+                auto const x0   = x > 0 ? x - 1 : x;
+                auto const x1   = x + 1 < width ? x + 1 : x;
+                auto const i    = static_cast<std::size_t> (y) * width + x;
+                auto const v    = values[i];
+
+                auto edge = false;
+                for (auto ny = y0; ny <= y1 && !edge; ++ny)
+                {
+                    for (auto nx = x0; nx <= x1 && !edge; ++nx)
+                    {
+                        edge = std::fabs (values[static_cast<std::size_t> (ny) * width + nx] - v) > options.threshold;
+                    }
+                }
+
+                if (!edge || grid < 2)
+                {
+                    rgba[i] = shade (v);
+                    continue;
+                }
+
+                ++refined[y];
+
+                // Stratified grid covering the pixel footprint around the 1 spp sample point
+                float sum[4] {};
+                for (auto sy = 0U; sy < grid; ++sy)
+                {
+                    auto py = vp.y (static_cast<T> (y) + static_cast<T> (sy + 0.5) / grid - T (0.5));
+
+                    for (auto sx = 0U; sx < grid; ++sx)
+                    {
+                        auto px     = vp.x (static_cast<T> (x) + static_cast<T> (sx + 0.5) / grid - T (0.5));
+                        auto color  = shade (static_cast<float> (sample (px, py)));
+
+                        for (auto c = 0U; c < 4; ++c)
+                        {
+                            sum[c] += channel (color, c);
+                        }
+                    }
+                }
+
+                rgba[i] = pack_rgba (sum[0] * weight, sum[1] * weight, sum[2] * weight, sum[3] * weight);
+            }
+        });
+
+        for (auto count : refined)
+        {
+            result.refined += count;
+        }
+
+        return result;
+    }
+}
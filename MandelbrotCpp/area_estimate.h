@@ -0,0 +1,489 @@
+// ----------------------------------------------------------------------------------------------
+// Copyright (c) Mrten Rnge.
+// ----------------------------------------------------------------------------------------------
+// This source code is subject to terms and conditions of the Microsoft Public License. A
+// copy of the license can be found in the License.html file at the root of this distribution.
+// If you cannot locate the  Microsoft Public License, please send an email to
+// dlr@microsoft.com. By using this source code in any fashion, you are agreeing to be bound
+//  by the terms of the Microsoft Public License.
+// ----------------------------------------------------------------------------------------------
+// You must not remove this notice, or any other, from this software.
+// ----------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "benchmark.h"
+#include "escape_time.h"
+#include "formulas.h"
+#include "simd.h"
+
+namespace fractal
+{
+    enum class sample_sequence
+    {
+        sobol   ,
+        halton  ,
+        // Pseudo random points, the baseline the low discrepancy sequences are measured by
+        random  ,
+    };
+
+    struct estimate_options
+    {
+        // Region sampled, the default covers the whole set
+        double          min_x           = -2                        ;
+        double          max_x           = 0.5                       ;
+        double          min_y           = -1.25                     ;
+        double          max_y           = 1.25                      ;
+        // Points still inside after iter steps count as inside the set
+        unsigned int    iter            = 4096                      ;
+        // Also estimates the fraction of the region that escapes in fewer steps, 0 for none
+        unsigned int    escape_within   = 0                         ;
+        sample_sequence sequence        = sample_sequence::sobol    ;
+        // Independently shifted copies of the sequence, the spread of their estimates is
+        //  the confidence interval. At least 4, with fewer the t quantile makes the interval
+        //  too wide to stop on.
+        unsigned int    replicates      = 16                        ;
+        // Points per replicate and round
+        unsigned int    round_points    = 4096                      ;
+        // Stops once the 95% confidence half width of every fraction is at most this,
+        //  0 runs to max_points
+        double          target_error    = 1e-4                      ;
+        std::uint64_t   max_points      = 1ULL << 32                ;
+        std::uint64_t   seed            = 1                         ;
+    };
+
+    struct area_estimate
+    {
+        // Fraction of the region inside the set and the area that makes
+        double          inside          = 0     ;
+        double          area            = 0     ;
+        // Fraction escaping in fewer than escape_within steps
+        double          escaped         = 0     ;
+        // 95% confidence half widths, area_error = inside_error * region area
+        double          inside_error    = 0     ;
+        double          area_error      = 0     ;
+        double          escaped_error   = 0     ;
+        std::uint64_t   points          = 0     ;
+        // Points the cardioid and bulb test placed inside without iterating
+        std::uint64_t   culled          = 0     ;
+        double          points_per_second = 0   ;
+        bool            converged       = false ;
+    };
+
+    namespace details
+    {
+        inline std::uint32_t reverse_bits (std::uint32_t v) noexcept
+        {
+            v = ((v >> 1) & 0x55555555U) | ((v & 0x55555555U) << 1);
+            v = ((v >> 2) & 0x33333333U) | ((v & 0x33333333U) << 2);
+            v = ((v >> 4) & 0x0F0F0F0FU) | ((v & 0x0F0F0F0FU) << 4);
+            v = ((v >> 8) & 0x00FF00FFU) | ((v & 0x00FF00FFU) << 8);
+            return (v >> 16) | (v << 16);
+        }
+
+        // Point n of the two dimensional Sobol sequence in [0, 1)^2. The first dimension is
+        //  the base 2 van der Corput sequence, the second uses the direction numbers of the
+        //  primitive polynomial x + 1.
+        inline void sobol_2d (std::uint32_t n, double & u, double & v) noexcept
+        {
+            auto y          = std::uint32_t ();
+            auto direction  = std::uint32_t (1) << 31;
+            for (auto bits = n; bits != 0; bits >>= 1)
+            {
+                y           ^= (bits & 1) ? direction : 0;
+                direction   ^= direction >> 1;
+            }
+
+            u = reverse_bits (n) * (1.0 / 4294967296.0);
+            v = y * (1.0 / 4294967296.0);
+        }
+
+        inline double radical_inverse (std::uint32_t n, std::uint32_t base) noexcept
+        {
+            auto const inverse  = 1.0 / base;
+            auto scale          = inverse;
+            auto result         = 0.0;
+            for (; n != 0; n /= base)
+            {
+                result  += (n % base) * scale;
+                scale   *= inverse;
+            }
+            return result;
+        }
+
+        // Quantile of Student's t at 97.5% for dof degrees of freedom. Tabulated up to 30,
+        //  past that the Cornish-Fisher expansion around the normal one is within 0.005%.
+        inline double student_t975 (unsigned int dof) noexcept
+        {
+            static double const table[] =
+            {
+                    12.70620474 , 4.302652730 , 3.182446305 , 2.776445105 , 2.570581836
+                ,   2.446911851 , 2.364624252 , 2.306004135 , 2.262157163 , 2.228138852
+                ,   2.200985160 , 2.178812830 , 2.160368656 , 2.144786688 , 2.131449546
+                ,   2.119905299 , 2.109815578 , 2.100922040 , 2.093024054 , 2.085963447
+                ,   2.079613845 , 2.073873068 , 2.068657610 , 2.063898562 , 2.059538553
+                ,   2.055529439 , 2.051830516 , 2.048407142 , 2.045229642 , 2.042272456
+            };
+
+            if (dof <= sizeof (table) / sizeof (table[0]))
+            {
+                return table[dof > 0 ? dof - 1 : 0];
+            }
+
+            auto const z    = 1.959963984540054;
+            auto const n    = static_cast<double> (dof);
+            auto const z3   = z * z * z;
+            auto const z5   = z3 * z * z;
+            return z + (z3 + z) / (4 * n) + (5 * z5 + 16 * z3 + 3 * z) / (96 * n * n);
+        }
+    }
+
+    // Monte Carlo estimate of the area of the set, and optionally the fraction of a region
+    //  escaping within a number of steps, without rendering an image.
+    //
+    //  Points come from a low discrepancy sequence over the region, which is stratified by
+    //  construction and converges far faster than independent points. A single such
+    //  sequence has no variance to build a confidence interval from, so replicates copies
+    //  of it are each shifted by an independent random offset (Cranley-Patterson
+    //  rotation). Every replicate is an unbiased estimate and the interval comes from their
+    //  spread.
+    //
+    //  A replicate is only ever advanced by one task at a time and accumulates into its own
+    //  cache line, so the workers never share a counter. Points in the cardioid or the
+    //  period 2 bulb are counted without iterating, the rest go through the mandelbrot2
+    //  SIMD kernel a full pack at a time.
+    struct area_estimator
+    {
+        using ptr = std::unique_ptr<area_estimator>;
+
+        static ptr create (estimate_options const & options)
+        {
+            if (
+                    !(options.max_x > options.min_x)
+                ||  !(options.max_y > options.min_y)
+                ||  options.iter == 0
+                ||  options.replicates < 4
+                ||  options.round_points == 0
+                )
+            {
+                return nullptr;
+            }
+
+            ptr result (new area_estimator (options));
+
+            std::mt19937_64 rng (options.seed);
+            std::uniform_real_distribution<double> unit;
+
+            result->m_replicates.resize (options.replicates);
+            for (auto & replicate : result->m_replicates)
+            {
+                replicate.shift_x = unit (rng);
+                replicate.shift_y = unit (rng);
+                replicate.rng.seed (rng ());
+            }
+
+            return result;
+        }
+
+        estimate_options const & options () const noexcept
+        {
+            return m_options;
+        }
+
+        area_estimate const & estimate () const noexcept
+        {
+            return m_estimate;
+        }
+
+        // Samples round_points more points of every replicate and updates the estimate.
+        //  false once converged or out of points.
+        bool step ()
+        {
+            if (done ())
+            {
+                return false;
+            }
+
+            auto const before = std::chrono::steady_clock::now ();
+
+            auto const first    = m_next;
+            auto const points   = m_options.round_points;
+
+            parallel_for_rows (static_cast<unsigned int> (m_replicates.size ()), [&] (unsigned int index)
+            {
+                sample (m_replicates[index], first, points);
+            });
+
+            m_next += points;
+
+            auto const seconds = std::chrono::duration<double> (std::chrono::steady_clock::now () - before).count ();
+            m_seconds += seconds;
+
+            update ();
+            return !done ();
+        }
+
+        // Steps until converged or out of points. progress sees the estimate after every
+        //  round and stops the run early by returning false.
+        area_estimate const & run (std::function<bool (area_estimate const &)> const & progress = nullptr)
+        {
+            while (step ())
+            {
+                if (progress && !progress (m_estimate))
+                {
+                    break;
+                }
+            }
+            return m_estimate;
+        }
+
+    private:
+        // Counters of one replicate, padded to a cache line
+        struct replicate
+        {
+            double              shift_x     = 0 ;
+            double              shift_y     = 0 ;
+            std::mt19937_64     rng             ;
+            std::uint64_t       points      = 0 ;
+            std::uint64_t       inside      = 0 ;
+            std::uint64_t       escaped     = 0 ;
+            std::uint64_t       culled      = 0 ;
+            char                padding[64]     ;
+        };
+
+        explicit area_estimator (estimate_options const & options)
+            :   m_options (options)
+        {
+        }
+
+        area_estimator (area_estimator const &)             = delete;
+        area_estimator& operator= (area_estimator const &)  = delete;
+
+        bool done () const noexcept
+        {
+            return m_estimate.converged || m_estimate.points >= m_options.max_points || m_next > 0xFFFFFFFFU - m_options.round_points;
+        }
+
+        void sample (replicate & r, std::uint32_t first, std::uint32_t points)
+        {
+            using lanes = pack<double, native_width<double>::value>;
+            auto const W = lanes::width;
+
+            auto const & o      = m_options;
+            auto const width    = o.max_x - o.min_x;
+            auto const height   = o.max_y - o.min_y;
+
+            std::uniform_real_distribution<double> unit;
+
+            double xs       [W];
+            double ys       [W];
+            double counts   [W];
+            auto pending    = 0U;
+
+            auto inside     = std::uint64_t ();
+            auto escaped    = std::uint64_t ();
+            auto culled     = std::uint64_t ();
+
+            auto const flush = [&] ()
+            {
+                // A partial pack repeats its last point, only pending lanes are counted
+                for (auto lane = pending; lane < W; ++lane)
+                {
+                    xs[lane] = xs[pending - 1];
+                    ys[lane] = ys[pending - 1];
+                }
+
+                auto const x = lanes::load (xs);
+                auto const y = lanes::load (ys);
+                escape_lanes_unrolled<formulas::mandelbrot2, default_unroll> (x, y, x, y, o.iter).store (counts);
+
+                for (auto lane = 0U; lane < pending; ++lane)
+                {
+                    auto const count = static_cast<unsigned int> (counts[lane]);
+                    inside  += count >= o.iter ? 1 : 0;
+                    escaped += count < o.escape_within ? 1 : 0;
+                }
+                pending = 0;
+            };
+
+            for (auto n = first; n < first + points; ++n)
+            {
+                auto u = 0.0;
+                auto v = 0.0;
+                switch (o.sequence)
+                {
+                case sample_sequence::sobol:
+                    details::sobol_2d (n, u, v);
+                    break;
+                case sample_sequence::halton:
+                    u = details::radical_inverse (n + 1, 2);
+                    v = details::radical_inverse (n + 1, 3);
+                    break;
+                default:
+                    u = unit (r.rng);
+                    v = unit (r.rng);
+                    break;
+                }
+
+                // The replicate's random shift, modulo 1
+                if (o.sequence != sample_sequence::random)
+                {
+                    u += r.shift_x;
+                    v += r.shift_y;
+                    u -= u >= 1 ? 1 : 0;
+                    v -= v >= 1 ? 1 : 0;
+                }
+
+                auto const cx = o.min_x + u * width;
+                auto const cy = o.min_y + v * height;
+
+                if (known_interior (cx, cy))
+                {
+                    ++inside;
+                    ++culled;
+                    continue;
+                }
+
+                xs[pending] = cx;
+                ys[pending] = cy;
+                if (++pending == W)
+                {
+                    flush ();
+                }
+            }
+
+            if (pending > 0)
+            {
+                flush ();
+            }
+
+            r.points    += points   ;
+            r.inside    += inside   ;
+            r.escaped   += escaped  ;
+            r.culled    += culled   ;
+        }
+
+        void update ()
+        {
+            auto const count = static_cast<double> (m_replicates.size ());
+
+            auto inside_sum     = 0.0;
+            auto inside_sq      = 0.0;
+            auto escaped_sum    = 0.0;
+            auto escaped_sq     = 0.0;
+
+            area_estimate e;
+            for (auto const & r : m_replicates)
+            {
+                auto const n = static_cast<double> (r.points);
+                auto const p = r.inside / n;
+                auto const q = r.escaped / n;
+
+                inside_sum  += p;
+                inside_sq   += p * p;
+                escaped_sum += q;
+                escaped_sq  += q * q;
+
+                e.points    += r.points;
+                e.culled    += r.culled;
+            }
+
+            // Half width of the mean's interval from the sample variance of the replicates
+            auto const t            = details::student_t975 (static_cast<unsigned int> (m_replicates.size () - 1));
+            auto const half_width   = [&] (double sum, double sq)
+            {
+                auto const mean     = sum / count;
+                auto const variance = std::fmax (sq / count - mean * mean, 0.0) * count / (count - 1);
+                return t * std::sqrt (variance / count);
+            };
+
+            auto const region = (m_options.max_x - m_options.min_x) * (m_options.max_y - m_options.min_y);
+
+            e.inside            = inside_sum / count;
+            e.area              = e.inside * region;
+            e.inside_error      = half_width (inside_sum, inside_sq);
+            e.area_error        = e.inside_error * region;
+            e.escaped           = escaped_sum / count;
+            e.escaped_error     = half_width (escaped_sum, escaped_sq);
+            e.points_per_second = m_seconds > 0 ? e.points / m_seconds : 0;
+            e.converged         =
+                    m_options.target_error > 0
+                &&  e.inside_error <= m_options.target_error
+                &&  (m_options.escape_within == 0 || e.escaped_error <= m_options.target_error)
+                ;
+
+            m_estimate = e;
+        }
+
+        estimate_options            m_options               ;
+        std::vector<replicate>      m_replicates            ;
+        std::uint32_t               m_next          = 0     ;
+        double                      m_seconds       = 0     ;
+        area_estimate               m_estimate              ;
+    };
+
+    // Time and points each sequence needs to estimate the area of the whole set to the
+    //  same confidence interval. Independent points are the baseline.
+    inline void benchmark_area (
+            benchmark_report &  report
+        ,   unsigned int        iter            = 1024
+        ,   double              target_error    = 2e-4
+        )
+    {
+        struct
+        {
+            sample_sequence     sequence;
+            char const *        name;
+        } const runs[] =
+        {
+            {sample_sequence::random    , "random" },
+            {sample_sequence::halton    , "Halton" },
+            {sample_sequence::sobol     , "Sobol"  },
+        };
+
+        for (auto const & run : runs)
+        {
+            estimate_options options;
+            options.iter            = iter              ;
+            options.sequence        = run.sequence      ;
+            options.target_error    = target_error      ;
+            options.max_points      = 1ULL << 28        ;
+
+            auto estimator = area_estimator::create (options);
+            if (!estimator)
+            {
+                continue;
+            }
+
+            area_estimate result;
+            auto const ms = measure_ms (1, [&] ()
+            {
+                result = estimator->run ();
+            });
+
+            char name[128];
+            std::snprintf (
+                    name
+                ,   sizeof (name)
+                ,   "%s, %.1fM points, %.5f +- %.5f"
+                ,   run.name
+                ,   result.points / 1e6
+                ,   result.area
+                ,   result.area_error
+                );
+
+            report.add ("area estimate", name, ms, static_cast<double> (result.points));
+        }
+    }
+}
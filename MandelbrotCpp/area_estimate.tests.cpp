@@ -0,0 +1,53 @@
+// ----------------------------------------------------------------------------------------------
+// Copyright (c) Mrten Rnge.
+// ----------------------------------------------------------------------------------------------
+// This source code is subject to terms and conditions of the Microsoft Public License. A
+// copy of the license can be found in the License.html file at the root of this distribution.
+// If you cannot locate the  Microsoft Public License, please send an email to
+// dlr@microsoft.com. By using this source code in any fashion, you are agreeing to be bound
+//  by the terms of the Microsoft Public License.
+// ----------------------------------------------------------------------------------------------
+// You must not remove this notice, or any other, from this software.
+// ----------------------------------------------------------------------------------------------
+
+
+#include <cmath>
+
+#include "area_estimate.h"
+#include "tests.h"
+
+namespace
+{
+    using namespace fractal;
+
+    bool close (double value, double expected, double tolerance)
+    {
+        return std::fabs (value - expected) <= tolerance * expected;
+    }
+
+    // The expansion alone was 44% low at 1 degree of freedom and 4% low at 3
+    FRACTAL_TEST (area_estimate_student_t_quantile)
+    {
+        CHECK (close (details::student_t975 (1)     , 12.70620474   , 1e-8));
+        CHECK (close (details::student_t975 (3)     , 3.182446305   , 1e-8));
+        CHECK (close (details::student_t975 (15)    , 2.131449546   , 1e-8));
+        CHECK (close (details::student_t975 (30)    , 2.042272456   , 1e-8));
+        CHECK (close (details::student_t975 (31)    , 2.039513446   , 1e-4));
+        CHECK (close (details::student_t975 (60)    , 2.000297822   , 1e-4));
+        CHECK (close (details::student_t975 (1000)  , 1.962339081   , 1e-4));
+    }
+
+    FRACTAL_TEST (area_estimate_needs_four_replicates)
+    {
+        estimate_options options;
+
+        options.replicates = 2;
+        CHECK (!area_estimator::create (options));
+
+        options.replicates = 3;
+        CHECK (!area_estimator::create (options));
+
+        options.replicates = 4;
+        CHECK (area_estimator::create (options));
+    }
+}
@@ -0,0 +1,388 @@
+// ----------------------------------------------------------------------------------------------
+// Copyright (c) Mrten Rnge.
+// ----------------------------------------------------------------------------------------------
+// This source code is subject to terms and conditions of the Microsoft Public License. A
+// copy of the license can be found in the License.html file at the root of this distribution.
+// If you cannot locate the  Microsoft Public License, please send an email to
+// dlr@microsoft.com. By using this source code in any fashion, you are agreeing to be bound
+//  by the terms of the Microsoft Public License.
+// ----------------------------------------------------------------------------------------------
+// You must not remove this notice, or any other, from this software.
+// ----------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#   include <intrin.h>
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#   include <cpuid.h>
+#endif
+
+#include "benchmark.h"
+#include "formulas.h"
+#include "lane_refill.h"
+#include "mapped_file.h"
+#include "render_scheduler.h"
+
+namespace fractal
+{
+    // SIMD width and unroll factor of the float kernels, 0 for what select_kernel picks.
+    //  The lane refill kernel has no unroll factor.
+    struct kernel_choice
+    {
+        unsigned int    width   = 0     ;
+        unsigned int    unroll  = 0     ;
+        bool            refill  = false ;
+    };
+
+    inline row_kernel select_kernel (formula f, precision p, kernel_choice const & choice) noexcept
+    {
+        return choice.refill
+            ? select_refill_kernel (f, p, choice.width)
+            : select_kernel (f, p, choice.width, choice.unroll)
+            ;
+    }
+
+    // What the CPU paths are dispatched with on this host. The defaults are what they
+    //  used before there was a tuner.
+    struct tuned_config
+    {
+        // CPU brand string and logical core count the config was tuned on
+        std::string     cpu                 ;
+        unsigned int    threads     = 0     ;
+        kernel_choice   float32             ;
+        kernel_choice   float64             ;
+        // Render scheduler workers, 0 for one per core
+        unsigned int    workers     = 0     ;
+        unsigned int    band_rows   = 16    ;
+
+        // Fixed point kernels have a single shape
+        kernel_choice kernel (precision p) const noexcept
+        {
+            switch (p)
+            {
+            case precision::float32 : return float32;
+            case precision::float64 : return float64;
+            default                 : return kernel_choice ();
+            }
+        }
+    };
+
+    struct autotune_options
+    {
+        // Size and iterations of the views every candidate renders
+        unsigned int    width       = 320   ;
+        unsigned int    height      = 180   ;
+        unsigned int    iter        = 384   ;
+        unsigned int    repeats     = 2     ;
+    };
+
+    // The CPU's brand string, what a tuned config is only valid for
+    inline std::string cpu_model ()
+    {
+        char brand[49] {};
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+        int regs[4] {};
+        __cpuid (regs, 0x80000000);
+        if (static_cast<unsigned int> (regs[0]) >= 0x80000004U)
+        {
+            for (auto leaf = 0U; leaf < 3; ++leaf)
+            {
+                __cpuid (regs, static_cast<int> (0x80000002U + leaf));
+                std::memcpy (brand + leaf * 16, regs, sizeof (regs));
+            }
+        }
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+        unsigned int regs[4] {};
+        if (__get_cpuid_max (0x80000000U, nullptr) >= 0x80000004U)
+        {
+            for (auto leaf = 0U; leaf < 3; ++leaf)
+            {
+                __get_cpuid (0x80000002U + leaf, &regs[0], &regs[1], &regs[2], &regs[3]);
+                std::memcpy (brand + leaf * 16, regs, sizeof (regs));
+            }
+        }
+#endif
+
+        // Brand strings are padded with spaces on either side
+        std::string result (brand);
+        auto const first    = result.find_first_not_of (' ');
+        auto const last     = result.find_last_not_of (' ');
+        return first == std::string::npos ? "unknown" : result.substr (first, last - first + 1);
+    }
+
+    inline unsigned int logical_cores () noexcept
+    {
+        auto const cores = std::thread::hardware_concurrency ();
+        return cores == 0 ? 1 : cores;
+    }
+
+    // Loads a config saved by save_config, false when the file is missing or damaged
+    inline bool load_config (native_path const & path, tuned_config & config)
+    {
+        std::ifstream file (path);
+        if (!file)
+        {
+            return false;
+        }
+
+        tuned_config result;
+        auto fields = 0U;
+
+        std::string line;
+        while (std::getline (file, line))
+        {
+            auto const equals = line.find ('=');
+            if (equals == std::string::npos)
+            {
+                continue;
+            }
+
+            auto const key = line.substr (0, equals);
+            std::istringstream value (line.substr (equals + 1));
+
+            if (key == "cpu")
+            {
+                result.cpu = line.substr (equals + 1);
+            }
+            else if (key == "threads")
+            {
+                value >> result.threads;
+            }
+            else if (key == "float32")
+            {
+                value >> result.float32.width >> result.float32.unroll >> result.float32.refill;
+            }
+            else if (key == "float64")
+            {
+                value >> result.float64.width >> result.float64.unroll >> result.float64.refill;
+            }
+            else if (key == "workers")
+            {
+                value >> result.workers;
+            }
+            else if (key == "band_rows")
+            {
+                value >> result.band_rows;
+            }
+            else
+            {
+                continue;
+            }
+
+            if (!value && key != "cpu")
+            {
+                return false;
+            }
+            ++fields;
+        }
+
+        if (fields != 6 || result.band_rows == 0)
+        {
+            return false;
+        }
+
+        config = result;
+        return true;
+    }
+
+    inline bool save_config (native_path const & path, tuned_config const & config)
+    {
+        std::ofstream file (path, std::ios::trunc);
+        file
+            << "cpu="       << config.cpu                                                                               << "\n"
+            << "threads="   << config.threads                                                                           << "\n"
+            << "float32="   << config.float32.width << " " << config.float32.unroll << " " << config.float32.refill     << "\n"
+            << "float64="   << config.float64.width << " " << config.float64.unroll << " " << config.float64.refill     << "\n"
+            << "workers="   << config.workers                                                                           << "\n"
+            << "band_rows=" << config.band_rows                                                                         << "\n"
+            ;
+        return static_cast<bool> (file);
+    }
+
+    namespace details
+    {
+        // The whole set, mostly cheap escapes and interior, and a boundary zoom where
+        //  every pixel costs a different number of iterations
+        inline std::vector<formula_view> tuning_views (autotune_options const & options)
+        {
+            formula_view whole;
+            whole.center_x  = -0.5                  ;
+            whole.zoom      = 0.4                   ;
+            whole.width     = options.width         ;
+            whole.height    = options.height        ;
+            whole.iter      = options.iter          ;
+
+            auto boundary       = whole             ;
+            boundary.center_x   = -0.7453           ;
+            boundary.center_y   = 0.1127            ;
+            boundary.zoom       = 300               ;
+
+            return { whole, boundary };
+        }
+
+        inline kernel_choice tune_kernel (
+                autotune_options const &            options
+            ,   std::vector<formula_view> const &   views
+            ,   precision                           p
+            ,   std::vector<std::uint32_t> &        counts
+            ,   benchmark_report *                  report
+            )
+        {
+            auto const widths   = precision_widths (p);
+            auto const unrolls  = kernel_unroll_factors ();
+
+            kernel_choice best;
+            auto best_ms = -1.0;
+
+            for (auto w = 0U; w < kernel_widths; ++w)
+            {
+                // Every unroll factor, then the lane refill kernel
+                for (auto u = 0U; u <= kernel_unrolls; ++u)
+                {
+                    kernel_choice candidate;
+                    candidate.width     = widths[w]                                 ;
+                    candidate.unroll    = u < kernel_unrolls ? unrolls[u] : 0       ;
+                    candidate.refill    = u == kernel_unrolls                       ;
+
+                    auto const kernel = select_kernel (formula::mandelbrot2, p, candidate);
+                    if (!kernel)
+                    {
+                        continue;
+                    }
+
+                    auto ms = 0.0;
+                    for (auto const & view : views)
+                    {
+                        ms += measure_ms (options.repeats, [&] ()
+                        {
+                            render_formula (view, kernel, counts.data ());
+                        });
+                    }
+
+                    if (report)
+                    {
+                        report->add (
+                                std::string ("autotune ") + (p == precision::float32 ? "float" : "double")
+                            ,   "W=" + std::to_string (widths[w]) + (candidate.refill ? std::string (" refill") : " K=" + std::to_string (unrolls[u]))
+                            ,   ms
+                            ,   static_cast<double> (counts.size () * views.size ())
+                            );
+                    }
+
+                    if (best_ms < 0 || ms < best_ms)
+                    {
+                        best_ms = ms        ;
+                        best    = candidate ;
+                    }
+                }
+            }
+
+            return best;
+        }
+    }
+
+    // Microbenchmarks the candidate configurations on representative views and returns
+    //  the fastest: every width and unroll factor of the dispatch table per precision and
+    //  the lane refill kernel of every width, then the scheduler's worker count and band
+    //  height with the winning float kernel. Takes a second or two, the timings go into
+    //  report when there is one.
+    inline tuned_config autotune (autotune_options const & options = autotune_options (), benchmark_report * report = nullptr)
+    {
+        tuned_config config;
+        config.cpu      = cpu_model ();
+        config.threads  = logical_cores ();
+
+        auto const views = details::tuning_views (options);
+        std::vector<std::uint32_t> counts (static_cast<std::size_t> (options.width) * options.height);
+
+        config.float32 = details::tune_kernel (options, views, precision::float32, counts, report);
+        config.float64 = details::tune_kernel (options, views, precision::float64, counts, report);
+
+        // Fewer workers than cores wins when the cores share execution units or memory
+        //  bandwidth, more when the hardware thread count is underreported
+        std::vector<unsigned int> workers;
+        for (auto candidate : { config.threads / 2, config.threads, config.threads + config.threads / 2 })
+        {
+            if (candidate > 0 && (workers.empty () || workers.back () != candidate))
+            {
+                workers.push_back (candidate);
+            }
+        }
+
+        unsigned int const band_rows[] = { 4, 8, 16, 32 };
+
+        auto best_ms = -1.0;
+        for (auto count : workers)
+        {
+            auto scheduler = render_scheduler::create (count);
+
+            for (auto rows : band_rows)
+            {
+                auto ms = 0.0;
+                for (auto const & view : views)
+                {
+                    session_options session;
+                    session.view            = view                  ;
+                    session.kernel_width    = config.float32.width  ;
+                    session.kernel_unroll   = config.float32.unroll ;
+                    session.kernel_refill   = config.float32.refill ;
+                    session.band_rows       = rows                  ;
+                    session.counts          = counts.data ()        ;
+
+                    ms += measure_ms (options.repeats, [&] ()
+                    {
+                        auto rendering = scheduler->submit (session);
+                        if (rendering)
+                        {
+                            rendering->wait ();
+                        }
+                    });
+                }
+
+                if (report)
+                {
+                    report->add (
+                            "autotune scheduler"
+                        ,   std::to_string (count) + " workers, " + std::to_string (rows) + " rows"
+                        ,   ms
+                        ,   static_cast<double> (counts.size () * views.size ())
+                        );
+                }
+
+                if (best_ms < 0 || ms < best_ms)
+                {
+                    best_ms             = ms    ;
+                    config.workers      = count ;
+                    config.band_rows    = rows  ;
+                }
+            }
+        }
+
+        return config;
+    }
+
+    // The config saved at path when it was tuned on this CPU, the fast path of every start
+    //  but the first. Otherwise tunes, saves the result and returns it.
+    inline tuned_config load_or_tune (native_path const & path, autotune_options const & options = autotune_options ())
+    {
+        tuned_config config;
+        if (load_config (path, config) && config.cpu == cpu_model () && config.threads == logical_cores ())
+        {
+            return config;
+        }
+
+        config = autotune (options);
+        save_config (path, config);
+        return config;
+    }
+}
@@ -0,0 +1,245 @@
+// ----------------------------------------------------------------------------------------------
+// Copyright (c) Mrten Rnge.
+// ----------------------------------------------------------------------------------------------
+// This source code is subject to terms and conditions of the Microsoft Public License. A
+// copy of the license can be found in the License.html file at the root of this distribution.
+// If you cannot locate the  Microsoft Public License, please send an email to
+// dlr@microsoft.com. By using this source code in any fashion, you are agreeing to be bound
+//  by the terms of the Microsoft Public License.
+// ----------------------------------------------------------------------------------------------
+// You must not remove this notice, or any other, from this software.
+// ----------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "formulas.h"
+#include "mapped_file.h"
+
+namespace fractal
+{
+    // Best wall clock time of repeats runs of body, in milliseconds. The best run is the
+    //  one least disturbed by the rest of the system.
+    template<typename TBody>
+    double measure_ms (unsigned int repeats, TBody const & body)
+    {
+        auto best = -1.0;
+        for (auto run = 0U; run < repeats; ++run)
+        {
+            auto const before = std::chrono::steady_clock::now ();
+            body ();
+            auto const after  = std::chrono::steady_clock::now ();
+
+            auto const ms = std::chrono::duration<double, std::milli> (after - before).count ();
+            best = best < 0 || ms < best ? ms : best;
+        }
+        return best;
+    }
+
+    struct benchmark_entry
+    {
+        std::string     group           ;
+        std::string     name            ;
+        double          milliseconds    ;
+        // Pixels, samples or bytes the run produced, 0 when the throughput is meaningless
+        double          work            ;
+    };
+
+    // Entries are grouped by the variants they compete with, speedups are relative to the
+    //  first entry of each group
+    struct benchmark_report
+    {
+        std::vector<benchmark_entry> entries;
+
+        void add (std::string group, std::string name, double milliseconds, double work)
+        {
+            entries.push_back (benchmark_entry {std::move (group), std::move (name), milliseconds, work});
+        }
+
+        std::string to_text () const
+        {
+            std::string result;
+            char line[256];
+
+            std::string group;
+            auto baseline = 0.0;
+            for (auto const & entry : entries)
+            {
+                if (entry.group != group)
+                {
+                    group       = entry.group;
+                    baseline    = entry.milliseconds;
+
+                    std::snprintf (line, sizeof (line), "\n%s\n", group.c_str ());
+                    result += line;
+                }
+
+                auto const rate = entry.work > 0 && entry.milliseconds > 0
+                    ? entry.work / entry.milliseconds * 1000
+                    : 0
+                    ;
+
+                std::snprintf (
+                        line
+                    ,   sizeof (line)
+                    ,   "  %-40s %10.2f ms %14.0f /s %6.2fx\n"
+                    ,   entry.name.c_str ()
+                    ,   entry.milliseconds
+                    ,   rate
+                    ,   entry.milliseconds > 0 ? baseline / entry.milliseconds : 0
+                    );
+                result += line;
+            }
+
+            return result;
+        }
+
+        bool write (native_path const & path) const
+        {
+            std::ofstream file (path, std::ios::binary | std::ios::trunc);
+            file << to_text ();
+            return static_cast<bool> (file);
+        }
+    };
+
+    // Times every unroll factor of the dispatch table for one formula at the native width
+    inline void benchmark_unroll (
+            benchmark_report &      report
+        ,   formula_view const &    view
+        ,   formula                 f
+        ,   precision               p
+        ,   unsigned int            repeats = 3
+        )
+    {
+        std::vector<std::uint32_t> counts (static_cast<std::size_t> (view.width) * view.height);
+
+        auto const group    = std::string ("unroll ") + (p == precision::float32 ? "float " : "double ") + (view.julia ? "julia" : "mandelbrot");
+        auto const unrolls  = details::kernel_unroll_factors ();
+
+        for (auto i = 0U; i < details::kernel_unrolls; ++i)
+        {
+            auto kernel = select_kernel (f, p, 0, unrolls[i]);
+            if (!kernel)
+            {
+                continue;
+            }
+
+            auto ms = measure_ms (repeats, [&] ()
+            {
+                render_formula (view, kernel, counts.data ());
+            });
+
+            report.add (group, "K=" + std::to_string (unrolls[i]), ms, static_cast<double> (counts.size ()));
+        }
+    }
+
+    // Times the same kernel on every executor backend compiled in, native first
+    inline void benchmark_executors (
+            benchmark_report &      report
+        ,   formula_view const &    view
+        ,   formula                 f
+        ,   precision               p
+        ,   unsigned int            repeats = 3
+        )
+    {
+        auto const kernel = select_kernel (f, p);
+        if (!kernel)
+        {
+            return;
+        }
+
+        std::vector<std::uint32_t> counts (static_cast<std::size_t> (view.width) * view.height);
+
+        for (auto k = 0U; k < static_cast<unsigned int> (executor_kind::count); ++k)
+        {
+            auto const kind = static_cast<executor_kind> (k);
+            auto rows       = make_executor (kind);
+            if (!rows)
+            {
+                continue;
+            }
+
+            auto ms = measure_ms (repeats, [&] ()
+            {
+                render_formula (view, kernel, counts.data (), *rows);
+            });
+
+            // The names are plain ASCII
+            std::string name;
+            for (auto c = executor_name (kind); *c; ++c)
+            {
+                name += static_cast<char> (*c);
+            }
+
+            report.add (std::string ("executor ") + (view.julia ? "julia" : "mandelbrot"), name, ms, static_cast<double> (counts.size ()));
+        }
+    }
+
+    // Fraction of counts that differ from a reference rendering
+    inline double mismatch_fraction (std::vector<std::uint32_t> const & counts, std::vector<std::uint32_t> const & reference)
+    {
+        auto mismatched = std::size_t ();
+        for (auto i = std::size_t (); i < counts.size (); ++i)
+        {
+            mismatched += counts[i] != reference[i];
+        }
+        return counts.empty () ? 0 : static_cast<double> (mismatched) / static_cast<double> (counts.size ());
+    }
+
+    // Times every precision for one formula and validates each against the 256 bit fixed
+    //  point rendering, which is exact for any zoom a double center can express
+    inline void benchmark_precision (
+            benchmark_report &      report
+        ,   formula_view const &    view
+        ,   formula                 f
+        ,   unsigned int            repeats = 1
+        )
+    {
+        auto const pixels = static_cast<std::size_t> (view.width) * view.height;
+
+        std::vector<std::uint32_t> reference (pixels);
+        std::vector<std::uint32_t> counts (pixels);
+
+        auto const reference_kernel = select_kernel (f, precision::fixed256);
+        if (!reference_kernel)
+        {
+            return;
+        }
+        render_formula (view, reference_kernel, reference.data ());
+
+        auto const group = std::string ("precision ") + (view.julia ? "julia" : "mandelbrot");
+
+        for (auto p : {precision::float32, precision::float64, precision::fixed128, precision::fixed192, precision::fixed256})
+        {
+            auto kernel = select_kernel (f, p);
+            if (!kernel)
+            {
+                continue;
+            }
+
+            auto ms = measure_ms (repeats, [&] ()
+            {
+                render_formula (view, kernel, counts.data ());
+            });
+
+            char name[64];
+            std::snprintf (
+                    name
+                ,   sizeof (name)
+                ,   "%u bit, %.3f%% differ"
+                ,   static_cast<unsigned int> (p)
+                ,   100 * mismatch_fraction (counts, reference)
+                );
+
+            report.add (group, name, ms, static_cast<double> (pixels));
+        }
+    }
+}
@@ -0,0 +1,438 @@
+// ----------------------------------------------------------------------------------------------
+// Copyright (c) Mrten Rnge.
+// ----------------------------------------------------------------------------------------------
+// This source code is subject to terms and conditions of the Microsoft Public License. A
+// copy of the license can be found in the License.html file at the root of this distribution.
+// If you cannot locate the  Microsoft Public License, please send an email to
+// dlr@microsoft.com. By using this source code in any fashion, you are agreeing to be bound
+//  by the terms of the Microsoft Public License.
+// ----------------------------------------------------------------------------------------------
+// You must not remove this notice, or any other, from this software.
+// ----------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "benchmark.h"
+#include "escape_time.h"
+
+namespace fractal
+{
+    struct buddhabrot_options
+    {
+        unsigned int    width       = 512   ;
+        unsigned int    height      = 512   ;
+        double          center_x    = -0.5  ;
+        double          center_y    = 0     ;
+        double          zoom        = 0.25  ;
+        // Orbits that escape in fewer than min_iter steps or not within max_iter are not
+        //  plotted, they are most of the samples and contribute only noise
+        unsigned int    min_iter    = 20    ;
+        unsigned int    max_iter    = 2000  ;
+        // Cells per side of the escape map c is drawn from, 0 draws c uniformly
+        unsigned int    map_size    = 256   ;
+        // 0 runs a worker per core
+        unsigned int    workers     = 0     ;
+        std::uint64_t   seed        = 1     ;
+    };
+
+    // Orbit density (Buddhabrot) engine: c is sampled over [-2, 2]^2, every orbit of z*z + c
+    //  that escapes within [min_iter, max_iter) steps adds to the density of each pixel it
+    //  passes through.
+    //
+    //  c is importance sampled from a precomputed escape map. Cells where some probe point
+    //  has a plottable orbit are drawn far more often than cells that are interior or
+    //  escape at once, and every orbit is weighted by the inverse of how much more often
+    //  its cell was drawn, so the density converges to the uniformly sampled one.
+    //
+    //  Every worker plots into its own float buffer, run merges them into the double
+    //  density at the end. Calling run repeatedly and showing to_pixels after every call is
+    //  the progressive mode.
+    struct buddhabrot
+    {
+        using ptr = std::unique_ptr<buddhabrot>;
+
+        static ptr create (buddhabrot_options const & options)
+        {
+            if (options.width == 0 || options.height == 0 || options.max_iter <= options.min_iter || !(options.zoom > 0))
+            {
+                return nullptr;
+            }
+
+            ptr result (new buddhabrot (options));
+
+            auto & o = result->m_options;
+            if (o.workers == 0)
+            {
+                o.workers = std::thread::hardware_concurrency ();
+                o.workers = o.workers == 0 ? 1 : o.workers;
+            }
+
+            auto const pixels = static_cast<std::size_t> (o.width) * o.height;
+
+            result->m_view      = make_viewport (o.center_x, o.center_y, o.zoom, o.width, o.height);
+            result->m_density.assign (pixels, 0.0);
+
+            result->m_workers.resize (o.workers);
+            for (auto i = 0U; i < o.workers; ++i)
+            {
+                auto & worker = result->m_workers[i];
+                worker.rng.seed (o.seed * 0x9E3779B97F4A7C15ULL + i);
+                worker.density.assign (pixels, 0.0F);
+                worker.orbit.resize (o.max_iter);
+            }
+
+            result->build_map ();
+            return result;
+        }
+
+        // Traces samples more orbits, then merges the workers' densities
+        void run (std::uint64_t samples)
+        {
+            auto const workers  = m_options.workers;
+            auto const before   = std::chrono::steady_clock::now ();
+
+            parallel_for_rows (workers, [&] (unsigned int index)
+            {
+                auto & worker = m_workers[index];
+                auto const share = samples * (index + 1) / workers - samples * index / workers;
+
+                worker.plotted = 0;
+                for (auto sample = std::uint64_t (); sample < share; ++sample)
+                {
+                    trace (worker);
+                }
+            });
+
+            merge ();
+
+            auto const after = std::chrono::steady_clock::now ();
+            auto const seconds = std::chrono::duration<double> (after - before).count ();
+
+            m_samples += samples;
+            for (auto const & worker : m_workers)
+            {
+                m_plotted += worker.plotted;
+            }
+            m_samples_per_second = seconds > 0 ? samples / seconds : 0;
+        }
+
+        // Square root tone mapped gray, the densest pixel is white
+        void to_pixels (std::uint32_t * rgba) const
+        {
+            auto const peak     = *std::max_element (m_density.begin (), m_density.end ());
+            auto const scale    = peak > 0 ? 1 / peak : 0.0;
+            auto const width    = m_options.width;
+
+            parallel_for_rows (m_options.height, [&] (unsigned int y)
+            {
+                auto const row = static_cast<std::size_t> (y) * width;
+                for (auto x = 0U; x < width; ++x)
+                {
+                    auto const level = static_cast<std::uint32_t> (std::sqrt (m_density[row + x] * scale) * 255 + 0.5);
+                    rgba[row + x] = opaque | level | level << 8 | level << 16;
+                }
+            });
+        }
+
+        // Starts over on another view of the same size. The escape map covers all of
+        //  [-2, 2]^2 and the buffers keep their size, so only the density is cleared.
+        //  False for a zoom create would refuse.
+        bool set_view (double center_x, double center_y, double zoom) noexcept
+        {
+            if (!(zoom > 0))
+            {
+                return false;
+            }
+
+            m_options.center_x  = center_x;
+            m_options.center_y  = center_y;
+            m_options.zoom      = zoom;
+            m_view              = make_viewport (center_x, center_y, zoom, m_options.width, m_options.height);
+
+            // The workers' buffers are cleared by every merge
+            std::fill (m_density.begin (), m_density.end (), 0.0);
+            m_samples           = 0;
+            m_plotted           = 0;
+            return true;
+        }
+
+        // Expected hits per sampled c, times the samples so far
+        std::vector<double> const & density () const noexcept
+        {
+            return m_density;
+        }
+
+        buddhabrot_options const & options () const noexcept
+        {
+            return m_options;
+        }
+
+        std::uint64_t samples () const noexcept
+        {
+            return m_samples;
+        }
+
+        // Samples whose orbit was plotted
+        std::uint64_t plotted () const noexcept
+        {
+            return m_plotted;
+        }
+
+        // Of the last run
+        double samples_per_second () const noexcept
+        {
+            return m_samples_per_second;
+        }
+
+    private:
+        static std::uint32_t const opaque = 0xFF000000U;
+
+        struct orbit_point
+        {
+            double x;
+            double y;
+        };
+
+        struct worker_state
+        {
+            std::mt19937_64             rng             ;
+            std::vector<float>          density         ;
+            std::vector<orbit_point>    orbit           ;
+            std::uint64_t               plotted     = 0 ;
+        };
+
+        explicit buddhabrot (buddhabrot_options const & options)
+            :   m_options (options)
+        {
+        }
+
+        buddhabrot (buddhabrot const &)                 = delete;
+        buddhabrot& operator= (buddhabrot const &)      = delete;
+
+        static inline double uniform (std::mt19937_64 & rng) noexcept
+        {
+            return static_cast<double> (rng () >> 11) * (1.0 / 9007199254740992.0);
+        }
+
+        // Steps the orbit of c takes to escape, max_iter when it does not
+        unsigned int escape (double cx, double cy) const noexcept
+        {
+            if (known_interior (cx, cy))
+            {
+                return m_options.max_iter;
+            }
+            return mandelbrot2 (0.0, 0.0, cx, cy, m_options.max_iter);
+        }
+
+        // Weights the cells of [-2, 2]^2 by how many of four probe points have a plottable
+        //  orbit. Every cell keeps a floor weight, thin filaments between the probes would
+        //  otherwise never be sampled and the density would be biased.
+        void build_map ()
+        {
+            auto const size = m_options.map_size;
+            if (size == 0)
+            {
+                return;
+            }
+
+            auto const cell = 4.0 / size;
+            std::vector<double> weights (static_cast<std::size_t> (size) * size);
+
+            parallel_for_rows (size, [&] (unsigned int row)
+            {
+                for (auto column = 0U; column < size; ++column)
+                {
+                    auto plottable = 0U;
+                    for (auto probe = 0U; probe < 4; ++probe)
+                    {
+                        auto const cx       = -2 + (column + 0.25 + 0.5 * (probe & 1)) * cell;
+                        auto const cy       = -2 + (row    + 0.25 + 0.5 * (probe >> 1)) * cell;
+                        auto const steps    = escape (cx, cy);
+
+                        plottable += steps >= m_options.min_iter && steps < m_options.max_iter ? 1 : 0;
+                    }
+
+                    weights[static_cast<std::size_t> (row) * size + column] = plottable + floor_weight;
+                }
+            });
+
+            m_cells.resize (weights.size ());
+            auto running = 0.0;
+            for (auto i = std::size_t (); i < weights.size (); ++i)
+            {
+                running     += weights[i];
+                m_cells[i]  = running;
+            }
+
+            m_mean_weight = running / static_cast<double> (weights.size ());
+        }
+
+        void trace (worker_state & worker) const noexcept
+        {
+            auto cx     = 0.0;
+            auto cy     = 0.0;
+            auto weight = 1.0;
+
+            if (m_cells.empty ())
+            {
+                cx = -2 + 4 * uniform (worker.rng);
+                cy = -2 + 4 * uniform (worker.rng);
+            }
+            else
+            {
+                auto const size     = m_options.map_size;
+                auto const target   = uniform (worker.rng) * m_cells.back ();
+                auto const index    = static_cast<std::size_t> (std::upper_bound (m_cells.begin (), m_cells.end (), target) - m_cells.begin ());
+                auto const cell     = index < m_cells.size () ? index : m_cells.size () - 1;
+                auto const w        = m_cells[cell] - (cell > 0 ? m_cells[cell - 1] : 0.0);
+
+                cx      = -2 + (cell % size + uniform (worker.rng)) * (4.0 / size);
+                cy      = -2 + (cell / size + uniform (worker.rng)) * (4.0 / size);
+                weight  = m_mean_weight / w;
+            }
+
+            if (known_interior (cx, cy))
+            {
+                return;
+            }
+
+            auto const max_iter = m_options.max_iter;
+            auto const orbit    = worker.orbit.data ();
+
+            auto x = 0.0;
+            auto y = 0.0;
+            auto n = 0U;
+            for (; n < max_iter; ++n)
+            {
+                auto const x2 = x * x;
+                auto const y2 = y * y;
+                if (x2 + y2 >= 4)
+                {
+                    break;
+                }
+
+                y = (x + x) * y + cy;
+                x = x2 - y2 + cx;
+                orbit[n] = orbit_point {x, y};
+            }
+
+            if (n < m_options.min_iter || n >= max_iter)
+            {
+                return;
+            }
+
+            ++worker.plotted;
+
+            auto const width    = m_options.width;
+            auto const height   = m_options.height;
+            auto const fweight  = static_cast<float> (weight);
+            auto const inv_x    = 1 / m_view.step_x;
+            auto const inv_y    = 1 / m_view.step_y;
+            auto const density  = worker.density.data ();
+
+            for (auto i = 0U; i < n; ++i)
+            {
+                auto const px = (orbit[i].x - m_view.origin_x) * inv_x;
+                auto const py = (orbit[i].y - m_view.origin_y) * inv_y;
+
+                if (px >= 0 && py >= 0 && px < width && py < height)
+                {
+                    density[static_cast<std::size_t> (py) * width + static_cast<std::size_t> (px)] += fweight;
+                }
+            }
+        }
+
+        // Folds the workers' float buffers into the double density a row at a time, the
+        //  floats only ever hold one run's worth and so keep their precision
+        void merge ()
+        {
+            auto const width = m_options.width;
+
+            parallel_for_rows (m_options.height, [&] (unsigned int y)
+            {
+                auto const begin    = static_cast<std::size_t> (y) * width;
+                auto const end      = begin + width;
+
+                for (auto & worker : m_workers)
+                {
+                    auto const source = worker.density.data ();
+                    for (auto i = begin; i < end; ++i)
+                    {
+                        m_density[i]    += source[i];
+                        source[i]       = 0;
+                    }
+                }
+            });
+        }
+
+        static constexpr double floor_weight = 1.0 / 16;
+
+        buddhabrot_options          m_options                   ;
+        viewport<double>            m_view                      ;
+        std::vector<double>         m_density                   ;
+        std::vector<worker_state>   m_workers                   ;
+        // Running sum of the cell weights of the escape map, empty for uniform sampling
+        std::vector<double>         m_cells                     ;
+        double                      m_mean_weight           = 1 ;
+        std::uint64_t               m_samples               = 0 ;
+        std::uint64_t               m_plotted               = 0 ;
+        double                      m_samples_per_second    = 0 ;
+    };
+
+    // Uniform against escape map sampling of the same view, each run until it plotted the
+    //  same number of orbits. Building the map is left out, it is paid once per view while
+    //  the progressive mode keeps sampling.
+    inline void benchmark_buddhabrot (
+            benchmark_report &          report
+        ,   buddhabrot_options          options
+        ,   std::uint64_t               orbits  = 20000
+        ,   std::uint64_t               batch   = 100000
+        )
+    {
+        auto const map_size = options.map_size;
+
+        for (auto size : {0U, map_size})
+        {
+            options.map_size = size;
+
+            auto engine = buddhabrot::create (options);
+            if (!engine)
+            {
+                return;
+            }
+
+            auto ms = measure_ms (1, [&] ()
+            {
+                while (engine->plotted () < orbits)
+                {
+                    engine->run (batch);
+                }
+            });
+
+            char name[64];
+            std::snprintf (
+                    name
+                ,   sizeof (name)
+                ,   size == 0 ? "uniform c, %.2f%% plotted" : "escape map, %.2f%% plotted"
+                ,   100.0 * static_cast<double> (engine->plotted ()) / static_cast<double> (engine->samples ())
+                );
+
+            report.add ("buddhabrot plotted orbits", name, ms, static_cast<double> (engine->plotted ()));
+
+            if (map_size == 0)
+            {
+                return;
+            }
+        }
+    }
+}
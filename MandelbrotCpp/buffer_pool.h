@@ -0,0 +1,178 @@
+// ----------------------------------------------------------------------------------------------
+// Copyright (c) Mrten Rnge.
+// ----------------------------------------------------------------------------------------------
+// This source code is subject to terms and conditions of the Microsoft Public License. A
+// copy of the license can be found in the License.html file at the root of this distribution.
+// If you cannot locate the  Microsoft Public License, please send an email to
+// dlr@microsoft.com. By using this source code in any fashion, you are agreeing to be bound
+//  by the terms of the Microsoft Public License.
+// ----------------------------------------------------------------------------------------------
+// You must not remove this notice, or any other, from this software.
+// ----------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace fractal
+{
+    // Reusable scratch buffers for the per frame CPU paths, so neither a frame nor a resize
+    //  goes back to the heap for a few megabytes of pixels every time.
+    //
+    //  acquire hands out the smallest free buffer that fits, uninitialized, and the buffer
+    //  goes back to the pool when its handle is destroyed. The pool must outlive every
+    //  handle it handed out. Thread safe.
+    template<typename T>
+    struct buffer_pool
+    {
+        struct buffer
+        {
+            buffer () noexcept                          = default;
+            buffer (buffer const &)                     = delete;
+            buffer& operator= (buffer const &)          = delete;
+
+            buffer (buffer && other) noexcept
+                :   m_pool      (other.m_pool       )
+                ,   m_data      (std::move (other.m_data))
+                ,   m_size      (other.m_size       )
+                ,   m_capacity  (other.m_capacity   )
+            {
+                other.m_pool = nullptr;
+            }
+
+            buffer& operator= (buffer && other) noexcept
+            {
+                if (this != &other)
+                {
+                    release ();
+                    m_pool          = other.m_pool          ;
+                    m_data          = std::move (other.m_data);
+                    m_size          = other.m_size          ;
+                    m_capacity      = other.m_capacity      ;
+                    other.m_pool    = nullptr               ;
+                }
+                return *this;
+            }
+
+            ~buffer () noexcept
+            {
+                release ();
+            }
+
+            inline T * data () const noexcept
+            {
+                return m_data.get ();
+            }
+
+            inline std::size_t size () const noexcept
+            {
+                return m_size;
+            }
+
+            inline T & operator[] (std::size_t index) const noexcept
+            {
+                return m_data[index];
+            }
+
+        private:
+            friend struct buffer_pool;
+
+            void release () noexcept
+            {
+                if (m_pool && m_data)
+                {
+                    m_pool->give_back (std::move (m_data), m_capacity);
+                }
+                m_pool = nullptr;
+            }
+
+            buffer_pool *           m_pool      = nullptr   ;
+            std::unique_ptr<T[]>    m_data                  ;
+            std::size_t             m_size      = 0         ;
+            std::size_t             m_capacity  = 0         ;
+        };
+
+        buffer_pool () noexcept                         = default;
+        buffer_pool (buffer_pool const &)               = delete;
+        buffer_pool& operator= (buffer_pool const &)    = delete;
+
+        buffer acquire (std::size_t size)
+        {
+            buffer result;
+            result.m_pool = this;
+            result.m_size = size;
+
+            {
+                std::lock_guard<std::mutex> lock (m_lock);
+
+                auto best = m_free.end ();
+                for (auto it = m_free.begin (); it != m_free.end (); ++it)
+                {
+                    if (it->capacity >= size && (best == m_free.end () || it->capacity < best->capacity))
+                    {
+                        best = it;
+                    }
+                }
+
+                if (best != m_free.end ())
+                {
+                    result.m_data       = std::move (best->data);
+                    result.m_capacity   = best->capacity;
+                    m_free.erase (best);
+                    return result;
+                }
+
+                ++m_allocations;
+            }
+
+            result.m_data       = std::unique_ptr<T[]> (new T[size > 0 ? size : 1]);
+            result.m_capacity   = size;
+            return result;
+        }
+
+        // Frees the idle buffers too small for size elements, after a resize grew the frames
+        void trim (std::size_t size)
+        {
+            std::lock_guard<std::mutex> lock (m_lock);
+            m_free.erase (
+                    std::remove_if (m_free.begin (), m_free.end (), [size] (entry const & e) {return e.capacity < size;})
+                ,   m_free.end ()
+                );
+        }
+
+        // Times acquire had to go to the heap, stays flat while the frame size does
+        std::size_t allocations () const
+        {
+            std::lock_guard<std::mutex> lock (m_lock);
+            return m_allocations;
+        }
+
+    private:
+        struct entry
+        {
+            std::size_t             capacity    ;
+            std::unique_ptr<T[]>    data        ;
+        };
+
+        void give_back (std::unique_ptr<T[]> data, std::size_t capacity) noexcept
+        {
+            std::lock_guard<std::mutex> lock (m_lock);
+            try
+            {
+                m_free.push_back (entry {capacity, std::move (data)});
+            }
+            catch (...)
+            {
+                // Out of memory, the buffer is simply freed
+            }
+        }
+
+        mutable std::mutex          m_lock              ;
+        std::vector<entry>          m_free              ;
+        std::size_t                 m_allocations   = 0 ;
+    };
+}
@@ -0,0 +1,202 @@
+// ----------------------------------------------------------------------------------------------
+// Copyright (c) Mrten Rnge.
+// ----------------------------------------------------------------------------------------------
+// This source code is subject to terms and conditions of the Microsoft Public License. A
+// copy of the license can be found in the License.html file at the root of this distribution.
+// If you cannot locate the  Microsoft Public License, please send an email to
+// dlr@microsoft.com. By using this source code in any fashion, you are agreeing to be bound
+//  by the terms of the Microsoft Public License.
+// ----------------------------------------------------------------------------------------------
+// You must not remove this notice, or any other, from this software.
+// ----------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "escape_time.h"
+#include "palette.h"
+
+namespace fractal
+{
+    // Iterates z*z + c while carrying dz, the derivative of z with respect to c for the
+    //  Mandelbrot set (z0 == c) or to z0 for a Julia set. Returns the exterior distance
+    //  estimate 2*|z|*ln|z|/|dz| in plane units, 0 for points that never escaped.
+    //  By the Koebe 1/4 theorem no point of the set is closer than a quarter of it.
+    template<typename T>
+    inline T mandelbrot2_distance (T x, T y, T cx, T cy, bool julia, unsigned int iter) noexcept
+    {
+        auto ix     = x;
+        auto iy     = y;
+        auto dx     = T (1);
+        auto dy     = T (0);
+        auto dc     = julia ? T (0) : T (1);
+
+        auto i = iter;
+
+        for (; (i > 0) & ((ix*ix + iy*iy) < (1 << 16)); --i)
+        {
+            auto tdx = 2 * (ix * dx - iy * dy) + dc;
+            dy = 2 * (ix * dy + iy * dx);
+            dx = tdx;
+
+            auto tx = ix * ix - iy * iy + cx;
+            iy = 2 * ix * iy + cy;
+            ix = tx;
+        }
+
+        if (i == 0)
+        {
+            return T (0);
+        }
+
+        auto z  = std::sqrt (ix*ix + iy*iy);
+        auto dz = std::sqrt (dx*dx + dy*dy);
+
+        return 2 * z * std::log (z) / dz;
+    }
+
+    struct distance_options
+    {
+        // Pixels further than this from the set all get the same color, and the disk
+        //  around a pixel that is guaranteed to be that far is filled without iterating
+        float           far_pixels      = 8     ;
+        // Filaments fade out over this many pixels, less than 1 draws subpixel lines
+        float           filament_width  = 0.5F  ;
+    };
+
+    struct distance_result
+    {
+        std::size_t     iterated    = 0;
+        std::size_t     filled      = 0;
+
+        inline double filled_fraction () const noexcept
+        {
+            auto pixels = iterated + filled;
+            return pixels > 0
+                ? static_cast<double> (filled) / static_cast<double> (pixels)
+                : 0
+                ;
+        }
+    };
+
+    // Writes the distance estimate in pixels for every texel, 0 inside the set and
+    //  options.far_pixels for texels filled from a neighbour's estimate.
+    //  Rows are processed in bands of band_size so disk fills never cross threads.
+    template<typename T>
+    distance_result render_distance (
+            viewport<T> const &         vp
+        ,   T                           cx
+        ,   T                           cy
+        ,   bool                        julia
+        ,   unsigned int                iter
+        ,   distance_options const &    options
+        ,   float *                     distances
+        )
+    {
+        unsigned int const band_size = 32;
+
+        auto const width    = vp.width  ;
+        auto const height   = vp.height ;
+        auto const bands    = (height + band_size - 1) / band_size;
+        auto const pixel    = std::fabs (vp.step_x);
+
+        std::vector<std::size_t> filled (bands);
+
+        parallel_for_rows (bands, [&] (unsigned int band)
+        {
+            auto const begin    = band * band_size;
+            auto const end      = begin + band_size < height ? begin + band_size : height;
+            auto const rows     = end - begin;
+
+            // 0 = pending, 1 = filled
+            std::vector<unsigned char> state (static_cast<std::size_t> (rows) * width);
+
+            for (auto y = begin; y < end; ++y)
+            {
+                auto py = vp.y (static_cast<T> (y));
+
+                for (auto x = 0U; x < width; ++x)
+                {
+                    auto const i = static_cast<std::size_t> (y) * width + x;
+
+                    if (state[(y - begin) * width + x])
+                    {
+                        distances[i] = options.far_pixels;
+                        continue;
+                    }
+
+                    auto px = vp.x (static_cast<T> (x));
+                    auto d  = static_cast<float> (
+                        julia
+                            ? mandelbrot2_distance (px, py, cx, cy, true, iter)
+                            : mandelbrot2_distance (px, py, px, py, false, iter)
+                        / pixel);
+
+                    distances[i] = d < options.far_pixels ? d : options.far_pixels;
+
+                    // Every point within lower - far_pixels of this one is still at least
+                    //  far_pixels from the set
+                    auto const radius = d / 4 - options.far_pixels;
+                    if (radius < 1)
+                    {
+                        continue;
+                    }
+
+                    auto const r    = static_cast<unsigned int> (radius);
+                    auto const r2   = radius * radius;
+                    auto const y0   = y;
+                    auto const y1   = y + r + 1 < end ? y + r + 1 : end;
+                    auto const x0   = x > r ? x - r : 0;
+                    auto const x1   = x + r + 1 < width ? x + r + 1 : width;
+
+                    for (auto fy = y0; fy < y1; ++fy)
+                    {
+                        auto const dy = static_cast<float> (fy - y);
+                        for (auto fx = x0; fx < x1; ++fx)
+                        {
+                            auto const dx = static_cast<float> (fx) - static_cast<float> (x);
+                            if (dx * dx + dy * dy <= r2 && !(fy == y && fx <= x))
+                            {
+                                auto & s = state[(fy - begin) * width + fx];
+                                filled[band] += s == 0;
+                                s = 1;
+                            }
+                        }
+                    }
+                }
+            }
+        });
+
+        distance_result result;
+        for (auto count : filled)
+        {
+            result.filled += count;
+        }
+        result.iterated = static_cast<std::size_t> (width) * height - result.filled;
+
+        return result;
+    }
+
+    // Set and filaments in set_color, fading into a gradient that settles on far_color
+    //  at options.far_pixels
+    inline std::uint32_t shade_distance (
+            float                       distance
+        ,   distance_options const &    options
+        ,   std::uint32_t               set_color
+        ,   std::uint32_t               near_color
+        ,   std::uint32_t               far_color
+        ) noexcept
+    {
+        if (distance < options.filament_width)
+        {
+            return lerp_rgba (set_color, near_color, distance / options.filament_width);
+        }
+
+        auto ratio = std::log (distance / options.filament_width) / std::log (options.far_pixels / options.filament_width);
+        return lerp_rgba (near_color, far_color, ratio < 1 ? ratio : 1);
+    }
+}
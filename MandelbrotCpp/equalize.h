@@ -0,0 +1,264 @@
+// ----------------------------------------------------------------------------------------------
+// Copyright (c) Mrten Rnge.
+// ----------------------------------------------------------------------------------------------
+// This source code is subject to terms and conditions of the Microsoft Public License. A
+// copy of the license can be found in the License.html file at the root of this distribution.
+// If you cannot locate the  Microsoft Public License, please send an email to
+// dlr@microsoft.com. By using this source code in any fashion, you are agreeing to be bound
+//  by the terms of the Microsoft Public License.
+// ----------------------------------------------------------------------------------------------
+// You must not remove this notice, or any other, from this software.
+// ----------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "benchmark.h"
+#include "escape_time.h"
+#include "formulas.h"
+#include "palette.h"
+
+namespace fractal
+{
+    // Histogram equalized coloring: every color of the palette covers about as many escaped
+    //  pixels as any other, instead of most of the palette going to iteration counts hardly
+    //  any pixel has. Interior pixels (count + 1 >= iter) stay black like cyclic_palette.
+    //
+    //  The histograms only span the escaped counts actually in the frame, with one more
+    //  bin for every interior pixel, so a raised limit costs nothing until pixels really
+    //  escape that late.
+    //
+    //  All passes run on every core. Each worker counts its own slice of the frame into
+    //  private histograms, no atomics and no shared cache lines. Neighbouring pixels mostly
+    //  share a count, so a worker spreads them over four histograms to keep the increments
+    //  of one bin from waiting on each other. The histograms are summed and scanned into
+    //  the CDF in blocks of bins, a block per worker, with a serial scan of just the block
+    //  totals in between. The CDF becomes a count to color table and the final sweep is a
+    //  branch free table lookup per pixel, which vectorizes to a gather.
+    //
+    //  Keeps its scratch between frames, not thread safe.
+    struct histogram_equalizer
+    {
+        explicit histogram_equalizer (unsigned int workers = 0)
+            :   m_workers (workers)
+        {
+            if (m_workers == 0)
+            {
+                m_workers = std::thread::hardware_concurrency ();
+                m_workers = m_workers == 0 ? 1 : m_workers;
+            }
+        }
+
+        // Colors size counts into pixels, counts and pixels may be the same buffer
+        void apply (
+                std::uint32_t const *               counts
+            ,   std::size_t                         size
+            ,   unsigned int                        iter
+            ,   std::vector<std::uint32_t> const &  colors
+            ,   unsigned int                        offset
+            ,   std::uint32_t *                     pixels
+            )
+        {
+            if (size == 0 || iter == 0)
+            {
+                return;
+            }
+
+            auto const workers  = m_workers;
+            auto const escaped  = iter - 1;
+
+            auto const slice = [=] (unsigned int worker, std::size_t total)
+            {
+                return total * worker / workers;
+            };
+
+            // The largest escaped count of each slice
+            m_block_totals.resize (workers + 1);
+            parallel_for_rows (workers, [&] (unsigned int worker)
+            {
+                auto top        = std::uint32_t ();
+                auto const end  = slice (worker + 1, size);
+                for (auto i = slice (worker, size); i < end; ++i)
+                {
+                    auto const count = counts[i];
+                    top = count < escaped && count > top ? count : top;
+                }
+                m_block_totals[worker] = top;
+            });
+
+            // Escaped counts up to top have a bin each, every interior count lands in the
+            //  last one
+            auto const top      = static_cast<unsigned int> (*std::max_element (m_block_totals.begin (), m_block_totals.begin () + workers));
+            auto const interior = std::min (top + 1, escaped);
+            auto const bins     = interior + 1;
+            // Whole cache lines per histogram
+            auto const stride   = (bins + 15) & ~15U;
+            auto const rows     = workers * histogram_lanes;
+
+            m_histograms.resize (static_cast<std::size_t> (stride) * rows);
+            m_cdf.resize (bins);
+            m_lut.resize (bins);
+
+            // Private histograms of one slice of the frame each
+            parallel_for_rows (workers, [&] (unsigned int worker)
+            {
+                auto const h0   = m_histograms.data () + static_cast<std::size_t> (stride) * histogram_lanes * worker;
+                auto const h1   = h0 + stride;
+                auto const h2   = h1 + stride;
+                auto const h3   = h2 + stride;
+
+                std::fill (h0, h0 + stride * histogram_lanes, 0U);
+
+                auto const bin  = [interior] (std::uint32_t count) {return count < interior ? count : interior;};
+
+                auto const end  = slice (worker + 1, size);
+                auto i          = slice (worker, size);
+                for (; i + histogram_lanes <= end; i += histogram_lanes)
+                {
+                    ++h0[bin (counts[i + 0])];
+                    ++h1[bin (counts[i + 1])];
+                    ++h2[bin (counts[i + 2])];
+                    ++h3[bin (counts[i + 3])];
+                }
+
+                for (; i < end; ++i)
+                {
+                    ++h0[bin (counts[i])];
+                }
+            });
+
+            // Sum the histograms and scan each block of bins, the interior bin counts for nothing
+            parallel_for_rows (workers, [&] (unsigned int block)
+            {
+                auto const begin    = static_cast<unsigned int> (slice (block, bins));
+                auto const end      = static_cast<unsigned int> (slice (block + 1, bins));
+
+                auto running = std::uint64_t ();
+                for (auto bin = begin; bin < end; ++bin)
+                {
+                    auto sum = std::uint64_t ();
+                    for (auto row = 0U; row < rows; ++row)
+                    {
+                        sum += m_histograms[static_cast<std::size_t> (stride) * row + bin];
+                    }
+
+                    running     += bin < interior ? sum : 0;
+                    m_cdf[bin]  = running;
+                }
+
+                m_block_totals[block + 1] = running;
+            });
+
+            m_block_totals[0] = 0;
+            for (auto block = 0U; block < workers; ++block)
+            {
+                m_block_totals[block + 1] += m_block_totals[block];
+            }
+
+            auto const total = m_block_totals[workers];
+            auto const ncolors = static_cast<std::uint64_t> (colors.size ());
+
+            // Finish the CDF and turn it into the color table
+            parallel_for_rows (workers, [&] (unsigned int block)
+            {
+                auto const begin    = static_cast<unsigned int> (slice (block, bins));
+                auto const end      = static_cast<unsigned int> (slice (block + 1, bins));
+                auto const base     = m_block_totals[block];
+
+                for (auto bin = begin; bin < end; ++bin)
+                {
+                    m_cdf[bin] += base;
+
+                    if (bin >= interior || total == 0 || ncolors == 0)
+                    {
+                        m_lut[bin] = opaque_black;
+                        continue;
+                    }
+
+                    auto const index = m_cdf[bin] * (ncolors - 1) / total;
+                    m_lut[bin] = colors[static_cast<std::size_t> ((index + offset) % ncolors)];
+                }
+            });
+
+            auto const lut = m_lut.data ();
+            parallel_for_rows (workers, [&] (unsigned int worker)
+            {
+                auto const end = slice (worker + 1, size);
+                for (auto i = slice (worker, size); i < end; ++i)
+                {
+                    auto const count = counts[i];
+                    pixels[i] = lut[count < interior ? count : interior];
+                }
+            });
+        }
+
+        // Escaped pixels with at most bin iterations, valid after apply up to the largest
+        //  escaped count of the frame
+        std::vector<std::uint64_t> const & cdf () const noexcept
+        {
+            return m_cdf;
+        }
+
+    private:
+        static unsigned int const   histogram_lanes = 4;
+
+        unsigned int                m_workers       ;
+        std::vector<std::uint32_t>  m_histograms    ;
+        std::vector<std::uint64_t>  m_cdf           ;
+        std::vector<std::uint32_t>  m_lut           ;
+        std::vector<std::uint64_t>  m_block_totals  ;
+    };
+
+    // Times the coloring passes against the escape time render they follow, the speedup
+    //  column then tells how many times cheaper than the render each coloring is
+    inline void benchmark_coloring (
+            benchmark_report &                  report
+        ,   formula_view const &                view
+        ,   formula                             f
+        ,   std::vector<std::uint32_t> const &  colors
+        ,   unsigned int                        repeats = 3
+        )
+    {
+        auto const kernel = select_kernel (f, precision::float32);
+        if (!kernel)
+        {
+            return;
+        }
+
+        auto const pixels = static_cast<std::size_t> (view.width) * view.height;
+
+        std::vector<std::uint32_t> counts (pixels);
+        std::vector<std::uint32_t> colored (pixels);
+
+        auto const group = "coloring " + std::to_string (view.width) + "x" + std::to_string (view.height);
+
+        auto ms = measure_ms (repeats, [&] ()
+        {
+            render_formula (view, kernel, counts.data ());
+        });
+        report.add (group, "escape time", ms, static_cast<double> (pixels));
+
+        auto palette = cyclic_palette (colors, 0, view.iter);
+        ms = measure_ms (repeats, [&] ()
+        {
+            for (auto i = std::size_t (); i < pixels; ++i)
+            {
+                colored[i] = palette (static_cast<unsigned int> (counts[i]));
+            }
+        });
+        report.add (group, "cyclic palette, serial", ms, static_cast<double> (pixels));
+
+        histogram_equalizer equalizer;
+        ms = measure_ms (repeats, [&] ()
+        {
+            equalizer.apply (counts.data (), pixels, view.iter, colors, 0, colored.data ());
+        });
+        report.add (group, "histogram equalized", ms, static_cast<double> (pixels));
+    }
+}
@@ -0,0 +1,209 @@
+// ----------------------------------------------------------------------------------------------
+// Copyright (c) Mrten Rnge.
+// ----------------------------------------------------------------------------------------------
+// This source code is subject to terms and conditions of the Microsoft Public License. A
+// copy of the license can be found in the License.html file at the root of this distribution.
+// If you cannot locate the  Microsoft Public License, please send an email to
+// dlr@microsoft.com. By using this source code in any fashion, you are agreeing to be bound
+//  by the terms of the Microsoft Public License.
+// ----------------------------------------------------------------------------------------------
+// You must not remove this notice, or any other, from this software.
+// ----------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#ifdef _MSC_VER
+#   include <ppl.h>
+#endif
+
+#include "simd.h"
+
+namespace fractal
+{
+    // Maps texels to the complex plane the same way compute_set does
+    template<typename T>
+    struct viewport
+    {
+        unsigned int    width   ;
+        unsigned int    height  ;
+        T               origin_x;
+        T               origin_y;
+        T               step_x  ;
+        T               step_y  ;
+
+        inline T x (T texel_x) const noexcept
+        {
+            return step_x * texel_x + origin_x;
+        }
+
+        inline T y (T texel_y) const noexcept
+        {
+            return step_y * texel_y + origin_y;
+        }
+    };
+
+    template<typename T>
+    viewport<T> make_viewport (T center_x, T center_y, T zoom, unsigned int width, unsigned int height) noexcept
+    {
+        auto w      = static_cast<T> (width );
+        auto h      = static_cast<T> (height);
+        auto aspect = w / h;
+
+        auto dx     = aspect * 1/zoom   ;
+        auto dy     = 1/zoom            ;
+
+        viewport<T> result;
+        result.width    = width                         ;
+        result.height   = height                        ;
+        result.origin_x = center_x - dx * T (0.5)       ;
+        result.origin_y = center_y - dy * T (0.5)       ;
+        result.step_x   = dx / w                        ;
+        result.step_y   = dy / h                        ;
+        return result;
+    }
+
+FRACTAL_EXACT_FP_BEGIN
+
+    // CPU twin of the AMP mandelbrot2, z starts at (x, y) and iterates z*z + c
+    template<typename T>
+    inline unsigned int mandelbrot2 (T x, T y, T cx, T cy, unsigned int iter) noexcept
+    {
+        auto ix = x;
+        auto iy = y;
+
+        auto i = iter;
+
+        for (; (i > 0) & ((ix*ix + iy*iy) < 4); --i)
+        {
+            auto tx = ix * ix - iy * iy + cx;
+            iy = 2 * ix * iy + cy;
+            ix = tx;
+        }
+
+        return iter - i;
+    }
+
+FRACTAL_EXACT_FP_END
+
+    // True for c in the main cardioid or the period 2 bulb, where mandelbrot2 would run
+    //  to the iteration limit. Checking costs less than a handful of iterations.
+    template<typename T>
+    inline bool known_interior (T cx, T cy) noexcept
+    {
+        auto const y2 = cy * cy;
+
+        auto const bx = cx + 1;
+        if (bx * bx + y2 < T (0.0625))
+        {
+            return true;
+        }
+
+        auto const qx = cx - T (0.25);
+        auto const q  = qx * qx + y2;
+        return q * (q + qx) < T (0.25) * y2;
+    }
+
+FRACTAL_EXACT_FP_BEGIN
+
+    // mandelbrot2 over every lane of a pack, the result matches the scalar version lane
+    //  for lane. Counts are accumulated in the lane type which is exact up to 2^24 for float.
+    template<typename TPack>
+    inline TPack mandelbrot2_lanes (TPack x, TPack y, TPack cx, TPack cy, unsigned int iter) noexcept
+    {
+        using T = typename TPack::value_type;
+
+        auto const one  = TPack::broadcast (T (1));
+        auto const four = TPack::broadcast (T (4));
+
+        auto ix     = x;
+        auto iy     = y;
+        auto count  = TPack::broadcast (T (0));
+        auto alive  = less (count, one);
+
+        for (auto i = iter; i > 0; --i)
+        {
+            auto x2 = ix * ix;
+            auto y2 = iy * iy;
+
+            // A lane stays retired once it escaped, even if z wanders back inside
+            alive = alive & less (x2 + y2, four);
+            if (!any (alive))
+            {
+                break;
+            }
+
+            count = count + (alive & one);
+
+            auto tx = x2 - y2 + cx;
+            iy = (ix + ix) * iy + cy;
+            ix = tx;
+        }
+
+        return count;
+    }
+
+FRACTAL_EXACT_FP_END
+
+    // Continuous iteration count, equals iter for points that never escape.
+    //  A larger bailout than mandelbrot2 keeps the log log correction accurate.
+    template<typename T>
+    inline T mandelbrot2_smooth (T x, T y, T cx, T cy, unsigned int iter) noexcept
+    {
+        auto ix = x;
+        auto iy = y;
+
+        auto i = iter;
+
+        for (; (i > 0) & ((ix*ix + iy*iy) < 256); --i)
+        {
+            auto tx = ix * ix - iy * iy + cx;
+            iy = 2 * ix * iy + cy;
+            ix = tx;
+        }
+
+        if (i == 0)
+        {
+            return static_cast<T> (iter);
+        }
+
+        auto log_z  = std::log (ix*ix + iy*iy) / 2;
+        auto nu     = std::log (log_z / std::log (T (2))) / std::log (T (2));
+        auto result = static_cast<T> (iter - i) + 1 - nu;
+
+        return result < 0 ? T (0) : result;
+    }
+
+    // Runs body (y) for every row in [0, height) on all cores
+    template<typename TBody>
+    void parallel_for_rows (unsigned int height, TBody const & body)
+    {
+#ifdef _MSC_VER
+        concurrency::parallel_for (0U, height, body);
+#else
+        auto workers = std::thread::hardware_concurrency ();
+        workers = workers == 0 ? 1 : workers;
+
+        std::vector<std::thread> threads;
+        for (auto worker = 0U; worker < workers; ++worker)
+        {
+            threads.emplace_back ([=, &body] ()
+            {
+                for (auto y = worker; y < height; y += workers)
+                {
+                    body (y);
+                }
+            });
+        }
+
+        for (auto & thread : threads)
+        {
+            thread.join ();
+        }
+#endif
+    }
+}
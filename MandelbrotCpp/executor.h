@@ -0,0 +1,374 @@
+// ----------------------------------------------------------------------------------------------
+// Copyright (c) Mrten Rnge.
+// ----------------------------------------------------------------------------------------------
+// This source code is subject to terms and conditions of the Microsoft Public License. A
+// copy of the license can be found in the License.html file at the root of this distribution.
+// If you cannot locate the  Microsoft Public License, please send an email to
+// dlr@microsoft.com. By using this source code in any fashion, you are agreeing to be bound
+//  by the terms of the Microsoft Public License.
+// ----------------------------------------------------------------------------------------------
+// You must not remove this notice, or any other, from this software.
+// ----------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#if __cplusplus >= 201703L || (defined(_MSVC_LANG) && _MSVC_LANG >= 201703L)
+#   include <algorithm>
+#   include <execution>
+#endif
+
+#ifdef _OPENMP
+#   include <omp.h>
+#endif
+
+#include "escape_time.h"
+
+// std::execution::par_unseq needs the C++17 parallel algorithms from the standard library
+#if defined(__cpp_lib_execution) && __cpp_lib_execution >= 201603L
+#   define FRACTAL_HAS_PAR_UNSEQ 1
+#else
+#   define FRACTAL_HAS_PAR_UNSEQ 0
+#endif
+
+namespace fractal
+{
+    enum class executor_kind
+    {
+        // parallel_for_rows: PPL under MSVC, a thread per core elsewhere
+        native      ,
+        serial      ,
+        thread_pool ,
+        openmp      ,
+        par_unseq   ,
+        count       ,
+    };
+
+    inline wchar_t const * executor_name (executor_kind kind) noexcept
+    {
+        switch (kind)
+        {
+        case executor_kind::native      : return L"native";
+        case executor_kind::serial      : return L"serial";
+        case executor_kind::thread_pool : return L"thread pool";
+        case executor_kind::openmp      : return L"OpenMP";
+        case executor_kind::par_unseq   : return L"par_unseq";
+        default                         : return L"unknown";
+        }
+    }
+
+    // Runs body (i) for every i in [0, count), in any order and on any thread. This is
+    //  what the CPU kernels are written against, so a deployment picks its threading
+    //  without the kernels knowing. Bodies must not throw and, for par_unseq, must not
+    //  take locks.
+    struct executor
+    {
+        using ptr = std::unique_ptr<executor>;
+
+        virtual ~executor () noexcept = default;
+
+        virtual executor_kind kind () const noexcept = 0;
+
+        template<typename TBody>
+        void for_each (unsigned int count, TBody const & body)
+        {
+            run (
+                    count
+                ,   [] (void const * context, unsigned int index)
+                    {
+                        (*static_cast<TBody const *> (context)) (index);
+                    }
+                ,   &body
+                );
+        }
+
+    protected:
+        // Type erased without allocating, the body stays on the caller's stack
+        using invoker = void (*) (void const * context, unsigned int index);
+
+        virtual void run (unsigned int count, invoker invoke, void const * context) = 0;
+    };
+
+    namespace details
+    {
+        struct native_executor : executor
+        {
+            executor_kind kind () const noexcept override
+            {
+                return executor_kind::native;
+            }
+
+        protected:
+            void run (unsigned int count, invoker invoke, void const * context) override
+            {
+                parallel_for_rows (count, [=] (unsigned int index) { invoke (context, index); });
+            }
+        };
+
+        struct serial_executor : executor
+        {
+            executor_kind kind () const noexcept override
+            {
+                return executor_kind::serial;
+            }
+
+        protected:
+            void run (unsigned int count, invoker invoke, void const * context) override
+            {
+                for (auto index = 0U; index < count; ++index)
+                {
+                    invoke (context, index);
+                }
+            }
+        };
+
+        // Workers that stay alive between calls and take indices off a shared counter one
+        //  at a time, so a slow row never holds up a whole precomputed share. The calling
+        //  thread works too.
+        struct thread_pool_executor : executor
+        {
+            explicit thread_pool_executor (unsigned int workers)
+            {
+                for (auto worker = 1U; worker < workers; ++worker)
+                {
+                    m_threads.emplace_back ([this] () { work (); });
+                }
+            }
+
+            ~thread_pool_executor () noexcept override
+            {
+                {
+                    std::lock_guard<std::mutex> lock (m_lock);
+                    m_stopping = true;
+                }
+                m_start.notify_all ();
+
+                for (auto & thread : m_threads)
+                {
+                    thread.join ();
+                }
+            }
+
+            executor_kind kind () const noexcept override
+            {
+                return executor_kind::thread_pool;
+            }
+
+        protected:
+            void run (unsigned int count, invoker invoke, void const * context) override
+            {
+                // One job at a time, callers on other threads queue up here
+                std::lock_guard<std::mutex> job (m_job_lock);
+
+                {
+                    std::lock_guard<std::mutex> lock (m_lock);
+                    m_invoke    = invoke;
+                    m_context   = context;
+                    m_count     = count;
+                    m_next.store (0, std::memory_order_relaxed);
+                    m_busy      = static_cast<unsigned int> (m_threads.size ());
+                    ++m_generation;
+                }
+                m_start.notify_all ();
+
+                take ();
+
+                std::unique_lock<std::mutex> lock (m_lock);
+                m_finished.wait (lock, [this] () { return m_busy == 0; });
+            }
+
+        private:
+            void take () noexcept
+            {
+                for (;;)
+                {
+                    auto const index = m_next.fetch_add (1, std::memory_order_relaxed);
+                    if (index >= m_count)
+                    {
+                        return;
+                    }
+                    m_invoke (m_context, index);
+                }
+            }
+
+            void work ()
+            {
+                auto seen = std::uint64_t ();
+
+                std::unique_lock<std::mutex> lock (m_lock);
+                for (;;)
+                {
+                    m_start.wait (lock, [&] () { return m_stopping || m_generation != seen; });
+                    if (m_stopping)
+                    {
+                        return;
+                    }
+                    seen = m_generation;
+
+                    lock.unlock ();
+                    take ();
+                    lock.lock ();
+
+                    if (--m_busy == 0)
+                    {
+                        m_finished.notify_one ();
+                    }
+                }
+            }
+
+            std::mutex                  m_job_lock              ;
+            std::mutex                  m_lock                  ;
+            std::condition_variable     m_start                 ;
+            std::condition_variable     m_finished              ;
+            std::vector<std::thread>    m_threads               ;
+
+            invoker                     m_invoke    = nullptr   ;
+            void const *                m_context   = nullptr   ;
+            unsigned int                m_count     = 0         ;
+            std::atomic<unsigned int>   m_next      {0}         ;
+            unsigned int                m_busy      = 0         ;
+            std::uint64_t               m_generation= 0         ;
+            bool                        m_stopping  = false     ;
+        };
+
+#ifdef _OPENMP
+        struct openmp_executor : executor
+        {
+            explicit openmp_executor (unsigned int workers)
+                :   m_workers (static_cast<int> (workers))
+            {
+            }
+
+            executor_kind kind () const noexcept override
+            {
+                return executor_kind::openmp;
+            }
+
+        protected:
+            void run (unsigned int count, invoker invoke, void const * context) override
+            {
+                // OpenMP 2.0, what MSVC implements, only knows signed loop variables
+                auto const n = static_cast<int> (count);
+
+#               pragma omp parallel for schedule(dynamic) num_threads(m_workers)
+                for (int index = 0; index < n; ++index)
+                {
+                    invoke (context, static_cast<unsigned int> (index));
+                }
+            }
+
+        private:
+            int m_workers;
+        };
+#endif
+
+#if FRACTAL_HAS_PAR_UNSEQ
+        // The indices [0, count) as a random access range without storage, what the
+        //  standard algorithms take. Dereferencing yields the iterator's own value, like
+        //  boost's counting_iterator.
+        struct index_iterator
+        {
+            using iterator_category = std::random_access_iterator_tag   ;
+            using value_type        = unsigned int                      ;
+            using difference_type   = std::ptrdiff_t                    ;
+            using pointer           = unsigned int const *              ;
+            using reference         = unsigned int const &              ;
+
+            index_iterator () noexcept = default;
+
+            explicit index_iterator (unsigned int index) noexcept
+                :   m_index (index)
+            {
+            }
+
+            reference       operator*  () const noexcept                    { return m_index; }
+            value_type      operator[] (difference_type n) const noexcept   { return static_cast<value_type> (m_index + n); }
+
+            index_iterator & operator++ () noexcept                         { ++m_index; return *this; }
+            index_iterator & operator-- () noexcept                         { --m_index; return *this; }
+            index_iterator   operator++ (int) noexcept                      { auto result = *this; ++m_index; return result; }
+            index_iterator   operator-- (int) noexcept                      { auto result = *this; --m_index; return result; }
+
+            index_iterator & operator+= (difference_type n) noexcept        { m_index = static_cast<value_type> (m_index + n); return *this; }
+            index_iterator & operator-= (difference_type n) noexcept        { m_index = static_cast<value_type> (m_index - n); return *this; }
+
+            friend index_iterator   operator+ (index_iterator i, difference_type n) noexcept        { return i += n; }
+            friend index_iterator   operator+ (difference_type n, index_iterator i) noexcept        { return i += n; }
+            friend index_iterator   operator- (index_iterator i, difference_type n) noexcept        { return i -= n; }
+            friend difference_type  operator- (index_iterator l, index_iterator r) noexcept         { return static_cast<difference_type> (l.m_index) - static_cast<difference_type> (r.m_index); }
+
+            friend bool operator== (index_iterator l, index_iterator r) noexcept    { return l.m_index == r.m_index; }
+            friend bool operator!= (index_iterator l, index_iterator r) noexcept    { return l.m_index != r.m_index; }
+            friend bool operator<  (index_iterator l, index_iterator r) noexcept    { return l.m_index <  r.m_index; }
+            friend bool operator>  (index_iterator l, index_iterator r) noexcept    { return l.m_index >  r.m_index; }
+            friend bool operator<= (index_iterator l, index_iterator r) noexcept    { return l.m_index <= r.m_index; }
+            friend bool operator>= (index_iterator l, index_iterator r) noexcept    { return l.m_index >= r.m_index; }
+
+        private:
+            unsigned int m_index = 0;
+        };
+
+        struct par_unseq_executor : executor
+        {
+            executor_kind kind () const noexcept override
+            {
+                return executor_kind::par_unseq;
+            }
+
+        protected:
+            void run (unsigned int count, invoker invoke, void const * context) override
+            {
+                // Nothing is shared between calls, so callers on several threads and
+                //  bodies that call back into the executor are fine
+                std::for_each (
+                        std::execution::par_unseq
+                    ,   index_iterator (0)
+                    ,   index_iterator (count)
+                    ,   [=] (unsigned int index) { invoke (context, index); }
+                    );
+            }
+        };
+#endif
+    }
+
+    // nullptr when the backend is not compiled in: OpenMP needs /openmp (-fopenmp), par_unseq
+    //  a C++17 standard library with the parallel algorithms. workers 0 is one per core,
+    //  serial, native and par_unseq ignore it.
+    inline executor::ptr make_executor (executor_kind kind, unsigned int workers = 0)
+    {
+        if (workers == 0)
+        {
+            workers = std::thread::hardware_concurrency ();
+            workers = workers == 0 ? 1 : workers;
+        }
+
+        switch (kind)
+        {
+        case executor_kind::native:
+            return executor::ptr (new details::native_executor ());
+        case executor_kind::serial:
+            return executor::ptr (new details::serial_executor ());
+        case executor_kind::thread_pool:
+            return executor::ptr (new details::thread_pool_executor (workers));
+#ifdef _OPENMP
+        case executor_kind::openmp:
+            return executor::ptr (new details::openmp_executor (workers));
+#endif
+#if FRACTAL_HAS_PAR_UNSEQ
+        case executor_kind::par_unseq:
+            return executor::ptr (new details::par_unseq_executor ());
+#endif
+        default:
+            return nullptr;
+        }
+    }
+}
@@ -0,0 +1,104 @@
+// ----------------------------------------------------------------------------------------------
+// Copyright (c) Mrten Rnge.
+// ----------------------------------------------------------------------------------------------
+// This source code is subject to terms and conditions of the Microsoft Public License. A
+// copy of the license can be found in the License.html file at the root of this distribution.
+// If you cannot locate the  Microsoft Public License, please send an email to
+// dlr@microsoft.com. By using this source code in any fashion, you are agreeing to be bound
+//  by the terms of the Microsoft Public License.
+// ----------------------------------------------------------------------------------------------
+// You must not remove this notice, or any other, from this software.
+// ----------------------------------------------------------------------------------------------
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "executor.h"
+#include "tests.h"
+
+namespace
+{
+    using namespace fractal;
+
+    // Every backend compiled into this build
+    std::vector<executor::ptr> every_executor ()
+    {
+        std::vector<executor::ptr> result;
+        for (auto kind = 0U; kind < static_cast<unsigned int> (executor_kind::count); ++kind)
+        {
+            if (auto e = make_executor (static_cast<executor_kind> (kind), 4))
+            {
+                result.push_back (std::move (e));
+            }
+        }
+        return result;
+    }
+
+    bool visits_each_index_once (executor & e, unsigned int count)
+    {
+        std::unique_ptr<std::atomic<unsigned int>[]> visits (new std::atomic<unsigned int>[count > 0 ? count : 1]);
+        for (auto i = 0U; i < count; ++i)
+        {
+            visits[i] = 0;
+        }
+
+        e.for_each (count, [&] (unsigned int index)
+        {
+            visits[index].fetch_add (1, std::memory_order_relaxed);
+        });
+
+        for (auto i = 0U; i < count; ++i)
+        {
+            if (visits[i] != 1)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    FRACTAL_TEST (executor_visits_every_index_once)
+    {
+        for (auto const & e : every_executor ())
+        {
+            // Growing and shrinking counts, the par_unseq backend used to keep its indices
+            for (auto count : {0U, 1U, 7U, 1000U, 3U, 5000U})
+            {
+                CHECK (visits_each_index_once (*e, count));
+            }
+        }
+    }
+
+    // Callers on several threads share one executor, each must see all of its own indices
+    FRACTAL_TEST (executor_takes_concurrent_callers)
+    {
+        for (auto const & e : every_executor ())
+        {
+            std::atomic<unsigned int> failures {0};
+
+            std::vector<std::thread> callers;
+            for (auto caller = 0U; caller < 4; ++caller)
+            {
+                callers.emplace_back ([&, caller] ()
+                {
+                    for (auto round = 0U; round < 20; ++round)
+                    {
+                        if (!visits_each_index_once (*e, 100 + 37 * ((caller + round) % 5)))
+                        {
+                            ++failures;
+                        }
+                    }
+                });
+            }
+
+            for (auto & caller : callers)
+            {
+                caller.join ();
+            }
+
+            CHECK (failures == 0);
+        }
+    }
+}
@@ -0,0 +1,234 @@
+// ----------------------------------------------------------------------------------------------
+// Copyright (c) Mrten Rnge.
+// ----------------------------------------------------------------------------------------------
+// This source code is subject to terms and conditions of the Microsoft Public License. A
+// copy of the license can be found in the License.html file at the root of this distribution.
+// If you cannot locate the  Microsoft Public License, please send an email to
+// dlr@microsoft.com. By using this source code in any fashion, you are agreeing to be bound
+//  by the terms of the Microsoft Public License.
+// ----------------------------------------------------------------------------------------------
+// You must not remove this notice, or any other, from this software.
+// ----------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+
+#if defined(_MSC_VER) && defined(_M_X64)
+#   include <intrin.h>
+#endif
+
+namespace fractal
+{
+    namespace details
+    {
+        // Full 64 x 64 -> 128 bit product
+        inline std::uint64_t mul_64x64 (std::uint64_t a, std::uint64_t b, std::uint64_t & high) noexcept
+        {
+#if defined(_MSC_VER) && defined(_M_X64)
+            return _umul128 (a, b, &high);
+#elif defined(__SIZEOF_INT128__)
+            auto product = static_cast<unsigned __int128> (a) * b;
+            high = static_cast<std::uint64_t> (product >> 64);
+            return static_cast<std::uint64_t> (product);
+#else
+            auto const a_lo = a & 0xFFFFFFFFU;
+            auto const a_hi = a >> 32;
+            auto const b_lo = b & 0xFFFFFFFFU;
+            auto const b_hi = b >> 32;
+
+            auto const ll   = a_lo * b_lo;
+            auto const lh   = a_lo * b_hi;
+            auto const hl   = a_hi * b_lo;
+            auto const hh   = a_hi * b_hi;
+
+            auto const mid  = (ll >> 32) + (lh & 0xFFFFFFFFU) + (hl & 0xFFFFFFFFU);
+            high = hh + (lh >> 32) + (hl >> 32) + (mid >> 32);
+            return (mid << 32) | (ll & 0xFFFFFFFFU);
+#endif
+        }
+    }
+
+    // Two's complement fixed point number of L 64 bit limbs, least significant limb first.
+    //  The top integer_bits bits (sign included) are the integer part, which covers every
+    //  intermediate value of the formulas up to z^5 before the escape test.
+    template<unsigned int L>
+    struct fixed_point
+    {
+        static_assert (L >= 2, "Use float or double below 128 bits");
+
+        static unsigned int const limbs         = L                     ;
+        static unsigned int const integer_bits  = 16                    ;
+        static unsigned int const fraction_bits = 64 * L - integer_bits ;
+
+        std::uint64_t limb[L];
+
+        static inline fixed_point zero () noexcept
+        {
+            fixed_point result;
+            for (auto i = 0U; i < L; ++i)
+            {
+                result.limb[i] = 0;
+            }
+            return result;
+        }
+
+        static inline fixed_point from_int (std::int64_t value) noexcept
+        {
+            auto result = zero ();
+            result.limb[L - 1] = static_cast<std::uint64_t> (value) << (64 - integer_bits);
+            return result;
+        }
+
+        // Exact, a double has fewer significant bits than any fixed_point
+        static inline fixed_point from_double (double value) noexcept
+        {
+            auto result     = zero ();
+            auto magnitude  = std::ldexp (std::fabs (value), 64 - integer_bits);
+
+            for (auto i = L; i > 0; --i)
+            {
+                auto const whole    = std::floor (magnitude);
+                result.limb[i - 1]  = static_cast<std::uint64_t> (whole);
+                magnitude           = std::ldexp (magnitude - whole, 64);
+            }
+
+            return value < 0 ? -result : result;
+        }
+
+        inline double to_double () const noexcept
+        {
+            auto magnitude  = negative () ? -*this : *this;
+            auto result     = 0.0;
+
+            for (auto i = 0U; i < L; ++i)
+            {
+                result = result / 18446744073709551616.0 + static_cast<double> (magnitude.limb[i]);
+            }
+
+            result = std::ldexp (result, -static_cast<int> (64 - integer_bits));
+            return negative () ? -result : result;
+        }
+
+        inline bool negative () const noexcept
+        {
+            return (limb[L - 1] >> 63) != 0;
+        }
+
+        inline fixed_point operator- () const noexcept
+        {
+            fixed_point result;
+            auto carry = std::uint64_t (1);
+            for (auto i = 0U; i < L; ++i)
+            {
+                auto const inverted = ~limb[i];
+                result.limb[i]      = inverted + carry;
+                carry               = result.limb[i] < inverted ? 1 : 0;
+            }
+            return result;
+        }
+    };
+
+    template<unsigned int L>
+    inline fixed_point<L> operator+ (fixed_point<L> const & l, fixed_point<L> const & r) noexcept
+    {
+        fixed_point<L> result;
+        auto carry = std::uint64_t (0);
+        for (auto i = 0U; i < L; ++i)
+        {
+            auto const sum  = l.limb[i] + r.limb[i];
+            auto const c0   = sum < l.limb[i] ? 1 : 0;
+            result.limb[i]  = sum + carry;
+            carry           = c0 | (result.limb[i] < sum ? 1 : 0);
+        }
+        return result;
+    }
+
+    template<unsigned int L>
+    inline fixed_point<L> operator- (fixed_point<L> const & l, fixed_point<L> const & r) noexcept
+    {
+        fixed_point<L> result;
+        auto borrow = std::uint64_t (0);
+        for (auto i = 0U; i < L; ++i)
+        {
+            auto const difference   = l.limb[i] - r.limb[i];
+            auto const b0           = l.limb[i] < r.limb[i] ? 1 : 0;
+            result.limb[i]          = difference - borrow;
+            borrow                  = b0 | (difference < borrow ? 1 : 0);
+        }
+        return result;
+    }
+
+    // Truncates the magnitude of the exact product, so the result is symmetric in sign
+    template<unsigned int L>
+    inline fixed_point<L> operator* (fixed_point<L> const & l, fixed_point<L> const & r) noexcept
+    {
+        auto const negative = l.negative () != r.negative ();
+        auto const a        = l.negative () ? -l : l;
+        auto const b        = r.negative () ? -r : r;
+
+        std::uint64_t product[2 * L] {};
+        for (auto i = 0U; i < L; ++i)
+        {
+            auto carry = std::uint64_t (0);
+            for (auto j = 0U; j < L; ++j)
+            {
+                std::uint64_t high;
+                auto low    = details::mul_64x64 (a.limb[i], b.limb[j], high);
+
+                low         += carry;
+                high        += low < carry ? 1 : 0;
+
+                auto & p    = product[i + j];
+                p           += low;
+                high        += p < low ? 1 : 0;
+
+                carry       = high;
+            }
+            product[i + L] = carry;
+        }
+
+        // Shift right by fraction_bits, which is L - 1 limbs and 64 - integer_bits bits
+        auto const shift = 64 - fixed_point<L>::integer_bits;
+
+        fixed_point<L> result;
+        for (auto i = 0U; i < L; ++i)
+        {
+            result.limb[i] = (product[L - 1 + i] >> shift) | (product[L + i] << (64 - shift));
+        }
+
+        return negative ? -result : result;
+    }
+
+    template<unsigned int L>
+    inline bool operator< (fixed_point<L> const & l, fixed_point<L> const & r) noexcept
+    {
+        auto const lt = static_cast<std::int64_t> (l.limb[L - 1]);
+        auto const rt = static_cast<std::int64_t> (r.limb[L - 1]);
+        if (lt != rt)
+        {
+            return lt < rt;
+        }
+
+        for (auto i = L - 1; i > 0; --i)
+        {
+            if (l.limb[i - 1] != r.limb[i - 1])
+            {
+                return l.limb[i - 1] < r.limb[i - 1];
+            }
+        }
+
+        return false;
+    }
+
+    template<unsigned int L>
+    inline fixed_point<L> abs (fixed_point<L> const & value) noexcept
+    {
+        return value.negative () ? -value : value;
+    }
+
+    using fixed128 = fixed_point<2>;
+    using fixed192 = fixed_point<3>;
+    using fixed256 = fixed_point<4>;
+}
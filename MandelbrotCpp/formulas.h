@@ -0,0 +1,591 @@
+// ----------------------------------------------------------------------------------------------
+// Copyright (c) Mrten Rnge.
+// ----------------------------------------------------------------------------------------------
+// This source code is subject to terms and conditions of the Microsoft Public License. A
+// copy of the license can be found in the License.html file at the root of this distribution.
+// If you cannot locate the  Microsoft Public License, please send an email to
+// dlr@microsoft.com. By using this source code in any fashion, you are agreeing to be bound
+//  by the terms of the Microsoft Public License.
+// ----------------------------------------------------------------------------------------------
+// You must not remove this notice, or any other, from this software.
+// ----------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "escape_time.h"
+#include "executor.h"
+#include "fixed_point.h"
+#include "simd.h"
+
+namespace fractal
+{
+FRACTAL_EXACT_FP_BEGIN
+
+    // Every formula is a type with a step that advances z one iteration given z, its
+    //  squared components and c. The step is a template over the value type so the same
+    //  formula compiles to scalar code (pack<T, 1>) and to every SIMD width, and the
+    //  power of z is a template argument so no generic pow or loop is left in the kernel.
+    namespace formulas
+    {
+        // z^N by squaring, unrolled at compile time
+        template<unsigned int N, bool Even = N % 2 == 0>
+        struct complex_power;
+
+        template<>
+        struct complex_power<1, false>
+        {
+            template<typename V>
+            static inline void apply (V const & x, V const & y, V & rx, V & ry) noexcept
+            {
+                rx = x;
+                ry = y;
+            }
+        };
+
+        template<unsigned int N>
+        struct complex_power<N, true>
+        {
+            template<typename V>
+            static inline void apply (V const & x, V const & y, V & rx, V & ry) noexcept
+            {
+                V hx;
+                V hy;
+                complex_power<N / 2>::apply (x, y, hx, hy);
+
+                rx = hx * hx - hy * hy;
+                ry = (hx + hx) * hy;
+            }
+        };
+
+        template<unsigned int N>
+        struct complex_power<N, false>
+        {
+            template<typename V>
+            static inline void apply (V const & x, V const & y, V & rx, V & ry) noexcept
+            {
+                V px;
+                V py;
+                complex_power<N - 1>::apply (x, y, px, py);
+
+                rx = px * x - py * y;
+                ry = px * y + py * x;
+            }
+        };
+
+        // z*z + c with the exact operation order of mandelbrot2_lanes
+        struct mandelbrot2
+        {
+            template<typename V>
+            static inline void step (V & x, V & y, V const & x2, V const & y2, V const & cx, V const & cy) noexcept
+            {
+                auto tx = x2 - y2 + cx;
+                y = (x + x) * y + cy;
+                x = tx;
+            }
+        };
+
+        // z^N + c, the Julia sets of multibrot<3> are the cubic Julia sets
+        template<unsigned int N>
+        struct multibrot
+        {
+            static_assert (N >= 2, "Multibrot power must be at least 2");
+
+            template<typename V>
+            static inline void step (V & x, V & y, V const &, V const &, V const & cx, V const & cy) noexcept
+            {
+                V px;
+                V py;
+                complex_power<N>::apply (x, y, px, py);
+
+                x = px + cx;
+                y = py + cy;
+            }
+        };
+
+        // (|re z| + i |im z|)^2 + c
+        struct burning_ship
+        {
+            template<typename V>
+            static inline void step (V & x, V & y, V const & x2, V const & y2, V const & cx, V const & cy) noexcept
+            {
+                auto ax = abs (x);
+                auto tx = x2 - y2 + cx;
+                y = (ax + ax) * abs (y) + cy;
+                x = tx;
+            }
+        };
+
+        // conj(z)^2 + c, also known as the Mandelbar set
+        struct tricorn
+        {
+            template<typename V>
+            static inline void step (V & x, V & y, V const & x2, V const & y2, V const & cx, V const & cy) noexcept
+            {
+                auto tx = x2 - y2 + cx;
+                y = cy - (x + x) * y;
+                x = tx;
+            }
+        };
+    }
+
+    enum class formula : unsigned int
+    {
+        mandelbrot2     ,
+        multibrot3      ,
+        multibrot4      ,
+        multibrot5      ,
+        burning_ship    ,
+        tricorn         ,
+        count           ,
+    };
+
+    inline wchar_t const * formula_name (formula f) noexcept
+    {
+        switch (f)
+        {
+        case formula::mandelbrot2   : return L"z^2 + c"         ;
+        case formula::multibrot3    : return L"z^3 + c"         ;
+        case formula::multibrot4    : return L"z^4 + c"         ;
+        case formula::multibrot5    : return L"z^5 + c"         ;
+        case formula::burning_ship  : return L"Burning Ship"    ;
+        case formula::tricorn       : return L"Tricorn"         ;
+        default                     : return L"?"               ;
+        }
+    }
+
+    // The precision of a kernel in bits, the same value tile_key.precision stores
+    enum class precision : unsigned int
+    {
+        float32     = 32    ,
+        float64     = 64    ,
+        fixed128    = 128   ,
+        fixed192    = 192   ,
+        fixed256    = 256   ,
+    };
+
+    inline bool is_fixed (precision p) noexcept
+    {
+        return p == precision::fixed128 || p == precision::fixed192 || p == precision::fixed256;
+    }
+
+    // Lowest precision that still resolves neighbouring pixels of a view, with bits to
+    //  spare for the rounding error the iteration amplifies
+    inline precision required_precision (double center_x, double center_y, double zoom, unsigned int width, unsigned int height) noexcept
+    {
+        unsigned int const spare = 12;
+
+        auto const size         = width > height ? width : height;
+        auto const step         = 1 / zoom / (height > 0 ? height : 1);
+        auto const magnitude    = std::fmax (std::fmax (std::fabs (center_x), std::fabs (center_y)), step * size);
+        auto const bits         = std::log2 (magnitude / step) + spare;
+
+        if (bits <= 24)
+        {
+            return precision::float32;
+        }
+        else if (bits <= 53)
+        {
+            return precision::float64;
+        }
+        else if (bits <= fixed128::fraction_bits)
+        {
+            return precision::fixed128;
+        }
+        else if (bits <= fixed192::fraction_bits)
+        {
+            return precision::fixed192;
+        }
+        else
+        {
+            return precision::fixed256;
+        }
+    }
+
+    // escape_time over every lane of a pack for any formula. Same bailout, retirement and
+    //  count semantics as mandelbrot2_lanes, which it equals for formulas::mandelbrot2.
+    template<typename TFormula, typename TPack>
+    inline TPack escape_lanes (TPack x, TPack y, TPack cx, TPack cy, unsigned int iter) noexcept
+    {
+        using T = typename TPack::value_type;
+
+        auto const one  = TPack::broadcast (T (1));
+        auto const four = TPack::broadcast (T (4));
+
+        auto ix     = x;
+        auto iy     = y;
+        auto count  = TPack::broadcast (T (0));
+        auto alive  = less (count, one);
+
+        for (auto i = iter; i > 0; --i)
+        {
+            auto x2 = ix * ix;
+            auto y2 = iy * iy;
+
+            alive = alive & less (x2 + y2, four);
+            if (!any (alive))
+            {
+                break;
+            }
+
+            count = count + (alive & one);
+
+            TFormula::step (ix, iy, x2, y2, cx, cy);
+        }
+
+        return count;
+    }
+
+    // escape_lanes with the escape test deferred to every K iterations. Each block of K
+    //  steps runs without masks or branches from a snapshot of z; when a live lane turns
+    //  out to have escaped somewhere in the block, the block is replayed from the snapshot
+    //  with the per iteration test so the count is exact.
+    //
+    //  Testing only the end of a block is exact because escape is absorbing for every
+    //  formula here: |z| >= 2 and |c| < 1.9 keeps |z| growing by at least 0.1 per step.
+    //  Packs with a larger |c| take the plain kernel, Mandelbrot points out there never
+    //  get past the first test anyway.
+    template<typename TFormula, unsigned int K, typename TPack>
+    inline TPack escape_lanes_unrolled (TPack x, TPack y, TPack cx, TPack cy, unsigned int iter) noexcept
+    {
+        using T = typename TPack::value_type;
+
+        auto const one      = TPack::broadcast (T (1));
+        auto const four     = TPack::broadcast (T (4));
+        auto const block    = TPack::broadcast (T (K));
+
+        auto count  = TPack::broadcast (T (0));
+        auto alive  = less (count, one);
+        auto all    = move_mask (alive);
+
+        if (K < 2 || move_mask (less (cx * cx + cy * cy, TPack::broadcast (T (3.6)))) != all)
+        {
+            return escape_lanes<TFormula> (x, y, cx, cy, iter);
+        }
+
+        auto ix     = x;
+        auto iy     = y;
+        auto i      = iter;
+
+        while (i > 0)
+        {
+            auto const sx   = ix;
+            auto const sy   = iy;
+            auto const live = move_mask (alive);
+
+            if (i >= K)
+            {
+                for (auto k = 0U; k < K; ++k)
+                {
+                    auto x2 = ix * ix;
+                    auto y2 = iy * iy;
+                    TFormula::step (ix, iy, x2, y2, cx, cy);
+                }
+
+                if (move_mask (alive & less (ix * ix + iy * iy, four)) == live)
+                {
+                    count = count + (alive & block);
+                    i -= K;
+                    continue;
+                }
+
+                ix = sx;
+                iy = sy;
+            }
+
+            // Replay (or finish the last partial block) one tested iteration at a time
+            auto const steps = i < K ? i : K;
+            for (auto k = 0U; k < steps; ++k)
+            {
+                auto x2 = ix * ix;
+                auto y2 = iy * iy;
+
+                alive = alive & less (x2 + y2, four);
+                count = count + (alive & one);
+
+                TFormula::step (ix, iy, x2, y2, cx, cy);
+            }
+            i -= steps;
+
+            if (!any (alive))
+            {
+                break;
+            }
+        }
+
+        return count;
+    }
+
+    // Everything a row kernel needs, kept in double so one table entry type serves every
+    //  precision. Each kernel builds its own viewport in its value type.
+    struct formula_view
+    {
+        double          center_x    = 0     ;
+        double          center_y    = 0     ;
+        double          zoom        = 1     ;
+        unsigned int    width       = 0     ;
+        unsigned int    height      = 0     ;
+        // c for Julia sets, ignored otherwise
+        double          param_x     = 0     ;
+        double          param_y     = 0     ;
+        bool            julia       = false ;
+        unsigned int    iter        = 512   ;
+    };
+
+    // Writes the escape counts of row y, view.width values
+    using row_kernel = void (*) (formula_view const & view, unsigned int y, std::uint32_t * counts);
+
+    template<typename TFormula, typename T, unsigned int W, unsigned int K>
+    void formula_row (formula_view const & view, unsigned int y, std::uint32_t * counts)
+    {
+        using lanes = pack<T, W>;
+
+        auto const vp   = make_viewport (
+                static_cast<T> (view.center_x)
+            ,   static_cast<T> (view.center_y)
+            ,   static_cast<T> (view.zoom)
+            ,   view.width
+            ,   view.height
+            );
+        auto const z_y  = lanes::broadcast (vp.y (static_cast<T> (y)));
+        auto const p_x  = lanes::broadcast (static_cast<T> (view.param_x));
+        auto const p_y  = lanes::broadcast (static_cast<T> (view.param_y));
+
+        T xs[W];
+        T result[W];
+        for (auto x = 0U; x < view.width; x += W)
+        {
+            for (auto lane = 0U; lane < W; ++lane)
+            {
+                xs[lane] = vp.x (static_cast<T> (x + lane));
+            }
+
+            auto const z_x = lanes::load (xs);
+
+            // The julia test is per pack, the formula inside the kernel is fully inlined
+            (view.julia
+                ? escape_lanes_unrolled<TFormula, K> (z_x, z_y, p_x, p_y, view.iter)
+                : escape_lanes_unrolled<TFormula, K> (z_x, z_y, z_x, z_y, view.iter)
+                ).store (result);
+
+            auto const valid = view.width - x < W ? view.width - x : W;
+            for (auto lane = 0U; lane < valid; ++lane)
+            {
+                counts[x + lane] = static_cast<std::uint32_t> (result[lane]);
+            }
+        }
+    }
+
+    // Scalar escape time in fixed point, same test and count as escape_lanes. There is
+    //  no 64 x 64 -> 128 bit vector multiply on x86 so limbs are processed with the scalar
+    //  multiplier and the parallelism comes from the rows.
+    template<typename TFormula, unsigned int L>
+    inline unsigned int escape_fixed (
+            fixed_point<L>          x
+        ,   fixed_point<L>          y
+        ,   fixed_point<L> const &  cx
+        ,   fixed_point<L> const &  cy
+        ,   unsigned int            iter
+        ) noexcept
+    {
+        auto const four = fixed_point<L>::from_int (4);
+
+        auto i = iter;
+        for (; i > 0; --i)
+        {
+            auto x2 = x * x;
+            auto y2 = y * y;
+
+            if (!(x2 + y2 < four))
+            {
+                break;
+            }
+
+            TFormula::step (x, y, x2, y2, cx, cy);
+        }
+
+        return iter - i;
+    }
+
+    // Row kernel in fixed point. Pixel coordinates are exact offsets from the center so
+    //  neighbouring pixels stay distinct at any zoom a double center and step can express.
+    template<typename TFormula, unsigned int L>
+    void fixed_row (formula_view const & view, unsigned int y, std::uint32_t * counts)
+    {
+        using fixed = fixed_point<L>;
+
+        auto const vp       = make_viewport (view.center_x, view.center_y, view.zoom, view.width, view.height);
+        auto const step_x   = fixed::from_double (vp.step_x);
+        auto const step_y   = fixed::from_double (vp.step_y);
+        auto const origin_x = fixed::from_double (view.center_x) - step_x * fixed::from_double (view.width  * 0.5);
+        auto const origin_y = fixed::from_double (view.center_y) - step_y * fixed::from_double (view.height * 0.5);
+        auto const p_x      = fixed::from_double (view.param_x);
+        auto const p_y      = fixed::from_double (view.param_y);
+        auto const z_y      = origin_y + step_y * fixed::from_int (y);
+
+        for (auto x = 0U; x < view.width; ++x)
+        {
+            auto const z_x = origin_x + step_x * fixed::from_int (x);
+
+            counts[x] = view.julia
+                ? escape_fixed<TFormula> (z_x, z_y, p_x, p_y, view.iter)
+                : escape_fixed<TFormula> (z_x, z_y, z_x, z_y, view.iter)
+                ;
+        }
+    }
+
+FRACTAL_EXACT_FP_END
+
+    // Unroll factor select_kernel picks when none is given
+    unsigned int const default_unroll = 4;
+
+    namespace details
+    {
+        unsigned int const kernel_widths    = 4;
+        unsigned int const kernel_unrolls   = 4;
+
+        // Widths instantiated per precision, 1 is the scalar kernel
+        inline unsigned int const * precision_widths (precision p) noexcept
+        {
+            static unsigned int const widths32[kernel_widths] = { 1, 4, 8, 16 };
+            static unsigned int const widths64[kernel_widths] = { 1, 2, 4, 8  };
+
+            return p == precision::float32 ? widths32 : widths64;
+        }
+
+        // Iterations between escape tests, 1 is the plain kernel
+        inline unsigned int const * kernel_unroll_factors () noexcept
+        {
+            static unsigned int const unrolls[kernel_unrolls] = { 1, 4, 8, 16 };
+            return unrolls;
+        }
+
+        template<typename TFormula, unsigned int K>
+        struct formula_kernels
+        {
+            static inline row_kernel const * get (precision p) noexcept
+            {
+                static row_kernel const kernels32[kernel_widths] =
+                {
+                        &formula_row<TFormula, float , 1 , K>
+                    ,   &formula_row<TFormula, float , 4 , K>
+                    ,   &formula_row<TFormula, float , 8 , K>
+                    ,   &formula_row<TFormula, float , 16, K>
+                };
+
+                static row_kernel const kernels64[kernel_widths] =
+                {
+                        &formula_row<TFormula, double, 1 , K>
+                    ,   &formula_row<TFormula, double, 2 , K>
+                    ,   &formula_row<TFormula, double, 4 , K>
+                    ,   &formula_row<TFormula, double, 8 , K>
+                };
+
+                return p == precision::float32 ? kernels32 : kernels64;
+            }
+        };
+
+        template<typename TFormula>
+        inline row_kernel const * formula_table (precision p, unsigned int unroll) noexcept
+        {
+            switch (unroll)
+            {
+            case 1  : return formula_kernels<TFormula, 1 >::get (p);
+            case 4  : return formula_kernels<TFormula, 4 >::get (p);
+            case 8  : return formula_kernels<TFormula, 8 >::get (p);
+            case 16 : return formula_kernels<TFormula, 16>::get (p);
+            default : return nullptr;
+            }
+        }
+
+        // Fixed point kernels have one width and no unrolling
+        template<typename TFormula>
+        inline row_kernel fixed_kernel (precision p, unsigned int width, unsigned int unroll) noexcept
+        {
+            if (width > 1 || unroll > 1)
+            {
+                return nullptr;
+            }
+
+            switch (p)
+            {
+            case precision::fixed128    : return &fixed_row<TFormula, 2>;
+            case precision::fixed192    : return &fixed_row<TFormula, 3>;
+            case precision::fixed256    : return &fixed_row<TFormula, 4>;
+            default                     : return nullptr;
+            }
+        }
+
+        template<typename TFormula>
+        inline row_kernel formula_kernel (precision p, unsigned int width, unsigned int unroll) noexcept
+        {
+            if (is_fixed (p))
+            {
+                return fixed_kernel<TFormula> (p, width, unroll);
+            }
+
+            if (width == 0)
+            {
+                width = p == precision::float32
+                    ? native_width<float>::value
+                    : native_width<double>::value
+                    ;
+            }
+
+            auto const kernels = formula_table<TFormula> (p, unroll == 0 ? default_unroll : unroll);
+            if (!kernels)
+            {
+                return nullptr;
+            }
+
+            auto const widths = precision_widths (p);
+            for (auto i = 0U; i < kernel_widths; ++i)
+            {
+                if (widths[i] == width)
+                {
+                    return kernels[i];
+                }
+            }
+
+            return nullptr;
+        }
+    }
+
+    // Looks up the kernel of a formula, precision, SIMD width and unroll factor in the
+    //  dispatch table. A width of 0 picks the widest pack the target compiles to a single
+    //  register, an unroll of 0 picks default_unroll. Fixed point kernels are scalar.
+    //  Returns nullptr for combinations that were not instantiated.
+    inline row_kernel select_kernel (formula f, precision p, unsigned int width = 0, unsigned int unroll = 0) noexcept
+    {
+        switch (f)
+        {
+        case formula::mandelbrot2   : return details::formula_kernel<formulas::mandelbrot2 > (p, width, unroll);
+        case formula::multibrot3    : return details::formula_kernel<formulas::multibrot<3>> (p, width, unroll);
+        case formula::multibrot4    : return details::formula_kernel<formulas::multibrot<4>> (p, width, unroll);
+        case formula::multibrot5    : return details::formula_kernel<formulas::multibrot<5>> (p, width, unroll);
+        case formula::burning_ship  : return details::formula_kernel<formulas::burning_ship> (p, width, unroll);
+        case formula::tricorn       : return details::formula_kernel<formulas::tricorn     > (p, width, unroll);
+        default                     : return nullptr;
+        }
+    }
+
+    // Renders view.width * view.height escape counts with one kernel call per row
+    inline void render_formula (formula_view const & view, row_kernel kernel, std::uint32_t * counts)
+    {
+        parallel_for_rows (view.height, [&] (unsigned int y)
+        {
+            kernel (view, y, counts + static_cast<std::size_t> (y) * view.width);
+        });
+    }
+
+    // Same on the rows of a chosen executor backend
+    inline void render_formula (formula_view const & view, row_kernel kernel, std::uint32_t * counts, executor & rows)
+    {
+        rows.for_each (view.height, [&] (unsigned int y)
+        {
+            kernel (view, y, counts + static_cast<std::size_t> (y) * view.width);
+        });
+    }
+}
@@ -0,0 +1,130 @@
+// ----------------------------------------------------------------------------------------------
+// Copyright (c) Mrten Rnge.
+// ----------------------------------------------------------------------------------------------
+// This source code is subject to terms and conditions of the Microsoft Public License. A
+// copy of the license can be found in the License.html file at the root of this distribution.
+// If you cannot locate the  Microsoft Public License, please send an email to
+// dlr@microsoft.com. By using this source code in any fashion, you are agreeing to be bound
+//  by the terms of the Microsoft Public License.
+// ----------------------------------------------------------------------------------------------
+// You must not remove this notice, or any other, from this software.
+// ----------------------------------------------------------------------------------------------
+
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#include "formulas.h"
+#include "lane_refill.h"
+#include "tests.h"
+
+namespace
+{
+    using namespace fractal;
+
+    formula const every_formula[] =
+    {
+            formula::mandelbrot2
+        ,   formula::multibrot3
+        ,   formula::multibrot4
+        ,   formula::multibrot5
+        ,   formula::burning_ship
+        ,   formula::tricorn
+    };
+
+    std::vector<formula_view> views ()
+    {
+        std::vector<formula_view> result;
+
+        formula_view view;
+        view.width      = 97    ;
+        view.height     = 61    ;
+        view.iter       = 256   ;
+        view.zoom       = 0.5   ;
+        result.push_back (view);
+
+        // Mostly boundary, where a differently rounded step changes counts
+        view.center_x   = -0.7436439    ;
+        view.center_y   = 0.1318259     ;
+        view.zoom       = 300           ;
+        view.iter       = 1024          ;
+        result.push_back (view);
+
+        view.center_x   = 0             ;
+        view.center_y   = 0             ;
+        view.zoom       = 0.4           ;
+        view.param_x    = -0.8          ;
+        view.param_y    = 0.156         ;
+        view.julia      = true          ;
+        view.iter       = 512           ;
+        result.push_back (view);
+
+        return result;
+    }
+
+    std::size_t differing (std::vector<std::uint32_t> const & l, std::vector<std::uint32_t> const & r)
+    {
+        auto count = std::size_t ();
+        for (auto i = std::size_t (); i < l.size (); ++i)
+        {
+            count += l[i] != r[i];
+        }
+        return count;
+    }
+
+    // Deferred escape tests and lane refill only reorder work, every count must match
+    //  the scalar kernel that tests every iteration
+    FRACTAL_TEST (formulas_every_variant_matches_the_reference)
+    {
+        auto const unrolls  = details::kernel_unroll_factors ();
+        auto wrong_variants = 0U;
+
+        for (auto f : every_formula)
+        {
+            for (auto p : {precision::float32, precision::float64})
+            {
+                auto const reference_kernel = select_kernel (f, p, 1, 1);
+                CHECK (reference_kernel);
+
+                for (auto const & view : views ())
+                {
+                    auto const pixels = static_cast<std::size_t> (view.width) * view.height;
+
+                    std::vector<std::uint32_t> reference (pixels);
+                    render_formula (view, reference_kernel, reference.data ());
+
+                    std::vector<std::uint32_t> counts (pixels);
+                    for (auto w = 0U; w < details::kernel_widths; ++w)
+                    {
+                        auto const width = details::precision_widths (p)[w];
+                        for (auto k = 0U; k < details::kernel_unrolls; ++k)
+                        {
+                            auto const kernel = select_kernel (f, p, width, unrolls[k]);
+                            CHECK (kernel);
+
+                            render_formula (view, kernel, counts.data ());
+                            if (auto const wrong = differing (reference, counts))
+                            {
+                                std::printf ("          %ls, %u bit, W=%u, K=%u: %zu pixels differ\n", formula_name (f), static_cast<unsigned int> (p), width, unrolls[k], wrong);
+                                ++wrong_variants;
+                            }
+                        }
+
+                        if (auto const refill = select_refill_kernel (f, p, width))
+                        {
+                            render_formula (view, refill, counts.data ());
+                            if (auto const wrong = differing (reference, counts))
+                            {
+                                std::printf ("          %ls, %u bit, W=%u refill: %zu pixels differ\n", formula_name (f), static_cast<unsigned int> (p), width, wrong);
+                                ++wrong_variants;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+
+        CHECK (wrong_variants == 0);
+    }
+}
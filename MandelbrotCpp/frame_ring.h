@@ -0,0 +1,452 @@
+// ----------------------------------------------------------------------------------------------
+// Copyright (c) Mrten Rnge.
+// ----------------------------------------------------------------------------------------------
+// This source code is subject to terms and conditions of the Microsoft Public License. A
+// copy of the license can be found in the License.html file at the root of this distribution.
+// If you cannot locate the  Microsoft Public License, please send an email to
+// dlr@microsoft.com. By using this source code in any fashion, you are agreeing to be bound
+//  by the terms of the Microsoft Public License.
+// ----------------------------------------------------------------------------------------------
+// You must not remove this notice, or any other, from this software.
+// ----------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <thread>
+
+#include "benchmark.h"
+#include "mapped_file.h"
+
+namespace fractal
+{
+    // Single writer, any number of readers ring of RGBA frames in a shared mapping.
+    //
+    //  The writer renders straight into the next slot and publishes it, readers map the
+    //  same file (another process or another mapping in this one) and look at the newest
+    //  published frame in place. Every slot carries a sequence counter, odd while the
+    //  writer is in it, so a reader can tell a frame it looked at was overwritten while it
+    //  was looking. Nothing blocks: a slow reader skips frames, it never stalls the writer.
+    //
+    //  Creating the ring again over a live one (a resize) lays it out anew under the next
+    //  generation. Readers index only through the layout they attached to, which their
+    //  mapping covers, and re-attach once they see the generation change.
+    //
+    //  On Linux point it at /dev/shm to keep the frames out of the page cache writeback.
+    struct frame_ring
+    {
+        using ptr = std::unique_ptr<frame_ring>;
+
+        struct frame_view
+        {
+            std::uint32_t const *   pixels      = nullptr   ;
+            unsigned int            width       = 0         ;
+            unsigned int            height      = 0         ;
+            std::uint64_t           frame       = 0         ;
+            // Frames published since the previous view that this reader never saw
+            std::uint64_t           skipped     = 0         ;
+            // Layout the frame was acquired in
+            std::uint32_t           generation  = 0         ;
+        };
+
+        // Creates (or takes over) the ring at path as its writer
+        static ptr create (native_path const & path, unsigned int width, unsigned int height, unsigned int slots = 3)
+        {
+            if (width == 0 || height == 0 || slots < 2)
+            {
+                return nullptr;
+            }
+
+            auto const stride   = slot_stride (width, height);
+            auto const bytes    = sizeof (ring_header) + stride * slots;
+
+            ptr result (new frame_ring ());
+            result->m_file = mapped_file::open (path, bytes);
+
+            if (!result->m_file || !result->m_file->lock ())
+            {
+                return nullptr;
+            }
+
+            auto header = result->header ();
+
+            // Odd while the layout is rewritten, readers attached to the previous one see
+            //  the change before anything else and stop using it
+            auto const previous     = header->magic == magic && header->version == version ? header->generation.load (std::memory_order_relaxed) : 0U;
+            auto const generation   = (previous | 1U) + 1;
+
+            header->generation.store (generation - 1, std::memory_order_relaxed);
+            std::atomic_thread_fence (std::memory_order_release);
+
+            // Readers check the magic last, so they never see a half written header
+            header->magic       = 0;
+            header->version     = version;
+            header->width       = width;
+            header->height      = height;
+            header->slot_count  = slots;
+            header->slot_stride = stride;
+            header->ring_bytes  = bytes;
+            header->published.store (0, std::memory_order_relaxed);
+
+            result->adopt (width, height, slots, stride, generation);
+
+            for (auto i = 0U; i < slots; ++i)
+            {
+                result->slot_at (i)->sequence.store (0, std::memory_order_relaxed);
+            }
+
+            std::atomic_thread_fence (std::memory_order_release);
+            header->magic       = magic;
+            header->generation.store (generation, std::memory_order_release);
+
+            result->m_file->unlock ();
+
+            result->m_next = 1;
+            return result;
+        }
+
+        // Opens an existing ring as a reader. Returns nullptr until a writer created it.
+        static ptr attach (native_path const & path)
+        {
+            ptr result (new frame_ring ());
+            result->m_file = mapped_file::open (path, sizeof (ring_header));
+
+            if (!result->m_file || !result->reattach ())
+            {
+                return nullptr;
+            }
+
+            return result;
+        }
+
+        inline unsigned int width () const noexcept
+        {
+            return m_width;
+        }
+
+        inline unsigned int height () const noexcept
+        {
+            return m_height;
+        }
+
+        // Layouts the ring had since it was created, a reader's changes when it re-attaches
+        inline std::uint32_t generation () const noexcept
+        {
+            return m_generation;
+        }
+
+        // Writer: the slot the next frame is rendered into, width*height RGBA pixels.
+        //  Readers that still look at the frame previously in that slot will see it change.
+        std::uint32_t * begin_frame () noexcept
+        {
+            auto slot = slot_of (m_next);
+
+            slot->sequence.store (2 * m_next - 1, std::memory_order_relaxed);
+            std::atomic_thread_fence (std::memory_order_release);
+
+            return pixels_of (slot);
+        }
+
+        // Writer: makes the frame begin_frame handed out the newest one
+        void publish () noexcept
+        {
+            auto slot = slot_of (m_next);
+
+            slot->frame = m_next;
+            slot->sequence.store (2 * m_next, std::memory_order_release);
+            header ()->published.store (m_next, std::memory_order_release);
+
+            ++m_next;
+        }
+
+        // Reader: the newest frame in place if it is newer than the last one acquired.
+        //  The pixels are not copied, check still_valid after using them. Re-attaches
+        //  when the writer laid the ring out again, which may remap the file and change
+        //  the size of the frames; pixels of earlier views are gone then.
+        bool acquire (frame_view & view) noexcept
+        {
+            if (header ()->generation.load (std::memory_order_acquire) != m_generation && !reattach ())
+            {
+                return false;
+            }
+
+            auto const header   = this->header ();
+            auto const frame    = header->published.load (std::memory_order_acquire);
+
+            if (frame == 0 || frame == m_last)
+            {
+                return false;
+            }
+
+            auto const slot = slot_of (frame);
+            if (slot->sequence.load (std::memory_order_acquire) != 2 * frame)
+            {
+                // Already being overwritten, the writer lapped us
+                return false;
+            }
+
+            view.pixels     = pixels_of (slot);
+            view.width      = m_width;
+            view.height     = m_height;
+            view.frame      = frame;
+            view.skipped    = m_last == 0 || frame < m_last ? 0 : frame - m_last - 1;
+            view.generation = m_generation;
+
+            m_last = frame;
+            return true;
+        }
+
+        // Reader: true when the writer has not touched the slot of view since acquire
+        bool still_valid (frame_view const & view) const noexcept
+        {
+            std::atomic_thread_fence (std::memory_order_acquire);
+            return
+                    view.generation == m_generation
+                &&  header ()->generation.load (std::memory_order_relaxed) == m_generation
+                &&  slot_of (view.frame)->sequence.load (std::memory_order_relaxed) == 2 * view.frame
+                ;
+        }
+
+        // Reader: copies the newest frame, retrying when the writer laps the copy
+        bool copy_latest (std::uint32_t * out, frame_view & view) noexcept
+        {
+            for (auto attempt = 0U; attempt < 4; ++attempt)
+            {
+                if (!acquire (view))
+                {
+                    return false;
+                }
+
+                std::memcpy (out, view.pixels, static_cast<std::size_t> (view.width) * view.height * sizeof (std::uint32_t));
+
+                if (still_valid (view))
+                {
+                    view.pixels = out;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+    private:
+        static std::uint32_t const magic    = 0x474E5246; // "FRNG"
+        static std::uint32_t const version  = 2;
+
+        struct ring_header
+        {
+            std::uint32_t                   magic       ;
+            std::uint32_t                   version     ;
+            std::uint32_t                   width       ;
+            std::uint32_t                   height      ;
+            std::uint32_t                   slot_count  ;
+            // Odd while create lays the ring out, bumped every time it does
+            std::atomic<std::uint32_t>      generation  ;
+            std::uint64_t                   slot_stride ;
+            std::atomic<std::uint64_t>      published   ;
+            // Bytes the layout spans, mapped by a reader before it uses the layout
+            std::uint64_t                   ring_bytes  ;
+            unsigned char                   padding[16] ;
+        };
+
+        struct slot_header
+        {
+            std::atomic<std::uint64_t>      sequence    ;
+            std::uint64_t                   frame       ;
+            unsigned char                   padding[48] ;
+        };
+
+        static_assert (sizeof (ring_header) == 64, "Ring header must be one cache line");
+        static_assert (sizeof (slot_header) == 64, "Slot header must be one cache line");
+
+        static std::uint64_t slot_stride (unsigned int width, unsigned int height) noexcept
+        {
+            auto const bytes = sizeof (slot_header) + static_cast<std::uint64_t> (width) * height * sizeof (std::uint32_t);
+            return (bytes + 4095) & ~std::uint64_t (4095);
+        }
+
+        frame_ring () noexcept                          = default;
+        frame_ring (frame_ring const &)                 = delete;
+        frame_ring& operator= (frame_ring const &)      = delete;
+
+        inline ring_header * header () const noexcept
+        {
+            return reinterpret_cast<ring_header *> (m_file->data ());
+        }
+
+        void adopt (unsigned int width, unsigned int height, unsigned int slots, std::uint64_t stride, std::uint32_t generation) noexcept
+        {
+            m_width         = width;
+            m_height        = height;
+            m_slot_count    = slots;
+            m_slot_stride   = stride;
+            m_generation    = generation;
+            m_last          = 0;
+        }
+
+        // Reader: copies the layout the writer published and maps all of it. False while
+        //  the writer is laying the ring out, the layout stays the previous one then.
+        bool reattach () noexcept
+        {
+            auto header             = this->header ();
+            auto const generation   = header->generation.load (std::memory_order_acquire);
+            if ((generation & 1) != 0 || header->magic != magic || header->version != version)
+            {
+                return false;
+            }
+
+            auto const width        = header->width;
+            auto const height       = header->height;
+            auto const slots        = header->slot_count;
+            auto const stride       = header->slot_stride;
+            auto const bytes        = header->ring_bytes;
+
+            std::atomic_thread_fence (std::memory_order_acquire);
+            if (header->generation.load (std::memory_order_relaxed) != generation)
+            {
+                return false;
+            }
+
+            if (
+                    width == 0
+                ||  height == 0
+                ||  slots < 2
+                ||  stride < slot_stride (width, height)
+                ||  bytes != sizeof (ring_header) + stride * slots
+                )
+            {
+                return false;
+            }
+
+            if (!m_file->refresh () || m_file->size () < bytes)
+            {
+                return false;
+            }
+
+            adopt (width, height, slots, stride, generation);
+            return true;
+        }
+
+        // Always through the layout this side attached to, the header may already
+        //  describe a larger one this mapping does not cover
+        inline slot_header * slot_at (std::uint64_t index) const noexcept
+        {
+            return reinterpret_cast<slot_header *> (m_file->data () + sizeof (ring_header) + index * m_slot_stride);
+        }
+
+        inline slot_header * slot_of (std::uint64_t frame) const noexcept
+        {
+            return slot_at (frame % m_slot_count);
+        }
+
+        static inline std::uint32_t * pixels_of (slot_header * slot) noexcept
+        {
+            return reinterpret_cast<std::uint32_t *> (slot + 1);
+        }
+
+        mapped_file::ptr    m_file              ;
+        unsigned int        m_width         = 0 ;
+        unsigned int        m_height        = 0 ;
+        unsigned int        m_slot_count    = 0 ;
+        std::uint64_t       m_slot_stride   = 0 ;
+        std::uint32_t       m_generation    = 0 ;
+        // Writer: frame begin_frame fills, reader: last frame acquired
+        std::uint64_t       m_next          = 0 ;
+        std::uint64_t       m_last          = 0 ;
+    };
+
+    // Test harness: a writer publishes frames whose pixels all hold the frame number while
+    //  a reader on its own mapping of the same file checks every frame it sees in place.
+    //  A frame that passed still_valid but held the wrong number would be a torn read.
+    inline void benchmark_frame_ring (
+            benchmark_report &      report
+        ,   native_path const &     path
+        ,   unsigned int            width
+        ,   unsigned int            height
+        ,   unsigned int            frames  = 240
+        )
+    {
+        auto writer = frame_ring::create (path, width, height);
+        auto reader = frame_ring::attach (path);
+
+        if (!writer || !reader)
+        {
+            return;
+        }
+
+        std::atomic<bool> done {false};
+
+        std::uint64_t seen      = 0;
+        std::uint64_t skipped   = 0;
+        std::uint64_t lapped    = 0;
+        std::uint64_t torn      = 0;
+
+        std::thread watcher ([&] ()
+        {
+            frame_ring::frame_view view;
+            while (!done.load (std::memory_order_acquire))
+            {
+                if (!reader->acquire (view))
+                {
+                    std::this_thread::yield ();
+                    continue;
+                }
+
+                auto const expected = static_cast<std::uint32_t> (view.frame);
+                auto const count    = static_cast<std::size_t> (view.width) * view.height;
+                auto mismatched     = false;
+                for (auto i = std::size_t (); i < count; i += 997)
+                {
+                    mismatched |= view.pixels[i] != expected;
+                }
+                mismatched |= view.pixels[count - 1] != expected;
+
+                if (!reader->still_valid (view))
+                {
+                    ++lapped;
+                }
+                else
+                {
+                    ++seen;
+                    skipped += view.skipped;
+                    torn    += mismatched ? 1 : 0;
+                }
+            }
+        });
+
+        auto const pixels = static_cast<std::size_t> (width) * height;
+
+        auto ms = measure_ms (1, [&] ()
+        {
+            for (auto frame = 1U; frame <= frames; ++frame)
+            {
+                auto target = writer->begin_frame ();
+                for (auto i = std::size_t (); i < pixels; ++i)
+                {
+                    target[i] = frame;
+                }
+                writer->publish ();
+            }
+        });
+
+        done.store (true, std::memory_order_release);
+        watcher.join ();
+
+        char name[128];
+        std::snprintf (
+                name
+            ,   sizeof (name)
+            ,   "publish, read %u skipped %u lapped %u torn %u"
+            ,   static_cast<unsigned int> (seen)
+            ,   static_cast<unsigned int> (skipped)
+            ,   static_cast<unsigned int> (lapped)
+            ,   static_cast<unsigned int> (torn)
+            );
+
+        report.add ("frame ring frames", name, ms, frames);
+    }
+}
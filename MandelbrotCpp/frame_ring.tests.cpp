@@ -0,0 +1,141 @@
+// ----------------------------------------------------------------------------------------------
+// Copyright (c) Mrten Rnge.
+// ----------------------------------------------------------------------------------------------
+// This source code is subject to terms and conditions of the Microsoft Public License. A
+// copy of the license can be found in the License.html file at the root of this distribution.
+// If you cannot locate the  Microsoft Public License, please send an email to
+// dlr@microsoft.com. By using this source code in any fashion, you are agreeing to be bound
+//  by the terms of the Microsoft Public License.
+// ----------------------------------------------------------------------------------------------
+// You must not remove this notice, or any other, from this software.
+// ----------------------------------------------------------------------------------------------
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+#include "frame_ring.h"
+#include "tests.h"
+
+namespace
+{
+    using namespace fractal;
+
+    void fill (frame_ring & writer, std::uint32_t value)
+    {
+        auto const pixels = static_cast<std::size_t> (writer.width ()) * writer.height ();
+        auto target = writer.begin_frame ();
+        for (auto i = std::size_t (); i < pixels; ++i)
+        {
+            target[i] = value;
+        }
+        writer.publish ();
+    }
+
+    FRACTAL_TEST (frame_ring_attach_before_create_fails)
+    {
+        auto const path = tests::scratch_path ("attach_before_create.ring");
+        tests::remove_scratch (path);
+
+        CHECK (!frame_ring::attach (path));
+
+        tests::remove_scratch (path);
+    }
+
+    // Resizing the window creates the ring again on the same path while readers stay
+    //  attached with their smaller mapping. They used to index the new layout through it.
+    FRACTAL_TEST (frame_ring_reader_follows_writer_resize)
+    {
+        auto const path = tests::scratch_path ("resize.ring");
+        {
+            auto writer = frame_ring::create (path, 64, 32);
+            auto reader = frame_ring::attach (path);
+            CHECK (writer && reader);
+
+            fill (*writer, 5);
+
+            frame_ring::frame_view view;
+            CHECK (reader->acquire (view));
+            CHECK (view.width == 64 && view.height == 32 && view.pixels[64 * 32 - 1] == 5);
+            CHECK (reader->still_valid (view));
+
+            auto const generation = reader->generation ();
+
+            writer = frame_ring::create (path, 640, 480);
+            CHECK (writer);
+            CHECK (!reader->still_valid (view));
+
+            fill (*writer, 7);
+
+            CHECK (reader->acquire (view));
+            CHECK (reader->generation () != generation);
+            CHECK (view.width == 640 && view.height == 480);
+            CHECK (view.frame == 1);
+            CHECK (view.pixels[0] == 7 && view.pixels[640 * 480 - 1] == 7);
+            CHECK (reader->still_valid (view));
+        }
+        tests::remove_scratch (path);
+    }
+
+    // Every frame holds its number in each pixel, a frame that passed still_valid with
+    //  another number or outside the reader's mapping would be a torn read or a crash
+    FRACTAL_TEST (frame_ring_reader_races_resizing_writer)
+    {
+        auto const path = tests::scratch_path ("resize_race.ring");
+        {
+            unsigned int const sizes[][2] = {{64, 48}, {320, 200}, {32, 32}, {512, 384}};
+
+            auto writer = frame_ring::create (path, sizes[0][0], sizes[0][1]);
+            auto reader = frame_ring::attach (path);
+            CHECK (writer && reader);
+
+            std::atomic<bool>           done    {false};
+            std::atomic<unsigned int>   torn    {0};
+            std::atomic<unsigned int>   seen    {0};
+
+            std::thread watcher ([&] ()
+            {
+                frame_ring::frame_view view;
+                while (!done.load (std::memory_order_acquire))
+                {
+                    if (!reader->acquire (view))
+                    {
+                        std::this_thread::yield ();
+                        continue;
+                    }
+
+                    auto const count    = static_cast<std::size_t> (view.width) * view.height;
+                    auto const first    = view.pixels[0];
+                    auto const last     = view.pixels[count - 1];
+
+                    if (reader->still_valid (view))
+                    {
+                        ++seen;
+                        torn += first != static_cast<std::uint32_t> (view.frame) || last != first ? 1 : 0;
+                    }
+                }
+            });
+
+            for (auto round = 0U; round < 40; ++round)
+            {
+                auto const & size = sizes[round % 4];
+                writer = frame_ring::create (path, size[0], size[1]);
+                CHECK (writer);
+
+                for (auto frame = 1U; frame <= 20; ++frame)
+                {
+                    fill (*writer, frame);
+                }
+            }
+
+            done.store (true, std::memory_order_release);
+            watcher.join ();
+
+            CHECK (torn == 0);
+            CHECK (seen > 0);
+        }
+        tests::remove_scratch (path);
+    }
+}
@@ -0,0 +1,1639 @@
+// ----------------------------------------------------------------------------------------------
+// Copyright (c) Mrten Rnge.
+// ----------------------------------------------------------------------------------------------
+// This source code is subject to terms and conditions of the Microsoft Public License. A
+// copy of the license can be found in the License.html file at the root of this distribution.
+// If you cannot locate the  Microsoft Public License, please send an email to
+// dlr@microsoft.com. By using this source code in any fashion, you are agreeing to be bound
+//  by the terms of the Microsoft Public License.
+// ----------------------------------------------------------------------------------------------
+// You must not remove this notice, or any other, from this software.
+// ----------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "benchmark.h"
+#include "escape_time.h"
+#include "formulas.h"
+#include "mapped_file.h"
+#include "palette.h"
+
+namespace fractal
+{
+    enum class image_format : unsigned int
+    {
+        png     ,
+        qoi     ,
+        ppm     ,
+        count   ,
+    };
+
+    // Also the file extension
+    inline wchar_t const * image_format_name (image_format f) noexcept
+    {
+        switch (f)
+        {
+        case image_format::png  : return L"png";
+        case image_format::qoi  : return L"qoi";
+        case image_format::ppm  : return L"ppm";
+        default                 : return L"unknown";
+        }
+    }
+
+    struct image_options
+    {
+        // Rows encoded as a unit. Bands of a PNG are compressed independently so they can be
+        //  compressed on all cores and as soon as a tiled render finishes them.
+        unsigned int    band_rows   = 64    ;
+        // Keep the alpha channel, PPM never has one
+        bool            alpha       = false ;
+        // Candidates the PNG match finder tries per position, higher compresses better
+        unsigned int    effort      = 16    ;
+    };
+
+    namespace details
+    {
+        struct crc32_table
+        {
+            std::uint32_t entries[256];
+
+            crc32_table () noexcept
+            {
+                for (auto i = 0U; i < 256; ++i)
+                {
+                    auto c = i;
+                    for (auto bit = 0; bit < 8; ++bit)
+                    {
+                        c = (c & 1) ? 0xEDB88320U ^ (c >> 1) : c >> 1;
+                    }
+                    entries[i] = c;
+                }
+            }
+        };
+
+        inline std::uint32_t crc32 (std::uint32_t crc, void const * data, std::size_t size) noexcept
+        {
+            static crc32_table const table;
+
+            auto bytes = static_cast<unsigned char const *> (data);
+            crc = ~crc;
+            for (auto i = std::size_t (); i < size; ++i)
+            {
+                crc = table.entries[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+            }
+            return ~crc;
+        }
+
+        std::uint32_t const adler_base = 65521;
+
+        inline std::uint32_t adler32 (std::uint32_t adler, unsigned char const * data, std::size_t size) noexcept
+        {
+            std::uint32_t a = adler & 0xFFFF;
+            std::uint32_t b = adler >> 16;
+            while (size > 0)
+            {
+                // 5552 is the most bytes that can be summed before b overflows
+                auto const chunk = std::min<std::size_t> (size, 5552);
+                for (auto i = std::size_t (); i < chunk; ++i)
+                {
+                    a += data[i];
+                    b += a;
+                }
+                a       %= adler_base;
+                b       %= adler_base;
+                data    += chunk;
+                size    -= chunk;
+            }
+            return (b << 16) | a;
+        }
+
+        // Adler-32 of two concatenated blocks given the checksum of each, lets the bands of
+        //  a PNG be checksummed in parallel
+        inline std::uint32_t adler32_combine (std::uint32_t first, std::uint32_t second, std::uint64_t second_size) noexcept
+        {
+            auto const base = static_cast<std::uint64_t> (adler_base);
+            auto const rem  = second_size % base;
+
+            auto a = static_cast<std::uint64_t> (first & 0xFFFF);
+            auto b = (rem * a) % base;
+            a += (second & 0xFFFF) + base - 1;
+            b += (first >> 16) + (second >> 16) + base - rem;
+
+            a %= base;
+            b %= base;
+            return static_cast<std::uint32_t> ((b << 16) | a);
+        }
+
+        inline void put_u32_be (std::vector<char> & out, std::uint32_t value)
+        {
+            out.push_back (static_cast<char> (value >> 24));
+            out.push_back (static_cast<char> (value >> 16));
+            out.push_back (static_cast<char> (value >> 8));
+            out.push_back (static_cast<char> (value));
+        }
+
+        inline void set_u32_be (char * out, std::uint32_t value) noexcept
+        {
+            out[0] = static_cast<char> (value >> 24);
+            out[1] = static_cast<char> (value >> 16);
+            out[2] = static_cast<char> (value >> 8);
+            out[3] = static_cast<char> (value);
+        }
+
+        // Deflate packs bits starting with the least significant one
+        struct bit_writer
+        {
+            explicit bit_writer (std::vector<char> & out) noexcept
+                :   m_out (out)
+            {
+            }
+
+            // value must fit in bits, at most 32
+            inline void put (std::uint32_t value, unsigned int bits)
+            {
+                m_bits  |= static_cast<std::uint64_t> (value) << m_count;
+                m_count += bits;
+                while (m_count >= 8)
+                {
+                    m_out.push_back (static_cast<char> (m_bits & 0xFF));
+                    m_bits  >>= 8;
+                    m_count -=  8;
+                }
+            }
+
+            inline void align ()
+            {
+                if (m_count > 0)
+                {
+                    put (0, 8 - m_count);
+                }
+            }
+
+        private:
+            std::vector<char> &     m_out           ;
+            std::uint64_t           m_bits      = 0 ;
+            unsigned int            m_count     = 0 ;
+        };
+
+        std::uint16_t const length_base[29] =
+        {
+            3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258,
+        };
+
+        std::uint8_t const length_extra[29] =
+        {
+            0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0,
+        };
+
+        std::uint16_t const distance_base[30] =
+        {
+            1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577,
+        };
+
+        std::uint8_t const distance_extra[30] =
+        {
+            0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13,
+        };
+
+        // Order the code length code lengths are sent in
+        std::uint8_t const code_length_order[19] =
+        {
+            16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15,
+        };
+
+        struct deflate_codes
+        {
+            std::uint8_t    length[259]     ;
+            // Distances up to 256 index directly, longer ones by (distance - 1) / 128
+            std::uint8_t    distance[512]   ;
+
+            deflate_codes () noexcept
+            {
+                for (auto code = 0U; code < 29; ++code)
+                {
+                    for (auto i = 0U; i < (1U << length_extra[code]); ++i)
+                    {
+                        length[length_base[code] + i] = static_cast<std::uint8_t> (code);
+                    }
+                }
+
+                for (auto code = 0U; code < 30; ++code)
+                {
+                    for (auto i = 0U; i < (1U << distance_extra[code]); ++i)
+                    {
+                        auto const d = distance_base[code] + i - 1U;
+                        distance[d < 256 ? d : 256 + (d >> 7)] = static_cast<std::uint8_t> (code);
+                    }
+                }
+            }
+
+            inline unsigned int distance_code (unsigned int distance) const noexcept
+            {
+                auto const d = distance - 1;
+                return this->distance[d < 256 ? d : 256 + (d >> 7)];
+            }
+        };
+
+        inline deflate_codes const & deflate_tables () noexcept
+        {
+            static deflate_codes const tables;
+            return tables;
+        }
+
+        // Huffman code lengths no longer than limit. Lengths clamped to the limit are
+        //  evened out again afterwards since inflate rejects both over-subscribed and
+        //  incomplete codes.
+        inline void huffman_lengths (std::uint32_t const * frequencies, unsigned int count, unsigned int limit, std::uint8_t * lengths)
+        {
+            std::fill (lengths, lengths + count, std::uint8_t ());
+
+            using node = std::pair<std::uint64_t, unsigned int>;
+            std::priority_queue<node, std::vector<node>, std::greater<node>> heap;
+            for (auto i = 0U; i < count; ++i)
+            {
+                if (frequencies[i] > 0)
+                {
+                    heap.push (node (frequencies[i], i));
+                }
+            }
+
+            if (heap.empty ())
+            {
+                return;
+            }
+
+            if (heap.size () == 1)
+            {
+                lengths[heap.top ().second] = 1;
+                return;
+            }
+
+            // Internal nodes follow the leaves and always come after their children
+            std::vector<unsigned int> parent (2 * count);
+            auto next = count;
+            while (heap.size () > 1)
+            {
+                auto const left     = heap.top (); heap.pop ();
+                auto const right    = heap.top (); heap.pop ();
+
+                parent[left.second]     = next;
+                parent[right.second]    = next;
+                heap.push (node (left.first + right.first, next));
+                ++next;
+            }
+
+            auto const root = next - 1;
+            std::vector<unsigned int> depth (2 * count);
+            for (auto n = root; n-- > count;)
+            {
+                depth[n] = depth[parent[n]] + 1;
+            }
+
+            auto clamped = false;
+            for (auto i = 0U; i < count; ++i)
+            {
+                if (frequencies[i] > 0)
+                {
+                    auto const length   = std::min (depth[parent[i]] + 1, limit);
+                    clamped             = clamped || length == limit;
+                    lengths[i]          = static_cast<std::uint8_t> (length);
+                }
+            }
+
+            if (!clamped)
+            {
+                return;
+            }
+
+            std::vector<unsigned int> order;
+            for (auto i = 0U; i < count; ++i)
+            {
+                if (lengths[i] > 0)
+                {
+                    order.push_back (i);
+                }
+            }
+
+            std::stable_sort (order.begin (), order.end (), [&] (unsigned int l, unsigned int r)
+            {
+                return frequencies[l] < frequencies[r];
+            });
+
+            // The Kraft sum in units of 2^-limit, a complete code sums to one
+            auto const one = 1U << limit;
+            auto kraft = 0U;
+            for (auto i : order)
+            {
+                kraft += 1U << (limit - lengths[i]);
+            }
+
+            // Over-subscribed, lengthen the rarest codes
+            while (kraft > one)
+            {
+                for (auto i : order)
+                {
+                    if (lengths[i] < limit)
+                    {
+                        kraft -= 1U << (limit - lengths[i] - 1);
+                        ++lengths[i];
+                        if (kraft <= one)
+                        {
+                            break;
+                        }
+                    }
+                }
+            }
+
+            // Incomplete, shorten the most common codes that still fit
+            while (kraft < one)
+            {
+                for (auto i = order.rbegin (); i != order.rend (); ++i)
+                {
+                    auto const gain = 1U << (limit - lengths[*i]);
+                    if (lengths[*i] > 1 && kraft + gain <= one)
+                    {
+                        kraft += gain;
+                        --lengths[*i];
+                        if (kraft == one)
+                        {
+                            break;
+                        }
+                    }
+                }
+            }
+        }
+
+        // Canonical codes, bit reversed since deflate sends Huffman codes most significant
+        //  bit first
+        inline void huffman_codes (std::uint8_t const * lengths, unsigned int count, std::uint16_t * codes) noexcept
+        {
+            unsigned int per_length[16] = {};
+            for (auto i = 0U; i < count; ++i)
+            {
+                ++per_length[lengths[i]];
+            }
+            per_length[0] = 0;
+
+            unsigned int next[16] = {};
+            auto code = 0U;
+            for (auto bits = 1U; bits < 16; ++bits)
+            {
+                code        = (code + per_length[bits - 1]) << 1;
+                next[bits]  = code;
+            }
+
+            for (auto i = 0U; i < count; ++i)
+            {
+                auto const length = lengths[i];
+                if (length == 0)
+                {
+                    codes[i] = 0;
+                    continue;
+                }
+
+                auto c          = next[length]++;
+                auto reversed   = 0U;
+                for (auto bit = 0U; bit < length; ++bit)
+                {
+                    reversed    = (reversed << 1) | (c & 1);
+                    c           >>= 1;
+                }
+                codes[i] = static_cast<std::uint16_t> (reversed);
+            }
+        }
+
+        // A literal byte, or a match with the length in bits 16-24 and the distance below
+        std::uint32_t const match_token = 0x80000000U;
+
+        // One dynamic Huffman block, never the final one
+        inline void deflate_block (std::vector<std::uint32_t> const & tokens, bit_writer & out)
+        {
+            auto const & tables = deflate_tables ();
+
+            std::uint32_t literal_frequencies[286]  = {};
+            std::uint32_t distance_frequencies[30]  = {};
+            for (auto token : tokens)
+            {
+                if (token & match_token)
+                {
+                    ++literal_frequencies[257 + tables.length[(token >> 16) & 0x1FF]];
+                    ++distance_frequencies[tables.distance_code (token & 0xFFFF)];
+                }
+                else
+                {
+                    ++literal_frequencies[token];
+                }
+            }
+            ++literal_frequencies[256];
+
+            // Inflate wants at least one distance code even if it is never used
+            if (std::all_of (distance_frequencies, distance_frequencies + 30, [] (std::uint32_t f) { return f == 0; }))
+            {
+                distance_frequencies[0] = 1;
+            }
+
+            std::uint8_t    literal_lengths[286]    ;
+            std::uint8_t    distance_lengths[30]    ;
+            std::uint16_t   literal_codes[286]      ;
+            std::uint16_t   distance_codes[30]      ;
+            huffman_lengths (literal_frequencies    , 286, 15, literal_lengths  );
+            huffman_lengths (distance_frequencies   , 30 , 15, distance_lengths );
+            huffman_codes   (literal_lengths        , 286, literal_codes        );
+            huffman_codes   (distance_lengths       , 30 , distance_codes       );
+
+            auto literals = 286U;
+            while (literals > 257 && literal_lengths[literals - 1] == 0)
+            {
+                --literals;
+            }
+
+            auto distances = 30U;
+            while (distances > 1 && distance_lengths[distances - 1] == 0)
+            {
+                --distances;
+            }
+
+            // The code lengths themselves are run length encoded, runs of the previous
+            //  length use 16 and runs of zeros 17 and 18
+            std::uint8_t all_lengths[286 + 30];
+            std::copy (literal_lengths, literal_lengths + literals, all_lengths);
+            std::copy (distance_lengths, distance_lengths + distances, all_lengths + literals);
+            auto const total = literals + distances;
+
+            std::vector<std::pair<std::uint8_t, std::uint8_t>> runs;
+            std::uint32_t run_frequencies[19] = {};
+            auto const emit = [&] (unsigned int symbol, unsigned int extra)
+            {
+                runs.emplace_back (static_cast<std::uint8_t> (symbol), static_cast<std::uint8_t> (extra));
+                ++run_frequencies[symbol];
+            };
+
+            for (auto i = 0U; i < total;)
+            {
+                auto const value = all_lengths[i];
+                auto run = 1U;
+                while (i + run < total && all_lengths[i + run] == value)
+                {
+                    ++run;
+                }
+                i += run;
+
+                auto left = run;
+                if (value == 0)
+                {
+                    while (left >= 11)
+                    {
+                        auto const n = std::min (left, 138U);
+                        emit (18, n - 11);
+                        left -= n;
+                    }
+                    if (left >= 3)
+                    {
+                        emit (17, left - 3);
+                        left = 0;
+                    }
+                }
+                else
+                {
+                    emit (value, 0);
+                    --left;
+                    while (left >= 3)
+                    {
+                        auto const n = std::min (left, 6U);
+                        emit (16, n - 3);
+                        left -= n;
+                    }
+                }
+
+                for (; left > 0; --left)
+                {
+                    emit (value, 0);
+                }
+            }
+
+            // Unlike the other two the code length code has to be complete
+            if (std::count_if (run_frequencies, run_frequencies + 19, [] (std::uint32_t f) { return f > 0; }) < 2)
+            {
+                run_frequencies[run_frequencies[0] > 0 ? 1 : 0] = 1;
+            }
+
+            std::uint8_t    run_lengths[19] ;
+            std::uint16_t   run_codes[19]   ;
+            huffman_lengths (run_frequencies, 19, 7, run_lengths);
+            huffman_codes   (run_lengths, 19, run_codes);
+
+            auto sent_lengths = 19U;
+            while (sent_lengths > 4 && run_lengths[code_length_order[sent_lengths - 1]] == 0)
+            {
+                --sent_lengths;
+            }
+
+            out.put (0, 1);
+            out.put (2, 2);
+            out.put (literals - 257     , 5);
+            out.put (distances - 1      , 5);
+            out.put (sent_lengths - 4   , 4);
+            for (auto i = 0U; i < sent_lengths; ++i)
+            {
+                out.put (run_lengths[code_length_order[i]], 3);
+            }
+
+            for (auto const & run : runs)
+            {
+                out.put (run_codes[run.first], run_lengths[run.first]);
+                switch (run.first)
+                {
+                case 16 : out.put (run.second, 2); break;
+                case 17 : out.put (run.second, 3); break;
+                case 18 : out.put (run.second, 7); break;
+                default : break;
+                }
+            }
+
+            for (auto token : tokens)
+            {
+                if (token & match_token)
+                {
+                    auto const length   = (token >> 16) & 0x1FF;
+                    auto const distance = token & 0xFFFF;
+                    auto const lc       = tables.length[length];
+                    auto const dc       = tables.distance_code (distance);
+
+                    out.put (literal_codes[257 + lc], literal_lengths[257 + lc]);
+                    out.put (length - length_base[lc], length_extra[lc]);
+                    out.put (distance_codes[dc], distance_lengths[dc]);
+                    out.put (distance - distance_base[dc], distance_extra[dc]);
+                }
+                else
+                {
+                    out.put (literal_codes[token], literal_lengths[token]);
+                }
+            }
+
+            out.put (literal_codes[256], literal_lengths[256]);
+        }
+
+        // Compresses data as non-final deflate blocks ending in a sync flush, so the output
+        //  of independently compressed bands concatenates into a single deflate stream.
+        //  Matches are greedy from hash chains, effort bounds how many are tried.
+        inline void deflate_band (unsigned char const * data, std::size_t size, unsigned int effort, std::vector<char> & result)
+        {
+            std::size_t const   window          = 32768 ;
+            std::size_t const   block_tokens    = 16384 ;
+            unsigned int const  hash_bits       = 15    ;
+
+            std::vector<std::int32_t>   head (std::size_t (1) << hash_bits, -1);
+            std::vector<std::int32_t>   chain (size);
+            std::vector<std::uint32_t>  tokens;
+            tokens.reserve (block_tokens);
+
+            bit_writer out (result);
+
+            auto const hash = [&] (std::size_t i) noexcept
+            {
+                auto const key = (std::uint32_t (data[i]) << 16) | (std::uint32_t (data[i + 1]) << 8) | data[i + 2];
+                return (key * 2654435761U) >> (32 - hash_bits);
+            };
+
+            auto const insert = [&] (std::size_t i) noexcept
+            {
+                auto const h    = hash (i);
+                chain[i]        = head[h];
+                head[h]         = static_cast<std::int32_t> (i);
+            };
+
+            effort = effort > 0 ? effort : 1;
+
+            for (auto i = std::size_t (); i < size;)
+            {
+                auto best_length    = 0U;
+                auto best_distance  = 0U;
+
+                if (i + 2 < size)
+                {
+                    auto const longest  = static_cast<unsigned int> (std::min<std::size_t> (258, size - i));
+                    auto candidate      = head[hash (i)];
+                    for (auto tries = effort; candidate >= 0 && tries > 0 && i - static_cast<std::size_t> (candidate) <= window; --tries, candidate = chain[candidate])
+                    {
+                        auto const from = data + candidate;
+                        if (from[best_length] != data[i + best_length])
+                        {
+                            continue;
+                        }
+
+                        auto length = 0U;
+                        while (length < longest && from[length] == data[i + length])
+                        {
+                            ++length;
+                        }
+
+                        if (length > best_length)
+                        {
+                            best_length     = length;
+                            best_distance   = static_cast<unsigned int> (i - candidate);
+                            if (length == longest)
+                            {
+                                break;
+                            }
+                        }
+                    }
+                    insert (i);
+                }
+
+                if (best_length >= 3)
+                {
+                    tokens.push_back (match_token | (best_length << 16) | best_distance);
+                    for (auto j = i + 1; j < i + best_length && j + 2 < size; ++j)
+                    {
+                        insert (j);
+                    }
+                    i += best_length;
+                }
+                else
+                {
+                    tokens.push_back (data[i]);
+                    ++i;
+                }
+
+                if (tokens.size () >= block_tokens)
+                {
+                    deflate_block (tokens, out);
+                    tokens.clear ();
+                }
+            }
+
+            if (!tokens.empty ())
+            {
+                deflate_block (tokens, out);
+            }
+
+            // Sync flush, an empty stored block brings the stream back to a byte boundary
+            out.put (0, 3);
+            out.align ();
+            result.push_back ('\x00');
+            result.push_back ('\x00');
+            result.push_back ('\xFF');
+            result.push_back ('\xFF');
+        }
+
+        inline unsigned int channels_of (image_format format, image_options const & options) noexcept
+        {
+            return options.alpha && format != image_format::ppm ? 4 : 3;
+        }
+
+        inline void to_bytes (std::uint32_t const * rgba, unsigned int width, unsigned int channels, unsigned char * out) noexcept
+        {
+            for (auto x = 0U; x < width; ++x)
+            {
+                auto const c = rgba[x];
+                out[0] = static_cast<unsigned char> (c);
+                out[1] = static_cast<unsigned char> (c >> 8);
+                out[2] = static_cast<unsigned char> (c >> 16);
+                if (channels == 4)
+                {
+                    out[3] = static_cast<unsigned char> (c >> 24);
+                }
+                out += channels;
+            }
+        }
+
+        inline unsigned int filter_cost (int difference) noexcept
+        {
+            auto const d = static_cast<std::int8_t> (difference);
+            return static_cast<unsigned int> (d < 0 ? -d : d);
+        }
+
+        inline int paeth (int a, int b, int c) noexcept
+        {
+            auto const p    = a + b - c;
+            auto const pa   = p > a ? p - a : a - p;
+            auto const pb   = p > b ? p - b : b - p;
+            auto const pc   = p > c ? p - c : c - p;
+            return pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+        }
+
+        // Filters a row with whichever of the five PNG filters gives the smallest sum of
+        //  signed residuals. Without the row above (the first row of a streamed band) only
+        //  None and Sub are valid since the decoder sees a row the encoder did not.
+        inline void png_filter_row (unsigned char const * row, unsigned char const * above, std::size_t bytes, unsigned int channels, unsigned char * out) noexcept
+        {
+            unsigned int cost[5] = {};
+            for (auto i = std::size_t (); i < bytes; ++i)
+            {
+                int const x = row[i];
+                int const a = i >= channels ? row[i - channels] : 0;
+                int const b = above ? above[i] : 0;
+                int const c = above && i >= channels ? above[i - channels] : 0;
+
+                cost[0] += filter_cost (x);
+                cost[1] += filter_cost (x - a);
+                cost[2] += filter_cost (x - b);
+                cost[3] += filter_cost (x - ((a + b) >> 1));
+                cost[4] += filter_cost (x - paeth (a, b, c));
+            }
+
+            auto const candidates = above ? 5U : 2U;
+            auto best = 0U;
+            for (auto filter = 1U; filter < candidates; ++filter)
+            {
+                best = cost[filter] < cost[best] ? filter : best;
+            }
+
+            out[0] = static_cast<unsigned char> (best);
+            ++out;
+            for (auto i = std::size_t (); i < bytes; ++i)
+            {
+                int const x = row[i];
+                int const a = i >= channels ? row[i - channels] : 0;
+                int const b = above ? above[i] : 0;
+                int const c = above && i >= channels ? above[i - channels] : 0;
+
+                int predicted = 0;
+                switch (best)
+                {
+                case 1  : predicted = a;                break;
+                case 2  : predicted = b;                break;
+                case 3  : predicted = (a + b) >> 1;     break;
+                case 4  : predicted = paeth (a, b, c);  break;
+                default :                               break;
+                }
+                out[i] = static_cast<unsigned char> (x - predicted);
+            }
+        }
+
+        struct encoded_band
+        {
+            std::vector<char>   bytes           ;
+            // PNG only, the Adler-32 and size of the filtered rows for the zlib trailer
+            std::uint32_t       adler   = 1     ;
+            std::uint64_t       raw     = 0     ;
+        };
+
+        inline void put_chunk_header (std::vector<char> & out, char const * type)
+        {
+            put_u32_be (out, 0);
+            out.insert (out.end (), type, type + 4);
+        }
+
+        // Fills in the length and appends the CRC of the chunk starting at offset
+        inline void finish_chunk (std::vector<char> & out, std::size_t offset)
+        {
+            auto const length = out.size () - offset - 8;
+            set_u32_be (out.data () + offset, static_cast<std::uint32_t> (length));
+            put_u32_be (out, crc32 (0, out.data () + offset + 4, length + 4));
+        }
+
+        // One IDAT chunk holding the band's rows. above is the row before the band, or
+        //  nullptr when it is not known yet.
+        inline encoded_band png_band (
+                std::uint32_t const *   rgba
+            ,   std::uint32_t const *   above
+            ,   unsigned int            width
+            ,   unsigned int            rows
+            ,   image_options const &   options
+            )
+        {
+            auto const channels = channels_of (image_format::png, options);
+            auto const bytes    = static_cast<std::size_t> (width) * channels;
+            auto const stride   = bytes + 1;
+
+            std::vector<unsigned char> filtered (stride * rows);
+            std::vector<unsigned char> current  (bytes);
+            std::vector<unsigned char> previous (bytes);
+
+            if (above)
+            {
+                to_bytes (above, width, channels, previous.data ());
+            }
+
+            for (auto y = 0U; y < rows; ++y)
+            {
+                to_bytes (rgba + static_cast<std::size_t> (y) * width, width, channels, current.data ());
+                png_filter_row (current.data (), y > 0 || above ? previous.data () : nullptr, bytes, channels, filtered.data () + y * stride);
+                current.swap (previous);
+            }
+
+            encoded_band band;
+            band.adler  = adler32 (1, filtered.data (), filtered.size ());
+            band.raw    = filtered.size ();
+
+            band.bytes.reserve (filtered.size () / 4 + 64);
+            put_chunk_header (band.bytes, "IDAT");
+            deflate_band (filtered.data (), filtered.size (), options.effort, band.bytes);
+            finish_chunk (band.bytes, 0);
+
+            return band;
+        }
+
+        inline std::vector<char> png_header (unsigned int width, unsigned int height, image_options const & options)
+        {
+            std::vector<char> out {'\x89', 'P', 'N', 'G', '\r', '\n', '\x1A', '\n'};
+
+            put_chunk_header (out, "IHDR");
+            put_u32_be (out, width);
+            put_u32_be (out, height);
+            out.push_back (8);
+            out.push_back (options.alpha ? 6 : 2);
+            out.push_back (0);
+            out.push_back (0);
+            out.push_back (0);
+            finish_chunk (out, 8);
+
+            // The zlib header gets a chunk of its own so every band is a whole chunk
+            auto const offset = out.size ();
+            put_chunk_header (out, "IDAT");
+            out.push_back ('\x78');
+            out.push_back ('\x01');
+            finish_chunk (out, offset);
+
+            return out;
+        }
+
+        inline std::vector<char> png_trailer (std::uint32_t adler)
+        {
+            std::vector<char> out;
+
+            // A final empty fixed Huffman block then the zlib checksum
+            put_chunk_header (out, "IDAT");
+            out.push_back ('\x03');
+            out.push_back ('\x00');
+            put_u32_be (out, adler);
+            finish_chunk (out, 0);
+
+            put_chunk_header (out, "IEND");
+            finish_chunk (out, out.size () - 8);
+
+            return out;
+        }
+
+        // What a QOI decoder remembers between pixels
+        struct qoi_state
+        {
+            std::uint32_t   index[64]   = {}            ;
+            std::uint32_t   previous    = 0xFF000000U   ;
+        };
+
+        // The last pixel to land in each index slot over a band, enough to know the state
+        //  a decoder is in at the start of the next band without encoding this one
+        struct qoi_summary
+        {
+            std::uint32_t   index[64]   = {}    ;
+            std::uint64_t   seen        = 0     ;
+            std::uint32_t   last        = 0     ;
+        };
+
+        inline unsigned int qoi_hash (std::uint32_t c) noexcept
+        {
+            return ((c & 0xFF) * 3 + ((c >> 8) & 0xFF) * 5 + ((c >> 16) & 0xFF) * 7 + (c >> 24) * 11) & 63;
+        }
+
+        inline qoi_summary qoi_summarize (std::uint32_t const * rgba, std::size_t count, bool alpha) noexcept
+        {
+            auto const opaque = alpha ? 0U : 0xFF000000U;
+
+            qoi_summary summary;
+            for (auto i = std::size_t (); i < count; ++i)
+            {
+                auto const c        = rgba[i] | opaque;
+                auto const slot     = qoi_hash (c);
+                summary.index[slot] = c;
+                summary.seen        |= std::uint64_t (1) << slot;
+            }
+            summary.last = count > 0 ? rgba[count - 1] | opaque : 0;
+            return summary;
+        }
+
+        inline void qoi_advance (qoi_state & state, qoi_summary const & summary) noexcept
+        {
+            for (auto slot = 0U; slot < 64; ++slot)
+            {
+                if (summary.seen & (std::uint64_t (1) << slot))
+                {
+                    state.index[slot] = summary.index[slot];
+                }
+            }
+            state.previous = summary.seen != 0 ? summary.last : state.previous;
+        }
+
+        // Encodes pixels continuing from state, runs do not cross bands
+        inline void qoi_band (qoi_state & state, std::uint32_t const * rgba, std::size_t count, bool alpha, std::vector<char> & out)
+        {
+            auto const opaque = alpha ? 0U : 0xFF000000U;
+
+            auto previous   = state.previous;
+            auto run        = 0U;
+            for (auto i = std::size_t (); i < count; ++i)
+            {
+                auto const c = rgba[i] | opaque;
+                if (c == previous)
+                {
+                    ++run;
+                    if (run == 62)
+                    {
+                        out.push_back (static_cast<char> (0xC0 | (run - 1)));
+                        run = 0;
+                    }
+                    continue;
+                }
+
+                if (run > 0)
+                {
+                    out.push_back (static_cast<char> (0xC0 | (run - 1)));
+                    run = 0;
+                }
+
+                auto const slot = qoi_hash (c);
+                if (state.index[slot] == c)
+                {
+                    out.push_back (static_cast<char> (slot));
+                }
+                else
+                {
+                    state.index[slot] = c;
+
+                    if ((c >> 24) == (previous >> 24))
+                    {
+                        auto const dr = static_cast<std::int8_t> ((c & 0xFF) - (previous & 0xFF));
+                        auto const dg = static_cast<std::int8_t> (((c >> 8) & 0xFF) - ((previous >> 8) & 0xFF));
+                        auto const db = static_cast<std::int8_t> (((c >> 16) & 0xFF) - ((previous >> 16) & 0xFF));
+
+                        auto const dr_dg = dr - dg;
+                        auto const db_dg = db - dg;
+
+                        if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1)
+                        {
+                            out.push_back (static_cast<char> (0x40 | ((dr + 2) << 4) | ((dg + 2) << 2) | (db + 2)));
+                        }
+                        else if (dg >= -32 && dg <= 31 && dr_dg >= -8 && dr_dg <= 7 && db_dg >= -8 && db_dg <= 7)
+                        {
+                            out.push_back (static_cast<char> (0x80 | (dg + 32)));
+                            out.push_back (static_cast<char> (((dr_dg + 8) << 4) | (db_dg + 8)));
+                        }
+                        else
+                        {
+                            out.push_back ('\xFE');
+                            out.push_back (static_cast<char> (c));
+                            out.push_back (static_cast<char> (c >> 8));
+                            out.push_back (static_cast<char> (c >> 16));
+                        }
+                    }
+                    else
+                    {
+                        out.push_back ('\xFF');
+                        out.push_back (static_cast<char> (c));
+                        out.push_back (static_cast<char> (c >> 8));
+                        out.push_back (static_cast<char> (c >> 16));
+                        out.push_back (static_cast<char> (c >> 24));
+                    }
+                }
+
+                previous = c;
+            }
+
+            if (run > 0)
+            {
+                out.push_back (static_cast<char> (0xC0 | (run - 1)));
+            }
+
+            state.previous = previous;
+        }
+
+        inline std::vector<char> qoi_header (unsigned int width, unsigned int height, image_options const & options)
+        {
+            std::vector<char> out {'q', 'o', 'i', 'f'};
+            put_u32_be (out, width);
+            put_u32_be (out, height);
+            out.push_back (options.alpha ? 4 : 3);
+            out.push_back (0);
+            return out;
+        }
+
+        inline std::vector<char> qoi_trailer ()
+        {
+            return std::vector<char> {0, 0, 0, 0, 0, 0, 0, 1};
+        }
+
+        inline std::vector<char> ppm_header (unsigned int width, unsigned int height)
+        {
+            auto const header = "P6\n" + std::to_string (width) + " " + std::to_string (height) + "\n255\n";
+            return std::vector<char> (header.begin (), header.end ());
+        }
+
+        inline void ppm_rows (std::uint32_t const * rgba, unsigned int width, unsigned int rows, char * out) noexcept
+        {
+            for (auto y = 0U; y < rows; ++y)
+            {
+                to_bytes (rgba + static_cast<std::size_t> (y) * width, width, 3, reinterpret_cast<unsigned char *> (out) + static_cast<std::size_t> (y) * width * 3);
+            }
+        }
+
+        inline std::vector<char> image_header (image_format format, unsigned int width, unsigned int height, image_options const & options)
+        {
+            switch (format)
+            {
+            case image_format::png  : return png_header (width, height, options);
+            case image_format::qoi  : return qoi_header (width, height, options);
+            default                 : return ppm_header (width, height);
+            }
+        }
+
+        inline bool rename_file (native_path const & from, native_path const & to)
+        {
+#ifdef _WIN32
+            return MoveFileExW (from.c_str (), to.c_str (), MOVEFILE_REPLACE_EXISTING) != FALSE;
+#else
+            return std::rename (from.c_str (), to.c_str ()) == 0;
+#endif
+        }
+
+        inline void remove_file (native_path const & path)
+        {
+#ifdef _WIN32
+            DeleteFileW (path.c_str ());
+#else
+            std::remove (path.c_str ());
+#endif
+        }
+    }
+
+    // Encodes a whole frame on all cores. PNG and PPM bands are independent, QOI bands
+    //  first summarize which colors they leave in the index so every band knows the
+    //  state it starts from and they can then be encoded side by side.
+    inline std::vector<char> encode_image (
+            image_format                format
+        ,   std::uint32_t const *       rgba
+        ,   unsigned int                width
+        ,   unsigned int                height
+        ,   image_options const &       options = image_options ()
+        )
+    {
+        auto const band_rows    = options.band_rows > 0 ? options.band_rows : height;
+        auto const bands        = height > 0 ? (height + band_rows - 1) / band_rows : 0;
+        auto const row_of       = [&] (unsigned int band) { return rgba + static_cast<std::size_t> (band) * band_rows * width; };
+        auto const rows_of      = [&] (unsigned int band) { return std::min (band_rows, height - band * band_rows); };
+
+        auto result = details::image_header (format, width, height, options);
+
+        switch (format)
+        {
+        case image_format::png:
+            {
+                std::vector<details::encoded_band> encoded (bands);
+                parallel_for_rows (bands, [&] (unsigned int band)
+                {
+                    auto const above = band > 0 ? row_of (band) - width : nullptr;
+                    encoded[band] = details::png_band (row_of (band), above, width, rows_of (band), options);
+                });
+
+                auto adler = std::uint32_t (1);
+                for (auto const & band : encoded)
+                {
+                    adler = details::adler32_combine (adler, band.adler, band.raw);
+                    result.insert (result.end (), band.bytes.begin (), band.bytes.end ());
+                }
+
+                auto const trailer = details::png_trailer (adler);
+                result.insert (result.end (), trailer.begin (), trailer.end ());
+            }
+            break;
+        case image_format::qoi:
+            {
+                std::vector<details::qoi_summary> summaries (bands);
+                parallel_for_rows (bands, [&] (unsigned int band)
+                {
+                    summaries[band] = details::qoi_summarize (row_of (band), static_cast<std::size_t> (rows_of (band)) * width, options.alpha);
+                });
+
+                std::vector<details::qoi_state> states (bands);
+                for (auto band = 1U; band < bands; ++band)
+                {
+                    states[band] = states[band - 1];
+                    details::qoi_advance (states[band], summaries[band - 1]);
+                }
+
+                std::vector<std::vector<char>> encoded (bands);
+                parallel_for_rows (bands, [&] (unsigned int band)
+                {
+                    auto const pixels = static_cast<std::size_t> (rows_of (band)) * width;
+                    encoded[band].reserve (pixels);
+                    details::qoi_band (states[band], row_of (band), pixels, options.alpha, encoded[band]);
+                });
+
+                for (auto const & band : encoded)
+                {
+                    result.insert (result.end (), band.begin (), band.end ());
+                }
+
+                auto const trailer = details::qoi_trailer ();
+                result.insert (result.end (), trailer.begin (), trailer.end ());
+            }
+            break;
+        default:
+            {
+                auto const offset = result.size ();
+                result.resize (offset + static_cast<std::size_t> (width) * height * 3);
+                parallel_for_rows (bands, [&] (unsigned int band)
+                {
+                    auto const out = result.data () + offset + static_cast<std::size_t> (band) * band_rows * width * 3;
+                    details::ppm_rows (row_of (band), width, rows_of (band), out);
+                });
+            }
+            break;
+        }
+
+        return result;
+    }
+
+    inline bool write_file (native_path const & path, std::vector<char> const & bytes)
+    {
+        {
+            std::ofstream file (path, std::ios::binary | std::ios::trunc);
+            if (file.write (bytes.data (), static_cast<std::streamsize> (bytes.size ())))
+            {
+                return true;
+            }
+        }
+
+        details::remove_file (path);
+        return false;
+    }
+
+    inline bool write_image (
+            native_path const &         path
+        ,   image_format                format
+        ,   std::uint32_t const *       rgba
+        ,   unsigned int                width
+        ,   unsigned int                height
+        ,   image_options const &       options = image_options ()
+        )
+    {
+        return write_file (path, encode_image (format, rgba, width, height, options));
+    }
+
+    // Encodes an image as its rows arrive, for renders that finish bands out of order.
+    //  Encoded bands go to the sink in image order as soon as every band above them is
+    //  out, so a large render never holds the whole encoded image in memory.
+    struct image_stream
+    {
+        using ptr   = std::shared_ptr<image_stream>;
+        using sink  = std::function<bool (char const * data, std::size_t size)>;
+
+        static ptr create (
+                image_format            format
+            ,   unsigned int            width
+            ,   unsigned int            height
+            ,   image_options const &   options
+            ,   sink                    output
+            )
+        {
+            if (format >= image_format::count || width == 0 || height == 0 || !output)
+            {
+                return nullptr;
+            }
+
+            auto stream = ptr (new image_stream (format, width, height, options, std::move (output)));
+
+            stream->write (details::image_header (format, width, height, options));
+
+            return stream;
+        }
+
+        // Writes to path + ".part" and renames it to path once the last row is in, a stream
+        //  released before that removes the partial file
+        static ptr create_file (
+                native_path const &     path
+            ,   image_format            format
+            ,   unsigned int            width
+            ,   unsigned int            height
+            ,   image_options const &   options = image_options ()
+            )
+        {
+#ifdef _WIN32
+            auto const part = path + L".part";
+#else
+            auto const part = path + ".part";
+#endif
+
+            auto file = std::make_shared<std::ofstream> (part, std::ios::binary | std::ios::trunc);
+            if (!*file)
+            {
+                return nullptr;
+            }
+
+            auto stream = create (format, width, height, options, [file] (char const * data, std::size_t size)
+            {
+                return static_cast<bool> (file->write (data, static_cast<std::streamsize> (size)));
+            });
+            if (!stream)
+            {
+                file->close ();
+                details::remove_file (part);
+                return nullptr;
+            }
+
+            stream->m_path  = path;
+            stream->m_part  = part;
+            stream->m_file  = std::move (file);
+
+            return stream;
+        }
+
+        ~image_stream () noexcept
+        {
+            if (m_file)
+            {
+                m_file->close ();
+                details::remove_file (m_part);
+            }
+        }
+
+        image_stream (image_stream const &)             = delete;
+        image_stream & operator= (image_stream const &) = delete;
+
+        // Rows [first_row, first_row + rows) as rows * width pixels. The bands must tile
+        //  the image but may come in any order and from several threads at once. PNG and
+        //  PPM bands are encoded right away on the calling thread, QOI bands once every row
+        //  above them is in since each pixel is encoded relative to all before it.
+        //  Returns false once writing has failed.
+        bool put (unsigned int first_row, unsigned int rows, std::uint32_t const * rgba)
+        {
+            if (rows == 0 || first_row >= m_height || rows > m_height - first_row)
+            {
+                return false;
+            }
+
+            details::encoded_band band;
+            auto const pixels = static_cast<std::size_t> (rows) * m_width;
+            switch (m_format)
+            {
+            case image_format::png:
+                band = details::png_band (rgba, nullptr, m_width, rows, m_options);
+                break;
+            case image_format::ppm:
+                band.bytes.resize (pixels * 3);
+                details::ppm_rows (rgba, m_width, rows, band.bytes.data ());
+                break;
+            default:
+                band.bytes.resize (pixels * sizeof (std::uint32_t));
+                std::memcpy (band.bytes.data (), rgba, band.bytes.size ());
+                break;
+            }
+
+            std::lock_guard<std::mutex> lock (m_lock);
+            if (m_failed)
+            {
+                return false;
+            }
+
+            m_pending.emplace (first_row, std::make_pair (rows, std::move (band)));
+            flush ();
+
+            return !m_failed;
+        }
+
+        bool done () const noexcept
+        {
+            std::lock_guard<std::mutex> lock (m_lock);
+            return m_next_row == m_height && !m_failed;
+        }
+
+        bool failed () const noexcept
+        {
+            std::lock_guard<std::mutex> lock (m_lock);
+            return m_failed;
+        }
+
+        std::uint64_t bytes_written () const noexcept
+        {
+            std::lock_guard<std::mutex> lock (m_lock);
+            return m_written;
+        }
+
+    private:
+        image_stream (image_format format, unsigned int width, unsigned int height, image_options const & options, sink output)
+            :   m_format    (format)
+            ,   m_width     (width)
+            ,   m_height    (height)
+            ,   m_options   (options)
+            ,   m_output    (std::move (output))
+        {
+        }
+
+        bool write (std::vector<char> const & bytes)
+        {
+            m_failed    = m_failed || !m_output (bytes.data (), bytes.size ());
+            m_written   += bytes.size ();
+            return !m_failed;
+        }
+
+        // Lock held
+        void flush ()
+        {
+            for (auto next = m_pending.find (m_next_row); next != m_pending.end () && !m_failed; next = m_pending.find (m_next_row))
+            {
+                auto const rows = next->second.first;
+                auto & band     = next->second.second;
+
+                if (m_format == image_format::qoi)
+                {
+                    std::vector<char> encoded;
+                    encoded.reserve (band.bytes.size () / 4);
+                    auto const pixels = reinterpret_cast<std::uint32_t const *> (band.bytes.data ());
+                    details::qoi_band (m_qoi, pixels, static_cast<std::size_t> (rows) * m_width, m_options.alpha, encoded);
+                    band.bytes.swap (encoded);
+                }
+
+                m_adler = details::adler32_combine (m_adler, band.adler, band.raw);
+                write (band.bytes);
+
+                m_next_row += rows;
+                m_pending.erase (next);
+            }
+
+            if (m_next_row < m_height || m_failed)
+            {
+                return;
+            }
+
+            switch (m_format)
+            {
+            case image_format::png  : write (details::png_trailer (m_adler));   break;
+            case image_format::qoi  : write (details::qoi_trailer ());          break;
+            default                 :                                           break;
+            }
+
+            if (m_file)
+            {
+                m_file->close ();
+                m_failed = m_failed || !*m_file || !details::rename_file (m_part, m_path);
+                if (m_failed)
+                {
+                    details::remove_file (m_part);
+                }
+                m_file.reset ();
+            }
+        }
+
+        image_format const                                                      m_format            ;
+        unsigned int const                                                      m_width             ;
+        unsigned int const                                                      m_height            ;
+        image_options const                                                     m_options           ;
+        sink                                                                    m_output            ;
+
+        native_path                                                             m_path              ;
+        native_path                                                             m_part              ;
+        std::shared_ptr<std::ofstream>                                          m_file              ;
+
+        mutable std::mutex                                                      m_lock              ;
+        std::map<unsigned int, std::pair<unsigned int, details::encoded_band>>  m_pending           ;
+        unsigned int                                                            m_next_row  = 0     ;
+        std::uint32_t                                                           m_adler     = 1     ;
+        details::qoi_state                                                      m_qoi               ;
+        std::uint64_t                                                           m_written   = 0     ;
+        bool                                                                    m_failed    = false ;
+    };
+
+    struct image_writer_options
+    {
+        image_options   image               ;
+        // Frames waiting to be written before write blocks, bounds the memory held when
+        //  rendering outpaces encoding
+        unsigned int    queue_limit = 2     ;
+    };
+
+    // Encodes and writes finished frames on a thread of its own so a batch job renders the
+    //  next frame while the previous one is compressed
+    struct image_writer
+    {
+        using ptr = std::unique_ptr<image_writer>;
+
+        static ptr create (image_writer_options const & options = image_writer_options ())
+        {
+            return ptr (new image_writer (options));
+        }
+
+        ~image_writer () noexcept
+        {
+            {
+                std::lock_guard<std::mutex> lock (m_lock);
+                m_stopping = true;
+            }
+            m_changed.notify_all ();
+            m_thread.join ();
+        }
+
+        image_writer (image_writer const &)             = delete;
+        image_writer & operator= (image_writer const &) = delete;
+
+        void write (
+                native_path                 path
+            ,   image_format                format
+            ,   std::vector<std::uint32_t>  rgba
+            ,   unsigned int                width
+            ,   unsigned int                height
+            )
+        {
+            std::unique_lock<std::mutex> lock (m_lock);
+            m_changed.wait (lock, [this] () { return m_jobs.size () < std::max (m_options.queue_limit, 1U); });
+
+            m_jobs.push_back (job {std::move (path), format, std::move (rgba), width, height});
+            m_changed.notify_all ();
+        }
+
+        // Blocks until every frame handed to write is on disk
+        void wait ()
+        {
+            std::unique_lock<std::mutex> lock (m_lock);
+            m_changed.wait (lock, [this] () { return m_jobs.empty () && !m_busy; });
+        }
+
+        std::uint64_t written () const noexcept
+        {
+            std::lock_guard<std::mutex> lock (m_lock);
+            return m_written;
+        }
+
+        std::uint64_t failed () const noexcept
+        {
+            std::lock_guard<std::mutex> lock (m_lock);
+            return m_failed;
+        }
+
+    private:
+        struct job
+        {
+            native_path                 path    ;
+            image_format                format  ;
+            std::vector<std::uint32_t>  rgba    ;
+            unsigned int                width   ;
+            unsigned int                height  ;
+        };
+
+        explicit image_writer (image_writer_options const & options)
+            :   m_options (options)
+        {
+            m_thread = std::thread ([this] () { run (); });
+        }
+
+        void run ()
+        {
+            std::unique_lock<std::mutex> lock (m_lock);
+            for (;;)
+            {
+                m_changed.wait (lock, [this] () { return m_stopping || !m_jobs.empty (); });
+                if (m_jobs.empty ())
+                {
+                    return;
+                }
+
+                auto next = std::move (m_jobs.front ());
+                m_jobs.pop_front ();
+                m_busy = true;
+                m_changed.notify_all ();
+
+                lock.unlock ();
+                auto const ok = write_image (next.path, next.format, next.rgba.data (), next.width, next.height, m_options.image);
+                lock.lock ();
+
+                ++(ok ? m_written : m_failed);
+                m_busy = false;
+                m_changed.notify_all ();
+            }
+        }
+
+        image_writer_options const  m_options           ;
+
+        mutable std::mutex          m_lock              ;
+        std::condition_variable     m_changed           ;
+        std::deque<job>             m_jobs              ;
+        bool                        m_busy      = false ;
+        bool                        m_stopping  = false ;
+        std::uint64_t               m_written   = 0     ;
+        std::uint64_t               m_failed    = 0     ;
+        std::thread                 m_thread            ;
+    };
+
+    // Times each encoder on a colored frame, single band against parallel bands, then a
+    //  batch of frames rendered and written one after the other against the same batch
+    //  with writing overlapped with rendering. Frames go to scratch, which is removed.
+    inline void benchmark_image_encoders (
+            benchmark_report &                  report
+        ,   formula_view const &                view
+        ,   formula                             f
+        ,   std::vector<std::uint32_t> const &  colors
+        ,   native_path const &                 scratch
+        ,   unsigned int                        repeats = 3
+        )
+    {
+        auto const kernel = select_kernel (f, precision::float32);
+        if (!kernel)
+        {
+            return;
+        }
+
+        auto const pixels = static_cast<std::size_t> (view.width) * view.height;
+
+        auto const colorize = [&] (std::vector<std::uint32_t> & counts)
+        {
+            auto palette = cyclic_palette (colors, 0, view.iter);
+            for (auto & c : counts)
+            {
+                c = palette (c);
+            }
+        };
+
+        std::vector<std::uint32_t> frame (pixels);
+        render_formula (view, kernel, frame.data ());
+        colorize (frame);
+
+        auto const group = "image encoders " + std::to_string (view.width) + "x" + std::to_string (view.height);
+
+        struct variant
+        {
+            image_format    format      ;
+            unsigned int    band_rows   ;
+            char const *    name        ;
+        };
+
+        variant const variants[] =
+        {
+            {image_format::png, view.height , "png, one band"   },
+            {image_format::png, 64          , "png, 64 row bands"},
+            {image_format::qoi, view.height , "qoi, one band"   },
+            {image_format::qoi, 64          , "qoi, 64 row bands"},
+            {image_format::ppm, 64          , "ppm"             },
+        };
+
+        for (auto const & v : variants)
+        {
+            image_options options;
+            options.band_rows = v.band_rows;
+
+            std::size_t size = 0;
+            auto const ms = measure_ms (repeats, [&] ()
+            {
+                size = encode_image (v.format, frame.data (), view.width, view.height, options).size ();
+            });
+
+            char percent[32];
+            std::snprintf (percent, sizeof percent, ", %.1f%% of raw", 100.0 * size / (pixels * 3.0));
+            report.add (group, v.name + std::string (percent), ms, static_cast<double> (pixels));
+        }
+
+        // Every frame zooms in a little like a batch job rendering an animation
+        auto const frames   = 4U;
+        auto const render   = [&] (unsigned int i)
+        {
+            auto next = view;
+            next.zoom *= 1 + 0.1 * i;
+
+            std::vector<std::uint32_t> counts (pixels);
+            render_formula (next, kernel, counts.data ());
+            colorize (counts);
+            return counts;
+        };
+
+        auto const pipeline = "image pipeline, " + std::to_string (frames) + " png frames";
+
+        auto ms = measure_ms (1, [&] ()
+        {
+            for (auto i = 0U; i < frames; ++i)
+            {
+                auto const counts = render (i);
+                write_image (scratch, image_format::png, counts.data (), view.width, view.height);
+            }
+        });
+        report.add (pipeline, "render then write", ms, static_cast<double> (pixels * frames));
+
+        ms = measure_ms (1, [&] ()
+        {
+            auto writer = image_writer::create ();
+            for (auto i = 0U; i < frames; ++i)
+            {
+                writer->write (scratch, image_format::png, render (i), view.width, view.height);
+            }
+            writer->wait ();
+        });
+        report.add (pipeline, "write overlapped with render", ms, static_cast<double> (pixels * frames));
+
+        details::remove_file (scratch);
+    }
+}
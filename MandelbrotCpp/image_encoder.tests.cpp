@@ -0,0 +1,707 @@
+// ----------------------------------------------------------------------------------------------
+// Copyright (c) Mrten Rnge.
+// ----------------------------------------------------------------------------------------------
+// This source code is subject to terms and conditions of the Microsoft Public License. A
+// copy of the license can be found in the License.html file at the root of this distribution.
+// If you cannot locate the  Microsoft Public License, please send an email to
+// dlr@microsoft.com. By using this source code in any fashion, you are agreeing to be bound
+//  by the terms of the Microsoft Public License.
+// ----------------------------------------------------------------------------------------------
+// You must not remove this notice, or any other, from this software.
+// ----------------------------------------------------------------------------------------------
+
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "image_encoder.h"
+#include "tests.h"
+
+// Decodes what the encoders write with decoders of its own, written from the PNG, zlib,
+//  deflate and QOI specifications and sharing no code with the encoders, so a checksum
+//  or bit order mistake on both sides cannot cancel out.
+
+namespace
+{
+    using namespace fractal;
+
+    struct image_size
+    {
+        unsigned int    width   ;
+        unsigned int    height  ;
+    };
+
+    image_size const sizes[] =
+    {
+            {   1,   1 }
+        ,   {   1,  17 }
+        ,   {  33,   1 }
+        ,   {  61,  45 }
+        ,   { 300, 130 }
+    };
+
+    unsigned int const band_rows[] = { 0, 1, 7, 64 };
+
+    // Stretches that exercise every kind of encoding: gradients for small deltas, flat
+    //  areas for runs and matches, noise for literals and full pixels. Alpha varies too,
+    //  the encoders must drop it when it is not kept.
+    std::vector<std::uint32_t> test_image (unsigned int width, unsigned int height, unsigned int seed)
+    {
+        std::mt19937 random (seed);
+
+        std::vector<std::uint32_t> rgba (static_cast<std::size_t> (width) * height);
+        for (auto y = 0U; y < height; ++y)
+        {
+            for (auto x = 0U; x < width; ++x)
+            {
+                std::uint32_t c;
+                switch ((x / 16 + y / 8) % 4)
+                {
+                case 0  : c = (x * 3 & 0xFF) | (y * 5 & 0xFF) << 8 | ((x + y) & 0xFF) << 16 | 0xFF000000U;    break;
+                case 1  : c = 0xFF804020U;                                                                      break;
+                case 2  : c = static_cast<std::uint32_t> (random ());                                           break;
+                default : c = ((x + y) & 0xFF) * 0x010101U | (x * 17 & 0xFF) << 24;                             break;
+                }
+                rgba[static_cast<std::size_t> (y) * width + x] = c;
+            }
+        }
+        return rgba;
+    }
+
+    // What a decoder gives back, 0xAABBGGRR like the input
+    struct decoded_image
+    {
+        unsigned int                width   = 0 ;
+        unsigned int                height  = 0 ;
+        std::vector<std::uint32_t>  rgba        ;
+    };
+
+    bool matches (decoded_image const & image, std::vector<std::uint32_t> const & rgba, unsigned int width, unsigned int height, bool alpha)
+    {
+        if (image.width != width || image.height != height || image.rgba.size () != rgba.size ())
+        {
+            return false;
+        }
+
+        for (auto i = std::size_t (); i < rgba.size (); ++i)
+        {
+            if (image.rgba[i] != (alpha ? rgba[i] : rgba[i] | 0xFF000000U))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    std::uint32_t big_endian (unsigned char const * p)
+    {
+        return std::uint32_t (p[0]) << 24 | std::uint32_t (p[1]) << 16 | std::uint32_t (p[2]) << 8 | p[3];
+    }
+
+    std::uint32_t reference_crc32 (unsigned char const * data, std::size_t size)
+    {
+        auto crc = 0xFFFFFFFFU;
+        for (auto i = std::size_t (); i < size; ++i)
+        {
+            crc ^= data[i];
+            for (auto bit = 0; bit < 8; ++bit)
+            {
+                crc = crc & 1 ? (crc >> 1) ^ 0xEDB88320U : crc >> 1;
+            }
+        }
+        return ~crc;
+    }
+
+    std::uint32_t reference_adler32 (std::vector<unsigned char> const & data)
+    {
+        auto a = 1U;
+        auto b = 0U;
+        for (auto byte : data)
+        {
+            a = (a + byte) % 65521;
+            b = (b + a) % 65521;
+        }
+        return b << 16 | a;
+    }
+
+    // Inflate after the reference decoder in zlib's contrib/puff
+    struct inflater
+    {
+        struct huffman
+        {
+            std::uint16_t count[16]     ;
+            std::uint16_t symbol[288]   ;
+        };
+
+        inflater (unsigned char const * data, std::size_t size)
+            :   data    (data)
+            ,   size    (size)
+        {
+        }
+
+        unsigned int bits (unsigned int n)
+        {
+            auto value = bit_buffer;
+            while (bit_count < n)
+            {
+                CHECK (position < size);
+                value       |= std::uint32_t (data[position++]) << bit_count;
+                bit_count   += 8;
+            }
+            bit_buffer  = n < 32 ? value >> n : 0;
+            bit_count   -= n;
+            return value & ((std::uint32_t (1) << n) - 1);
+        }
+
+        void align ()
+        {
+            bit_buffer  = 0;
+            bit_count   = 0;
+        }
+
+        // Rejects over-subscribed codes and incomplete ones other than a single code,
+        //  what zlib's inflate rejects. The fixed distance code is incomplete by design.
+        static huffman build (std::uint8_t const * lengths, unsigned int n, bool complete = true)
+        {
+            huffman h {};
+            for (auto i = 0U; i < n; ++i)
+            {
+                ++h.count[lengths[i]];
+            }
+
+            auto left = 1;
+            for (auto length = 1; length < 16; ++length)
+            {
+                left = left * 2 - h.count[length];
+                CHECK (left >= 0);
+            }
+            CHECK (left == 0 || n - h.count[0] == 1 || !complete);
+
+            std::uint16_t offsets[16] {};
+            for (auto length = 1; length < 15; ++length)
+            {
+                offsets[length + 1] = offsets[length] + h.count[length];
+            }
+            for (auto i = 0U; i < n; ++i)
+            {
+                if (lengths[i] != 0)
+                {
+                    h.symbol[offsets[lengths[i]]++] = static_cast<std::uint16_t> (i);
+                }
+            }
+            return h;
+        }
+
+        unsigned int decode (huffman const & h)
+        {
+            auto code   = 0;
+            auto first  = 0;
+            auto index  = 0;
+            for (auto length = 1; length < 16; ++length)
+            {
+                code |= static_cast<int> (bits (1));
+                auto const count = h.count[length];
+                if (code - count < first)
+                {
+                    return h.symbol[index + code - first];
+                }
+                index   += count;
+                first   = (first + count) << 1;
+                code    <<= 1;
+            }
+            CHECK (!"code out of range");
+            return 0;
+        }
+
+        void codes (huffman const & lengths, huffman const & distances, std::vector<unsigned char> & out)
+        {
+            static std::uint16_t const length_base[]    = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+            static std::uint16_t const length_extra[]   = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+            static std::uint16_t const distance_base[]  = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+            static std::uint16_t const distance_extra[] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+            for (;;)
+            {
+                auto symbol = decode (lengths);
+                if (symbol < 256)
+                {
+                    out.push_back (static_cast<unsigned char> (symbol));
+                    continue;
+                }
+                if (symbol == 256)
+                {
+                    return;
+                }
+
+                symbol -= 257;
+                CHECK (symbol < 29);
+                auto const length = length_base[symbol] + bits (length_extra[symbol]);
+
+                symbol = decode (distances);
+                CHECK (symbol < 30);
+                auto const distance = distance_base[symbol] + bits (distance_extra[symbol]);
+                CHECK (distance <= out.size () && distance <= 32768);
+
+                for (auto i = 0U; i < length; ++i)
+                {
+                    out.push_back (out[out.size () - distance]);
+                }
+            }
+        }
+
+        void stored (std::vector<unsigned char> & out)
+        {
+            align ();
+            CHECK (position + 4 <= size);
+            auto const length   = data[position] | data[position + 1] << 8;
+            auto const inverse  = data[position + 2] | data[position + 3] << 8;
+            CHECK (length == (~inverse & 0xFFFF));
+            position += 4;
+
+            CHECK (position + length <= size);
+            out.insert (out.end (), data + position, data + position + length);
+            position += length;
+        }
+
+        void fixed (std::vector<unsigned char> & out)
+        {
+            std::uint8_t lengths[288];
+            std::fill (lengths      , lengths + 144 , 8);
+            std::fill (lengths + 144, lengths + 256 , 9);
+            std::fill (lengths + 256, lengths + 280 , 7);
+            std::fill (lengths + 280, lengths + 288 , 8);
+
+            std::uint8_t distances[30];
+            std::fill (distances, distances + 30, 5);
+
+            codes (build (lengths, 288), build (distances, 30, false), out);
+        }
+
+        void dynamic (std::vector<unsigned char> & out)
+        {
+            static std::uint8_t const order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+            auto const literals     = bits (5) + 257;
+            auto const distances    = bits (5) + 1;
+            auto const code_lengths = bits (4) + 4;
+            CHECK (literals <= 286 && distances <= 30);
+
+            std::uint8_t lengths[320] {};
+            for (auto i = 0U; i < code_lengths; ++i)
+            {
+                lengths[order[i]] = static_cast<std::uint8_t> (bits (3));
+            }
+            auto const length_code = build (lengths, 19);
+
+            std::fill (lengths, lengths + 19, 0);
+            for (auto i = 0U; i < literals + distances;)
+            {
+                auto const symbol = decode (length_code);
+                if (symbol < 16)
+                {
+                    lengths[i++] = static_cast<std::uint8_t> (symbol);
+                    continue;
+                }
+
+                auto value  = std::uint8_t (0);
+                auto repeat = 0U;
+                if (symbol == 16)
+                {
+                    CHECK (i > 0);
+                    value   = lengths[i - 1];
+                    repeat  = 3 + bits (2);
+                }
+                else if (symbol == 17)
+                {
+                    repeat  = 3 + bits (3);
+                }
+                else
+                {
+                    repeat  = 11 + bits (7);
+                }
+                CHECK (i + repeat <= literals + distances);
+                while (repeat-- > 0)
+                {
+                    lengths[i++] = value;
+                }
+            }
+            CHECK (lengths[256] != 0);
+
+            codes (build (lengths, literals), build (lengths + literals, distances), out);
+        }
+
+        // Every block up to and including the final one
+        std::vector<unsigned char> run ()
+        {
+            std::vector<unsigned char> out;
+            for (auto last = 0U; last == 0;)
+            {
+                last = bits (1);
+                switch (bits (2))
+                {
+                case 0  : stored (out);     break;
+                case 1  : fixed (out);      break;
+                case 2  : dynamic (out);    break;
+                default : CHECK (!"reserved block type");
+                }
+            }
+            align ();
+            return out;
+        }
+
+        unsigned char const *   data            ;
+        std::size_t             size            ;
+        std::size_t             position    = 0 ;
+        std::uint32_t           bit_buffer  = 0 ;
+        unsigned int            bit_count   = 0 ;
+    };
+
+    int reference_paeth (int a, int b, int c)
+    {
+        auto const p    = a + b - c;
+        auto const pa   = std::abs (p - a);
+        auto const pb   = std::abs (p - b);
+        auto const pc   = std::abs (p - c);
+        return pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+    }
+
+    decoded_image decode_png (std::vector<char> const & file)
+    {
+        auto const bytes    = reinterpret_cast<unsigned char const *> (file.data ());
+        auto const size     = file.size ();
+
+        static unsigned char const signature[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+        CHECK (size >= 8 && std::equal (bytes, bytes + 8, signature));
+
+        decoded_image image;
+        auto channels = 0U;
+        std::vector<unsigned char> compressed;
+
+        auto ended = false;
+        for (auto p = std::size_t (8); !ended;)
+        {
+            CHECK (p + 12 <= size);
+            auto const length = big_endian (bytes + p);
+            CHECK (p + 12 + length <= size);
+
+            auto const type = std::string (bytes + p + 4, bytes + p + 8);
+            auto const body = bytes + p + 8;
+            CHECK (big_endian (body + length) == reference_crc32 (bytes + p + 4, length + 4));
+
+            if (type == "IHDR")
+            {
+                CHECK (p == 8 && length == 13);
+                image.width     = big_endian (body);
+                image.height    = big_endian (body + 4);
+                CHECK (body[8] == 8 && (body[9] == 2 || body[9] == 6) && body[10] == 0 && body[11] == 0 && body[12] == 0);
+                channels = body[9] == 6 ? 4 : 3;
+            }
+            else if (type == "IDAT")
+            {
+                compressed.insert (compressed.end (), body, body + length);
+            }
+            else
+            {
+                CHECK (type == "IEND" && length == 0);
+                ended = true;
+            }
+
+            p += 12 + length;
+            CHECK (!ended || p == size);
+        }
+        CHECK (channels != 0);
+
+        // zlib: deflate with a 32K window, no dictionary, a valid check value
+        CHECK (compressed.size () >= 6);
+        CHECK ((compressed[0] & 0x0F) == 8 && (compressed[0] >> 4) <= 7);
+        CHECK ((compressed[0] << 8 | compressed[1]) % 31 == 0 && !(compressed[1] & 0x20));
+
+        inflater inflate (compressed.data () + 2, compressed.size () - 2);
+        auto const filtered = inflate.run ();
+        CHECK (inflate.position + 4 == inflate.size);
+        CHECK (big_endian (inflate.data + inflate.position) == reference_adler32 (filtered));
+
+        auto const stride = static_cast<std::size_t> (image.width) * channels;
+        CHECK (filtered.size () == (stride + 1) * image.height);
+
+        std::vector<unsigned char> previous (stride);
+        std::vector<unsigned char> current  (stride);
+        image.rgba.resize (static_cast<std::size_t> (image.width) * image.height);
+        for (auto y = 0U; y < image.height; ++y)
+        {
+            auto const row      = filtered.data () + y * (stride + 1);
+            auto const filter   = row[0];
+            CHECK (filter <= 4);
+
+            for (auto i = std::size_t (); i < stride; ++i)
+            {
+                auto const a = i >= channels ? current[i - channels] : 0;
+                auto const b = previous[i];
+                auto const c = i >= channels ? previous[i - channels] : 0;
+
+                auto predicted = 0;
+                switch (filter)
+                {
+                case 1  : predicted = a;                            break;
+                case 2  : predicted = b;                            break;
+                case 3  : predicted = (a + b) / 2;                  break;
+                case 4  : predicted = reference_paeth (a, b, c);    break;
+                default :                                           break;
+                }
+                current[i] = static_cast<unsigned char> (row[1 + i] + predicted);
+            }
+
+            for (auto x = 0U; x < image.width; ++x)
+            {
+                auto const pixel = current.data () + x * channels;
+                image.rgba[static_cast<std::size_t> (y) * image.width + x] =
+                        std::uint32_t (pixel[0])
+                    |   std::uint32_t (pixel[1]) << 8
+                    |   std::uint32_t (pixel[2]) << 16
+                    |   (channels == 4 ? std::uint32_t (pixel[3]) << 24 : 0xFF000000U)
+                    ;
+            }
+            current.swap (previous);
+        }
+
+        return image;
+    }
+
+    decoded_image decode_qoi (std::vector<char> const & file)
+    {
+        auto const bytes    = reinterpret_cast<unsigned char const *> (file.data ());
+        auto const size     = file.size ();
+
+        CHECK (size >= 14 + 8 && std::equal (bytes, bytes + 4, "qoif"));
+
+        decoded_image image;
+        image.width     = big_endian (bytes + 4);
+        image.height    = big_endian (bytes + 8);
+        CHECK ((bytes[12] == 3 || bytes[12] == 4) && bytes[13] <= 1);
+
+        auto const end = size - 8;
+        CHECK (std::equal (bytes + end, bytes + size, "\0\0\0\0\0\0\0\1"));
+
+        std::uint32_t index[64] {};
+        auto pixel  = 0xFF000000U;
+        auto run    = 0U;
+        auto p      = std::size_t (14);
+
+        image.rgba.resize (static_cast<std::size_t> (image.width) * image.height);
+        for (auto & out : image.rgba)
+        {
+            if (run > 0)
+            {
+                --run;
+                out = pixel;
+                continue;
+            }
+
+            CHECK (p < end);
+            auto const tag = bytes[p++];
+
+            auto r = pixel & 0xFF;
+            auto g = pixel >> 8 & 0xFF;
+            auto b = pixel >> 16 & 0xFF;
+            auto a = pixel >> 24;
+
+            if (tag == 0xFE || tag == 0xFF)
+            {
+                CHECK (p + (tag == 0xFF ? 4 : 3) <= end);
+                r = bytes[p++];
+                g = bytes[p++];
+                b = bytes[p++];
+                a = tag == 0xFF ? bytes[p++] : a;
+            }
+            else if ((tag & 0xC0) == 0x00)
+            {
+                r = index[tag] & 0xFF;
+                g = index[tag] >> 8 & 0xFF;
+                b = index[tag] >> 16 & 0xFF;
+                a = index[tag] >> 24;
+            }
+            else if ((tag & 0xC0) == 0x40)
+            {
+                r += (tag >> 4 & 3) - 2;
+                g += (tag >> 2 & 3) - 2;
+                b += (tag & 3) - 2;
+            }
+            else if ((tag & 0xC0) == 0x80)
+            {
+                CHECK (p < end);
+                auto const second   = bytes[p++];
+                auto const dg       = (tag & 0x3F) - 32U;
+                r += dg - 8 + (second >> 4);
+                g += dg;
+                b += dg - 8 + (second & 0x0F);
+            }
+            else
+            {
+                run = tag & 0x3F;
+            }
+
+            pixel = (r & 0xFF) | (g & 0xFF) << 8 | (b & 0xFF) << 16 | (a & 0xFF) << 24;
+            index[((pixel & 0xFF) * 3 + (pixel >> 8 & 0xFF) * 5 + (pixel >> 16 & 0xFF) * 7 + (pixel >> 24) * 11) % 64] = pixel;
+            out = pixel;
+        }
+        CHECK (run == 0 && p == end);
+
+        return image;
+    }
+
+    decoded_image decode_ppm (std::vector<char> const & file)
+    {
+        decoded_image image;
+        auto header = 0;
+        CHECK (std::sscanf (std::string (file.begin (), file.end ()).c_str (), "P6\n%u %u\n255\n%n", &image.width, &image.height, &header) == 2);
+        CHECK (header > 0 && file[header - 1] == '\n');
+
+        auto const pixels = static_cast<std::size_t> (image.width) * image.height;
+        CHECK (file.size () == header + pixels * 3);
+
+        auto const bytes = reinterpret_cast<unsigned char const *> (file.data ()) + header;
+        image.rgba.resize (pixels);
+        for (auto i = std::size_t (); i < pixels; ++i)
+        {
+            image.rgba[i] = bytes[i * 3] | bytes[i * 3 + 1] << 8 | bytes[i * 3 + 2] << 16 | 0xFF000000U;
+        }
+        return image;
+    }
+
+    decoded_image decode (image_format format, std::vector<char> const & file)
+    {
+        switch (format)
+        {
+        case image_format::png  : return decode_png (file);
+        case image_format::qoi  : return decode_qoi (file);
+        default                 : return decode_ppm (file);
+        }
+    }
+
+    image_format const every_format[] = { image_format::png, image_format::qoi, image_format::ppm };
+
+    FRACTAL_TEST (image_encoder_round_trips)
+    {
+        for (auto format : every_format)
+        {
+            for (auto alpha : {false, true})
+            {
+                for (auto const & size : sizes)
+                {
+                    auto const rgba = test_image (size.width, size.height, size.width + size.height);
+                    for (auto rows : band_rows)
+                    {
+                        image_options options;
+                        options.alpha       = alpha ;
+                        options.band_rows   = rows  ;
+
+                        auto const file = encode_image (format, rgba.data (), size.width, size.height, options);
+                        CHECK (matches (decode (format, file), rgba, size.width, size.height, alpha && format != image_format::ppm));
+                    }
+                }
+            }
+        }
+    }
+
+    // Long stretches of one color, runs past QOI's 62 and matches past the 32K window
+    FRACTAL_TEST (image_encoder_round_trips_flat_images)
+    {
+        unsigned int const width    = 512;
+        unsigned int const height   = 300;
+
+        std::vector<std::uint32_t> rgba (width * height, 0xFF102030U);
+        for (auto i = std::size_t (); i < rgba.size (); i += 40000)
+        {
+            rgba[i] = 0x80FFFFFFU;
+        }
+
+        for (auto format : every_format)
+        {
+            image_options options;
+            options.alpha = true;
+
+            auto const file = encode_image (format, rgba.data (), width, height, options);
+            CHECK (matches (decode (format, file), rgba, width, height, format != image_format::ppm));
+        }
+    }
+
+    // Bands are put in shuffled order from several threads at once, the file must be the
+    //  image in order all the same
+    FRACTAL_TEST (image_stream_encodes_bands_out_of_order)
+    {
+        unsigned int const  width       = 61;
+        unsigned int const  height      = 45;
+        unsigned int const  rows        = 7;
+        unsigned int const  threads     = 3;
+
+        auto const rgba = test_image (width, height, 42);
+
+        std::vector<unsigned int> first_rows;
+        for (auto row = 0U; row < height; row += rows)
+        {
+            first_rows.push_back (row);
+        }
+
+        std::mt19937 random (7);
+        for (auto format : every_format)
+        {
+            for (auto alpha : {false, true})
+            {
+                image_options options;
+                options.alpha = alpha;
+
+                // The sink is only called with the stream's lock held
+                std::vector<char> file;
+                auto stream = image_stream::create (format, width, height, options, [&file] (char const * data, std::size_t size)
+                {
+                    file.insert (file.end (), data, data + size);
+                    return true;
+                });
+                CHECK (stream);
+
+                std::shuffle (first_rows.begin (), first_rows.end (), random);
+
+                std::vector<std::thread> workers;
+                for (auto t = 0U; t < threads; ++t)
+                {
+                    workers.emplace_back ([&, t] ()
+                    {
+                        for (auto i = t; i < first_rows.size (); i += threads)
+                        {
+                            auto const first = first_rows[i];
+                            stream->put (first, std::min (rows, height - first), rgba.data () + static_cast<std::size_t> (first) * width);
+                        }
+                    });
+                }
+                for (auto & worker : workers)
+                {
+                    worker.join ();
+                }
+
+                CHECK (stream->done ());
+                CHECK (stream->bytes_written () == file.size ());
+                CHECK (matches (decode (format, file), rgba, width, height, alpha && format != image_format::ppm));
+            }
+        }
+    }
+
+    FRACTAL_TEST (image_stream_rejects_bands_outside_the_image)
+    {
+        auto stream = image_stream::create (image_format::ppm, 4, 4, image_options (), [] (char const *, std::size_t)
+        {
+            return true;
+        });
+        CHECK (stream);
+
+        std::vector<std::uint32_t> const rgba (4 * 4);
+        CHECK (!stream->put (4, 1, rgba.data ()));
+        CHECK (!stream->put (2, 3, rgba.data ()));
+        CHECK (!stream->put (0, 0, rgba.data ()));
+        CHECK (!stream->done ());
+    }
+}
@@ -0,0 +1,505 @@
+// ----------------------------------------------------------------------------------------------
+// Copyright (c) Mrten Rnge.
+// ----------------------------------------------------------------------------------------------
+// This source code is subject to terms and conditions of the Microsoft Public License. A
+// copy of the license can be found in the License.html file at the root of this distribution.
+// If you cannot locate the  Microsoft Public License, please send an email to
+// dlr@microsoft.com. By using this source code in any fashion, you are agreeing to be bound
+//  by the terms of the Microsoft Public License.
+// ----------------------------------------------------------------------------------------------
+// You must not remove this notice, or any other, from this software.
+// ----------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "benchmark.h"
+#include "escape_time.h"
+#include "formulas.h"
+#include "palette.h"
+
+namespace fractal
+{
+    struct inverse_julia_options
+    {
+        unsigned int    width       = 512   ;
+        unsigned int    height      = 512   ;
+        double          center_x    = 0     ;
+        double          center_y    = 0     ;
+        double          zoom        = 0.25  ;
+        // Preimages landing on a pixel hit this often are not expanded further
+        unsigned int    hit_limit   = 2     ;
+        // Preimages are not expanded past this depth, the bound for points that never
+        //  settle on a pixel
+        unsigned int    max_depth   = 64    ;
+        // 0 runs a walker per core
+        unsigned int    workers     = 0     ;
+    };
+
+    // Julia set boundary of z*z + c by the modified inverse iteration method. Backward
+    //  orbits z -> +-sqrt (z - c) from the repelling fixed point converge onto the Julia
+    //  set, the tree of preimages is walked depth first and a branch is cut once its pixel
+    //  has been hit hit_limit times. Only boundary pixels are ever touched, so a preview
+    //  costs a small fraction of escape time, which runs every pixel to its limit.
+    //
+    //  The first levels of the tree are split between walkers that share one grid of hit
+    //  counts, so a branch is cut once any walker covered its pixel. With a grid each they
+    //  would every one walk the whole boundary. Preimages outside the view are cut on a
+    //  coarse shared grid covering the whole set instead, otherwise a zoomed in view would
+    //  expand every branch that leaves it down to max_depth.
+    struct inverse_julia
+    {
+        using ptr = std::unique_ptr<inverse_julia>;
+
+        static ptr create (inverse_julia_options const & options)
+        {
+            if (options.width == 0 || options.height == 0 || !(options.zoom > 0) || options.hit_limit == 0 || options.hit_limit > 255)
+            {
+                return nullptr;
+            }
+
+            ptr result (new inverse_julia (options));
+
+            auto & o = result->m_options;
+            if (o.workers == 0)
+            {
+                o.workers = std::thread::hardware_concurrency ();
+                o.workers = o.workers == 0 ? 1 : o.workers;
+            }
+
+            auto const pixels = static_cast<std::size_t> (o.width) * o.height;
+
+            result->m_view = make_viewport (o.center_x, o.center_y, o.zoom, o.width, o.height);
+            result->m_hits.assign (pixels, 0);
+            result->m_shared_hits.reset (new std::atomic<std::uint8_t>[pixels]);
+            result->m_outside.reset (new std::atomic<std::uint16_t>[static_cast<std::size_t> (outside_size) * outside_size]);
+            result->m_walkers.resize (o.workers);
+
+            return result;
+        }
+
+        inverse_julia_options const & options () const noexcept
+        {
+            return m_options;
+        }
+
+        // Moves the view of the next render without reallocating anything, false for a
+        //  zoom create would refuse
+        bool set_view (double center_x, double center_y, double zoom) noexcept
+        {
+            if (!(zoom > 0))
+            {
+                return false;
+            }
+
+            m_options.center_x  = center_x;
+            m_options.center_y  = center_y;
+            m_options.zoom      = zoom;
+            m_view              = make_viewport (center_x, center_y, zoom, m_options.width, m_options.height);
+            return true;
+        }
+
+        // Draws the Julia set of c into hits, replacing the last one
+        void render (double cx, double cy)
+        {
+            auto const before = std::chrono::steady_clock::now ();
+
+            // Every point of the set is within max (2, |c|) of the origin
+            m_radius = std::fmax (2.0, std::sqrt (cx * cx + cy * cy));
+
+            // The repelling one of the two fixed points 1/2 +- sqrt (1/4 - c), |2z| > 1
+            auto rx = 0.0;
+            auto ry = 0.0;
+            complex_sqrt (0.25 - cx, -cy, rx, ry);
+            auto const a = (0.5 + rx) * (0.5 + rx) + ry * ry;
+            auto const b = (0.5 - rx) * (0.5 - rx) + ry * ry;
+            auto const fixed = a >= b ? point {0.5 + rx, ry, 0} : point {0.5 - rx, -ry, 0};
+
+            // Enough seeds a few levels down that the walkers stay busy however the
+            //  subtrees differ in size
+            std::vector<point> seeds {fixed};
+            while (seeds.size () < m_options.workers * 16U && seeds.front ().depth < m_options.max_depth)
+            {
+                std::vector<point> next;
+                next.reserve (seeds.size () * 2);
+                for (auto const & seed : seeds)
+                {
+                    auto sx = 0.0;
+                    auto sy = 0.0;
+                    complex_sqrt (seed.x - cx, seed.y - cy, sx, sy);
+                    next.push_back (point { sx,  sy, seed.depth + 1});
+                    next.push_back (point {-sx, -sy, seed.depth + 1});
+                }
+                seeds.swap (next);
+            }
+
+            clear ();
+
+            auto const workers = m_options.workers;
+            parallel_for_rows (workers, [&] (unsigned int index)
+            {
+                auto & walker = m_walkers[index];
+                walker.points = 0;
+
+                for (auto seed = index; seed < seeds.size (); seed += workers)
+                {
+                    walk (walker, seeds[seed], cx, cy);
+                }
+            });
+
+            merge ();
+
+            m_points = 0;
+            for (auto const & walker : m_walkers)
+            {
+                m_points += walker.points;
+            }
+            m_ms = std::chrono::duration<double, std::milli> (std::chrono::steady_clock::now () - before).count ();
+        }
+
+        // Per pixel hits, 0 off the boundary
+        std::vector<std::uint16_t> const & hits () const noexcept
+        {
+            return m_hits;
+        }
+
+        // Preimages visited by the last render
+        std::uint64_t points () const noexcept
+        {
+            return m_points;
+        }
+
+        double render_ms () const noexcept
+        {
+            return m_ms;
+        }
+
+        // Boundary pixels in ink, the rest in paper
+        void to_pixels (std::uint32_t * rgba, std::uint32_t ink, std::uint32_t paper = opaque_black) const
+        {
+            auto const width = m_options.width;
+
+            parallel_for_rows (m_options.height, [&] (unsigned int y)
+            {
+                auto const row = static_cast<std::size_t> (y) * width;
+                for (auto x = 0U; x < width; ++x)
+                {
+                    rgba[row + x] = m_hits[row + x] > 0 ? ink : paper;
+                }
+            });
+        }
+
+    private:
+        // Cells per side of the grid cutting preimages outside the view
+        static unsigned int const outside_size = 512;
+
+        struct point
+        {
+            double          x       ;
+            double          y       ;
+            unsigned int    depth   ;
+        };
+
+        struct walker_state
+        {
+            std::vector<point>          stack           ;
+            std::uint64_t               points      = 0 ;
+        };
+
+        explicit inverse_julia (inverse_julia_options const & options)
+            :   m_options (options)
+        {
+        }
+
+        inverse_julia (inverse_julia const &)             = delete;
+        inverse_julia& operator= (inverse_julia const &)  = delete;
+
+        // Principal square root, the other one is its negation
+        static inline void complex_sqrt (double x, double y, double & rx, double & ry) noexcept
+        {
+            auto const r = std::sqrt (x * x + y * y);
+            rx = std::sqrt (std::fmax (0.0, (r + x) * 0.5));
+            ry = std::copysign (std::sqrt (std::fmax (0.0, (r - x) * 0.5)), y);
+        }
+
+        // Counts one more hit on a cell of a shared grid unless it already has limit, in
+        //  which case the branch is cut. Plain relaxed loads and stores, no read-modify-
+        //  write: two walkers racing on a cell lose a count, which only costs a few extra
+        //  points, and the count never passes the limit.
+        template<typename T>
+        static inline bool take_hit (std::atomic<T> & hit, T limit) noexcept
+        {
+            auto const seen = hit.load (std::memory_order_relaxed);
+            if (seen >= limit)
+            {
+                return false;
+            }
+
+            hit.store (static_cast<T> (seen + 1), std::memory_order_relaxed);
+            return true;
+        }
+
+        void walk (walker_state & walker, point const & seed, double cx, double cy) const
+        {
+            auto const width        = m_options.width;
+            auto const height       = m_options.height;
+            auto const limit        = static_cast<std::uint8_t> (m_options.hit_limit);
+            auto const max_depth    = m_options.max_depth;
+            auto const inv_x        = 1 / m_view.step_x;
+            auto const inv_y        = 1 / m_view.step_y;
+            auto const cell         = outside_size / (2 * m_radius);
+
+            // A boundary crossing a coarse cell crosses about as many pixels as fit along
+            //  its side, the cell takes as many hits before it cuts
+            auto const pixels_per_cell  = std::ceil (1 / (cell * m_view.step_y));
+            auto const outside_limit    = static_cast<std::uint16_t> (std::fmin (limit * std::fmax (pixels_per_cell, 1.0), 65535.0));
+
+            auto & stack = walker.stack;
+            stack.clear ();
+            stack.push_back (seed);
+
+            auto points = std::uint64_t ();
+            while (!stack.empty ())
+            {
+                auto const p = stack.back ();
+                stack.pop_back ();
+                ++points;
+
+                // Nearest pixel, the way the escape time kernels sample pixel corners
+                auto const px = std::floor ((p.x - m_view.origin_x) * inv_x + 0.5);
+                auto const py = std::floor ((p.y - m_view.origin_y) * inv_y + 0.5);
+
+                if (px >= 0 && py >= 0 && px < width && py < height)
+                {
+                    if (!take_hit (m_shared_hits[static_cast<std::size_t> (py) * width + static_cast<std::size_t> (px)], limit))
+                    {
+                        continue;
+                    }
+                }
+                else
+                {
+                    auto const ox = static_cast<int> ((p.x + m_radius) * cell);
+                    auto const oy = static_cast<int> ((p.y + m_radius) * cell);
+                    if (ox < 0 || oy < 0 || ox >= static_cast<int> (outside_size) || oy >= static_cast<int> (outside_size))
+                    {
+                        continue;
+                    }
+
+                    if (!take_hit (m_outside[static_cast<std::size_t> (oy) * outside_size + static_cast<std::size_t> (ox)], outside_limit))
+                    {
+                        continue;
+                    }
+                }
+
+                if (p.depth >= max_depth)
+                {
+                    continue;
+                }
+
+                auto sx = 0.0;
+                auto sy = 0.0;
+                complex_sqrt (p.x - cx, p.y - cy, sx, sy);
+                stack.push_back (point { sx,  sy, p.depth + 1});
+                stack.push_back (point {-sx, -sy, p.depth + 1});
+            }
+
+            walker.points += points;
+        }
+
+        void clear ()
+        {
+            auto const width = m_options.width;
+
+            parallel_for_rows (m_options.height, [&] (unsigned int y)
+            {
+                auto const begin = static_cast<std::size_t> (y) * width;
+                for (auto i = begin; i < begin + width; ++i)
+                {
+                    m_shared_hits[i].store (0, std::memory_order_relaxed);
+                }
+            });
+
+            for (auto i = std::size_t (); i < static_cast<std::size_t> (outside_size) * outside_size; ++i)
+            {
+                m_outside[i].store (0, std::memory_order_relaxed);
+            }
+        }
+
+        void merge ()
+        {
+            auto const width = m_options.width;
+
+            parallel_for_rows (m_options.height, [&] (unsigned int y)
+            {
+                auto const begin = static_cast<std::size_t> (y) * width;
+                for (auto i = begin; i < begin + width; ++i)
+                {
+                    m_hits[i] = m_shared_hits[i].load (std::memory_order_relaxed);
+                }
+            });
+        }
+
+        inverse_julia_options       m_options               ;
+        viewport<double>            m_view                  ;
+        std::vector<std::uint16_t>  m_hits                  ;
+        // Shared by the walkers, in the view and on the coarse grid around it
+        std::unique_ptr<std::atomic<std::uint8_t>[]>   m_shared_hits   ;
+        std::unique_ptr<std::atomic<std::uint16_t>[]>  m_outside       ;
+        std::vector<walker_state>   m_walkers               ;
+        double                      m_radius        = 2     ;
+        std::uint64_t               m_points        = 0     ;
+        double                      m_ms            = 0     ;
+    };
+
+    // Escape time of a Julia view against its inverse iteration boundary. Quality is the
+    //  share of boundary pixels within two pixels of one the escape time rendering puts on
+    //  the boundary: next to the interior or escaping only after iter / 32 steps.
+    inline void benchmark_inverse_julia (
+            benchmark_report &      report
+        ,   formula_view const &    view
+        ,   unsigned int            repeats = 3
+        )
+    {
+        auto const kernel = select_kernel (formula::mandelbrot2, precision::float32);
+        if (!kernel)
+        {
+            return;
+        }
+
+        auto const width    = view.width;
+        auto const height   = view.height;
+        auto const pixels   = static_cast<std::size_t> (width) * height;
+
+        std::vector<std::uint32_t> counts (pixels);
+
+        auto julia  = view;
+        julia.julia = true;
+
+        auto const group = "julia preview " + std::to_string (width) + "x" + std::to_string (height);
+
+        auto ms = measure_ms (repeats, [&] ()
+        {
+            render_formula (julia, kernel, counts.data ());
+        });
+        report.add (group, "escape time, " + std::to_string (view.iter) + " iterations", ms, static_cast<double> (pixels));
+
+        inverse_julia_options options;
+        options.width       = width         ;
+        options.height      = height        ;
+        options.center_x    = view.center_x ;
+        options.center_y    = view.center_y ;
+        options.zoom        = view.zoom     ;
+
+        auto engine = inverse_julia::create (options);
+        if (!engine)
+        {
+            return;
+        }
+
+        ms = measure_ms (repeats, [&] ()
+        {
+            engine->render (view.param_x, view.param_y);
+        });
+
+        auto const reference = [&] (unsigned int x, unsigned int y)
+        {
+            auto const count = counts[static_cast<std::size_t> (y) * width + x];
+            if (count >= view.iter / 32 && count < view.iter)
+            {
+                return true;
+            }
+
+            if (count < view.iter)
+            {
+                return false;
+            }
+
+            // Interior next to an escaping pixel
+            for (auto dy = -1; dy <= 1; ++dy)
+            {
+                for (auto dx = -1; dx <= 1; ++dx)
+                {
+                    auto const nx = static_cast<int> (x) + dx;
+                    auto const ny = static_cast<int> (y) + dy;
+                    if (nx >= 0 && ny >= 0 && nx < static_cast<int> (width) && ny < static_cast<int> (height)
+                        && counts[static_cast<std::size_t> (ny) * width + nx] < view.iter)
+                    {
+                        return true;
+                    }
+                }
+            }
+            return false;
+        };
+
+        auto const & hits = engine->hits ();
+        auto boundary   = std::size_t ();
+        auto near       = std::size_t ();
+        for (auto y = 0U; y < height; ++y)
+        {
+            for (auto x = 0U; x < width; ++x)
+            {
+                if (hits[static_cast<std::size_t> (y) * width + x] == 0)
+                {
+                    continue;
+                }
+                ++boundary;
+
+                auto found = false;
+                for (auto dy = -2; dy <= 2 && !found; ++dy)
+                {
+                    for (auto dx = -2; dx <= 2 && !found; ++dx)
+                    {
+                        auto const nx = static_cast<int> (x) + dx;
+                        auto const ny = static_cast<int> (y) + dy;
+                        found = nx >= 0 && ny >= 0 && nx < static_cast<int> (width) && ny < static_cast<int> (height)
+                            && reference (static_cast<unsigned int> (nx), static_cast<unsigned int> (ny));
+                    }
+                }
+                near += found ? 1 : 0;
+            }
+        }
+
+        char name[96];
+        std::snprintf (
+                name
+            ,   sizeof (name)
+            ,   "inverse iteration, %.2f%% on boundary, %.1f%% near"
+            ,   100.0 * boundary / pixels
+            ,   boundary > 0 ? 100.0 * near / boundary : 0.0
+            );
+        report.add (group, name, ms, static_cast<double> (pixels));
+
+        // The walkers share the cut, so more of them split the boundary instead of each
+        //  walking all of it: points visited should stay flat while wall time drops
+        auto const cores    = std::max (std::thread::hardware_concurrency (), 1U);
+        auto const scaling  = "julia preview walkers " + std::to_string (width) + "x" + std::to_string (height);
+        for (auto workers = 1U; workers <= std::max (cores, 8U); workers *= 2)
+        {
+            options.workers = workers;
+
+            auto walkers = inverse_julia::create (options);
+            ms = measure_ms (repeats, [&] ()
+            {
+                walkers->render (view.param_x, view.param_y);
+            });
+
+            report.add (
+                    scaling
+                ,   std::to_string (workers) + " walkers, " + std::to_string (walkers->points ()) + " points"
+                ,   ms
+                ,   static_cast<double> (walkers->points ())
+                );
+        }
+    }
+}
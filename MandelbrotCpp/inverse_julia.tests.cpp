@@ -0,0 +1,79 @@
+// ----------------------------------------------------------------------------------------------
+// Copyright (c) Mrten Rnge.
+// ----------------------------------------------------------------------------------------------
+// This source code is subject to terms and conditions of the Microsoft Public License. A
+// copy of the license can be found in the License.html file at the root of this distribution.
+// If you cannot locate the  Microsoft Public License, please send an email to
+// dlr@microsoft.com. By using this source code in any fashion, you are agreeing to be bound
+//  by the terms of the Microsoft Public License.
+// ----------------------------------------------------------------------------------------------
+// You must not remove this notice, or any other, from this software.
+// ----------------------------------------------------------------------------------------------
+
+
+#include <cstdint>
+#include <vector>
+
+#include "inverse_julia.h"
+#include "tests.h"
+
+namespace
+{
+    using namespace fractal;
+
+    inverse_julia_options preview_options (unsigned int workers)
+    {
+        inverse_julia_options options;
+        options.width       = 256   ;
+        options.height      = 192   ;
+        options.zoom        = 0.3   ;
+        options.workers     = workers;
+        return options;
+    }
+
+    // With a grid each every walker covered the whole boundary, so the points visited
+    //  grew with the walker count
+    FRACTAL_TEST (inverse_julia_walkers_share_the_work)
+    {
+        auto single = inverse_julia::create (preview_options (1));
+        auto shared = inverse_julia::create (preview_options (8));
+        CHECK (single && shared);
+
+        single->render (-0.8, 0.156);
+        shared->render (-0.8, 0.156);
+
+        CHECK (single->points () > 0);
+        CHECK (shared->points () < 2 * single->points ());
+
+        auto boundary = std::size_t ();
+        for (auto hit : shared->hits ())
+        {
+            CHECK (hit <= shared->options ().hit_limit);
+            boundary += hit > 0;
+        }
+        CHECK (boundary > 0);
+    }
+
+    // Moving the view of a live engine draws what a new engine at that view draws
+    FRACTAL_TEST (inverse_julia_set_view_matches_create)
+    {
+        auto moved = inverse_julia::create (preview_options (1));
+        CHECK (moved);
+        moved->render (-0.8, 0.156);
+
+        CHECK (!moved->set_view (0.1, 0.2, 0));
+        CHECK (moved->set_view (0.1, 0.2, 0.5));
+        moved->render (-0.4, 0.6);
+
+        auto options        = preview_options (1);
+        options.center_x    = 0.1   ;
+        options.center_y    = 0.2   ;
+        options.zoom        = 0.5   ;
+        auto fresh = inverse_julia::create (options);
+        CHECK (fresh);
+        fresh->render (-0.4, 0.6);
+
+        CHECK (moved->points () == fresh->points ());
+        CHECK (moved->hits () == fresh->hits ());
+    }
+}
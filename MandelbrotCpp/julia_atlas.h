@@ -0,0 +1,112 @@
+// ----------------------------------------------------------------------------------------------
+// Copyright (c) Mrten Rnge.
+// ----------------------------------------------------------------------------------------------
+// This source code is subject to terms and conditions of the Microsoft Public License. A
+// copy of the license can be found in the License.html file at the root of this distribution.
+// If you cannot locate the  Microsoft Public License, please send an email to
+// dlr@microsoft.com. By using this source code in any fashion, you are agreeing to be bound
+//  by the terms of the Microsoft Public License.
+// ----------------------------------------------------------------------------------------------
+// You must not remove this notice, or any other, from this software.
+// ----------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "escape_time.h"
+#include "simd.h"
+
+namespace fractal
+{
+    template<typename T>
+    struct julia_thumbnails
+    {
+        unsigned int    width       = 64    ;
+        unsigned int    height      = 64    ;
+        unsigned int    columns     = 16    ;
+        T               center_x    = 0     ;
+        T               center_y    = 0     ;
+        T               zoom        = T (0.25);
+        unsigned int    iter        = 512   ;
+
+        inline unsigned int atlas_width () const noexcept
+        {
+            return columns * width;
+        }
+
+        inline unsigned int atlas_height (std::size_t count) const noexcept
+        {
+            return static_cast<unsigned int> ((count + columns - 1) / columns) * height;
+        }
+    };
+
+    // Renders the Julia set of every (cx[i], cy[i]) as a thumbnail into one atlas of
+    //  iteration counts, thumbnail i at column i % columns and row i / columns.
+    //
+    //  The lanes of a pack are spread across parameters instead of pixels: all lanes
+    //  iterate the same texel of W different thumbnails. Each task is one texel row of a
+    //  group of W thumbnails so every thumbnail shares one viewport and one scheduled pass.
+    template<typename T, unsigned int W = native_width<T>::value>
+    void render_julia_atlas (
+            T const *                       cx
+        ,   T const *                       cy
+        ,   std::size_t                     count
+        ,   julia_thumbnails<T> const &     thumbnails
+        ,   std::uint32_t *                 atlas
+        )
+    {
+        using lanes = pack<T, W>;
+
+        if (count == 0 || thumbnails.columns == 0)
+        {
+            return;
+        }
+
+        auto const vp           = make_viewport (thumbnails.center_x, thumbnails.center_y, thumbnails.zoom, thumbnails.width, thumbnails.height);
+        auto const groups       = static_cast<unsigned int> ((count + W - 1) / W);
+        auto const stride       = static_cast<std::size_t> (thumbnails.atlas_width ());
+        auto const iter         = thumbnails.iter;
+
+        parallel_for_rows (groups * thumbnails.height, [&] (unsigned int task)
+        {
+            auto const group    = task / thumbnails.height;
+            auto const y        = task % thumbnails.height;
+            auto const first    = static_cast<std::size_t> (group) * W;
+            auto const valid    = count - first < W ? static_cast<unsigned int> (count - first) : W;
+
+            // The last group is padded by repeating its last parameter
+            T px[W];
+            T py[W];
+            std::uint32_t * rows[W];
+            for (auto lane = 0U; lane < W; ++lane)
+            {
+                auto const p    = first + (lane < valid ? lane : valid - 1);
+                px[lane]        = cx[p];
+                py[lane]        = cy[p];
+
+                auto const col  = p % thumbnails.columns;
+                auto const row  = p / thumbnails.columns;
+                rows[lane]      = atlas + (row * thumbnails.height + y) * stride + col * thumbnails.width;
+            }
+
+            auto const c_x      = lanes::load (px);
+            auto const c_y      = lanes::load (py);
+            auto const z_y      = lanes::broadcast (vp.y (static_cast<T> (y)));
+
+            T counts[W];
+            for (auto x = 0U; x < thumbnails.width; ++x)
+            {
+                auto const z_x = lanes::broadcast (vp.x (static_cast<T> (x)));
+
+                mandelbrot2_lanes (z_x, z_y, c_x, c_y, iter).store (counts);
+
+                for (auto lane = 0U; lane < valid; ++lane)
+                {
+                    rows[lane][x] = static_cast<std::uint32_t> (counts[lane]);
+                }
+            }
+        });
+    }
+}
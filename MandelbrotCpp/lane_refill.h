@@ -0,0 +1,488 @@
+// ----------------------------------------------------------------------------------------------
+// Copyright (c) Mrten Rnge.
+// ----------------------------------------------------------------------------------------------
+// This source code is subject to terms and conditions of the Microsoft Public License. A
+// copy of the license can be found in the License.html file at the root of this distribution.
+// If you cannot locate the  Microsoft Public License, please send an email to
+// dlr@microsoft.com. By using this source code in any fashion, you are agreeing to be bound
+//  by the terms of the Microsoft Public License.
+// ----------------------------------------------------------------------------------------------
+// You must not remove this notice, or any other, from this software.
+// ----------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "benchmark.h"
+#include "escape_time.h"
+#include "formulas.h"
+#include "simd.h"
+
+namespace fractal
+{
+    // Iterations every pixel gets from the plain masked kernel before the refill kernel
+    //  takes over the ones still alive
+    unsigned int const refill_head = 64;
+
+    // Escape counts of row y like a row_kernel, also returns the lane slots the row took
+    using refill_probe = std::uint64_t (*) (formula_view const & view, unsigned int y, std::uint32_t * counts);
+
+    namespace details
+    {
+        // Set bits of a lane mask, W is at most 16
+        inline unsigned int lane_count (unsigned int mask) noexcept
+        {
+            mask = mask - ((mask >> 1) & 0x5555U);
+            mask = (mask & 0x3333U) + ((mask >> 2) & 0x3333U);
+            mask = (mask + (mask >> 4)) & 0x0F0FU;
+            return (mask + (mask >> 8)) & 0x1FU;
+        }
+
+        // Pixels of a row that outlived the head iterations, structure of arrays
+        template<typename T>
+        struct refill_queue
+        {
+            std::vector<T>              z_x     ;
+            std::vector<T>              z_y     ;
+            std::vector<T>              c_x     ;
+            std::vector<std::uint32_t>  pixel   ;
+            std::size_t                 size    = 0 ;
+
+            void reset (std::size_t capacity)
+            {
+                if (pixel.size () < capacity)
+                {
+                    z_x.resize (capacity);
+                    z_y.resize (capacity);
+                    c_x.resize (capacity);
+                    pixel.resize (capacity);
+                }
+                size = 0;
+            }
+        };
+
+        // One queue per worker thread, reused row after row
+        template<typename T>
+        inline refill_queue<T> & thread_refill_queue ()
+        {
+            static thread_local refill_queue<T> queue;
+            return queue;
+        }
+
+FRACTAL_EXACT_FP_BEGIN
+
+        // Escape counts of row y in two passes. The plain masked kernel runs every pack
+        //  for refill_head iterations, all most pixels of a view need. The pixels still
+        //  alive go into the thread's queue with their z, and the second pass works the
+        //  queue with lanes that retire their pixel as soon as it escapes or reaches the
+        //  limit and take the next one, so a pack no longer iterates until its slowest
+        //  pixel is done. Same test, step and count per lane as escape_lanes, the counts
+        //  are identical as long as neither contracts to FMA.
+        //
+        //  Refilling costs a mispredicted branch and a pass over the lanes, retired lanes
+        //  wait until Refill of them can be refilled at once. c_y is the same for the
+        //  whole row and the Julia c for every pixel, only z, c_x and the count are blended
+        //  into the retired lanes, the live ones stay in registers.
+        template<typename TFormula, typename T, unsigned int W, unsigned int Refill>
+        std::uint64_t refill_lanes (formula_view const & view, unsigned int y, std::uint32_t * counts)
+        {
+            using lanes = pack<T, W>;
+
+            auto const vp   = make_viewport (
+                    static_cast<T> (view.center_x)
+                ,   static_cast<T> (view.center_y)
+                ,   static_cast<T> (view.zoom)
+                ,   view.width
+                ,   view.height
+                );
+            auto const width    = view.width;
+            auto const head     = view.iter < refill_head ? view.iter : refill_head;
+            auto const full     = (1U << W) - 1;
+            auto const idle     = ~std::uint32_t ();
+
+            auto const one      = lanes::broadcast (T (1));
+            auto const four     = lanes::broadcast (T (4));
+            auto const limit    = lanes::broadcast (static_cast<T> (view.iter));
+            auto const z_y      = lanes::broadcast (vp.y (static_cast<T> (y)));
+            auto const c_x      = lanes::broadcast (static_cast<T> (view.param_x));
+            auto const c_y      = view.julia ? lanes::broadcast (static_cast<T> (view.param_y)) : z_y;
+
+            auto & queue = thread_refill_queue<T> ();
+            queue.reset (width);
+
+            T xs    [W];
+            T ys    [W];
+            T cxs   [W];
+            T ns    [W];
+            T masks [W];
+
+            std::uint64_t steps = 0;
+
+            // Head pass, escape_lanes cut off after head iterations
+            for (auto x = 0U; x < width; x += W)
+            {
+                for (auto lane = 0U; lane < W; ++lane)
+                {
+                    xs[lane] = vp.x (static_cast<T> (x + lane));
+                }
+
+                auto zx     = lanes::load (xs);
+                auto zy     = z_y;
+                auto cx     = view.julia ? c_x : zx;
+                auto n      = lanes::broadcast (T (0));
+                auto alive  = less (n, one);
+
+                for (auto i = head; i > 0; --i)
+                {
+                    auto x2 = zx * zx;
+                    auto y2 = zy * zy;
+
+                    alive = alive & less (x2 + y2, four);
+                    if (!any (alive))
+                    {
+                        break;
+                    }
+
+                    n = n + (alive & one);
+                    TFormula::step (zx, zy, x2, y2, cx, c_y);
+                    ++steps;
+                }
+
+                // Survivors are still inside after their last step
+                auto const survivors    = head < view.iter ? move_mask (alive & less (zx * zx + zy * zy, four)) : 0U;
+                auto const valid        = width - x < W ? width - x : W;
+
+                n.store (ns);
+                zx.store (xs);
+                zy.store (ys);
+                cx.store (cxs);
+
+                for (auto lane = 0U; lane < valid; ++lane)
+                {
+                    if ((survivors >> lane) & 1U)
+                    {
+                        auto const i = queue.size++;
+                        queue.z_x[i]    = xs[lane]  ;
+                        queue.z_y[i]    = ys[lane]  ;
+                        queue.c_x[i]    = cxs[lane] ;
+                        queue.pixel[i]  = x + lane  ;
+                    }
+                    else
+                    {
+                        counts[x + lane] = static_cast<std::uint32_t> (ns[lane]);
+                    }
+                }
+            }
+
+            if (queue.size == 0)
+            {
+                return steps * W;
+            }
+
+            // Refill pass over the survivors, all of them at head
+            std::uint32_t pixel[W];
+            auto next = std::size_t ();
+            auto busy = 0U;
+
+            // The next survivor into lane, an idle lane when there is none. Idle lanes sit
+            //  at the limit so they are never alive.
+            auto const take = [&] (unsigned int lane)
+            {
+                auto const has  = next < queue.size;
+                auto const i    = has ? next++ : 0;
+
+                xs[lane]    = has ? queue.z_x[i] : T (0)                        ;
+                ys[lane]    = has ? queue.z_y[i] : T (0)                        ;
+                cxs[lane]   = has ? queue.c_x[i] : T (0)                        ;
+                ns[lane]    = static_cast<T> (has ? head : view.iter)           ;
+                pixel[lane] = has ? queue.pixel[i] : idle                       ;
+                busy       += has ? 1 : 0                                       ;
+            };
+
+            for (auto lane = 0U; lane < W; ++lane)
+            {
+                take (lane);
+            }
+
+            auto zx = lanes::load (xs);
+            auto zy = lanes::load (ys);
+            auto cx = lanes::load (cxs);
+            auto n  = lanes::load (ns);
+
+            for (;;)
+            {
+                auto x2 = zx * zx;
+                auto y2 = zy * zy;
+
+                auto const alive    = less (x2 + y2, four) & less (n, limit);
+                auto const live     = move_mask (alive);
+
+                // Once the queue is empty the lanes drain and are collected when all of
+                //  them are done
+                if (live == 0 || (live != full && next < queue.size && lane_count (full & ~live) >= Refill))
+                {
+                    n.store (ns);
+
+                    for (auto lane = 0U; lane < W; ++lane)
+                    {
+                        auto const retired = ((live >> lane) & 1U) == 0;
+                        masks[lane] = mask_of<T> (retired);
+                        if (!retired)
+                        {
+                            continue;
+                        }
+
+                        if (pixel[lane] != idle)
+                        {
+                            counts[pixel[lane]] = static_cast<std::uint32_t> (ns[lane]);
+                            --busy;
+                        }
+                        take (lane);
+                    }
+
+                    if (busy == 0)
+                    {
+                        break;
+                    }
+
+                    auto const retired = lanes::load (masks);
+
+                    zx  = select (retired, lanes::load (xs) , zx);
+                    zy  = select (retired, lanes::load (ys) , zy);
+                    cx  = select (retired, lanes::load (cxs), cx);
+                    n   = select (retired, lanes::load (ns) , n );
+                    continue;
+                }
+
+                n = n + (alive & one);
+                TFormula::step (zx, zy, x2, y2, cx, c_y);
+                ++steps;
+            }
+
+            return steps * W;
+        }
+
+        template<typename TFormula, typename T, unsigned int W>
+        void refill_row (formula_view const & view, unsigned int y, std::uint32_t * counts)
+        {
+            refill_lanes<TFormula, T, W, (W >= 8 ? W / 4 : 1)> (view, y, counts);
+        }
+
+        template<typename TFormula, typename T, unsigned int W>
+        std::uint64_t refill_probe_row (formula_view const & view, unsigned int y, std::uint32_t * counts)
+        {
+            return refill_lanes<TFormula, T, W, (W >= 8 ? W / 4 : 1)> (view, y, counts);
+        }
+
+FRACTAL_EXACT_FP_END
+
+        // Same widths as precision_widths, a single lane has nothing to refill
+        template<typename TFormula>
+        struct refill_kernels
+        {
+            static inline row_kernel const * rows (precision p) noexcept
+            {
+                static row_kernel const kernels32[kernel_widths] =
+                {
+                        nullptr
+                    ,   &refill_row<TFormula, float , 4 >
+                    ,   &refill_row<TFormula, float , 8 >
+                    ,   &refill_row<TFormula, float , 16>
+                };
+
+                static row_kernel const kernels64[kernel_widths] =
+                {
+                        nullptr
+                    ,   &refill_row<TFormula, double, 2 >
+                    ,   &refill_row<TFormula, double, 4 >
+                    ,   &refill_row<TFormula, double, 8 >
+                };
+
+                return p == precision::float32 ? kernels32 : kernels64;
+            }
+
+            static inline refill_probe const * probes (precision p) noexcept
+            {
+                static refill_probe const probes32[kernel_widths] =
+                {
+                        nullptr
+                    ,   &refill_probe_row<TFormula, float , 4 >
+                    ,   &refill_probe_row<TFormula, float , 8 >
+                    ,   &refill_probe_row<TFormula, float , 16>
+                };
+
+                static refill_probe const probes64[kernel_widths] =
+                {
+                        nullptr
+                    ,   &refill_probe_row<TFormula, double, 2 >
+                    ,   &refill_probe_row<TFormula, double, 4 >
+                    ,   &refill_probe_row<TFormula, double, 8 >
+                };
+
+                return p == precision::float32 ? probes32 : probes64;
+            }
+        };
+
+        // Index of width in precision_widths, kernel_widths when there is none
+        inline unsigned int refill_slot (precision p, unsigned int width) noexcept
+        {
+            if (is_fixed (p))
+            {
+                return kernel_widths;
+            }
+
+            if (width == 0)
+            {
+                width = p == precision::float32
+                    ? native_width<float>::value
+                    : native_width<double>::value
+                    ;
+            }
+
+            auto const widths = precision_widths (p);
+            for (auto i = 1U; i < kernel_widths; ++i)
+            {
+                if (widths[i] == width)
+                {
+                    return i;
+                }
+            }
+
+            return kernel_widths;
+        }
+
+        template<typename TFormula>
+        inline row_kernel refill_kernel (precision p, unsigned int width) noexcept
+        {
+            auto const slot = refill_slot (p, width);
+            return slot < kernel_widths ? refill_kernels<TFormula>::rows (p)[slot] : nullptr;
+        }
+
+        template<typename TFormula>
+        inline refill_probe refill_probe_kernel (precision p, unsigned int width) noexcept
+        {
+            auto const slot = refill_slot (p, width);
+            return slot < kernel_widths ? refill_kernels<TFormula>::probes (p)[slot] : nullptr;
+        }
+    }
+
+    // The lane refill kernel of a formula, precision and SIMD width, a drop in for the
+    //  select_kernel one with the same counts. A width of 0 picks the native width.
+    //  Returns nullptr for the scalar width and fixed point precisions.
+    inline row_kernel select_refill_kernel (formula f, precision p, unsigned int width = 0) noexcept
+    {
+        switch (f)
+        {
+        case formula::mandelbrot2   : return details::refill_kernel<formulas::mandelbrot2 > (p, width);
+        case formula::multibrot3    : return details::refill_kernel<formulas::multibrot<3>> (p, width);
+        case formula::multibrot4    : return details::refill_kernel<formulas::multibrot<4>> (p, width);
+        case formula::multibrot5    : return details::refill_kernel<formulas::multibrot<5>> (p, width);
+        case formula::burning_ship  : return details::refill_kernel<formulas::burning_ship> (p, width);
+        case formula::tricorn       : return details::refill_kernel<formulas::tricorn     > (p, width);
+        default                     : return nullptr;
+        }
+    }
+
+    // Same kernel counting the lane slots it spends, for the benchmarks
+    inline refill_probe select_refill_probe (formula f, precision p, unsigned int width = 0) noexcept
+    {
+        switch (f)
+        {
+        case formula::mandelbrot2   : return details::refill_probe_kernel<formulas::mandelbrot2 > (p, width);
+        case formula::multibrot3    : return details::refill_probe_kernel<formulas::multibrot<3>> (p, width);
+        case formula::multibrot4    : return details::refill_probe_kernel<formulas::multibrot<4>> (p, width);
+        case formula::multibrot5    : return details::refill_probe_kernel<formulas::multibrot<5>> (p, width);
+        case formula::burning_ship  : return details::refill_probe_kernel<formulas::burning_ship> (p, width);
+        case formula::tricorn       : return details::refill_probe_kernel<formulas::tricorn     > (p, width);
+        default                     : return nullptr;
+        }
+    }
+
+    // Times the plain masked kernel against the refill kernel at every width and reports
+    //  how many lane slots did useful work. A masked pack takes as many iterations as its
+    //  slowest pixel, W slots each, the refill kernel counts its own.
+    inline void benchmark_lane_refill (
+            benchmark_report &      report
+        ,   formula_view const &    view
+        ,   formula                 f
+        ,   precision               p
+        ,   unsigned int            repeats = 3
+        )
+    {
+        auto const pixels = static_cast<std::size_t> (view.width) * view.height;
+
+        std::vector<std::uint32_t> reference (pixels);
+        std::vector<std::uint32_t> counts (pixels);
+
+        auto const widths = details::precision_widths (p);
+        for (auto w = 1U; w < details::kernel_widths; ++w)
+        {
+            auto const width    = widths[w];
+            auto const masked   = select_kernel (f, p, width, 1);
+            auto const refill   = select_refill_kernel (f, p, width);
+            auto const probe    = select_refill_probe (f, p, width);
+            if (!masked || !refill || !probe)
+            {
+                continue;
+            }
+
+            auto const group =
+                    std::string ("lane refill ")
+                +   (p == precision::float32 ? "float" : "double")
+                +   " W=" + std::to_string (width) + " "
+                +   (view.julia ? "julia" : "mandelbrot")
+                ;
+
+            auto ms = measure_ms (repeats, [&] ()
+            {
+                render_formula (view, masked, reference.data ());
+            });
+
+            auto useful = 0.0;
+            auto slots  = 0.0;
+            for (auto y = 0U; y < view.height; ++y)
+            {
+                auto const row = reference.data () + static_cast<std::size_t> (y) * view.width;
+                for (auto x = 0U; x < view.width; x += width)
+                {
+                    auto slowest = 0U;
+                    for (auto lane = x; lane < x + width && lane < view.width; ++lane)
+                    {
+                        useful  += row[lane];
+                        slowest  = row[lane] > slowest ? row[lane] : slowest;
+                    }
+                    slots += static_cast<double> (slowest) * width;
+                }
+            }
+
+            char name[64];
+            std::snprintf (name, sizeof (name), "masked, %.1f%% lanes busy", slots > 0 ? 100 * useful / slots : 100.0);
+            report.add (group, name, ms, static_cast<double> (pixels));
+
+            ms = measure_ms (repeats, [&] ()
+            {
+                render_formula (view, refill, counts.data ());
+            });
+
+            slots = 0;
+            for (auto y = 0U; y < view.height; ++y)
+            {
+                slots += static_cast<double> (probe (view, y, counts.data () + static_cast<std::size_t> (y) * view.width));
+            }
+
+            std::snprintf (
+                    name
+                ,   sizeof (name)
+                ,   "refill, %.1f%% lanes busy, %.3f%% differ"
+                ,   slots > 0 ? 100 * useful / slots : 100.0
+                ,   100 * mismatch_fraction (counts, reference)
+                );
+            report.add (group, name, ms, static_cast<double> (pixels));
+        }
+    }
+}
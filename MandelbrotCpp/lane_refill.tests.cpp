@@ -0,0 +1,150 @@
+// ----------------------------------------------------------------------------------------------
+// Copyright (c) Mrten Rnge.
+// ----------------------------------------------------------------------------------------------
+// This source code is subject to terms and conditions of the Microsoft Public License. A
+// copy of the license can be found in the License.html file at the root of this distribution.
+// If you cannot locate the  Microsoft Public License, please send an email to
+// dlr@microsoft.com. By using this source code in any fashion, you are agreeing to be bound
+//  by the terms of the Microsoft Public License.
+// ----------------------------------------------------------------------------------------------
+// You must not remove this notice, or any other, from this software.
+// ----------------------------------------------------------------------------------------------
+
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#include "formulas.h"
+#include "lane_refill.h"
+#include "tests.h"
+
+namespace
+{
+    using namespace fractal;
+
+    // Limits below, at and just past the head pass, then long enough that the refill
+    //  pass does most of the work
+    unsigned int const iteration_limits[] = { 1, refill_head - 1, refill_head, refill_head + 1, 300, 2000 };
+
+    // A width that leaves a partial last pack at every SIMD width
+    std::vector<formula_view> views ()
+    {
+        std::vector<formula_view> result;
+
+        formula_view view;
+        view.width      = 61    ;
+        view.height     = 37    ;
+        view.center_x   = -0.5  ;
+        view.zoom       = 0.4   ;
+        result.push_back (view);
+
+        // Boundary, every pixel survives the head pass for a different time
+        view.center_x   = -0.7453   ;
+        view.center_y   = 0.1127    ;
+        view.zoom       = 300       ;
+        result.push_back (view);
+
+        // All interior, nothing escapes and every pixel goes to the refill queue
+        view.center_x   = -0.2      ;
+        view.center_y   = 0         ;
+        view.zoom       = 20        ;
+        result.push_back (view);
+
+        // All outside, nothing survives the head pass
+        view.center_x   = 3         ;
+        view.zoom       = 10        ;
+        result.push_back (view);
+
+        view.center_x   = 0         ;
+        view.zoom       = 0.4       ;
+        view.param_x    = -0.8      ;
+        view.param_y    = 0.156     ;
+        view.julia      = true      ;
+        result.push_back (view);
+
+        return result;
+    }
+
+    std::vector<std::uint32_t> render (formula_view const & view, row_kernel kernel)
+    {
+        std::vector<std::uint32_t> counts (static_cast<std::size_t> (view.width) * view.height, ~std::uint32_t ());
+        render_formula (view, kernel, counts.data ());
+        return counts;
+    }
+
+    FRACTAL_TEST (lane_refill_matches_the_masked_kernel)
+    {
+        auto wrong_cases = 0U;
+
+        for (auto f : {formula::mandelbrot2, formula::multibrot3, formula::burning_ship})
+        {
+            for (auto p : {precision::float32, precision::float64})
+            {
+                for (auto w = 0U; w < details::kernel_widths; ++w)
+                {
+                    auto const width    = details::precision_widths (p)[w];
+                    auto const refill   = select_refill_kernel (f, p, width);
+                    if (!refill)
+                    {
+                        continue;
+                    }
+
+                    // The same width with the escape test on every iteration
+                    auto const masked = select_kernel (f, p, width, 1);
+                    CHECK (masked);
+
+                    for (auto view : views ())
+                    {
+                        for (auto iter : iteration_limits)
+                        {
+                            view.iter = iter;
+                            if (render (view, refill) != render (view, masked))
+                            {
+                                std::printf ("          %ls, %u bit, W=%u, iter %u: counts differ\n", formula_name (f), static_cast<unsigned int> (p), width, iter);
+                                ++wrong_cases;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+
+        CHECK (wrong_cases == 0);
+    }
+
+    // The probe is the same kernel, it only also counts the lane slots it spends. Every
+    //  iteration a pixel is counted for took a slot.
+    FRACTAL_TEST (lane_refill_probe_counts_like_the_kernel)
+    {
+        auto const p        = precision::float32;
+        auto const width    = details::precision_widths (p)[details::kernel_widths - 1];
+        auto const refill   = select_refill_kernel (formula::mandelbrot2, p, width);
+        auto const probe    = select_refill_probe (formula::mandelbrot2, p, width);
+        CHECK (refill && probe);
+
+        for (auto view : views ())
+        {
+            view.iter = 300;
+
+            auto const expected = render (view, refill);
+            std::vector<std::uint32_t> counts (expected.size ());
+
+            for (auto y = 0U; y < view.height; ++y)
+            {
+                auto const row      = counts.data () + static_cast<std::size_t> (y) * view.width;
+                auto const slots    = probe (view, y, row);
+
+                auto useful = std::uint64_t ();
+                for (auto x = 0U; x < view.width; ++x)
+                {
+                    useful += row[x];
+                }
+
+                CHECK (slots >= useful);
+            }
+
+            CHECK (counts == expected);
+        }
+    }
+}
@@ -0,0 +1,321 @@
+// ----------------------------------------------------------------------------------------------
+// Copyright (c) Mrten Rnge.
+// ----------------------------------------------------------------------------------------------
+// This source code is subject to terms and conditions of the Microsoft Public License. A
+// copy of the license can be found in the License.html file at the root of this distribution.
+// If you cannot locate the  Microsoft Public License, please send an email to
+// dlr@microsoft.com. By using this source code in any fashion, you are agreeing to be bound
+//  by the terms of the Microsoft Public License.
+// ----------------------------------------------------------------------------------------------
+// You must not remove this notice, or any other, from this software.
+// ----------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#ifdef _WIN32
+#   ifndef WIN32_LEAN_AND_MEAN
+#       define WIN32_LEAN_AND_MEAN
+#   endif
+#   ifndef NOMINMAX
+#       define NOMINMAX
+#   endif
+#   include <windows.h>
+#else
+#   include <fcntl.h>
+#   include <sys/file.h>
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#   include <unistd.h>
+#endif
+
+namespace fractal
+{
+#ifdef _WIN32
+    using native_path = std::wstring;
+#else
+    using native_path = std::string;
+#endif
+
+    // A read-write shared mapping of a whole file. Other processes mapping the same file see
+    //  the same pages so the mapping doubles as a cross-process shared memory region.
+    //  Growing the file remaps it which invalidates any pointer previously handed out.
+    struct mapped_file
+    {
+        using ptr = std::unique_ptr<mapped_file>;
+
+        ~mapped_file () noexcept
+        {
+            unmap ();
+#ifdef _WIN32
+            if (m_file != INVALID_HANDLE_VALUE)
+            {
+                CloseHandle (m_file);
+            }
+#else
+            if (m_file >= 0)
+            {
+                close (m_file);
+            }
+#endif
+        }
+
+        // Opens (creating if needed) the file and maps at least minimum_size bytes of it.
+        //  Returns nullptr if the file can't be opened or mapped.
+        static ptr open (native_path const & path, std::uint64_t minimum_size)
+        {
+            ptr result (new mapped_file ());
+
+#ifdef _WIN32
+            result->m_file = CreateFileW (
+                    path.c_str ()
+                ,   GENERIC_READ | GENERIC_WRITE
+                ,   FILE_SHARE_READ | FILE_SHARE_WRITE
+                ,   nullptr
+                ,   OPEN_ALWAYS
+                ,   FILE_ATTRIBUTE_NORMAL
+                ,   nullptr
+                );
+
+            if (result->m_file == INVALID_HANDLE_VALUE)
+            {
+                return nullptr;
+            }
+#else
+            result->m_file = ::open (path.c_str (), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+
+            if (result->m_file < 0)
+            {
+                return nullptr;
+            }
+#endif
+
+            auto size = result->file_size ();
+
+            if (size < minimum_size)
+            {
+                if (!result->set_file_size (minimum_size))
+                {
+                    return nullptr;
+                }
+
+                size = minimum_size;
+            }
+
+            if (!result->map (size))
+            {
+                return nullptr;
+            }
+
+            return result;
+        }
+
+        inline unsigned char * data () const noexcept
+        {
+            return m_data;
+        }
+
+        inline std::uint64_t size () const noexcept
+        {
+            return m_size;
+        }
+
+        // Grows the file to at least size bytes and remaps it
+        bool grow (std::uint64_t size)
+        {
+            if (size <= m_size)
+            {
+                return true;
+            }
+
+            if (file_size () < size && !set_file_size (size))
+            {
+                return false;
+            }
+
+            unmap ();
+            return map (size);
+        }
+
+        // Picks up growth done through another mapping of the same file
+        bool refresh ()
+        {
+            auto size = file_size ();
+
+            if (size <= m_size)
+            {
+                return true;
+            }
+
+            unmap ();
+            return map (size);
+        }
+
+        // Writes the dirty pages in [offset, offset + size) through to the disk
+        bool flush (std::uint64_t offset, std::uint64_t size) noexcept
+        {
+            if (!m_data || offset >= m_size)
+            {
+                return false;
+            }
+
+            auto const page     = page_size ();
+            auto const begin    = offset - offset % page;
+            auto const end      = offset + size < m_size ? offset + size : m_size;
+
+#ifdef _WIN32
+            return
+                    FlushViewOfFile (m_data + begin, static_cast<SIZE_T> (end - begin))
+                &&  FlushFileBuffers (m_file)
+                ;
+#else
+            return msync (m_data + begin, static_cast<size_t> (end - begin), MS_SYNC) == 0;
+#endif
+        }
+
+        // Exclusive advisory lock shared by every process that opens the file
+        bool lock () noexcept
+        {
+#ifdef _WIN32
+            OVERLAPPED overlapped {};
+            return LockFileEx (m_file, LOCKFILE_EXCLUSIVE_LOCK, 0, 1, 0, &overlapped) != FALSE;
+#else
+            return flock (m_file, LOCK_EX) == 0;
+#endif
+        }
+
+        void unlock () noexcept
+        {
+#ifdef _WIN32
+            OVERLAPPED overlapped {};
+            UnlockFileEx (m_file, 0, 1, 0, &overlapped);
+#else
+            flock (m_file, LOCK_UN);
+#endif
+        }
+
+    private:
+        mapped_file () noexcept                         = default;
+        mapped_file (mapped_file const &)               = delete;
+        mapped_file& operator= (mapped_file const &)    = delete;
+
+        static std::uint64_t page_size () noexcept
+        {
+#ifdef _WIN32
+            SYSTEM_INFO info {};
+            GetSystemInfo (&info);
+            return info.dwAllocationGranularity;
+#else
+            return static_cast<std::uint64_t> (sysconf (_SC_PAGESIZE));
+#endif
+        }
+
+        std::uint64_t file_size () const noexcept
+        {
+#ifdef _WIN32
+            LARGE_INTEGER size {};
+            return GetFileSizeEx (m_file, &size)
+                ? static_cast<std::uint64_t> (size.QuadPart)
+                : 0
+                ;
+#else
+            struct stat st {};
+            return fstat (m_file, &st) == 0
+                ? static_cast<std::uint64_t> (st.st_size)
+                : 0
+                ;
+#endif
+        }
+
+        bool set_file_size (std::uint64_t size) noexcept
+        {
+#ifdef _WIN32
+            LARGE_INTEGER position {};
+            position.QuadPart = static_cast<LONGLONG> (size);
+            return
+                    SetFilePointerEx (m_file, position, nullptr, FILE_BEGIN)
+                &&  SetEndOfFile (m_file)
+                ;
+#else
+            return ftruncate (m_file, static_cast<off_t> (size)) == 0;
+#endif
+        }
+
+        bool map (std::uint64_t size) noexcept
+        {
+            if (size == 0)
+            {
+                return false;
+            }
+
+#ifdef _WIN32
+            m_mapping = CreateFileMappingW (
+                    m_file
+                ,   nullptr
+                ,   PAGE_READWRITE
+                ,   static_cast<DWORD> (size >> 32)
+                ,   static_cast<DWORD> (size)
+                ,   nullptr
+                );
+
+            if (!m_mapping)
+            {
+                return false;
+            }
+
+            auto view = MapViewOfFile (m_mapping, FILE_MAP_READ | FILE_MAP_WRITE, 0, 0, static_cast<SIZE_T> (size));
+            if (!view)
+            {
+                return false;
+            }
+
+            m_data = static_cast<unsigned char *> (view);
+#else
+            auto view = mmap (nullptr, static_cast<size_t> (size), PROT_READ | PROT_WRITE, MAP_SHARED, m_file, 0);
+            if (view == MAP_FAILED)
+            {
+                return false;
+            }
+
+            m_data = static_cast<unsigned char *> (view);
+#endif
+            m_size = size;
+            return true;
+        }
+
+        void unmap () noexcept
+        {
+#ifdef _WIN32
+            if (m_data)
+            {
+                UnmapViewOfFile (m_data);
+            }
+
+            if (m_mapping)
+            {
+                CloseHandle (m_mapping);
+                m_mapping = nullptr;
+            }
+#else
+            if (m_data)
+            {
+                munmap (m_data, static_cast<size_t> (m_size));
+            }
+#endif
+            m_data = nullptr;
+            m_size = 0;
+        }
+
+#ifdef _WIN32
+        HANDLE          m_file      = INVALID_HANDLE_VALUE  ;
+        HANDLE          m_mapping   = nullptr               ;
+#else
+        int             m_file      = -1                    ;
+#endif
+        unsigned char * m_data      = nullptr               ;
+        std::uint64_t   m_size      = 0                     ;
+    };
+}
@@ -0,0 +1,98 @@
+// ----------------------------------------------------------------------------------------------
+// Copyright (c) Mrten Rnge.
+// ----------------------------------------------------------------------------------------------
+// This source code is subject to terms and conditions of the Microsoft Public License. A
+// copy of the license can be found in the License.html file at the root of this distribution.
+// If you cannot locate the  Microsoft Public License, please send an email to
+// dlr@microsoft.com. By using this source code in any fashion, you are agreeing to be bound
+//  by the terms of the Microsoft Public License.
+// ----------------------------------------------------------------------------------------------
+// You must not remove this notice, or any other, from this software.
+// ----------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace fractal
+{
+    // Colors are packed as R8G8B8A8 with red in the lowest byte, the layout of
+    //  DXGI_FORMAT_R8G8B8A8_UNORM textures
+    inline std::uint32_t pack_rgba (float r, float g, float b, float a) noexcept
+    {
+        auto to_byte = [] (float v)
+        {
+            v = v < 0 ? 0 : (v > 1 ? 1 : v);
+            return static_cast<std::uint32_t> (v * 255 + 0.5F);
+        };
+
+        return
+                to_byte (r)
+            |   to_byte (g) << 8
+            |   to_byte (b) << 16
+            |   to_byte (a) << 24
+            ;
+    }
+
+    inline float channel (std::uint32_t color, unsigned int index) noexcept
+    {
+        return static_cast<float> ((color >> (8 * index)) & 0xFF) / 255;
+    }
+
+    inline std::uint32_t lerp_rgba (std::uint32_t from, std::uint32_t to, float ratio) noexcept
+    {
+        auto lerp = [=] (unsigned int index)
+        {
+            return channel (from, index) + ratio * (channel (to, index) - channel (from, index));
+        };
+
+        return pack_rgba (lerp (0), lerp (1), lerp (2), lerp (3));
+    }
+
+    std::uint32_t const opaque_black = 0xFF000000U;
+
+    // CPU side of the cyclic color lookup compute_set builds: iteration i maps to
+    //  colors[(i + offset) % size] and points that never escaped are black.
+    //  Fractional (smooth) values blend the two neighbouring colors.
+    struct cyclic_palette
+    {
+        cyclic_palette (std::vector<std::uint32_t> const & colors, unsigned int offset, unsigned int iter) noexcept
+            :   colors  (&colors)
+            ,   offset  (offset )
+            ,   iter    (iter   )
+        {
+        }
+
+        inline std::uint32_t operator() (unsigned int count) const noexcept
+        {
+            if (count + 1 >= iter || colors->empty ())
+            {
+                return opaque_black;
+            }
+
+            return (*colors)[(count + offset) % colors->size ()];
+        }
+
+        inline std::uint32_t operator() (float value) const noexcept
+        {
+            auto count = static_cast<unsigned int> (value);
+            if (count + 1 >= iter || colors->empty ())
+            {
+                return opaque_black;
+            }
+
+            auto size = colors->size ();
+            return lerp_rgba (
+                    (*colors)[(count + offset) % size]
+                ,   (*colors)[(count + offset + 1) % size]
+                ,   value - static_cast<float> (count)
+                );
+        }
+
+    private:
+        std::vector<std::uint32_t> const *  colors  ;
+        unsigned int                        offset  ;
+        unsigned int                        iter    ;
+    };
+}
@@ -0,0 +1,586 @@
+// ----------------------------------------------------------------------------------------------
+// Copyright (c) Mrten Rnge.
+// ----------------------------------------------------------------------------------------------
+// This source code is subject to terms and conditions of the Microsoft Public License. A
+// copy of the license can be found in the License.html file at the root of this distribution.
+// If you cannot locate the  Microsoft Public License, please send an email to
+// dlr@microsoft.com. By using this source code in any fashion, you are agreeing to be bound
+//  by the terms of the Microsoft Public License.
+// ----------------------------------------------------------------------------------------------
+// You must not remove this notice, or any other, from this software.
+// ----------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "benchmark.h"
+#include "escape_time.h"
+#include "formulas.h"
+#include "palette.h"
+
+// Hardware counters come from perf_event_open, so only Linux has them. Defining
+//  FRACTAL_PERF_COUNTERS 0 compiles them out, every perf_scope is then an empty object.
+#ifndef FRACTAL_PERF_COUNTERS
+#   ifdef __linux__
+#       define FRACTAL_PERF_COUNTERS 1
+#   else
+#       define FRACTAL_PERF_COUNTERS 0
+#   endif
+#endif
+
+#if FRACTAL_PERF_COUNTERS
+#   include <linux/perf_event.h>
+#   include <sys/ioctl.h>
+#   include <sys/syscall.h>
+#   include <unistd.h>
+#endif
+
+namespace fractal
+{
+    enum class perf_event
+    {
+        cycles          ,
+        instructions    ,
+        branch_misses   ,
+        // Last level cache
+        cache_misses    ,
+        dtlb_misses     ,
+        count           ,
+    };
+
+    unsigned int const perf_events = static_cast<unsigned int> (perf_event::count);
+
+    inline char const * perf_event_name (perf_event e) noexcept
+    {
+        switch (e)
+        {
+        case perf_event::cycles         : return "cycles";
+        case perf_event::instructions   : return "instructions";
+        case perf_event::branch_misses  : return "branch misses";
+        case perf_event::cache_misses   : return "cache misses";
+        case perf_event::dtlb_misses    : return "dTLB misses";
+        default                         : return "unknown";
+        }
+    }
+
+    // Counts of one thread over some stretch of work. Hosts count what their PMU and
+    //  virtualization allow, the events in valid, the rest stay 0.
+    struct perf_sample
+    {
+        std::uint64_t   values[perf_events] {}  ;
+        unsigned int    valid               = 0 ;
+
+        inline std::uint64_t operator[] (perf_event e) const noexcept
+        {
+            return values[static_cast<unsigned int> (e)];
+        }
+
+        inline bool has (perf_event e) const noexcept
+        {
+            return (valid & (1U << static_cast<unsigned int> (e))) != 0;
+        }
+
+        perf_sample & operator+= (perf_sample const & other) noexcept
+        {
+            for (auto i = 0U; i < perf_events; ++i)
+            {
+                values[i] += other.values[i];
+            }
+            valid |= other.valid;
+            return *this;
+        }
+
+        // Instructions per cycle
+        inline double ipc () const noexcept
+        {
+            auto const cycles = (*this)[perf_event::cycles];
+            return cycles > 0 ? static_cast<double> ((*this)[perf_event::instructions]) / cycles : 0;
+        }
+
+        // Misses of e per thousand instructions
+        inline double per_kilo_instruction (perf_event e) const noexcept
+        {
+            auto const instructions = (*this)[perf_event::instructions];
+            return instructions > 0 ? 1000.0 * (*this)[e] / instructions : 0;
+        }
+
+        // Cycles, IPC and misses per thousand instructions of the events counted
+        std::string describe () const
+        {
+            if (!has (perf_event::cycles))
+            {
+                return "not counted";
+            }
+
+            char text[160];
+            auto length = std::snprintf (
+                    text
+                ,   sizeof (text)
+                ,   "%.1fM cyc, IPC %.2f"
+                ,   (*this)[perf_event::cycles] / 1e6
+                ,   ipc ()
+                );
+
+            struct
+            {
+                perf_event      event;
+                char const *    name;
+            } const misses[] =
+            {
+                {perf_event::branch_misses  , "br"  },
+                {perf_event::cache_misses   , "LLC" },
+                {perf_event::dtlb_misses    , "TLB" },
+            };
+
+            for (auto const & miss : misses)
+            {
+                if (has (miss.event) && length > 0 && static_cast<std::size_t> (length) < sizeof (text))
+                {
+                    length += std::snprintf (
+                            text + length
+                        ,   sizeof (text) - length
+                        ,   ", %s %.2f/ki"
+                        ,   miss.name
+                        ,   per_kilo_instruction (miss.event)
+                        );
+                }
+            }
+
+            return text;
+        }
+    };
+
+    // One perf_scope's counts. label is a string literal naming the phase or kernel, tile
+    //  the band or tile of the frame and worker the thread, numbered as threads first count.
+    struct perf_record
+    {
+        char const *    label   = ""    ;
+        unsigned int    tile    = 0     ;
+        unsigned int    worker  = 0     ;
+        double          ms      = 0     ;
+        perf_sample     sample          ;
+    };
+
+    namespace details
+    {
+        // Small dense numbers for the threads that count, stable for a thread's lifetime
+        inline unsigned int perf_worker () noexcept
+        {
+            static std::atomic<unsigned int> next {0};
+            thread_local auto const worker = next.fetch_add (1, std::memory_order_relaxed);
+            return worker;
+        }
+
+#if FRACTAL_PERF_COUNTERS
+        // The counters of the calling thread, user space only so perf_event_paranoid 2
+        //  allows them. They count from open on, a sample is the difference of two reads of
+        //  the whole group, one system call each.
+        struct perf_group
+        {
+            perf_group () noexcept
+            {
+                struct
+                {
+                    std::uint32_t   type;
+                    std::uint64_t   config;
+                } const events[perf_events] =
+                {
+                    {PERF_TYPE_HARDWARE , PERF_COUNT_HW_CPU_CYCLES      },
+                    {PERF_TYPE_HARDWARE , PERF_COUNT_HW_INSTRUCTIONS    },
+                    {PERF_TYPE_HARDWARE , PERF_COUNT_HW_BRANCH_MISSES   },
+                    {PERF_TYPE_HARDWARE , PERF_COUNT_HW_CACHE_MISSES    },
+                    {
+                            PERF_TYPE_HW_CACHE
+                        ,   PERF_COUNT_HW_CACHE_DTLB
+                        |   (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                        |   (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)
+                    },
+                };
+
+                // Without cycles there is nothing to relate the rest to
+                for (auto i = 0U; i < perf_events; ++i)
+                {
+                    perf_event_attr attr;
+                    std::memset (&attr, 0, sizeof (attr));
+                    attr.size           = sizeof (attr)             ;
+                    attr.type           = events[i].type            ;
+                    attr.config         = events[i].config          ;
+                    attr.read_format    = PERF_FORMAT_GROUP         ;
+                    attr.exclude_kernel = 1                         ;
+                    attr.exclude_hv     = 1                         ;
+                    attr.disabled       = m_leader < 0 ? 1 : 0      ;
+
+                    auto const fd = static_cast<int> (syscall (SYS_perf_event_open, &attr, 0, -1, m_leader, 0));
+                    if (fd < 0)
+                    {
+                        if (i == 0)
+                        {
+                            return;
+                        }
+                        continue;
+                    }
+
+                    if (m_leader < 0)
+                    {
+                        m_leader = fd;
+                    }
+                    else
+                    {
+                        m_members[m_count - 1] = fd;
+                    }
+                    m_events[m_count++] = i;
+                }
+
+                ioctl (m_leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+                ioctl (m_leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+            }
+
+            ~perf_group () noexcept
+            {
+                for (auto i = 0U; i + 1 < m_count; ++i)
+                {
+                    close (m_members[i]);
+                }
+
+                if (m_leader >= 0)
+                {
+                    close (m_leader);
+                }
+            }
+
+            perf_group (perf_group const &)             = delete;
+            perf_group& operator= (perf_group const &)  = delete;
+
+            inline bool is_open () const noexcept
+            {
+                return m_leader >= 0;
+            }
+
+            bool read (perf_sample & sample) const noexcept
+            {
+                // PERF_FORMAT_GROUP: the number of events, then their values in open order
+                std::uint64_t buffer[1 + perf_events] {};
+                if (m_leader < 0 || ::read (m_leader, buffer, sizeof (buffer)) < static_cast<ssize_t> ((1 + m_count) * sizeof (std::uint64_t)))
+                {
+                    return false;
+                }
+
+                for (auto i = 0U; i < m_count; ++i)
+                {
+                    sample.values[m_events[i]] = buffer[1 + i];
+                    sample.valid |= 1U << m_events[i];
+                }
+                return true;
+            }
+
+        private:
+            int             m_leader                    = -1;
+            int             m_members[perf_events - 1]  {}  ;
+            unsigned int    m_events[perf_events]       {}  ;
+            unsigned int    m_count                     = 0 ;
+        };
+
+        // Opened the first time the thread counts, closed when it exits
+        inline perf_group const & thread_counters ()
+        {
+            thread_local perf_group const group;
+            return group;
+        }
+#endif
+    }
+
+    // Collects perf_scope records from any number of threads
+    struct perf_log
+    {
+        // Whether this build and host count at all, no permission or a VM without a
+        //  virtual PMU is as good as the counters being compiled out
+        static bool available ()
+        {
+#if FRACTAL_PERF_COUNTERS
+            return details::thread_counters ().is_open ();
+#else
+            return false;
+#endif
+        }
+
+        void add (perf_record const & record)
+        {
+            std::lock_guard<std::mutex> lock (m_lock);
+            m_records.push_back (record);
+        }
+
+        void clear ()
+        {
+            std::lock_guard<std::mutex> lock (m_lock);
+            m_records.clear ();
+        }
+
+        std::vector<perf_record> records () const
+        {
+            std::lock_guard<std::mutex> lock (m_lock);
+            return m_records;
+        }
+
+        // Sum of the records of label, of all records for nullptr
+        perf_record total (char const * label = nullptr) const
+        {
+            std::lock_guard<std::mutex> lock (m_lock);
+
+            perf_record result;
+            result.label = label ? label : "";
+            for (auto const & record : m_records)
+            {
+                if (!label || std::strcmp (record.label, label) == 0)
+                {
+                    result.ms       += record.ms;
+                    result.sample   += record.sample;
+                }
+            }
+            return result;
+        }
+
+        // Sums of the records of label per worker or per tile, indexed by worker or tile
+        std::vector<perf_record> by_worker (char const * label = nullptr) const
+        {
+            return group_by (label, [] (perf_record const & record) { return record.worker; });
+        }
+
+        std::vector<perf_record> by_tile (char const * label = nullptr) const
+        {
+            return group_by (label, [] (perf_record const & record) { return record.tile; });
+        }
+
+    private:
+        template<typename TKey>
+        std::vector<perf_record> group_by (char const * label, TKey const & key) const
+        {
+            std::lock_guard<std::mutex> lock (m_lock);
+
+            std::vector<perf_record> result;
+            for (auto const & record : m_records)
+            {
+                if (label && std::strcmp (record.label, label) != 0)
+                {
+                    continue;
+                }
+
+                auto const index = key (record);
+                if (index >= result.size ())
+                {
+                    result.resize (index + 1);
+                }
+
+                auto & sum  = result[index];
+                sum.label   = record.label  ;
+                sum.tile    = record.tile   ;
+                sum.worker  = record.worker ;
+                sum.ms      += record.ms    ;
+                sum.sample  += record.sample;
+            }
+            return result;
+        }
+
+        mutable std::mutex          m_lock      ;
+        std::vector<perf_record>    m_records   ;
+    };
+
+#if FRACTAL_PERF_COUNTERS
+    // Counts the calling thread from construction to destruction into log, nothing with a
+    //  null log or when the host cannot count. Two reads of the thread's counter group and
+    //  a locked push_back, so scope a band or a tile, not a pixel.
+    struct perf_scope
+    {
+        perf_scope (perf_log * log, char const * label, unsigned int tile = 0) noexcept
+            :   m_log   (log && details::thread_counters ().is_open () ? log : nullptr)
+            ,   m_label (label)
+            ,   m_tile  (tile)
+        {
+            if (m_log)
+            {
+                m_before = std::chrono::steady_clock::now ();
+                details::thread_counters ().read (m_start);
+            }
+        }
+
+        ~perf_scope () noexcept
+        {
+            if (!m_log)
+            {
+                return;
+            }
+
+            perf_sample end;
+            details::thread_counters ().read (end);
+
+            perf_record record;
+            record.label    = m_label;
+            record.tile     = m_tile;
+            record.worker   = details::perf_worker ();
+            record.ms       = std::chrono::duration<double, std::milli> (std::chrono::steady_clock::now () - m_before).count ();
+            record.sample   = end;
+            for (auto i = 0U; i < perf_events; ++i)
+            {
+                record.sample.values[i] -= m_start.values[i];
+            }
+
+            try
+            {
+                m_log->add (record);
+            }
+            catch (...)
+            {
+                // Out of memory for a record, the counts are lost but not the frame
+            }
+        }
+
+        perf_scope (perf_scope const &)             = delete;
+        perf_scope& operator= (perf_scope const &)  = delete;
+
+    private:
+        perf_log *                              m_log       ;
+        char const *                            m_label     ;
+        unsigned int                            m_tile      ;
+        std::chrono::steady_clock::time_point   m_before    ;
+        perf_sample                             m_start     ;
+    };
+#else
+    struct perf_scope
+    {
+        perf_scope (perf_log *, char const *, unsigned int = 0) noexcept
+        {
+        }
+
+        perf_scope (perf_scope const &)             = delete;
+        perf_scope& operator= (perf_scope const &)  = delete;
+    };
+#endif
+
+    // Hardware counters of the compute and coloring phases of one view, per kernel
+    //  variant, then per worker and per band for the native kernel. Compute bound kernels
+    //  show a high IPC, branch bound ones branch misses and memory bound ones cache and
+    //  TLB misses. Hosts that cannot count get a single line saying so.
+    inline void benchmark_perf_counters (
+            benchmark_report &                  report
+        ,   formula_view const &                view
+        ,   formula                             f
+        ,   precision                           p
+        ,   std::vector<std::uint32_t> const &  colors
+        ,   unsigned int                        band_rows = 16
+        )
+    {
+        auto const group = std::string ("perf counters ") + (view.julia ? "julia" : "mandelbrot");
+
+        if (!perf_log::available ())
+        {
+            report.add (group, "unavailable on this host", 0, 0);
+            return;
+        }
+
+        auto const pixels   = static_cast<std::size_t> (view.width) * view.height;
+        auto const bands    = (view.height + band_rows - 1) / band_rows;
+
+        std::vector<std::uint32_t> counts (pixels);
+        std::vector<std::uint32_t> colored (pixels);
+
+        perf_log log;
+        auto const render = [&] (row_kernel kernel, char const * label)
+        {
+            parallel_for_rows (bands, [&] (unsigned int band)
+            {
+                perf_scope counted (&log, label, band);
+
+                auto const end = std::min ((band + 1) * band_rows, view.height);
+                for (auto y = band * band_rows; y < end; ++y)
+                {
+                    kernel (view, y, counts.data () + static_cast<std::size_t> (y) * view.width);
+                }
+            });
+        };
+
+        auto const add = [&] (std::string const & name, perf_record const & record, std::size_t work)
+        {
+            report.add (group, name + ": " + record.sample.describe (), record.ms, static_cast<double> (work));
+        };
+
+        // Every width at the default unroll, every unroll at the native width
+        auto const widths       = details::precision_widths (p);
+        auto const unrolls      = details::kernel_unroll_factors ();
+        auto const native       = p == precision::float32 ? native_width<float>::value : native_width<double>::value;
+
+        for (auto i = 0U; i < details::kernel_widths + details::kernel_unrolls; ++i)
+        {
+            auto const width    = i < details::kernel_widths ? widths[i] : native;
+            auto const unroll   = i < details::kernel_widths ? default_unroll : unrolls[i - details::kernel_widths];
+            if (i >= details::kernel_widths && unroll == default_unroll)
+            {
+                continue;
+            }
+
+            auto const kernel = select_kernel (f, p, width, unroll);
+            if (!kernel)
+            {
+                continue;
+            }
+
+            log.clear ();
+            render (kernel, "compute");
+            add ("W=" + std::to_string (width) + " K=" + std::to_string (unroll), log.total ("compute"), pixels);
+        }
+
+        auto const kernel = select_kernel (f, p);
+        if (!kernel)
+        {
+            return;
+        }
+
+        log.clear ();
+        render (kernel, "compute");
+
+        auto const palette = cyclic_palette (colors, 0, view.iter);
+        parallel_for_rows (bands, [&] (unsigned int band)
+        {
+            perf_scope counted (&log, "coloring", band);
+
+            auto const begin    = static_cast<std::size_t> (band) * band_rows * view.width;
+            auto const end      = std::min (begin + static_cast<std::size_t> (band_rows) * view.width, pixels);
+            for (auto i = begin; i < end; ++i)
+            {
+                colored[i] = palette (static_cast<unsigned int> (counts[i]));
+            }
+        });
+
+        add ("frame", log.total (), pixels);
+        add ("coloring", log.total ("coloring"), pixels);
+
+        auto const workers = log.by_worker ("compute");
+        for (auto const & worker : workers)
+        {
+            if (worker.sample.valid != 0)
+            {
+                add ("worker " + std::to_string (worker.worker), worker, 0);
+            }
+        }
+
+        // The band that cost the most cycles, usually on the boundary of the set
+        auto const tiles = log.by_tile ("compute");
+        auto const hottest = std::max_element (tiles.begin (), tiles.end (), [] (perf_record const & a, perf_record const & b)
+        {
+            return a.sample[perf_event::cycles] < b.sample[perf_event::cycles];
+        });
+
+        if (hottest != tiles.end ())
+        {
+            add ("hottest band " + std::to_string (hottest->tile) + " of " + std::to_string (bands), *hottest, static_cast<std::size_t> (band_rows) * view.width);
+        }
+    }
+}
@@ -0,0 +1,370 @@
+// ----------------------------------------------------------------------------------------------
+// Copyright (c) Mrten Rnge.
+// ----------------------------------------------------------------------------------------------
+// This source code is subject to terms and conditions of the Microsoft Public License. A
+// copy of the license can be found in the License.html file at the root of this distribution.
+// If you cannot locate the  Microsoft Public License, please send an email to
+// dlr@microsoft.com. By using this source code in any fashion, you are agreeing to be bound
+//  by the terms of the Microsoft Public License.
+// ----------------------------------------------------------------------------------------------
+// You must not remove this notice, or any other, from this software.
+// ----------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "benchmark.h"
+#include "escape_time.h"
+#include "executor.h"
+#include "formulas.h"
+#include "simd.h"
+
+namespace fractal
+{
+    // Structure of arrays input of query_points, count points
+    struct point_inputs
+    {
+        std::size_t     count   = 0         ;
+        // c for Mandelbrot queries, z starts at c like compute_set. z0 for Julia queries.
+        double const *  x       = nullptr   ;
+        double const *  y       = nullptr   ;
+        bool            julia   = false     ;
+        // c of each Julia query, nullptr for param_x and param_y for every point
+        double const *  cx      = nullptr   ;
+        double const *  cy      = nullptr   ;
+        double          param_x = 0         ;
+        double          param_y = 0         ;
+    };
+
+    // Caller owned outputs of query_points, count values each. Only counts is required,
+    //  every other pair is left alone when its arrays are nullptr and costs nothing then.
+    struct point_outputs
+    {
+        // Iterations of z*z + c while |z| < 2, the mandelbrot2 count
+        std::uint32_t * counts  = nullptr   ;
+        // z where the orbit stopped, the first z outside the circle or z after iter steps
+        double *        z_x     = nullptr   ;
+        double *        z_y     = nullptr   ;
+        // dz/dc of a Mandelbrot query, dz/dz0 of a Julia query, at the same step as z
+        double *        dz_x    = nullptr   ;
+        double *        dz_y    = nullptr   ;
+    };
+
+    namespace details
+    {
+        // Points per parallel task
+        std::size_t const point_block = 1024;
+
+FRACTAL_EXACT_FP_BEGIN
+
+        // escape_lanes for z*z + c that also keeps the final z and its derivative. Lanes
+        //  that escaped are frozen with select, so z stays finite and is the z the escape
+        //  test saw. dc is 1 for dz/dc and 0 for dz/dz0.
+        template<bool Derivative, typename TPack>
+        inline TPack orbit_lanes (
+                TPack &         x
+            ,   TPack &         y
+            ,   TPack &         dx
+            ,   TPack &         dy
+            ,   TPack const &   cx
+            ,   TPack const &   cy
+            ,   TPack const &   dc
+            ,   unsigned int    iter
+            ) noexcept
+        {
+            using T = typename TPack::value_type;
+
+            auto const one  = TPack::broadcast (T (1));
+            auto const two  = TPack::broadcast (T (2));
+            auto const four = TPack::broadcast (T (4));
+
+            auto count  = TPack::broadcast (T (0));
+            auto alive  = less (count, one);
+
+            for (auto i = iter; i > 0; --i)
+            {
+                auto x2 = x * x;
+                auto y2 = y * y;
+
+                alive = alive & less (x2 + y2, four);
+                if (!any (alive))
+                {
+                    break;
+                }
+
+                count = count + (alive & one);
+
+                if (Derivative)
+                {
+                    auto const ndx = two * (x * dx - y * dy) + dc;
+                    auto const ndy = two * (x * dy + y * dx);
+                    dx = select (alive, ndx, dx);
+                    dy = select (alive, ndy, dy);
+                }
+
+                // The operation order of formulas::mandelbrot2, so counts match it
+                auto const nx = x2 - y2 + cx;
+                auto const ny = (x + x) * y + cy;
+                x = select (alive, nx, x);
+                y = select (alive, ny, y);
+            }
+
+            return count;
+        }
+
+        template<typename T, unsigned int W, bool Track, bool Derivative>
+        void query_range (
+                point_inputs const &    in
+            ,   point_outputs const &   out
+            ,   unsigned int            iter
+            ,   std::size_t             begin
+            ,   std::size_t             end
+            ) noexcept
+        {
+            using lanes = pack<T, W>;
+
+            T xs    [W];
+            T ys    [W];
+            T cxs   [W];
+            T cys   [W];
+            T counts[W];
+            T zx    [W];
+            T zy    [W];
+            T dzx   [W];
+            T dzy   [W];
+
+            auto const dc = lanes::broadcast (in.julia ? T (0) : T (1));
+
+            for (auto i = begin; i < end; i += W)
+            {
+                // A partial pack repeats its last point rather than iterating padding
+                auto const valid = end - i < W ? static_cast<unsigned int> (end - i) : W;
+                for (auto lane = 0U; lane < W; ++lane)
+                {
+                    auto const j = i + (lane < valid ? lane : valid - 1);
+                    xs[lane]    = static_cast<T> (in.x[j]);
+                    ys[lane]    = static_cast<T> (in.y[j]);
+                    cxs[lane]   = static_cast<T> (in.cx ? in.cx[j] : in.param_x);
+                    cys[lane]   = static_cast<T> (in.cy ? in.cy[j] : in.param_y);
+                }
+
+                auto x  = lanes::load (xs);
+                auto y  = lanes::load (ys);
+                auto cx = in.julia ? lanes::load (cxs) : x;
+                auto cy = in.julia ? lanes::load (cys) : y;
+
+                if (!Track)
+                {
+                    escape_lanes_unrolled<formulas::mandelbrot2, default_unroll> (x, y, cx, cy, iter).store (counts);
+                }
+                else
+                {
+                    auto dx = lanes::broadcast (T (1));
+                    auto dy = lanes::broadcast (T (0));
+
+                    orbit_lanes<Derivative> (x, y, dx, dy, cx, cy, dc, iter).store (counts);
+
+                    x.store (zx);
+                    y.store (zy);
+                    dx.store (dzx);
+                    dy.store (dzy);
+                }
+
+                for (auto lane = 0U; lane < valid; ++lane)
+                {
+                    out.counts[i + lane] = static_cast<std::uint32_t> (counts[lane]);
+                }
+
+                if (Track && out.z_x && out.z_y)
+                {
+                    for (auto lane = 0U; lane < valid; ++lane)
+                    {
+                        out.z_x[i + lane] = zx[lane];
+                        out.z_y[i + lane] = zy[lane];
+                    }
+                }
+
+                if (Derivative)
+                {
+                    for (auto lane = 0U; lane < valid; ++lane)
+                    {
+                        out.dz_x[i + lane] = dzx[lane];
+                        out.dz_y[i + lane] = dzy[lane];
+                    }
+                }
+            }
+        }
+
+        template<typename T>
+        void query_range (
+                point_inputs const &    in
+            ,   point_outputs const &   out
+            ,   unsigned int            iter
+            ,   std::size_t             begin
+            ,   std::size_t             end
+            ) noexcept
+        {
+            auto const W = native_width<T>::value;
+
+            if (out.dz_x && out.dz_y)
+            {
+                query_range<T, W, true, true> (in, out, iter, begin, end);
+            }
+            else if (out.z_x && out.z_y)
+            {
+                query_range<T, W, true, false> (in, out, iter, begin, end);
+            }
+            else
+            {
+                query_range<T, W, false, false> (in, out, iter, begin, end);
+            }
+        }
+
+FRACTAL_EXACT_FP_END
+
+        template<typename TForEach>
+        bool query_points (
+                point_inputs const &    in
+            ,   point_outputs const &   out
+            ,   unsigned int            iter
+            ,   precision               p
+            ,   TForEach const &        for_each
+            )
+        {
+            if (!in.x || !in.y || !out.counts || (p != precision::float32 && p != precision::float64))
+            {
+                return false;
+            }
+
+            auto const blocks = static_cast<unsigned int> ((in.count + point_block - 1) / point_block);
+
+            for_each (blocks, [&] (unsigned int block)
+            {
+                auto const begin    = block * point_block;
+                auto const end      = begin + point_block < in.count ? begin + point_block : in.count;
+
+                if (p == precision::float32)
+                {
+                    query_range<float> (in, out, iter, begin, end);
+                }
+                else
+                {
+                    query_range<double> (in, out, iter, begin, end);
+                }
+            });
+
+            return true;
+        }
+    }
+
+    // Escape counts, and on request final z and derivatives, of arbitrary points rather
+    //  than a pixel grid. Points go through the SIMD kernels a native pack at a time, in
+    //  parallel blocks of points. Nothing is allocated for the points, all results go
+    //  straight into the caller's arrays. Only float32 and float64 are supported, false
+    //  for anything else or missing inputs.
+    inline bool query_points (
+            point_inputs const &    in
+        ,   point_outputs const &   out
+        ,   unsigned int            iter
+        ,   precision               p = precision::float64
+        )
+    {
+        return details::query_points (in, out, iter, p, [] (unsigned int count, auto const & body)
+        {
+            parallel_for_rows (count, body);
+        });
+    }
+
+    // Same on a chosen executor backend. The thread pool backend hands out work without
+    //  allocating, which makes the whole call allocation free.
+    inline bool query_points (
+            point_inputs const &    in
+        ,   point_outputs const &   out
+        ,   unsigned int            iter
+        ,   executor &              blocks
+        ,   precision               p = precision::float64
+        )
+    {
+        return details::query_points (in, out, iter, p, [&] (unsigned int count, auto const & body)
+        {
+            blocks.for_each (count, body);
+        });
+    }
+
+    // Times batches of random points around the Mandelbrot set against the scalar
+    //  mandelbrot2 a point at a time
+    inline void benchmark_point_query (
+            benchmark_report &  report
+        ,   unsigned int        iter
+        ,   std::size_t         points  = 1 << 20
+        ,   unsigned int        repeats = 3
+        )
+    {
+        std::vector<double>         x       (points);
+        std::vector<double>         y       (points);
+        std::vector<std::uint32_t>  counts  (points);
+        std::vector<double>         z_x     (points);
+        std::vector<double>         z_y     (points);
+        std::vector<double>         dz_x    (points);
+        std::vector<double>         dz_y    (points);
+
+        // Fixed seed so every run queries the same points
+        auto state = std::uint64_t (0x9E3779B97F4A7C15ULL);
+        auto const next = [&state] ()
+        {
+            state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+            return static_cast<double> (state >> 11) / 9007199254740992.0;
+        };
+
+        for (auto i = std::size_t (); i < points; ++i)
+        {
+            x[i] = next () * 3 - 2;
+            y[i] = next () * 3 - 1.5;
+        }
+
+        auto const group = "point query " + std::to_string (points);
+
+        auto ms = measure_ms (repeats, [&] ()
+        {
+            for (auto i = std::size_t (); i < points; ++i)
+            {
+                counts[i] = mandelbrot2 (x[i], y[i], x[i], y[i], iter);
+            }
+        });
+        report.add (group, "scalar, serial", ms, static_cast<double> (points));
+
+        point_inputs in;
+        in.count    = points    ;
+        in.x        = x.data () ;
+        in.y        = y.data () ;
+
+        point_outputs out;
+        out.counts  = counts.data ();
+
+        ms = measure_ms (repeats, [&] ()
+        {
+            query_points (in, out, iter, precision::float32);
+        });
+        report.add (group, "batch float32, counts", ms, static_cast<double> (points));
+
+        ms = measure_ms (repeats, [&] ()
+        {
+            query_points (in, out, iter, precision::float64);
+        });
+        report.add (group, "batch float64, counts", ms, static_cast<double> (points));
+
+        out.z_x     = z_x.data ()   ;
+        out.z_y     = z_y.data ()   ;
+        out.dz_x    = dz_x.data ()  ;
+        out.dz_y    = dz_y.data ()  ;
+
+        ms = measure_ms (repeats, [&] ()
+        {
+            query_points (in, out, iter, precision::float64);
+        });
+        report.add (group, "batch float64, z and dz/dc", ms, static_cast<double> (points));
+    }
+}
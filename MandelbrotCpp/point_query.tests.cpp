@@ -0,0 +1,181 @@
+// ----------------------------------------------------------------------------------------------
+// Copyright (c) Mrten Rnge.
+// ----------------------------------------------------------------------------------------------
+// This source code is subject to terms and conditions of the Microsoft Public License. A
+// copy of the license can be found in the License.html file at the root of this distribution.
+// If you cannot locate the  Microsoft Public License, please send an email to
+// dlr@microsoft.com. By using this source code in any fashion, you are agreeing to be bound
+//  by the terms of the Microsoft Public License.
+// ----------------------------------------------------------------------------------------------
+// You must not remove this notice, or any other, from this software.
+// ----------------------------------------------------------------------------------------------
+
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#include "escape_time.h"
+#include "executor.h"
+#include "point_query.h"
+#include "tests.h"
+
+namespace
+{
+    using namespace fractal;
+
+    unsigned int const iter = 500;
+
+    // More than one block of points and not a whole number of packs, so the last pack of
+    //  the last block is partial
+    std::size_t const point_count = 2 * details::point_block + 37;
+
+    struct points
+    {
+        std::vector<double> x   ;
+        std::vector<double> y   ;
+        std::vector<double> cx  ;
+        std::vector<double> cy  ;
+    };
+
+    // Fixed seed, around the set and along its boundary where counts vary the most
+    points make_points ()
+    {
+        auto state = std::uint64_t (0x2545F4914F6CDD1DULL);
+        auto const next = [&state] ()
+        {
+            state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+            return static_cast<double> (state >> 11) / 9007199254740992.0;
+        };
+
+        points result;
+        for (auto i = std::size_t (); i < point_count; ++i)
+        {
+            auto const boundary = i % 2 == 1;
+            result.x.push_back (boundary ? -0.7453 + (next () - 0.5) * 0.01 : next () * 3 - 2);
+            result.y.push_back (boundary ? 0.1127 + (next () - 0.5) * 0.01 : next () * 3 - 1.5);
+            result.cx.push_back (-0.8 + (next () - 0.5) * 0.2);
+            result.cy.push_back (0.156 + (next () - 0.5) * 0.2);
+        }
+        return result;
+    }
+
+    // The scalar mandelbrot2 in the query's precision
+    template<typename T>
+    std::uint32_t expected_count (point_inputs const & in, std::size_t i)
+    {
+        auto const x = static_cast<T> (in.x[i]);
+        auto const y = static_cast<T> (in.y[i]);
+        if (!in.julia)
+        {
+            return mandelbrot2 (x, y, x, y, iter);
+        }
+
+        auto const cx = static_cast<T> (in.cx ? in.cx[i] : in.param_x);
+        auto const cy = static_cast<T> (in.cy ? in.cy[i] : in.param_y);
+        return mandelbrot2 (x, y, cx, cy, iter);
+    }
+
+    std::size_t wrong_counts (point_inputs const & in, precision p, std::vector<std::uint32_t> const & counts)
+    {
+        auto wrong = std::size_t ();
+        for (auto i = std::size_t (); i < in.count; ++i)
+        {
+            auto const expected = p == precision::float32
+                ? expected_count<float> (in, i)
+                : expected_count<double> (in, i)
+                ;
+            wrong += counts[i] != expected;
+        }
+        return wrong;
+    }
+
+    // Counts alone take the unrolled kernel, with z or dz requested the tracking kernel,
+    //  every one of them must count like mandelbrot2
+    FRACTAL_TEST (point_query_agrees_with_mandelbrot2)
+    {
+        auto const queried = make_points ();
+
+        std::vector<std::uint32_t>  counts  (point_count);
+        std::vector<double>         z_x     (point_count);
+        std::vector<double>         z_y     (point_count);
+        std::vector<double>         dz_x    (point_count);
+        std::vector<double>         dz_y    (point_count);
+
+        auto wrong_cases = 0U;
+
+        for (auto julia : {0, 1, 2})
+        {
+            point_inputs in;
+            in.count    = point_count           ;
+            in.x        = queried.x.data ()     ;
+            in.y        = queried.y.data ()     ;
+            in.julia    = julia != 0            ;
+            in.param_x  = -0.8                  ;
+            in.param_y  = 0.156                 ;
+            // One c for every point, then a c per point
+            in.cx       = julia == 2 ? queried.cx.data () : nullptr;
+            in.cy       = julia == 2 ? queried.cy.data () : nullptr;
+
+            for (auto p : {precision::float32, precision::float64})
+            {
+                for (auto outputs : {0, 1, 2})
+                {
+                    point_outputs out;
+                    out.counts  = counts.data ();
+                    out.z_x     = outputs >= 1 ? z_x.data ()  : nullptr;
+                    out.z_y     = outputs >= 1 ? z_y.data ()  : nullptr;
+                    out.dz_x    = outputs >= 2 ? dz_x.data () : nullptr;
+                    out.dz_y    = outputs >= 2 ? dz_y.data () : nullptr;
+
+                    std::fill (counts.begin (), counts.end (), ~std::uint32_t ());
+                    CHECK (query_points (in, out, iter, p));
+
+                    if (auto const wrong = wrong_counts (in, p, counts))
+                    {
+                        std::printf ("          julia %d, %u bit, outputs %d: %zu counts differ\n", julia, static_cast<unsigned int> (p), outputs, wrong);
+                        ++wrong_cases;
+                    }
+                }
+            }
+        }
+
+        CHECK (wrong_cases == 0);
+    }
+
+    FRACTAL_TEST (point_query_on_an_executor_matches)
+    {
+        auto const queried = make_points ();
+
+        point_inputs in;
+        in.count    = point_count       ;
+        in.x        = queried.x.data () ;
+        in.y        = queried.y.data () ;
+
+        std::vector<std::uint32_t> counts (point_count);
+        point_outputs out;
+        out.counts  = counts.data ();
+
+        auto pool = make_executor (executor_kind::thread_pool);
+        CHECK (pool);
+        CHECK (query_points (in, out, iter, *pool, precision::float64));
+        CHECK (wrong_counts (in, precision::float64, counts) == 0);
+    }
+
+    FRACTAL_TEST (point_query_rejects_fixed_point)
+    {
+        double const x = 0;
+        std::uint32_t count = 0;
+
+        point_inputs in;
+        in.count    = 1     ;
+        in.x        = &x    ;
+        in.y        = &x    ;
+
+        point_outputs out;
+        out.counts  = &count;
+
+        CHECK (!query_points (in, out, iter, precision::fixed128));
+    }
+}
@@ -0,0 +1,635 @@
+// ----------------------------------------------------------------------------------------------
+// Copyright (c) Mrten Rnge.
+// ----------------------------------------------------------------------------------------------
+// This source code is subject to terms and conditions of the Microsoft Public License. A
+// copy of the license can be found in the License.html file at the root of this distribution.
+// If you cannot locate the  Microsoft Public License, please send an email to
+// dlr@microsoft.com. By using this source code in any fashion, you are agreeing to be bound
+//  by the terms of the Microsoft Public License.
+// ----------------------------------------------------------------------------------------------
+// You must not remove this notice, or any other, from this software.
+// ----------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "benchmark.h"
+#include "formulas.h"
+#include "lane_refill.h"
+#include "perf_counters.h"
+
+namespace fractal
+{
+    enum class session_priority
+    {
+        interactive ,
+        batch       ,
+    };
+
+    struct render_session;
+
+    struct session_options
+    {
+        formula_view                                    view                                        ;
+        formula                                         kernel_formula      = formula::mandelbrot2  ;
+        precision                                       kernel_precision    = precision::float32    ;
+        // SIMD width and unroll factor of the kernel, 0 for what select_kernel picks. The
+        //  lane refill kernel ignores the unroll factor.
+        unsigned int                                    kernel_width        = 0                     ;
+        unsigned int                                    kernel_unroll       = 0                     ;
+        bool                                            kernel_refill       = false                 ;
+        session_priority                                priority            = session_priority::interactive;
+        // Share of the workers relative to the other sessions of the same priority
+        double                                          weight              = 1                     ;
+        // Milliseconds from submit the frame is due in, 0 for none
+        double                                          deadline_ms         = 0                     ;
+        // Rows per band, the unit the scheduler hands out
+        unsigned int                                    band_rows           = 16                    ;
+        // Only rows [row_begin, row_end) of the view are rendered, row_end 0 for all of them
+        unsigned int                                    row_begin           = 0                     ;
+        unsigned int                                    row_end             = 0                     ;
+        // view.width * view.height counts the frame is rendered into, nullptr to have the
+        //  session own them
+        std::uint32_t *                                 counts              = nullptr               ;
+        // Hardware counters of every band go here, tile is the band, nullptr for none
+        perf_log *                                      counters            = nullptr               ;
+        // Called on the worker thread that rendered rows [row_begin, row_end), in no
+        //  particular order. Lets an output stage consume a frame while it renders.
+        std::function<void (render_session const &, unsigned int, unsigned int)>   band_completed  ;
+        // Called on a worker thread once the last band is rendered or the session cancelled
+        std::function<void (render_session const &)>    completed                                   ;
+    };
+
+    // One frame of one viewer or batch job, rendered a band of rows at a time by the
+    //  shared scheduler. Everything about the view is the session's own.
+    struct render_session
+    {
+        using ptr   = std::shared_ptr<render_session>;
+        using clock = std::chrono::steady_clock;
+
+        inline session_options const & options () const noexcept
+        {
+            return m_options;
+        }
+
+        // The frame's escape counts, complete once done
+        inline std::uint32_t const * counts () const noexcept
+        {
+            return m_counts;
+        }
+
+        inline bool done () const noexcept
+        {
+            return m_done.load (std::memory_order_acquire);
+        }
+
+        inline bool cancelled () const noexcept
+        {
+            return m_cancelled.load (std::memory_order_acquire);
+        }
+
+        // Finished after its deadline
+        inline bool late () const noexcept
+        {
+            return m_late;
+        }
+
+        // Submit to done, valid once done
+        inline double latency_ms () const noexcept
+        {
+            return std::chrono::duration<double, std::milli> (m_finished - m_submitted).count ();
+        }
+
+        void wait ()
+        {
+            std::unique_lock<std::mutex> lock (m_lock);
+            m_finished_signal.wait (lock, [this] () { return done (); });
+        }
+
+    private:
+        friend struct render_scheduler;
+
+        explicit render_session (session_options options)
+            :   m_options (std::move (options))
+        {
+        }
+
+        render_session (render_session const &)             = delete;
+        render_session& operator= (render_session const &)  = delete;
+
+        session_options             m_options                   ;
+        row_kernel                  m_kernel        = nullptr   ;
+        std::vector<std::uint32_t>  m_owned                     ;
+        std::uint32_t *             m_counts        = nullptr   ;
+
+        unsigned int                m_bands         = 0         ;
+        unsigned int                m_next_band     = 0         ;
+        unsigned int                m_finished_bands= 0         ;
+        unsigned int                m_in_flight     = 0         ;
+
+        // Virtual time: work charged to the session divided by its weight
+        double                      m_pass          = 0         ;
+        double                      m_band_ms       = 1         ;
+        std::uint64_t               m_order         = 0         ;
+
+        clock::time_point           m_submitted                 ;
+        clock::time_point           m_deadline                  ;
+        clock::time_point           m_finished                  ;
+        bool                        m_late          = false     ;
+
+        std::atomic<bool>           m_done          {false}     ;
+        std::atomic<bool>           m_cancelled     {false}     ;
+        // Off the scheduler's list and finished or about to be, guarded by its lock
+        bool                        m_retired       = false     ;
+        std::mutex                  m_lock                      ;
+        std::condition_variable     m_finished_signal           ;
+    };
+
+    // Renders bands of rows of any number of sessions on one set of workers.
+    //
+    //  Which band goes next:
+    //   - Interactive sessions before batch ones, but batch sessions with bands left get
+    //     at least batch_share of the recent worker time so they are never starved. The
+    //     share is in measured time, not bands, as a deep zoom band costs many frames'.
+    //   - Within a priority the session whose deadline is in danger, the earliest first.
+    //     A deadline is in danger once the bands left at the session's measured band time
+    //     would take more than half the time left.
+    //   - Otherwise the session with the least virtual time, the measured milliseconds of
+    //     its bands divided by its weight. A deep zoom pays for its expensive bands, so it
+    //     gets fewer of them instead of more time. New sessions start at the least virtual
+    //     time of the running ones so they cannot claim what they did not use.
+    //
+    //  The fifo policy hands out bands strictly in submit order, to compare against.
+    struct render_scheduler
+    {
+        using ptr   = std::unique_ptr<render_scheduler>;
+        using clock = render_session::clock;
+
+        enum class policy
+        {
+            fair    ,
+            fifo    ,
+        };
+
+        struct statistics
+        {
+            std::uint64_t   bands       ;
+            std::uint64_t   sessions    ;
+            std::uint64_t   late        ;
+            std::uint64_t   cancelled   ;
+        };
+
+        static ptr create (unsigned int workers = 0, policy order = policy::fair)
+        {
+            if (workers == 0)
+            {
+                workers = std::thread::hardware_concurrency ();
+                workers = workers == 0 ? 1 : workers;
+            }
+
+            return ptr (new render_scheduler (workers, order));
+        }
+
+        // Cancels what is not rendered yet and waits for the bands in flight
+        ~render_scheduler () noexcept
+        {
+            {
+                std::lock_guard<std::mutex> lock (m_lock);
+                m_stopping = true;
+                for (auto & session : m_sessions)
+                {
+                    session->m_cancelled.store (true, std::memory_order_release);
+                }
+            }
+            m_work.notify_all ();
+
+            for (auto & worker : m_workers)
+            {
+                worker.join ();
+            }
+
+            for (auto & session : m_sessions)
+            {
+                session->m_retired = true;
+                finish (*session);
+            }
+        }
+
+        // nullptr when the formula has no kernel at the requested precision or there are no
+        //  rows to render
+        render_session::ptr submit (session_options options)
+        {
+            auto kernel = options.kernel_refill
+                ? select_refill_kernel (options.kernel_formula, options.kernel_precision, options.kernel_width)
+                : select_kernel (options.kernel_formula, options.kernel_precision, options.kernel_width, options.kernel_unroll)
+                ;
+            if (!kernel || options.view.width == 0 || options.view.height == 0)
+            {
+                return nullptr;
+            }
+
+            options.band_rows   = options.band_rows > 0 ? options.band_rows : 1;
+            options.weight      = options.weight > 0 ? options.weight : 1;
+            options.row_end     = options.row_end > 0 && options.row_end < options.view.height ? options.row_end : options.view.height;
+            if (options.row_begin >= options.row_end)
+            {
+                return nullptr;
+            }
+
+            render_session::ptr session (new render_session (std::move (options)));
+            auto & o = session->m_options;
+
+            session->m_kernel       = kernel;
+            session->m_bands        = (o.row_end - o.row_begin + o.band_rows - 1) / o.band_rows;
+            session->m_submitted    = clock::now ();
+            session->m_deadline     = session->m_submitted + std::chrono::microseconds (static_cast<std::int64_t> (o.deadline_ms * 1000));
+
+            if (o.counts)
+            {
+                session->m_counts = o.counts;
+            }
+            else
+            {
+                session->m_owned.resize (static_cast<std::size_t> (o.view.width) * o.view.height);
+                session->m_counts = session->m_owned.data ();
+            }
+
+            {
+                std::lock_guard<std::mutex> lock (m_lock);
+
+                auto pass = -1.0;
+                for (auto const & running : m_sessions)
+                {
+                    if (running->m_options.priority == o.priority)
+                    {
+                        pass = pass < 0 || running->m_pass < pass ? running->m_pass : pass;
+                    }
+                }
+
+                session->m_pass     = pass < 0 ? 0 : pass;
+                session->m_order    = m_submitted++;
+                m_sessions.push_back (session);
+            }
+            m_work.notify_all ();
+
+            return session;
+        }
+
+        // Hands out no more bands of session, the ones in flight are still rendered. The
+        //  session is done once they are.
+        void cancel (render_session::ptr const & session)
+        {
+            std::unique_lock<std::mutex> lock (m_lock);
+            if (session->m_retired || session->cancelled ())
+            {
+                return;
+            }
+
+            session->m_cancelled.store (true, std::memory_order_release);
+            if (session->m_in_flight == 0 && retire (*session))
+            {
+                lock.unlock ();
+                finish (*session);
+            }
+        }
+
+        statistics stats () const
+        {
+            std::lock_guard<std::mutex> lock (m_lock);
+            return statistics {m_bands_rendered, m_sessions_done, m_late, m_cancelled};
+        }
+
+        inline unsigned int workers () const noexcept
+        {
+            return static_cast<unsigned int> (m_workers.size ());
+        }
+
+        static constexpr double batch_share = 0.1;
+
+    private:
+        render_scheduler (unsigned int workers, policy order)
+            :   m_policy (order)
+        {
+            for (auto worker = 0U; worker < workers; ++worker)
+            {
+                m_workers.emplace_back ([this] () { work (); });
+            }
+        }
+
+        render_scheduler (render_scheduler const &)             = delete;
+        render_scheduler& operator= (render_scheduler const &)  = delete;
+
+        static bool runnable (render_session const & session) noexcept
+        {
+            return session.m_next_band < session.m_bands && !session.cancelled ();
+        }
+
+        bool endangered (render_session const & session, clock::time_point now) const noexcept
+        {
+            if (session.m_options.deadline_ms <= 0)
+            {
+                return false;
+            }
+
+            auto const left_ms  = std::chrono::duration<double, std::milli> (session.m_deadline - now).count ();
+            auto const bands    = session.m_bands - session.m_next_band;
+            return bands * session.m_band_ms > left_ms / 2;
+        }
+
+        // Called under m_lock
+        render_session * pick (clock::time_point now)
+        {
+            render_session * first          = nullptr;
+            auto any_interactive            = false;
+            auto any_batch                  = false;
+
+            for (auto & session : m_sessions)
+            {
+                if (!runnable (*session))
+                {
+                    continue;
+                }
+
+                if (!first || session->m_order < first->m_order)
+                {
+                    first = session.get ();
+                }
+
+                auto const batch = session->m_options.priority == session_priority::batch;
+                any_batch       |= batch;
+                any_interactive |= !batch;
+            }
+
+            if (!first || m_policy == policy::fifo)
+            {
+                return first;
+            }
+
+            auto const batch_ms = m_recent_ms[static_cast<int> (session_priority::batch)];
+            auto const total_ms = batch_ms + m_recent_ms[static_cast<int> (session_priority::interactive)];
+
+            auto const priority = any_interactive && !(any_batch && batch_ms < batch_share * total_ms)
+                ? session_priority::interactive
+                : session_priority::batch
+                ;
+
+            render_session * urgent = nullptr;
+            render_session * fair   = nullptr;
+            for (auto & session : m_sessions)
+            {
+                if (!runnable (*session) || session->m_options.priority != priority)
+                {
+                    continue;
+                }
+
+                if (endangered (*session, now) && (!urgent || session->m_deadline < urgent->m_deadline))
+                {
+                    urgent = session.get ();
+                }
+
+                if (!fair || session->m_pass < fair->m_pass)
+                {
+                    fair = session.get ();
+                }
+            }
+
+            return urgent ? urgent : fair;
+        }
+
+        void work ()
+        {
+            std::unique_lock<std::mutex> lock (m_lock);
+            for (;;)
+            {
+                render_session * session = nullptr;
+                m_work.wait (lock, [&] ()
+                {
+                    session = m_stopping ? nullptr : pick (clock::now ());
+                    return m_stopping || session;
+                });
+
+                if (!session)
+                {
+                    return;
+                }
+
+                // Keep the session alive even if it is finished and dropped meanwhile
+                render_session::ptr keep;
+                for (auto & s : m_sessions)
+                {
+                    if (s.get () == session)
+                    {
+                        keep = s;
+                    }
+                }
+
+                auto const band     = session->m_next_band++;
+                auto const estimate = session->m_band_ms;
+                session->m_pass     += estimate / session->m_options.weight;
+                ++session->m_in_flight;
+
+                lock.unlock ();
+
+                auto const & view   = session->m_options.view;
+                auto const begin    = session->m_options.row_begin + band * session->m_options.band_rows;
+                auto const end      = std::min (begin + session->m_options.band_rows, session->m_options.row_end);
+
+                auto const before   = clock::now ();
+                {
+                    perf_scope counted (session->m_options.counters, "band", band);
+                    for (auto y = begin; y < end; ++y)
+                    {
+                        session->m_kernel (view, y, session->m_counts + static_cast<std::size_t> (y) * view.width);
+                    }
+                }
+                auto const ms       = std::chrono::duration<double, std::milli> (clock::now () - before).count ();
+
+                if (session->m_options.band_completed && !session->cancelled ())
+                {
+                    session->m_options.band_completed (*session, begin, end);
+                }
+
+                lock.lock ();
+
+                // Charge what the band actually cost instead of the estimate
+                session->m_pass     += (ms - estimate) / session->m_options.weight;
+                session->m_band_ms  = session->m_band_ms + (ms - session->m_band_ms) / 4;
+                ++session->m_finished_bands;
+
+                // Worker time per priority, decaying so only the last few hundred bands count
+                for (auto & recent : m_recent_ms)
+                {
+                    recent *= 255.0 / 256;
+                }
+                m_recent_ms[static_cast<int> (session->m_options.priority)] += ms;
+
+                --session->m_in_flight;
+                ++m_bands_rendered;
+
+                auto const complete = session->m_in_flight == 0 && (session->m_finished_bands == session->m_bands || session->cancelled ());
+                if (complete && retire (*session))
+                {
+                    lock.unlock ();
+                    finish (*session);
+                    lock.lock ();
+                }
+            }
+        }
+
+        // Called under m_lock. Takes session off the list, true only for the one caller
+        //  that gets to finish it: a cancel can race the worker that rendered the last band
+        //  between its unlock and finish.
+        bool retire (render_session & session)
+        {
+            if (session.m_retired)
+            {
+                return false;
+            }
+
+            session.m_retired = true;
+
+            auto const found = std::find_if (m_sessions.begin (), m_sessions.end (), [&] (render_session::ptr const & s)
+            {
+                return s.get () == &session;
+            });
+            if (found != m_sessions.end ())
+            {
+                m_sessions.erase (found);
+            }
+
+            return true;
+        }
+
+        // Runs once per session, after retire
+        void finish (render_session & session)
+        {
+            session.m_finished  = clock::now ();
+            session.m_late      = session.m_options.deadline_ms > 0 && session.m_finished > session.m_deadline;
+
+            {
+                std::lock_guard<std::mutex> lock (m_lock);
+                ++m_sessions_done;
+                m_late      += session.m_late ? 1 : 0;
+                m_cancelled += session.cancelled () ? 1 : 0;
+            }
+
+            if (session.m_options.completed)
+            {
+                session.m_options.completed (session);
+            }
+
+            {
+                std::lock_guard<std::mutex> lock (session.m_lock);
+                session.m_done.store (true, std::memory_order_release);
+            }
+            session.m_finished_signal.notify_all ();
+        }
+
+        policy                                  m_policy                ;
+        mutable std::mutex                      m_lock                  ;
+        std::condition_variable                 m_work                  ;
+        std::vector<render_session::ptr>        m_sessions              ;
+        std::vector<std::thread>                m_workers               ;
+        bool                                    m_stopping      = false ;
+        double                                  m_recent_ms[2]  {}      ;
+        std::uint64_t                           m_submitted     = 0     ;
+        std::uint64_t                           m_bands_rendered= 0     ;
+        std::uint64_t                           m_sessions_done = 0     ;
+        std::uint64_t                           m_late          = 0     ;
+        std::uint64_t                           m_cancelled     = 0     ;
+    };
+
+    // Interactive viewers each render frames back to back while one deep zoom batch job
+    //  is running, with the fifo and the fair policy. Reported are the interactive frame
+    //  latencies, the batch job's time and the frames that missed their deadline.
+    inline void benchmark_scheduler (
+            benchmark_report &      report
+        ,   formula_view            interactive
+        ,   formula_view            batch
+        ,   unsigned int            viewers     = 4
+        ,   unsigned int            frames      = 16
+        ,   double                  deadline_ms = 100
+        )
+    {
+        for (auto order : {render_scheduler::policy::fifo, render_scheduler::policy::fair})
+        {
+            auto scheduler = render_scheduler::create (0, order);
+
+            session_options batch_options;
+            batch_options.view                  = batch                     ;
+            batch_options.kernel_precision      = precision::float64        ;
+            batch_options.priority              = session_priority::batch   ;
+
+            auto job = scheduler->submit (batch_options);
+            if (!job)
+            {
+                return;
+            }
+
+            std::mutex                  latencies_lock;
+            std::vector<double>         latencies;
+            std::vector<std::thread>    clients;
+
+            for (auto viewer = 0U; viewer < viewers; ++viewer)
+            {
+                clients.emplace_back ([&, viewer] ()
+                {
+                    auto options            = session_options ();
+                    options.view            = interactive;
+                    options.deadline_ms     = deadline_ms;
+
+                    for (auto frame = 0U; frame < frames; ++frame)
+                    {
+                        // Every viewer pans a little every frame
+                        options.view.center_x = interactive.center_x + 0.01 * (viewer + frame) / interactive.zoom;
+
+                        auto session = scheduler->submit (options);
+                        session->wait ();
+
+                        std::lock_guard<std::mutex> lock (latencies_lock);
+                        latencies.push_back (session->latency_ms ());
+                    }
+                });
+            }
+
+            for (auto & client : clients)
+            {
+                client.join ();
+            }
+            job->wait ();
+
+            std::sort (latencies.begin (), latencies.end ());
+            auto const p50 = latencies[latencies.size () / 2];
+            auto const p99 = latencies[std::min (latencies.size () - 1, latencies.size () * 99 / 100)];
+
+            auto const stats = scheduler->stats ();
+
+            char name[128];
+            std::snprintf (
+                    name
+                ,   sizeof (name)
+                ,   "%s, p50 %.1f ms, batch %.0f ms, %u late"
+                ,   order == render_scheduler::policy::fifo ? "fifo" : "fair"
+                ,   p50
+                ,   job->latency_ms ()
+                ,   static_cast<unsigned int> (stats.late)
+                );
+
+            // The time column is the p99 frame latency
+            report.add ("scheduler interactive p99", name, p99, 0);
+        }
+    }
+}
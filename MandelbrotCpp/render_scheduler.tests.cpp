@@ -0,0 +1,127 @@
+// ----------------------------------------------------------------------------------------------
+// Copyright (c) Mrten Rnge.
+// ----------------------------------------------------------------------------------------------
+// This source code is subject to terms and conditions of the Microsoft Public License. A
+// copy of the license can be found in the License.html file at the root of this distribution.
+// If you cannot locate the  Microsoft Public License, please send an email to
+// dlr@microsoft.com. By using this source code in any fashion, you are agreeing to be bound
+//  by the terms of the Microsoft Public License.
+// ----------------------------------------------------------------------------------------------
+// You must not remove this notice, or any other, from this software.
+// ----------------------------------------------------------------------------------------------
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "render_scheduler.h"
+#include "tests.h"
+
+namespace
+{
+    using namespace fractal;
+
+    session_options small_session (unsigned int band_rows = 1)
+    {
+        session_options options;
+        options.view.width      = 64    ;
+        options.view.height     = 64    ;
+        options.view.iter       = 64    ;
+        options.view.zoom       = 0.5   ;
+        options.band_rows       = band_rows;
+        return options;
+    }
+
+    // A cancel landing after the last band but before the session is marked done used
+    //  to erase end () and finish the session a second time
+    FRACTAL_TEST (render_scheduler_cancel_while_finishing_completes_once)
+    {
+        auto scheduler = render_scheduler::create (1);
+
+        std::atomic<int>    completions {0};
+        std::promise<void>  finishing;
+
+        auto options = small_session (64);
+        options.completed = [&] (render_session const &)
+        {
+            if (completions++ == 0)
+            {
+                finishing.set_value ();
+            }
+            std::this_thread::sleep_for (std::chrono::milliseconds (50));
+        };
+
+        auto session = scheduler->submit (options);
+        CHECK (session);
+
+        finishing.get_future ().wait ();
+        scheduler->cancel (session);
+        session->wait ();
+
+        CHECK (completions == 1);
+        CHECK (!session->cancelled ());
+        CHECK (scheduler->stats ().sessions == 1);
+        CHECK (scheduler->stats ().cancelled == 0);
+    }
+
+    FRACTAL_TEST (render_scheduler_cancel_races_workers_complete_once)
+    {
+        auto scheduler = render_scheduler::create (4);
+
+        auto const sessions = 200U;
+        std::vector<std::atomic<int>>       completions (sessions);
+        std::vector<render_session::ptr>    submitted;
+
+        for (auto i = 0U; i < sessions; ++i)
+        {
+            auto options = small_session (1 + i % 8);
+            options.completed = [&completions, i] (render_session const &) { ++completions[i]; };
+
+            submitted.push_back (scheduler->submit (options));
+            CHECK (submitted.back ());
+
+            // Cancel some right away, some part way and some probably after they finished
+            if (i % 3 == 0)
+            {
+                std::this_thread::sleep_for (std::chrono::microseconds ((i * 37) % 500));
+                scheduler->cancel (submitted.back ());
+            }
+        }
+
+        for (auto i = 0U; i < sessions; ++i)
+        {
+            scheduler->cancel (submitted[i]);
+            submitted[i]->wait ();
+        }
+
+        for (auto const & count : completions)
+        {
+            CHECK (count == 1);
+        }
+        CHECK (scheduler->stats ().sessions == sessions);
+    }
+
+    FRACTAL_TEST (render_scheduler_destructor_finishes_pending_sessions)
+    {
+        std::atomic<int> completions {0};
+
+        auto options = small_session ();
+        options.view.width  = 1024;
+        options.view.height = 1024;
+        options.view.iter   = 4096;
+        options.completed   = [&] (render_session const &) { ++completions; };
+
+        render_session::ptr session;
+        {
+            auto scheduler = render_scheduler::create (1);
+            session = scheduler->submit (options);
+            CHECK (session);
+        }
+
+        CHECK (session->done ());
+        CHECK (completions == 1);
+    }
+}
@@ -0,0 +1,670 @@
+// ----------------------------------------------------------------------------------------------
+// Copyright (c) Mrten Rnge.
+// ----------------------------------------------------------------------------------------------
+// This source code is subject to terms and conditions of the Microsoft Public License. A
+// copy of the license can be found in the License.html file at the root of this distribution.
+// If you cannot locate the  Microsoft Public License, please send an email to
+// dlr@microsoft.com. By using this source code in any fashion, you are agreeing to be bound
+//  by the terms of the Microsoft Public License.
+// ----------------------------------------------------------------------------------------------
+// You must not remove this notice, or any other, from this software.
+// ----------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <vector>
+
+#include "benchmark.h"
+#include "escape_time.h"
+#include "formulas.h"
+#include "mapped_file.h"
+#include "simd.h"
+
+namespace fractal
+{
+    struct resumable_options
+    {
+        // view.iter is the first iteration limit
+        formula_view    view                                    ;
+        formula         kernel_formula  = formula::mandelbrot2  ;
+        // Also keeps dz/dc (dz/dz0 for Julia views) of the unfinished pixels, z*z + c only
+        bool            derivative      = false                 ;
+    };
+
+    namespace details
+    {
+        // Pixels per parallel task
+        std::size_t const resumable_block = 1024;
+
+        // The unfinished pixels of a resumable frame, structure of arrays
+        struct resumable_pixels
+        {
+            std::vector<std::uint32_t>  index   ;
+            std::vector<double>         z_x     ;
+            std::vector<double>         z_y     ;
+            std::vector<double>         dz_x    ;
+            std::vector<double>         dz_y    ;
+        };
+
+FRACTAL_EXACT_FP_BEGIN
+
+        // escape_lanes that keeps z, and dz when Derivative, where each lane stopped.
+        //  Lanes that escape are frozen with select so z is the first z outside the circle.
+        template<typename TFormula, bool Derivative, typename TPack>
+        inline TPack resume_lanes (
+                TPack &         x
+            ,   TPack &         y
+            ,   TPack &         dx
+            ,   TPack &         dy
+            ,   TPack const &   cx
+            ,   TPack const &   cy
+            ,   TPack const &   dc
+            ,   unsigned int    steps
+            ) noexcept
+        {
+            using T = typename TPack::value_type;
+
+            auto const one  = TPack::broadcast (T (1));
+            auto const two  = TPack::broadcast (T (2));
+            auto const four = TPack::broadcast (T (4));
+
+            auto count  = TPack::broadcast (T (0));
+            auto alive  = less (count, one);
+
+            for (auto i = steps; i > 0; --i)
+            {
+                auto const x2 = x * x;
+                auto const y2 = y * y;
+
+                alive = alive & less (x2 + y2, four);
+                if (!any (alive))
+                {
+                    break;
+                }
+
+                count = count + (alive & one);
+
+                if (Derivative)
+                {
+                    auto const ndx = two * (x * dx - y * dy) + dc;
+                    auto const ndy = two * (x * dy + y * dx);
+                    dx = select (alive, ndx, dx);
+                    dy = select (alive, ndy, dy);
+                }
+
+                auto nx = x;
+                auto ny = y;
+                TFormula::step (nx, ny, x2, y2, cx, cy);
+                x = select (alive, nx, x);
+                y = select (alive, ny, y);
+            }
+
+            return count;
+        }
+
+        // Advances pixels [begin, end) by steps, writes the counts of the ones that escape
+        //  and moves the survivors to the front of the range. Returns how many survived.
+        template<typename TFormula, bool Derivative>
+        std::size_t resume_range (
+                formula_view const &    view
+            ,   resumable_pixels &      pixels
+            ,   std::uint32_t *         counts
+            ,   std::uint32_t           reached
+            ,   unsigned int            steps
+            ,   std::size_t             begin
+            ,   std::size_t             end
+            ) noexcept
+        {
+            auto const W    = native_width<double>::value;
+            using lanes     = pack<double, W>;
+
+            auto const vp = make_viewport (view.center_x, view.center_y, view.zoom, view.width, view.height);
+            auto const dc = lanes::broadcast (view.julia ? 0.0 : 1.0);
+
+            double xs   [W];
+            double ys   [W];
+            double cxs  [W];
+            double cys  [W];
+            double dxs  [W];
+            double dys  [W];
+            double done [W];
+
+            auto kept = begin;
+            for (auto i = begin; i < end; i += W)
+            {
+                // A partial pack repeats its last pixel rather than iterating padding
+                auto const valid = end - i < W ? static_cast<unsigned int> (end - i) : W;
+                for (auto lane = 0U; lane < W; ++lane)
+                {
+                    auto const j        = i + (lane < valid ? lane : valid - 1);
+                    auto const index    = pixels.index[j];
+
+                    xs[lane]    = pixels.z_x[j];
+                    ys[lane]    = pixels.z_y[j];
+                    cxs[lane]   = view.julia ? view.param_x : vp.x (static_cast<double> (index % view.width));
+                    cys[lane]   = view.julia ? view.param_y : vp.y (static_cast<double> (index / view.width));
+                    dxs[lane]   = Derivative ? pixels.dz_x[j] : 0;
+                    dys[lane]   = Derivative ? pixels.dz_y[j] : 0;
+                }
+
+                auto x  = lanes::load (xs);
+                auto y  = lanes::load (ys);
+                auto dx = lanes::load (dxs);
+                auto dy = lanes::load (dys);
+
+                resume_lanes<TFormula, Derivative> (x, y, dx, dy, lanes::load (cxs), lanes::load (cys), dc, steps).store (done);
+
+                x.store (xs);
+                y.store (ys);
+                dx.store (dxs);
+                dy.store (dys);
+
+                for (auto lane = 0U; lane < valid; ++lane)
+                {
+                    auto const index = pixels.index[i + lane];
+                    auto const count = static_cast<std::uint32_t> (done[lane]);
+                    if (count < steps)
+                    {
+                        counts[index] = reached + count;
+                        continue;
+                    }
+
+                    // kept never passes i + lane, so nothing unread is overwritten
+                    pixels.index[kept]  = index;
+                    pixels.z_x[kept]    = xs[lane];
+                    pixels.z_y[kept]    = ys[lane];
+                    if (Derivative)
+                    {
+                        pixels.dz_x[kept] = dxs[lane];
+                        pixels.dz_y[kept] = dys[lane];
+                    }
+                    ++kept;
+                }
+            }
+
+            return kept - begin;
+        }
+
+FRACTAL_EXACT_FP_END
+
+        using resume_function = std::size_t (*) (
+                formula_view const &
+            ,   resumable_pixels &
+            ,   std::uint32_t *
+            ,   std::uint32_t
+            ,   unsigned int
+            ,   std::size_t
+            ,   std::size_t
+            );
+
+        template<typename TFormula>
+        inline resume_function resume_kernel (bool derivative) noexcept
+        {
+            return derivative ? &resume_range<TFormula, true> : &resume_range<TFormula, false>;
+        }
+
+        inline resume_function select_resume (formula f, bool derivative) noexcept
+        {
+            if (derivative && f != formula::mandelbrot2)
+            {
+                return nullptr;
+            }
+
+            switch (f)
+            {
+            case formula::mandelbrot2   : return resume_kernel<formulas::mandelbrot2 > (derivative);
+            case formula::multibrot3    : return resume_kernel<formulas::multibrot<3>> (derivative);
+            case formula::multibrot4    : return resume_kernel<formulas::multibrot<4>> (derivative);
+            case formula::multibrot5    : return resume_kernel<formulas::multibrot<5>> (derivative);
+            case formula::burning_ship  : return resume_kernel<formulas::burning_ship> (derivative);
+            case formula::tricorn       : return resume_kernel<formulas::tricorn     > (derivative);
+            default                     : return nullptr;
+            }
+        }
+
+        template<typename T>
+        inline void write_raw (std::ofstream & file, T const & value)
+        {
+            file.write (reinterpret_cast<char const *> (&value), sizeof (value));
+        }
+
+        template<typename T>
+        inline void write_raw (std::ofstream & file, std::vector<T> const & values)
+        {
+            write_raw (file, static_cast<std::uint64_t> (values.size ()));
+            file.write (reinterpret_cast<char const *> (values.data ()), static_cast<std::streamsize> (values.size () * sizeof (T)));
+        }
+
+        template<typename T>
+        inline bool read_raw (std::ifstream & file, T & value)
+        {
+            return static_cast<bool> (file.read (reinterpret_cast<char *> (&value), sizeof (value)));
+        }
+
+        template<typename T>
+        inline bool read_raw (std::ifstream & file, std::vector<T> & values, std::uint64_t limit)
+        {
+            auto size = std::uint64_t ();
+            if (!read_raw (file, size) || size > limit)
+            {
+                return false;
+            }
+
+            values.resize (static_cast<std::size_t> (size));
+            return static_cast<bool> (file.read (reinterpret_cast<char *> (values.data ()), static_cast<std::streamsize> (size * sizeof (T))));
+        }
+    }
+
+    // An escape time frame whose iteration limit can be raised without starting over.
+    //  Pixels that reach the limit keep z (and on request dz) where they stopped, raising
+    //  the limit continues only those, escaped pixels are final. Iterating in slices of
+    //  steps turns a multi-million iteration view into a series of short calls, and the
+    //  whole state saves to a checkpoint file that load continues from.
+    //
+    //  Every unfinished pixel has done the same number of iterations, reached, so each
+    //  slice is plain SIMD work over a compacted list of pixels. State is double, counts
+    //  equal the float64 kernels'. Cardioid and period 2 bulb pixels of a z*z + c
+    //  Mandelbrot view never escape and are not iterated at all.
+    struct resumable_frame
+    {
+        using ptr = std::unique_ptr<resumable_frame>;
+
+        static ptr create (resumable_options const & options)
+        {
+            auto const resume = details::select_resume (options.kernel_formula, options.derivative);
+            if (!resume || options.view.width == 0 || options.view.height == 0)
+            {
+                return nullptr;
+            }
+
+            ptr result (new resumable_frame (options, resume));
+            result->start ();
+            return result;
+        }
+
+        resumable_options const & options () const noexcept
+        {
+            return m_options;
+        }
+
+        // The frame so far, view ().iter is the current limit. Unfinished pixels count the
+        //  iterations done, reached ().
+        formula_view const & view () const noexcept
+        {
+            return m_options.view;
+        }
+
+        std::uint32_t const * counts () const noexcept
+        {
+            return m_counts.data ();
+        }
+
+        std::uint32_t reached () const noexcept
+        {
+            return m_reached;
+        }
+
+        // Pixels that may still escape
+        std::size_t unfinished () const noexcept
+        {
+            return m_pixels.index.size ();
+        }
+
+        // Every unfinished pixel is at the limit
+        bool done () const noexcept
+        {
+            return m_reached >= m_options.view.iter;
+        }
+
+        // Continues the unfinished pixels up to iter once advanced. Lowering the limit is
+        //  ignored, escaped pixels are not kept.
+        void raise_limit (unsigned int iter)
+        {
+            if (iter > m_options.view.iter)
+            {
+                m_options.view.iter = iter;
+            }
+        }
+
+        // Up to steps more iterations of every unfinished pixel, true once done
+        bool advance (unsigned int steps = ~0U)
+        {
+            auto const limit = m_options.view.iter;
+            if (m_pixels.index.empty ())
+            {
+                // Only interior left, it is at any limit
+                m_reached = std::max (m_reached, limit);
+            }
+
+            if (done ())
+            {
+                fill_unfinished ();
+                return true;
+            }
+
+            steps = std::min (steps, limit - m_reached);
+
+            auto & pixels       = m_pixels;
+            auto const total    = pixels.index.size ();
+            auto const blocks   = static_cast<unsigned int> ((total + details::resumable_block - 1) / details::resumable_block);
+
+            m_survivors.resize (blocks);
+            parallel_for_rows (blocks, [&] (unsigned int block)
+            {
+                auto const begin    = block * details::resumable_block;
+                auto const end      = std::min (begin + details::resumable_block, total);
+                m_survivors[block]  = m_resume (m_options.view, pixels, m_counts.data (), m_reached, steps, begin, end);
+            });
+
+            // Blocks compacted in place, now close the gaps between them
+            auto kept = std::size_t ();
+            for (auto block = 0U; block < blocks; ++block)
+            {
+                auto const begin = block * details::resumable_block;
+                auto const count = m_survivors[block];
+                if (kept != begin)
+                {
+                    std::copy_n (pixels.index.begin () + begin, count, pixels.index.begin () + kept);
+                    std::copy_n (pixels.z_x.begin () + begin, count, pixels.z_x.begin () + kept);
+                    std::copy_n (pixels.z_y.begin () + begin, count, pixels.z_y.begin () + kept);
+                    if (m_options.derivative)
+                    {
+                        std::copy_n (pixels.dz_x.begin () + begin, count, pixels.dz_x.begin () + kept);
+                        std::copy_n (pixels.dz_y.begin () + begin, count, pixels.dz_y.begin () + kept);
+                    }
+                }
+                kept += count;
+            }
+
+            pixels.index.resize (kept);
+            pixels.z_x.resize (kept);
+            pixels.z_y.resize (kept);
+            if (m_options.derivative)
+            {
+                pixels.dz_x.resize (kept);
+                pixels.dz_y.resize (kept);
+            }
+
+            m_reached += steps;
+            fill_unfinished ();
+            return done ();
+        }
+
+        // Advances in slices until done or about budget_ms have passed, a slice taking the
+        //  number of steps the last one suggests fits. true once done.
+        bool run_for (double budget_ms)
+        {
+            auto const start = std::chrono::steady_clock::now ();
+
+            while (!done ())
+            {
+                auto const before = std::chrono::steady_clock::now ();
+                advance (m_slice);
+                auto const after  = std::chrono::steady_clock::now ();
+
+                auto const slice_ms = std::chrono::duration<double, std::milli> (after - before).count ();
+                auto const spent    = std::chrono::duration<double, std::milli> (after - start).count ();
+                if (spent >= budget_ms)
+                {
+                    break;
+                }
+
+                // Fewer pixels survive every slice, so the next one may take more steps
+                auto const scale = slice_ms > 0 ? (budget_ms - spent) / slice_ms : 2.0;
+                m_slice = static_cast<unsigned int> (std::min (std::max (m_slice * std::min (scale, 2.0), 16.0), 1e9));
+            }
+
+            return done ();
+        }
+
+        // The unfinished pixels' image indices and where their orbits are now, for distance
+        //  estimates or anything else the final z says something about
+        std::uint32_t const * unfinished_index () const noexcept { return m_pixels.index.data (); }
+        double const *        unfinished_z_x   () const noexcept { return m_pixels.z_x.data ();   }
+        double const *        unfinished_z_y   () const noexcept { return m_pixels.z_y.data ();   }
+        double const *        unfinished_dz_x  () const noexcept { return m_options.derivative ? m_pixels.dz_x.data () : nullptr; }
+        double const *        unfinished_dz_y  () const noexcept { return m_options.derivative ? m_pixels.dz_y.data () : nullptr; }
+
+        // Checkpoint of the whole state, load continues from it on any host with the same
+        //  byte order
+        bool save (native_path const & path) const
+        {
+            std::ofstream file (path, std::ios::binary | std::ios::trunc);
+
+            details::write_raw (file, std::uint32_t (checkpoint_magic)                   );
+            details::write_raw (file, static_cast<std::uint32_t> (m_options.kernel_formula));
+            details::write_raw (file, static_cast<std::uint32_t> (m_options.derivative) );
+            details::write_raw (file, m_options.view                                    );
+            details::write_raw (file, m_reached                                         );
+            details::write_raw (file, m_counts                                          );
+            details::write_raw (file, m_interior                                        );
+            details::write_raw (file, m_pixels.index                                    );
+            details::write_raw (file, m_pixels.z_x                                      );
+            details::write_raw (file, m_pixels.z_y                                      );
+            details::write_raw (file, m_pixels.dz_x                                     );
+            details::write_raw (file, m_pixels.dz_y                                     );
+
+            return static_cast<bool> (file);
+        }
+
+        // nullptr for a missing or damaged checkpoint
+        static ptr load (native_path const & path)
+        {
+            std::ifstream file (path, std::ios::binary);
+
+            auto magic      = std::uint32_t ();
+            auto f          = std::uint32_t ();
+            auto derivative = std::uint32_t ();
+
+            resumable_options options;
+            if (
+                    !details::read_raw (file, magic)
+                ||  magic != checkpoint_magic
+                ||  !details::read_raw (file, f)
+                ||  !details::read_raw (file, derivative)
+                ||  !details::read_raw (file, options.view)
+                )
+            {
+                return nullptr;
+            }
+
+            options.kernel_formula  = static_cast<formula> (f);
+            options.derivative      = derivative != 0;
+
+            auto const resume = details::select_resume (options.kernel_formula, options.derivative);
+            auto const pixels = static_cast<std::uint64_t> (options.view.width) * options.view.height;
+            if (!resume || pixels == 0)
+            {
+                return nullptr;
+            }
+
+            ptr result (new resumable_frame (options, resume));
+            auto & p = result->m_pixels;
+            auto const tracked = options.derivative ? pixels : 0;
+            if (
+                    !details::read_raw (file, result->m_reached)
+                ||  !details::read_raw (file, result->m_counts, pixels)
+                ||  !details::read_raw (file, result->m_interior, pixels)
+                ||  !details::read_raw (file, p.index, pixels)
+                ||  !details::read_raw (file, p.z_x, pixels)
+                ||  !details::read_raw (file, p.z_y, pixels)
+                ||  !details::read_raw (file, p.dz_x, tracked)
+                ||  !details::read_raw (file, p.dz_y, tracked)
+                ||  result->m_counts.size () != pixels
+                ||  p.z_x.size () != p.index.size ()
+                ||  p.z_y.size () != p.index.size ()
+                ||  (options.derivative && (p.dz_x.size () != p.index.size () || p.dz_y.size () != p.index.size ()))
+                )
+            {
+                return nullptr;
+            }
+
+            for (auto index : p.index)
+            {
+                if (index >= pixels)
+                {
+                    return nullptr;
+                }
+            }
+
+            for (auto index : result->m_interior)
+            {
+                if (index >= pixels)
+                {
+                    return nullptr;
+                }
+            }
+
+            return result;
+        }
+
+    private:
+        static std::uint32_t const checkpoint_magic = 0x53455246;   // "FRES"
+
+        resumable_frame (resumable_options const & options, details::resume_function resume)
+            :   m_options   (options)
+            ,   m_resume    (resume )
+        {
+        }
+
+        resumable_frame (resumable_frame const &)             = delete;
+        resumable_frame& operator= (resumable_frame const &)  = delete;
+
+        // Every pixel unfinished at z0, but the known interior
+        void start ()
+        {
+            auto const & view   = m_options.view;
+            auto const pixels   = static_cast<std::size_t> (view.width) * view.height;
+            auto const vp       = make_viewport (view.center_x, view.center_y, view.zoom, view.width, view.height);
+            auto const cull     = !view.julia && m_options.kernel_formula == formula::mandelbrot2;
+
+            m_counts.assign (pixels, 0);
+            m_pixels.index.reserve (pixels);
+            m_pixels.z_x.reserve (pixels);
+            m_pixels.z_y.reserve (pixels);
+
+            for (auto y = 0U; y < view.height; ++y)
+            {
+                auto const z_y = vp.y (static_cast<double> (y));
+                for (auto x = 0U; x < view.width; ++x)
+                {
+                    auto const index    = static_cast<std::uint32_t> (static_cast<std::size_t> (y) * view.width + x);
+                    auto const z_x      = vp.x (static_cast<double> (x));
+                    if (cull && known_interior (z_x, z_y))
+                    {
+                        m_interior.push_back (index);
+                        continue;
+                    }
+
+                    m_pixels.index.push_back (index);
+                    m_pixels.z_x.push_back (z_x);
+                    m_pixels.z_y.push_back (z_y);
+                }
+            }
+
+            if (m_options.derivative)
+            {
+                // z starts at c, so dz/dc starts at 1 just like dz/dz0
+                m_pixels.dz_x.assign (m_pixels.index.size (), 1.0);
+                m_pixels.dz_y.assign (m_pixels.index.size (), 0.0);
+            }
+        }
+
+        // Pixels that have not escaped show the iterations done, like a frame at that limit
+        void fill_unfinished () noexcept
+        {
+            for (auto index : m_pixels.index)
+            {
+                m_counts[index] = m_reached;
+            }
+
+            for (auto index : m_interior)
+            {
+                m_counts[index] = m_reached;
+            }
+        }
+
+        resumable_options           m_options               ;
+        details::resume_function    m_resume    = nullptr   ;
+        std::vector<std::uint32_t>  m_counts                ;
+        std::vector<std::uint32_t>  m_interior              ;
+        details::resumable_pixels   m_pixels                ;
+        std::vector<std::size_t>    m_survivors             ;
+        std::uint32_t               m_reached   = 0         ;
+        unsigned int                m_slice     = 256       ;
+    };
+
+    // Raising the limit of a deep boundary view from iter to 16 * iter by starting over
+    //  against resuming the pixels still unfinished, both checked against each other
+    inline void benchmark_resumable (
+            benchmark_report &      report
+        ,   formula_view            view
+        ,   unsigned int            repeats = 1
+        )
+    {
+        auto const kernel = select_kernel (formula::mandelbrot2, precision::float64);
+        if (!kernel)
+        {
+            return;
+        }
+
+        auto const pixels   = static_cast<std::size_t> (view.width) * view.height;
+        auto const low      = view.iter;
+        auto const high     = view.iter * 16;
+
+        std::vector<std::uint32_t> reference (pixels);
+        std::vector<std::uint32_t> counts (pixels);
+
+        auto const group = "resume " + std::to_string (low) + " -> " + std::to_string (high) + " iterations";
+
+        view.iter = high;
+        auto ms = measure_ms (repeats, [&] ()
+        {
+            render_formula (view, kernel, reference.data ());
+        });
+        report.add (group, "render again from z0", ms, static_cast<double> (pixels));
+
+        view.iter = low;
+        resumable_options options;
+        options.view = view;
+
+        auto unfinished = std::size_t ();
+        ms = 0;
+        for (auto run = 0U; run < repeats; ++run)
+        {
+            auto frame = resumable_frame::create (options);
+            if (!frame)
+            {
+                return;
+            }
+            frame->advance ();
+            unfinished = frame->unfinished ();
+
+            auto const resumed = measure_ms (1, [&] ()
+            {
+                frame->raise_limit (high);
+                frame->advance ();
+            });
+            ms = run == 0 || resumed < ms ? resumed : ms;
+
+            std::copy_n (frame->counts (), pixels, counts.begin ());
+        }
+
+        char name[96];
+        std::snprintf (
+                name
+            ,   sizeof (name)
+            ,   "resume %.1f%% of pixels, %.3f%% differ"
+            ,   100.0 * unfinished / pixels
+            ,   100 * mismatch_fraction (counts, reference)
+            );
+        report.add (group, name, ms, static_cast<double> (pixels));
+    }
+}
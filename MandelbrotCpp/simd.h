@@ -0,0 +1,424 @@
+// ----------------------------------------------------------------------------------------------
+// Copyright (c) Mrten Rnge.
+// ----------------------------------------------------------------------------------------------
+// This source code is subject to terms and conditions of the Microsoft Public License. A
+// copy of the license can be found in the License.html file at the root of this distribution.
+// If you cannot locate the  Microsoft Public License, please send an email to
+// dlr@microsoft.com. By using this source code in any fashion, you are agreeing to be bound
+//  by the terms of the Microsoft Public License.
+// ----------------------------------------------------------------------------------------------
+// You must not remove this notice, or any other, from this software.
+// ----------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(_M_X64) || defined(_M_AMD64) || defined(__SSE2__)
+#   define FRACTAL_SSE2
+#   include <emmintrin.h>
+#endif
+
+#if defined(__AVX__)
+#   define FRACTAL_AVX
+#   include <immintrin.h>
+#endif
+
+// Code between these compiles without fusing a multiply and an add into an FMA. The
+//  kernels promise the same counts for every width and unroll factor, which only holds
+//  when every build rounds each product and sum on its own: g++ contracts by default
+//  whenever FMA is enabled and the v140 toolset's /fp:precise, the project setting, is
+//  allowed to as well. MSVC's pragma holds to the end of the file, END turns it back on.
+//
+//  Only wrap the kernels themselves, g++ does not inline a function from such a region
+//  into code outside it. Helpers called from inside are inlined with contraction off.
+#if defined(__clang__)
+#   define FRACTAL_EXACT_FP_BEGIN   _Pragma ("STDC FP_CONTRACT OFF")
+#   define FRACTAL_EXACT_FP_END     _Pragma ("STDC FP_CONTRACT DEFAULT")
+#elif defined(__GNUC__)
+#   define FRACTAL_EXACT_FP_BEGIN   _Pragma ("GCC push_options") _Pragma ("GCC optimize (\"fp-contract=off\")")
+#   define FRACTAL_EXACT_FP_END     _Pragma ("GCC pop_options")
+#elif defined(_MSC_VER)
+#   define FRACTAL_EXACT_FP_BEGIN   __pragma (fp_contract (off))
+#   define FRACTAL_EXACT_FP_END     __pragma (fp_contract (on))
+#else
+#   define FRACTAL_EXACT_FP_BEGIN
+#   define FRACTAL_EXACT_FP_END
+#endif
+
+namespace fractal
+{
+    // W lanes of T. The generic version is plain loops the compiler is free to vectorize,
+    //  widths that map onto SSE2/AVX registers are specialized below.
+    //
+    //  Masks are packs whose lanes are all ones (true) or all zeros (false) so they
+    //  combine with & and select with blend like the hardware versions.
+    template<typename T, unsigned int W>
+    struct pack
+    {
+        using value_type = T;
+        static unsigned int const width = W;
+
+        T v[W];
+
+        static inline pack broadcast (T value) noexcept
+        {
+            pack result;
+            for (auto i = 0U; i < W; ++i)
+            {
+                result.v[i] = value;
+            }
+            return result;
+        }
+
+        static inline pack load (T const * p) noexcept
+        {
+            pack result;
+            for (auto i = 0U; i < W; ++i)
+            {
+                result.v[i] = p[i];
+            }
+            return result;
+        }
+
+        inline void store (T * p) const noexcept
+        {
+            for (auto i = 0U; i < W; ++i)
+            {
+                p[i] = v[i];
+            }
+        }
+
+        inline T operator[] (unsigned int i) const noexcept
+        {
+            return v[i];
+        }
+    };
+
+    namespace details
+    {
+        template<typename T>
+        struct bits;
+
+        template<>
+        struct bits<float>
+        {
+            using type = std::uint32_t;
+        };
+
+        template<>
+        struct bits<double>
+        {
+            using type = std::uint64_t;
+        };
+
+        template<typename T>
+        inline typename bits<T>::type to_bits (T value) noexcept
+        {
+            typename bits<T>::type result;
+            std::memcpy (&result, &value, sizeof (result));
+            return result;
+        }
+
+        template<typename T>
+        inline T from_bits (typename bits<T>::type value) noexcept
+        {
+            T result;
+            std::memcpy (&result, &value, sizeof (result));
+            return result;
+        }
+
+        template<typename T>
+        inline T mask_of (bool value) noexcept
+        {
+            return from_bits<T> (value ? ~typename bits<T>::type () : 0);
+        }
+    }
+
+#define FRACTAL_GENERIC_OP(op)                                                                      \
+    template<typename T, unsigned int W>                                                            \
+    inline pack<T, W> operator op (pack<T, W> const & l, pack<T, W> const & r) noexcept             \
+    {                                                                                               \
+        pack<T, W> result;                                                                          \
+        for (auto i = 0U; i < W; ++i)                                                               \
+        {                                                                                           \
+            result.v[i] = l.v[i] op r.v[i];                                                         \
+        }                                                                                           \
+        return result;                                                                              \
+    }
+
+    FRACTAL_GENERIC_OP(+)
+    FRACTAL_GENERIC_OP(-)
+    FRACTAL_GENERIC_OP(*)
+    FRACTAL_GENERIC_OP(/)
+
+#undef FRACTAL_GENERIC_OP
+
+    template<typename T, unsigned int W>
+    inline pack<T, W> operator& (pack<T, W> const & l, pack<T, W> const & r) noexcept
+    {
+        pack<T, W> result;
+        for (auto i = 0U; i < W; ++i)
+        {
+            result.v[i] = details::from_bits<T> (details::to_bits (l.v[i]) & details::to_bits (r.v[i]));
+        }
+        return result;
+    }
+
+    template<typename T, unsigned int W>
+    inline pack<T, W> less (pack<T, W> const & l, pack<T, W> const & r) noexcept
+    {
+        pack<T, W> result;
+        for (auto i = 0U; i < W; ++i)
+        {
+            result.v[i] = details::mask_of<T> (l.v[i] < r.v[i]);
+        }
+        return result;
+    }
+
+    // Clears the sign bit of every lane
+    template<typename T, unsigned int W>
+    inline pack<T, W> abs (pack<T, W> const & value) noexcept
+    {
+        pack<T, W> result;
+        for (auto i = 0U; i < W; ++i)
+        {
+            result.v[i] = value.v[i] < 0 ? -value.v[i] : value.v[i];
+        }
+        return result;
+    }
+
+    // Picks t where mask is set, otherwise f
+    template<typename T, unsigned int W>
+    inline pack<T, W> select (pack<T, W> const & mask, pack<T, W> const & t, pack<T, W> const & f) noexcept
+    {
+        pack<T, W> result;
+        for (auto i = 0U; i < W; ++i)
+        {
+            result.v[i] = details::to_bits (mask.v[i]) ? t.v[i] : f.v[i];
+        }
+        return result;
+    }
+
+    // Bit i is set when lane i of mask is set
+    template<typename T, unsigned int W>
+    inline unsigned int move_mask (pack<T, W> const & mask) noexcept
+    {
+        auto result = 0U;
+        for (auto i = 0U; i < W; ++i)
+        {
+            result |= (details::to_bits (mask.v[i]) ? 1U : 0U) << i;
+        }
+        return result;
+    }
+
+    template<typename T, unsigned int W>
+    inline bool any (pack<T, W> const & mask) noexcept
+    {
+        return move_mask (mask) != 0;
+    }
+
+#ifdef FRACTAL_SSE2
+    template<>
+    struct pack<float, 4>
+    {
+        using value_type = float;
+        static unsigned int const width = 4;
+
+        __m128 v;
+
+        static inline pack broadcast (float value) noexcept
+        {
+            return pack {_mm_set1_ps (value)};
+        }
+
+        static inline pack load (float const * p) noexcept
+        {
+            return pack {_mm_loadu_ps (p)};
+        }
+
+        inline void store (float * p) const noexcept
+        {
+            _mm_storeu_ps (p, v);
+        }
+
+        inline float operator[] (unsigned int i) const noexcept
+        {
+            float lanes[4];
+            store (lanes);
+            return lanes[i];
+        }
+    };
+
+    template<>
+    struct pack<double, 2>
+    {
+        using value_type = double;
+        static unsigned int const width = 2;
+
+        __m128d v;
+
+        static inline pack broadcast (double value) noexcept
+        {
+            return pack {_mm_set1_pd (value)};
+        }
+
+        static inline pack load (double const * p) noexcept
+        {
+            return pack {_mm_loadu_pd (p)};
+        }
+
+        inline void store (double * p) const noexcept
+        {
+            _mm_storeu_pd (p, v);
+        }
+
+        inline double operator[] (unsigned int i) const noexcept
+        {
+            double lanes[2];
+            store (lanes);
+            return lanes[i];
+        }
+    };
+
+    using float4    = pack<float , 4>;
+    using double2   = pack<double, 2>;
+
+    inline float4   operator+ (float4 l , float4 r ) noexcept { return float4  {_mm_add_ps (l.v, r.v)}; }
+    inline float4   operator- (float4 l , float4 r ) noexcept { return float4  {_mm_sub_ps (l.v, r.v)}; }
+    inline float4   operator* (float4 l , float4 r ) noexcept { return float4  {_mm_mul_ps (l.v, r.v)}; }
+    inline float4   operator/ (float4 l , float4 r ) noexcept { return float4  {_mm_div_ps (l.v, r.v)}; }
+    inline float4   operator& (float4 l , float4 r ) noexcept { return float4  {_mm_and_ps (l.v, r.v)}; }
+    inline float4   less      (float4 l , float4 r ) noexcept { return float4  {_mm_cmplt_ps (l.v, r.v)}; }
+    inline float4   abs       (float4 v )            noexcept { return float4  {_mm_andnot_ps (_mm_set1_ps (-0.0F), v.v)}; }
+    inline unsigned move_mask (float4 m )            noexcept { return static_cast<unsigned> (_mm_movemask_ps (m.v)); }
+    inline bool     any       (float4 m )            noexcept { return _mm_movemask_ps (m.v) != 0; }
+    inline float4   select    (float4 m , float4 t, float4 f) noexcept
+    {
+        return float4 {_mm_or_ps (_mm_and_ps (m.v, t.v), _mm_andnot_ps (m.v, f.v))};
+    }
+
+    inline double2  operator+ (double2 l, double2 r) noexcept { return double2 {_mm_add_pd (l.v, r.v)}; }
+    inline double2  operator- (double2 l, double2 r) noexcept { return double2 {_mm_sub_pd (l.v, r.v)}; }
+    inline double2  operator* (double2 l, double2 r) noexcept { return double2 {_mm_mul_pd (l.v, r.v)}; }
+    inline double2  operator/ (double2 l, double2 r) noexcept { return double2 {_mm_div_pd (l.v, r.v)}; }
+    inline double2  operator& (double2 l, double2 r) noexcept { return double2 {_mm_and_pd (l.v, r.v)}; }
+    inline double2  less      (double2 l, double2 r) noexcept { return double2 {_mm_cmplt_pd (l.v, r.v)}; }
+    inline double2  abs       (double2 v)            noexcept { return double2 {_mm_andnot_pd (_mm_set1_pd (-0.0), v.v)}; }
+    inline unsigned move_mask (double2 m)            noexcept { return static_cast<unsigned> (_mm_movemask_pd (m.v)); }
+    inline bool     any       (double2 m)            noexcept { return _mm_movemask_pd (m.v) != 0; }
+    inline double2  select    (double2 m, double2 t, double2 f) noexcept
+    {
+        return double2 {_mm_or_pd (_mm_and_pd (m.v, t.v), _mm_andnot_pd (m.v, f.v))};
+    }
+#endif
+
+#ifdef FRACTAL_AVX
+    template<>
+    struct pack<float, 8>
+    {
+        using value_type = float;
+        static unsigned int const width = 8;
+
+        __m256 v;
+
+        static inline pack broadcast (float value) noexcept
+        {
+            return pack {_mm256_set1_ps (value)};
+        }
+
+        static inline pack load (float const * p) noexcept
+        {
+            return pack {_mm256_loadu_ps (p)};
+        }
+
+        inline void store (float * p) const noexcept
+        {
+            _mm256_storeu_ps (p, v);
+        }
+
+        inline float operator[] (unsigned int i) const noexcept
+        {
+            float lanes[8];
+            store (lanes);
+            return lanes[i];
+        }
+    };
+
+    template<>
+    struct pack<double, 4>
+    {
+        using value_type = double;
+        static unsigned int const width = 4;
+
+        __m256d v;
+
+        static inline pack broadcast (double value) noexcept
+        {
+            return pack {_mm256_set1_pd (value)};
+        }
+
+        static inline pack load (double const * p) noexcept
+        {
+            return pack {_mm256_loadu_pd (p)};
+        }
+
+        inline void store (double * p) const noexcept
+        {
+            _mm256_storeu_pd (p, v);
+        }
+
+        inline double operator[] (unsigned int i) const noexcept
+        {
+            double lanes[4];
+            store (lanes);
+            return lanes[i];
+        }
+    };
+
+    using float8    = pack<float , 8>;
+    using double4   = pack<double, 4>;
+
+    inline float8   operator+ (float8 l , float8 r ) noexcept { return float8  {_mm256_add_ps (l.v, r.v)}; }
+    inline float8   operator- (float8 l , float8 r ) noexcept { return float8  {_mm256_sub_ps (l.v, r.v)}; }
+    inline float8   operator* (float8 l , float8 r ) noexcept { return float8  {_mm256_mul_ps (l.v, r.v)}; }
+    inline float8   operator/ (float8 l , float8 r ) noexcept { return float8  {_mm256_div_ps (l.v, r.v)}; }
+    inline float8   operator& (float8 l , float8 r ) noexcept { return float8  {_mm256_and_ps (l.v, r.v)}; }
+    inline float8   less      (float8 l , float8 r ) noexcept { return float8  {_mm256_cmp_ps (l.v, r.v, _CMP_LT_OQ)}; }
+    inline float8   abs       (float8 v )            noexcept { return float8  {_mm256_andnot_ps (_mm256_set1_ps (-0.0F), v.v)}; }
+    inline unsigned move_mask (float8 m )            noexcept { return static_cast<unsigned> (_mm256_movemask_ps (m.v)); }
+    inline bool     any       (float8 m )            noexcept { return _mm256_movemask_ps (m.v) != 0; }
+    inline float8   select    (float8 m , float8 t, float8 f) noexcept
+    {
+        return float8 {_mm256_blendv_ps (f.v, t.v, m.v)};
+    }
+
+    inline double4  operator+ (double4 l, double4 r) noexcept { return double4 {_mm256_add_pd (l.v, r.v)}; }
+    inline double4  operator- (double4 l, double4 r) noexcept { return double4 {_mm256_sub_pd (l.v, r.v)}; }
+    inline double4  operator* (double4 l, double4 r) noexcept { return double4 {_mm256_mul_pd (l.v, r.v)}; }
+    inline double4  operator/ (double4 l, double4 r) noexcept { return double4 {_mm256_div_pd (l.v, r.v)}; }
+    inline double4  operator& (double4 l, double4 r) noexcept { return double4 {_mm256_and_pd (l.v, r.v)}; }
+    inline double4  less      (double4 l, double4 r) noexcept { return double4 {_mm256_cmp_pd (l.v, r.v, _CMP_LT_OQ)}; }
+    inline double4  abs       (double4 v)            noexcept { return double4 {_mm256_andnot_pd (_mm256_set1_pd (-0.0), v.v)}; }
+    inline unsigned move_mask (double4 m)            noexcept { return static_cast<unsigned> (_mm256_movemask_pd (m.v)); }
+    inline bool     any       (double4 m)            noexcept { return _mm256_movemask_pd (m.v) != 0; }
+    inline double4  select    (double4 m, double4 t, double4 f) noexcept
+    {
+        return double4 {_mm256_blendv_pd (f.v, t.v, m.v)};
+    }
+#endif
+
+    // Widest pack the target compiles to a single register
+    template<typename T>
+    struct native_width
+    {
+#if defined(FRACTAL_AVX)
+        static unsigned int const value = 32 / sizeof (T);
+#elif defined(FRACTAL_SSE2)
+        static unsigned int const value = 16 / sizeof (T);
+#else
+        static unsigned int const value = 4;
+#endif
+    };
+}
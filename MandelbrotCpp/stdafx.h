@@ -15,6 +15,8 @@
 #include "targetver.h"
 
 #define WIN32_LEAN_AND_MEAN
+// std::min and std::max rather than the macros
+#define NOMINMAX
 
 #include <windows.h>
 #include <windowsx.h>
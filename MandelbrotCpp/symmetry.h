@@ -0,0 +1,352 @@
+// ----------------------------------------------------------------------------------------------
+// Copyright (c) Mrten Rnge.
+// ----------------------------------------------------------------------------------------------
+// This source code is subject to terms and conditions of the Microsoft Public License. A
+// copy of the license can be found in the License.html file at the root of this distribution.
+// If you cannot locate the  Microsoft Public License, please send an email to
+// dlr@microsoft.com. By using this source code in any fashion, you are agreeing to be bound
+//  by the terms of the Microsoft Public License.
+// ----------------------------------------------------------------------------------------------
+// You must not remove this notice, or any other, from this software.
+// ----------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "benchmark.h"
+#include "escape_time.h"
+#include "executor.h"
+#include "formulas.h"
+
+namespace fractal
+{
+    enum class symmetry
+    {
+        none        ,
+        // c and its conjugate escape alike
+        real_axis   ,
+        // z and -z escape alike
+        origin      ,
+    };
+
+    // Every formula but the Burning Ship has real coefficients, so its Mandelbrot view is
+    //  symmetric about the real axis. A Julia view is point symmetric when the step only
+    //  sees z through an even function: even powers, the Tricorn and the Burning Ship.
+    inline symmetry formula_symmetry (formula f, bool julia) noexcept
+    {
+        switch (f)
+        {
+        case formula::mandelbrot2   :
+        case formula::multibrot4    :
+        case formula::tricorn       : return julia ? symmetry::origin : symmetry::real_axis;
+        case formula::multibrot3    :
+        case formula::multibrot5    : return julia ? symmetry::none : symmetry::real_axis;
+        case formula::burning_ship  : return julia ? symmetry::origin : symmetry::none;
+        default                     : return symmetry::none;
+        }
+    }
+
+    // Which pixels of a view are mirror images of pixels rendered anyway.
+    //  Rows [mirror_begin, mirror_end) are copies of row mirror_y - y, all other rows are
+    //  rendered. With origin symmetry a copied row is also reversed, column x coming from
+    //  column mirror_x - x, and its columns outside [covered_begin, covered_end) have
+    //  their mirror image outside the frame and are rendered.
+    struct symmetry_plan
+    {
+        symmetry        kind            = symmetry::none;
+        unsigned int    mirror_begin    = 0             ;
+        unsigned int    mirror_end      = 0             ;
+        std::int64_t    mirror_x        = 0             ;
+        std::int64_t    mirror_y        = 0             ;
+        unsigned int    covered_begin   = 0             ;
+        unsigned int    covered_end     = 0             ;
+
+        inline unsigned int mirrored () const noexcept
+        {
+            return mirror_end - mirror_begin;
+        }
+    };
+
+    // A window of a view on the same pixel grid, pixel (x, y) of the window is pixel
+    //  (left + x, top + y) of the view. Both steps of a view are 1 / (zoom * height), so
+    //  only the zoom and the center move.
+    inline formula_view sub_view (
+            formula_view const &    view
+        ,   unsigned int            left
+        ,   unsigned int            top
+        ,   unsigned int            width
+        ,   unsigned int            height
+        ) noexcept
+    {
+        auto const vp   = make_viewport (view.center_x, view.center_y, view.zoom, view.width, view.height);
+
+        auto result     = view;
+        result.width    = width                                         ;
+        result.height   = height                                        ;
+        result.zoom     = 1 / (vp.step_y * height)                      ;
+        result.center_x = vp.x (left + width  * 0.5)                    ;
+        result.center_y = vp.y (top  + height * 0.5)                    ;
+        return result;
+    }
+
+    namespace details
+    {
+        // Pixel mirror - i sits where pixel i would be negated. Only a whole number of
+        //  pixels is of any use, a thousandth of a pixel off is invisible.
+        inline bool mirror_index (double origin, double step, std::int64_t & mirror) noexcept
+        {
+            auto const k = -2 * origin / step;
+            if (!(std::fabs (k) < 1e9))
+            {
+                return false;
+            }
+
+            auto const rounded = std::floor (k + 0.5);
+            if (std::fabs (k - rounded) > 1.0 / 1024)
+            {
+                return false;
+            }
+
+            mirror = static_cast<std::int64_t> (rounded);
+            return true;
+        }
+
+        // Moving a double center for a sub view rounds by an ulp of the center, too
+        //  coarse for the fixed point zooms
+        inline bool sub_views_exact (viewport<double> const & vp) noexcept
+        {
+            auto const magnitude = std::fmax (std::fabs (vp.origin_x), std::fabs (vp.origin_y)) + vp.step_x * vp.width;
+            return magnitude * std::numeric_limits<double>::epsilon () * 1024 < vp.step_y;
+        }
+    }
+
+    // Nothing is mirrored unless the axis (or the origin) falls on the pixel grid, which
+    //  it does for a Mandelbrot view centered on the real axis or a Julia view centered
+    //  on the origin
+    inline symmetry_plan plan_symmetry (formula_view const & view, symmetry kind) noexcept
+    {
+        symmetry_plan plan;
+        plan.mirror_begin   = view.height;
+        plan.mirror_end     = view.height;
+
+        if (kind == symmetry::none || view.width == 0 || view.height == 0)
+        {
+            return plan;
+        }
+
+        auto const vp = make_viewport (view.center_x, view.center_y, view.zoom, view.width, view.height);
+
+        auto mirror_y = std::int64_t ();
+        if (!details::mirror_index (vp.origin_y, vp.step_y, mirror_y) || mirror_y < 0)
+        {
+            return plan;
+        }
+
+        auto const width    = static_cast<std::int64_t> (view.width );
+        auto const height   = static_cast<std::int64_t> (view.height);
+
+        // Rows past the axis mirror the ones before it
+        auto const begin    = mirror_y / 2 + 1;
+        auto const end      = std::min (mirror_y + 1, height);
+        if (begin >= end)
+        {
+            return plan;
+        }
+
+        plan.covered_begin  = 0;
+        plan.covered_end    = view.width;
+
+        if (kind == symmetry::origin)
+        {
+            auto mirror_x = std::int64_t ();
+            if (!details::mirror_index (vp.origin_x, vp.step_x, mirror_x) || !details::sub_views_exact (vp))
+            {
+                return plan;
+            }
+
+            auto const covered_begin    = std::max (mirror_x - (width - 1), std::int64_t ());
+            auto const covered_end      = std::min (mirror_x + 1, width);
+            if (covered_begin >= covered_end)
+            {
+                return plan;
+            }
+
+            plan.mirror_x       = mirror_x;
+            plan.covered_begin  = static_cast<unsigned int> (covered_begin);
+            plan.covered_end    = static_cast<unsigned int> (covered_end);
+        }
+
+        plan.kind           = kind;
+        plan.mirror_y       = mirror_y;
+        plan.mirror_begin   = static_cast<unsigned int> (begin);
+        plan.mirror_end     = static_cast<unsigned int> (end);
+        return plan;
+    }
+
+    // Fills row y, one of the mirrored rows, once its mirror image is rendered. The copy
+    //  is a memmove for the real axis and a reversed copy, which vectorizes to shuffles,
+    //  for the origin.
+    inline void mirror_row (
+            formula_view const &    view
+        ,   symmetry_plan const &   plan
+        ,   row_kernel              kernel
+        ,   std::uint32_t *         counts
+        ,   unsigned int            y
+        )
+    {
+        auto const target = counts + static_cast<std::size_t> (y) * view.width;
+        auto const source = counts + static_cast<std::size_t> (plan.mirror_y - y) * view.width;
+
+        if (plan.kind != symmetry::origin)
+        {
+            std::copy (source, source + view.width, target);
+            return;
+        }
+
+        std::reverse_copy (
+                source + (plan.mirror_x - (plan.covered_end - 1))
+            ,   source + (plan.mirror_x - plan.covered_begin) + 1
+            ,   target + plan.covered_begin
+            );
+
+        // The rest is rendered as one row views of the same grid
+        if (plan.covered_begin > 0)
+        {
+            kernel (sub_view (view, 0, y, plan.covered_begin, 1), 0, target);
+        }
+
+        if (plan.covered_end < view.width)
+        {
+            kernel (sub_view (view, plan.covered_end, y, view.width - plan.covered_end, 1), 0, target + plan.covered_end);
+        }
+    }
+
+    // Fills all mirrored rows once the rows they mirror are rendered
+    inline void mirror_rows (
+            formula_view const &    view
+        ,   symmetry_plan const &   plan
+        ,   row_kernel              kernel
+        ,   std::uint32_t *         counts
+        )
+    {
+        parallel_for_rows (plan.mirrored (), [&] (unsigned int row)
+        {
+            mirror_row (view, plan, kernel, counts, plan.mirror_begin + row);
+        });
+    }
+
+    namespace details
+    {
+        template<typename TForEach>
+        void render_symmetric (
+                formula_view const &    view
+            ,   symmetry_plan const &   plan
+            ,   row_kernel              kernel
+            ,   std::uint32_t *         counts
+            ,   TForEach const &        for_each
+            )
+        {
+            auto const mirrored = plan.mirrored ();
+
+            for_each (view.height - mirrored, [&] (unsigned int row)
+            {
+                auto const y = row < plan.mirror_begin ? row : row + mirrored;
+                kernel (view, y, counts + static_cast<std::size_t> (y) * view.width);
+            });
+
+            for_each (mirrored, [&] (unsigned int row)
+            {
+                mirror_row (view, plan, kernel, counts, plan.mirror_begin + row);
+            });
+        }
+    }
+
+    // render_formula that renders only one of every pair of mirrored rows. Rendered rows
+    //  match render_formula exactly. A mirrored pixel takes the count of the negated
+    //  coordinate, which rounds differently from its own, so boundary pixels may differ:
+    //  up to 0.5% of a float64 frame and 3% of a float32 one at 1000 iterations, most
+    //  on chaotic Julia sets.
+    inline void render_symmetric (
+            formula_view const &    view
+        ,   symmetry_plan const &   plan
+        ,   row_kernel              kernel
+        ,   std::uint32_t *         counts
+        )
+    {
+        details::render_symmetric (view, plan, kernel, counts, [] (unsigned int count, auto const & body)
+        {
+            parallel_for_rows (count, body);
+        });
+    }
+
+    // Same on the rows of a chosen executor backend
+    inline void render_symmetric (
+            formula_view const &    view
+        ,   symmetry_plan const &   plan
+        ,   row_kernel              kernel
+        ,   std::uint32_t *         counts
+        ,   executor &              rows
+        )
+    {
+        details::render_symmetric (view, plan, kernel, counts, [&] (unsigned int count, auto const & body)
+        {
+            rows.for_each (count, body);
+        });
+    }
+
+    // Times the mirrored rendering against the full one and reports how many pixels
+    //  differ, within the tolerance of render_symmetric
+    inline void benchmark_symmetry (
+            benchmark_report &      report
+        ,   formula_view const &    view
+        ,   formula                 f
+        ,   precision               p
+        ,   unsigned int            repeats = 3
+        )
+    {
+        auto const kernel = select_kernel (f, p);
+        if (!kernel)
+        {
+            return;
+        }
+
+        auto const pixels = static_cast<std::size_t> (view.width) * view.height;
+
+        std::vector<std::uint32_t> reference (pixels);
+        std::vector<std::uint32_t> counts (pixels);
+
+        auto const group = std::string ("symmetry ") + (view.julia ? "julia" : "mandelbrot");
+
+        auto ms = measure_ms (repeats, [&] ()
+        {
+            render_formula (view, kernel, reference.data ());
+        });
+        report.add (group, "full frame", ms, static_cast<double> (pixels));
+
+        auto const plan = plan_symmetry (view, formula_symmetry (f, view.julia));
+        ms = measure_ms (repeats, [&] ()
+        {
+            render_symmetric (view, plan, kernel, counts.data ());
+        });
+
+        char name[64];
+        std::snprintf (
+                name
+            ,   sizeof (name)
+            ,   "%u of %u rows mirrored, %.3f%% differ"
+            ,   plan.mirrored ()
+            ,   view.height
+            ,   100 * mismatch_fraction (counts, reference)
+            );
+
+        report.add (group, name, ms, static_cast<double> (pixels));
+    }
+}
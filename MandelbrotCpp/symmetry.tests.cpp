@@ -0,0 +1,157 @@
+// ----------------------------------------------------------------------------------------------
+// Copyright (c) Mrten Rnge.
+// ----------------------------------------------------------------------------------------------
+// This source code is subject to terms and conditions of the Microsoft Public License. A
+// copy of the license can be found in the License.html file at the root of this distribution.
+// If you cannot locate the  Microsoft Public License, please send an email to
+// dlr@microsoft.com. By using this source code in any fashion, you are agreeing to be bound
+//  by the terms of the Microsoft Public License.
+// ----------------------------------------------------------------------------------------------
+// You must not remove this notice, or any other, from this software.
+// ----------------------------------------------------------------------------------------------
+
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <iterator>
+#include <vector>
+
+#include "benchmark.h"
+#include "formulas.h"
+#include "symmetry.h"
+#include "tests.h"
+
+namespace
+{
+    using namespace fractal;
+
+    // The tolerance render_symmetric documents, as a fraction of the frame
+    double tolerance (precision p) noexcept
+    {
+        return p == precision::float32 ? 0.03 : 0.005;
+    }
+
+    struct symmetric_case
+    {
+        formula         f       ;
+        formula_view    view    ;
+    };
+
+    // Views straddling the real axis, or centered on the origin for Julia views. Pixel y
+    //  sits at y / height of the view, so the axis runs through row height / 2 of an even
+    //  height, a centre row that mirrors itself, and between two rows of an odd one
+    std::vector<symmetric_case> cases ()
+    {
+        std::vector<symmetric_case> result;
+
+        for (auto height : {61U, 60U})
+        {
+            formula_view view;
+            view.width      = 97        ;
+            view.height     = height    ;
+            view.iter       = 1000      ;
+
+            view.center_x   = -0.5      ;
+            view.zoom       = 0.4       ;
+            result.push_back ({formula::mandelbrot2, view});
+            result.push_back ({formula::multibrot3, view});
+
+            // The neck between the cardioid and the period 2 bulb, boundary on the axis
+            view.center_x   = -0.75     ;
+            view.zoom       = 5         ;
+            result.push_back ({formula::mandelbrot2, view});
+            result.push_back ({formula::tricorn, view});
+
+            view.center_x   = 0         ;
+            view.zoom       = 0.4       ;
+            view.julia      = true      ;
+            view.param_x    = -0.8      ;
+            view.param_y    = 0.156     ;
+            result.push_back ({formula::mandelbrot2, view});
+        }
+
+        return result;
+    }
+
+    FRACTAL_TEST (symmetry_mirrored_frame_matches_a_full_render)
+    {
+        for (auto const & c : cases ())
+        {
+            auto const & view   = c.view;
+            auto const width    = view.width;
+            auto const plan     = plan_symmetry (view, formula_symmetry (c.f, view.julia));
+
+            // Row 0 has no mirror image in the frame. The centre row height / 2 is rendered,
+            //  the rows below it mirror the ones above.
+            CHECK (plan.kind != symmetry::none);
+            CHECK (plan.mirror_y == view.height);
+            CHECK (plan.mirror_begin == view.height / 2 + 1);
+            CHECK (plan.mirrored () == (view.height - 1) / 2);
+
+            for (auto p : {precision::float32, precision::float64})
+            {
+                auto const kernel = select_kernel (c.f, p);
+                CHECK (kernel);
+
+                auto const pixels = static_cast<std::size_t> (width) * view.height;
+
+                std::vector<std::uint32_t> reference (pixels);
+                render_formula (view, kernel, reference.data ());
+
+                std::vector<std::uint32_t> counts (pixels, ~std::uint32_t ());
+                render_symmetric (view, plan, kernel, counts.data ());
+
+                for (auto y = 0U; y < view.height; ++y)
+                {
+                    auto const row      = counts.begin () + static_cast<std::size_t> (y) * width;
+                    auto const mirrored = y >= plan.mirror_begin && y < plan.mirror_end;
+
+                    if (!mirrored)
+                    {
+                        // Rendered rows, the centre row among them, are the full render's
+                        CHECK (std::equal (row, row + width, reference.begin () + static_cast<std::size_t> (y) * width));
+                        continue;
+                    }
+
+                    // Mirrored rows are exact copies of their mirror image
+                    auto const source = counts.begin () + static_cast<std::size_t> (plan.mirror_y - y) * width;
+                    if (plan.kind == symmetry::origin)
+                    {
+                        CHECK (std::equal (row + plan.covered_begin, row + plan.covered_end, std::reverse_iterator<decltype (source)> (source + (plan.mirror_x - plan.covered_begin) + 1)));
+                    }
+                    else
+                    {
+                        CHECK (std::equal (row, row + width, source));
+                    }
+                }
+
+                auto const differ = mismatch_fraction (counts, reference);
+                if (differ > tolerance (p))
+                {
+                    std::printf ("          %ls%s, %u bit, height %u: %.3f%% differ\n", formula_name (c.f), view.julia ? " Julia" : "", static_cast<unsigned int> (p), view.height, 100 * differ);
+                }
+                CHECK (differ <= tolerance (p));
+            }
+        }
+    }
+
+    // An axis off the grid, or a view that does not reach it, mirrors nothing
+    FRACTAL_TEST (symmetry_needs_the_axis_on_the_pixel_grid)
+    {
+        formula_view view;
+        view.width      = 97    ;
+        view.height     = 61    ;
+        view.zoom       = 0.4   ;
+
+        // A third of a pixel off the axis
+        view.center_y   = 1 / (3 * view.zoom * view.height);
+        CHECK (plan_symmetry (view, symmetry::real_axis).mirrored () == 0);
+
+        // Entirely above the axis
+        view.center_y   = 5;
+        CHECK (plan_symmetry (view, symmetry::real_axis).mirrored () == 0);
+
+        CHECK (plan_symmetry (view, symmetry::none).mirrored () == 0);
+    }
+}
@@ -0,0 +1,20 @@
+// ----------------------------------------------------------------------------------------------
+// Copyright (c) Mrten Rnge.
+// ----------------------------------------------------------------------------------------------
+// This source code is subject to terms and conditions of the Microsoft Public License. A
+// copy of the license can be found in the License.html file at the root of this distribution.
+// If you cannot locate the  Microsoft Public License, please send an email to
+// dlr@microsoft.com. By using this source code in any fashion, you are agreeing to be bound
+//  by the terms of the Microsoft Public License.
+// ----------------------------------------------------------------------------------------------
+// You must not remove this notice, or any other, from this software.
+// ----------------------------------------------------------------------------------------------
+
+#include "tests.h"
+
+// Runs the tests of every <module>.tests.cpp linked in, or only those whose name contains
+//  the first argument
+int main (int argc, char ** argv)
+{
+    return fractal::tests::run (argc > 1 ? argv[1] : nullptr) == 0 ? 0 : 1;
+}
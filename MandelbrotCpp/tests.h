@@ -0,0 +1,124 @@
+// ----------------------------------------------------------------------------------------------
+// Copyright (c) Mrten Rnge.
+// ----------------------------------------------------------------------------------------------
+// This source code is subject to terms and conditions of the Microsoft Public License. A
+// copy of the license can be found in the License.html file at the root of this distribution.
+// If you cannot locate the  Microsoft Public License, please send an email to
+// dlr@microsoft.com. By using this source code in any fashion, you are agreeing to be bound
+//  by the terms of the Microsoft Public License.
+// ----------------------------------------------------------------------------------------------
+// You must not remove this notice, or any other, from this software.
+// ----------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstdio>
+#include <exception>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "mapped_file.h"
+
+// A test is a function registered by name; CHECK throws so a failing test stops at the
+//  first broken expectation and the runner moves on to the next one.
+
+namespace fractal
+{
+    namespace tests
+    {
+        struct test_case
+        {
+            char const *    name    ;
+            void            (*body) ();
+        };
+
+        inline std::vector<test_case> & registry ()
+        {
+            static std::vector<test_case> cases;
+            return cases;
+        }
+
+        struct registrar
+        {
+            registrar (char const * name, void (*body) ())
+            {
+                registry ().push_back (test_case {name, body});
+            }
+        };
+
+        struct failure : std::runtime_error
+        {
+            explicit failure (std::string const & what)
+                :   std::runtime_error (what)
+            {
+            }
+        };
+
+        inline void check (bool condition, char const * expression, char const * file, int line)
+        {
+            if (!condition)
+            {
+                throw failure (std::string (file) + "(" + std::to_string (line) + "): " + expression);
+            }
+        }
+
+        // A file name in the temporary directory, tests remove what they create there
+        inline native_path scratch_path (char const * name)
+        {
+#ifdef _WIN32
+            wchar_t directory[MAX_PATH + 1];
+            auto const length = GetTempPathW (MAX_PATH + 1, directory);
+            std::string const narrow (name);
+            return std::wstring (directory, directory + length) + L"fractal_tests_" + std::wstring (narrow.begin (), narrow.end ());
+#else
+            return std::string ("/tmp/fractal_tests_") + name;
+#endif
+        }
+
+        inline void remove_scratch (native_path const & path)
+        {
+#ifdef _WIN32
+            DeleteFileW (path.c_str ());
+#else
+            std::remove (path.c_str ());
+#endif
+        }
+
+        // Runs every test whose name contains filter, returns the number that failed
+        inline int run (char const * filter)
+        {
+            auto failed = 0;
+            auto ran    = 0;
+            for (auto const & test : registry ())
+            {
+                if (filter && std::string (test.name).find (filter) == std::string::npos)
+                {
+                    continue;
+                }
+
+                ++ran;
+                try
+                {
+                    test.body ();
+                    std::printf ("  passed  %s\n", test.name);
+                }
+                catch (std::exception const & e)
+                {
+                    ++failed;
+                    std::printf ("  FAILED  %s\n          %s\n", test.name, e.what ());
+                }
+            }
+
+            std::printf ("%d of %d tests passed\n", ran - failed, ran);
+            return failed;
+        }
+    }
+}
+
+#define FRACTAL_TEST(name)                                                              \
+    static void name ();                                                                \
+    static ::fractal::tests::registrar name##_registrar (#name, &name);                 \
+    static void name ()
+
+#define CHECK(expression) ::fractal::tests::check (static_cast<bool> (expression), #expression, __FILE__, __LINE__)
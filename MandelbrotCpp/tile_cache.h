@@ -0,0 +1,128 @@
+// ----------------------------------------------------------------------------------------------
+// Copyright (c) Mrten Rnge.
+// ----------------------------------------------------------------------------------------------
+// This source code is subject to terms and conditions of the Microsoft Public License. A
+// copy of the license can be found in the License.html file at the root of this distribution.
+// If you cannot locate the  Microsoft Public License, please send an email to
+// dlr@microsoft.com. By using this source code in any fashion, you are agreeing to be bound
+//  by the terms of the Microsoft Public License.
+// ----------------------------------------------------------------------------------------------
+// You must not remove this notice, or any other, from this software.
+// ----------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+
+#include "tile_codec.h"
+#include "tile_store.h"
+
+namespace fractal
+{
+    struct tile_key_hash
+    {
+        inline std::size_t operator() (tile_key const & key) const noexcept
+        {
+            return static_cast<std::size_t> (hash_key (key));
+        }
+    };
+
+    // In-memory LRU of compressed iteration tiles bounded by the bytes the tiles occupy
+    //  (not by tile count) so cheap tiles such as the interior leave room for more of them.
+    struct tile_cache
+    {
+        using ptr = std::unique_ptr<tile_cache>;
+
+        explicit tile_cache (std::size_t budget_in_bytes) noexcept
+            :   m_budget    (budget_in_bytes)
+        {
+        }
+
+        // Decodes the tile for key into out (width*height counts). Returns false on a miss.
+        bool find (tile_key const & key, std::uint32_t * out)
+        {
+            auto found = m_lookup.find (key);
+            if (found == m_lookup.end ())
+            {
+                ++m_misses;
+                return false;
+            }
+
+            ++m_hits;
+
+            // Move to front
+            m_entries.splice (m_entries.begin (), m_entries, found->second);
+
+            decode_tile (found->second->second, out);
+
+            return true;
+        }
+
+        void insert (tile_key const & key, std::uint32_t const * counts)
+        {
+            auto tile = encode_tile (counts, key.width * key.height);
+            auto size = tile.size_in_bytes ();
+
+            if (size > m_budget)
+            {
+                return;
+            }
+
+            auto found = m_lookup.find (key);
+            if (found != m_lookup.end ())
+            {
+                m_used -= found->second->second.size_in_bytes ();
+                m_entries.erase (found->second);
+                m_lookup.erase (found);
+            }
+
+            while (m_used + size > m_budget && !m_entries.empty ())
+            {
+                auto & last = m_entries.back ();
+                m_used -= last.second.size_in_bytes ();
+                m_lookup.erase (last.first);
+                m_entries.pop_back ();
+            }
+
+            m_entries.emplace_front (key, std::move (tile));
+            m_lookup[key]   = m_entries.begin ();
+            m_used          += size;
+        }
+
+        inline std::size_t used_bytes () const noexcept
+        {
+            return m_used;
+        }
+
+        inline std::size_t tile_count () const noexcept
+        {
+            return m_entries.size ();
+        }
+
+        inline std::uint64_t hits () const noexcept
+        {
+            return m_hits;
+        }
+
+        inline std::uint64_t misses () const noexcept
+        {
+            return m_misses;
+        }
+
+    private:
+        using entry     = std::pair<tile_key, compressed_tile>;
+        using entries   = std::list<entry>;
+
+        std::size_t                                                         m_budget        ;
+        std::size_t                                                         m_used      = 0 ;
+        std::uint64_t                                                       m_hits      = 0 ;
+        std::uint64_t                                                       m_misses    = 0 ;
+        entries                                                             m_entries       ;
+        std::unordered_map<tile_key, entries::iterator, tile_key_hash>      m_lookup        ;
+    };
+}
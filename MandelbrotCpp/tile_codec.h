@@ -0,0 +1,335 @@
+// ----------------------------------------------------------------------------------------------
+// Copyright (c) Mrten Rnge.
+// ----------------------------------------------------------------------------------------------
+// This source code is subject to terms and conditions of the Microsoft Public License. A
+// copy of the license can be found in the License.html file at the root of this distribution.
+// If you cannot locate the  Microsoft Public License, please send an email to
+// dlr@microsoft.com. By using this source code in any fashion, you are agreeing to be bound
+//  by the terms of the Microsoft Public License.
+// ----------------------------------------------------------------------------------------------
+// You must not remove this notice, or any other, from this software.
+// ----------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "simd.h"
+
+namespace fractal
+{
+    // Compact encoding of iteration counts.
+    //
+    //  Counts are split into blocks of 128. A block that repeats the previous count is merged
+    //  into a run, which is how the interior (all counts == iter) ends up costing a few bytes.
+    //  Other blocks store the zigzagged differences between neighbouring counts packed with
+    //  the smallest bit width that fits them. The packing is interleaved over 4 lanes (value i
+    //  lives in lane i % 4) so unpacking is the same shift and mask in every lane of a SIMD
+    //  register and the prefix sum restoring the counts runs 4 values at a time.
+    //
+    //  Block layout
+    //      0   varint block count, u32 count           run of constant blocks
+    //      b   u32 previous count, 16*b bytes          packed deltas, 1 <= b <= 32
+    struct compressed_tile
+    {
+        std::vector<unsigned char>  bytes   ;
+        std::uint32_t               count   = 0;
+
+        inline std::size_t size_in_bytes () const noexcept
+        {
+            return sizeof (compressed_tile) + bytes.capacity ();
+        }
+    };
+
+    namespace details
+    {
+        std::size_t const block_size    = 128;
+        std::size_t const lanes         = 4;
+        std::size_t const lane_size     = block_size / lanes;
+
+        inline std::uint32_t zigzag (std::uint32_t value, std::uint32_t previous) noexcept
+        {
+            auto diff = static_cast<std::int32_t> (value - previous);
+            return (static_cast<std::uint32_t> (diff) << 1) ^ static_cast<std::uint32_t> (diff >> 31);
+        }
+
+        inline std::uint32_t bit_width (std::uint32_t value) noexcept
+        {
+            auto width = 0U;
+            while (value)
+            {
+                ++width;
+                value >>= 1;
+            }
+            return width;
+        }
+
+        inline void put_u32 (std::vector<unsigned char> & bytes, std::uint32_t value)
+        {
+            unsigned char raw[4];
+            std::memcpy (raw, &value, sizeof (raw));
+            bytes.insert (bytes.end (), raw, raw + sizeof (raw));
+        }
+
+        inline std::uint32_t get_u32 (unsigned char const * & p) noexcept
+        {
+            std::uint32_t value;
+            std::memcpy (&value, p, sizeof (value));
+            p += sizeof (value);
+            return value;
+        }
+
+        inline void put_varint (std::vector<unsigned char> & bytes, std::size_t value)
+        {
+            while (value >= 0x80)
+            {
+                bytes.push_back (static_cast<unsigned char> (value | 0x80));
+                value >>= 7;
+            }
+            bytes.push_back (static_cast<unsigned char> (value));
+        }
+
+        inline std::size_t get_varint (unsigned char const * & p) noexcept
+        {
+            std::size_t value = 0;
+            auto        shift = 0U;
+            while (*p & 0x80)
+            {
+                value |= static_cast<std::size_t> (*p++ & 0x7F) << shift;
+                shift += 7;
+            }
+            value |= static_cast<std::size_t> (*p++) << shift;
+            return value;
+        }
+
+        inline void pack_block (std::vector<unsigned char> & bytes, std::uint32_t const (&deltas)[block_size], std::uint32_t width)
+        {
+            auto offset = bytes.size ();
+            bytes.resize (offset + lane_size * width / 8 * lanes);
+
+            std::uint32_t words[lanes * 32] {};
+
+            for (auto lane = 0U; lane < lanes; ++lane)
+            {
+                auto bit = 0U;
+                for (auto iter = 0U; iter < lane_size; ++iter, bit += width)
+                {
+                    auto value  = static_cast<std::uint64_t> (deltas[iter * lanes + lane]) << (bit % 32);
+                    auto word   = bit / 32;
+
+                    words[word * lanes + lane] |= static_cast<std::uint32_t> (value);
+                    if (bit % 32 + width > 32)
+                    {
+                        words[(word + 1) * lanes + lane] |= static_cast<std::uint32_t> (value >> 32);
+                    }
+                }
+            }
+
+            std::memcpy (&bytes[offset], words, lane_size * width / 8 * lanes);
+        }
+
+        // Unpacks one block of deltas and turns them back into counts
+        inline void unpack_block (unsigned char const * packed, std::uint32_t width, std::uint32_t previous, std::uint32_t * out) noexcept
+        {
+#ifdef FRACTAL_SSE2
+            auto words  = reinterpret_cast<__m128i const *> (packed);
+            auto mask   = _mm_set1_epi32 (width == 32 ? -1 : static_cast<int> ((1U << width) - 1));
+            auto one    = _mm_set1_epi32 (1);
+            auto carry  = _mm_set1_epi32 (static_cast<int> (previous));
+            auto word   = _mm_loadu_si128 (words);
+            auto bit    = 0U;
+
+            for (auto iter = 0U; iter < lane_size; ++iter)
+            {
+                auto shift  = bit % 32;
+                auto value  = _mm_srl_epi32 (word, _mm_cvtsi32_si128 (static_cast<int> (shift)));
+
+                bit += width;
+                if (bit % 32 == 0 || shift + width > 32)
+                {
+                    ++words;
+                    if (iter + 1 < lane_size || shift + width > 32)
+                    {
+                        word = _mm_loadu_si128 (words);
+                    }
+
+                    if (shift + width > 32)
+                    {
+                        value = _mm_or_si128 (value, _mm_sll_epi32 (word, _mm_cvtsi32_si128 (static_cast<int> (32 - shift))));
+                    }
+                }
+
+                value = _mm_and_si128 (value, mask);
+
+                // zigzag decode: (v >> 1) ^ -(v & 1)
+                auto delta = _mm_xor_si128 (
+                        _mm_srli_epi32 (value, 1)
+                    ,   _mm_sub_epi32 (_mm_setzero_si128 (), _mm_and_si128 (value, one))
+                    );
+
+                // Inclusive prefix sum over the 4 lanes plus the last count of the previous group
+                delta = _mm_add_epi32 (delta, _mm_slli_si128 (delta, 4));
+                delta = _mm_add_epi32 (delta, _mm_slli_si128 (delta, 8));
+                delta = _mm_add_epi32 (delta, carry);
+
+                _mm_storeu_si128 (reinterpret_cast<__m128i *> (out + iter * lanes), delta);
+
+                carry = _mm_shuffle_epi32 (delta, _MM_SHUFFLE (3, 3, 3, 3));
+            }
+#else
+            std::uint32_t words[lanes * 32];
+            std::memcpy (words, packed, lane_size * width / 8 * lanes);
+
+            auto mask = width == 32 ? ~0U : (1U << width) - 1;
+
+            for (auto lane = 0U; lane < lanes; ++lane)
+            {
+                auto bit = 0U;
+                for (auto iter = 0U; iter < lane_size; ++iter, bit += width)
+                {
+                    auto word   = bit / 32;
+                    auto value  = static_cast<std::uint64_t> (words[word * lanes + lane]) >> (bit % 32);
+                    if (bit % 32 + width > 32)
+                    {
+                        value |= static_cast<std::uint64_t> (words[(word + 1) * lanes + lane]) << (32 - bit % 32);
+                    }
+
+                    auto v = static_cast<std::uint32_t> (value) & mask;
+                    out[iter * lanes + lane] = (v >> 1) ^ (0U - (v & 1));
+                }
+            }
+
+            for (auto iter = 0U; iter < block_size; ++iter)
+            {
+                previous    += out[iter];
+                out[iter]   = previous;
+            }
+#endif
+        }
+
+        inline void fill (std::uint32_t * out, std::size_t count, std::uint32_t value) noexcept
+        {
+            auto iter = std::size_t ();
+#ifdef FRACTAL_SSE2
+            auto v = _mm_set1_epi32 (static_cast<int> (value));
+            for (; iter + 4 <= count; iter += 4)
+            {
+                _mm_storeu_si128 (reinterpret_cast<__m128i *> (out + iter), v);
+            }
+#endif
+            for (; iter < count; ++iter)
+            {
+                out[iter] = value;
+            }
+        }
+    }
+
+    inline compressed_tile encode_tile (std::uint32_t const * counts, std::uint32_t count)
+    {
+        using namespace details;
+
+        compressed_tile result;
+        result.count = count;
+
+        std::uint32_t   previous    = count > 0 ? counts[0] : 0 ;
+        std::size_t     run         = 0                         ;
+
+        auto flush_run = [&] ()
+        {
+            if (run > 0)
+            {
+                result.bytes.push_back (0);
+                put_varint (result.bytes, run);
+                put_u32 (result.bytes, previous);
+                run = 0;
+            }
+        };
+
+        for (std::size_t begin = 0; begin < count; begin += block_size)
+        {
+            // The last block is padded by repeating the last count
+            std::uint32_t deltas[block_size];
+            auto width      = 0U;
+            auto current    = previous;
+
+            for (auto iter = 0U; iter < block_size; ++iter)
+            {
+                auto value      = begin + iter < count ? counts[begin + iter] : current;
+                auto delta      = zigzag (value, current);
+                deltas[iter]    = delta;
+                current         = value;
+
+                auto w = bit_width (delta);
+                width = w > width ? w : width;
+            }
+
+            if (width == 0)
+            {
+                ++run;
+                continue;
+            }
+
+            flush_run ();
+
+            result.bytes.push_back (static_cast<unsigned char> (width));
+            put_u32 (result.bytes, previous);
+            pack_block (result.bytes, deltas, width);
+
+            previous = current;
+        }
+
+        flush_run ();
+
+        result.bytes.shrink_to_fit ();
+
+        return result;
+    }
+
+    // out must have room for tile.count counts
+    inline void decode_tile (compressed_tile const & tile, std::uint32_t * out) noexcept
+    {
+        using namespace details;
+
+        auto p      = tile.bytes.data ();
+        auto end    = p + tile.bytes.size ();
+        auto written= std::size_t ();
+
+        std::uint32_t scratch[block_size];
+
+        while (p < end && written < tile.count)
+        {
+            auto tag        = *p++;
+            auto remaining  = tile.count - written;
+
+            if (tag == 0)
+            {
+                auto blocks = get_varint (p);
+                auto value  = get_u32 (p);
+                auto n      = blocks * block_size < remaining ? blocks * block_size : remaining;
+
+                fill (out + written, n, value);
+                written += n;
+                continue;
+            }
+
+            auto previous = get_u32 (p);
+
+            if (remaining >= block_size)
+            {
+                unpack_block (p, tag, previous, out + written);
+                written += block_size;
+            }
+            else
+            {
+                unpack_block (p, tag, previous, scratch);
+                std::memcpy (out + written, scratch, remaining * sizeof (std::uint32_t));
+                written += remaining;
+            }
+
+            p += lane_size * tag / 8 * lanes;
+        }
+    }
+}
@@ -0,0 +1,146 @@
+// ----------------------------------------------------------------------------------------------
+// Copyright (c) Mrten Rnge.
+// ----------------------------------------------------------------------------------------------
+// This source code is subject to terms and conditions of the Microsoft Public License. A
+// copy of the license can be found in the License.html file at the root of this distribution.
+// If you cannot locate the  Microsoft Public License, please send an email to
+// dlr@microsoft.com. By using this source code in any fashion, you are agreeing to be bound
+//  by the terms of the Microsoft Public License.
+// ----------------------------------------------------------------------------------------------
+// You must not remove this notice, or any other, from this software.
+// ----------------------------------------------------------------------------------------------
+
+
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "tile_codec.h"
+#include "tests.h"
+
+namespace
+{
+    using namespace fractal;
+
+    // Tile sizes whose pixel count is a multiple of the 128 count block, and ones that
+    //  leave a partial last block of every kind, down to a single count
+    struct tile_size
+    {
+        std::uint32_t width     ;
+        std::uint32_t height    ;
+    };
+
+    tile_size const sizes[] =
+    {
+            {  0,   0 }
+        ,   {  1,   1 }
+        ,   {127,   1 }
+        ,   {128,   1 }
+        ,   {129,   1 }
+        ,   { 37,  23 }
+        ,   { 64,  64 }
+        ,   {100,  75 }
+        ,   {257,   3 }
+    };
+
+    bool round_trips (std::vector<std::uint32_t> const & counts)
+    {
+        auto const tile = encode_tile (counts.data (), static_cast<std::uint32_t> (counts.size ()));
+        if (tile.count != counts.size ())
+        {
+            return false;
+        }
+
+        // One past the end is a canary, decode must not write past tile.count
+        std::uint32_t const canary = 0xDEADBEEF;
+        std::vector<std::uint32_t> decoded (counts.size () + 1, canary);
+        decode_tile (tile, decoded.data ());
+
+        return
+                std::equal (counts.begin (), counts.end (), decoded.begin ())
+            &&  decoded.back () == canary
+            ;
+    }
+
+    FRACTAL_TEST (tile_codec_round_trips_random_tiles)
+    {
+        std::mt19937 random (1234);
+
+        for (auto const & size : sizes)
+        {
+            std::vector<std::uint32_t> counts (static_cast<std::size_t> (size.width) * size.height);
+
+            // Every bit width the packing has, 32 included
+            for (auto bits : {1U, 4U, 11U, 31U, 32U})
+            {
+                auto const mask = bits == 32 ? ~0U : (1U << bits) - 1;
+                for (auto & count : counts)
+                {
+                    count = static_cast<std::uint32_t> (random ()) & mask;
+                }
+
+                CHECK (round_trips (counts));
+            }
+
+            // Smooth counts, the small deltas of a real escape time tile
+            auto value = 1000U;
+            for (auto & count : counts)
+            {
+                value += static_cast<std::uint32_t> (random () % 5) - 2;
+                count = value;
+            }
+            CHECK (round_trips (counts));
+        }
+    }
+
+    FRACTAL_TEST (tile_codec_round_trips_run_heavy_tiles)
+    {
+        std::mt19937 random (5678);
+
+        for (auto const & size : sizes)
+        {
+            auto const pixels = static_cast<std::size_t> (size.width) * size.height;
+
+            // All interior
+            std::vector<std::uint32_t> counts (pixels, 256);
+            CHECK (round_trips (counts));
+
+            // Interior with escaped stretches, runs start and end inside blocks and the
+            //  tile ends both in and out of a run
+            for (auto stretch : {1U, 50U, 128U, 300U})
+            {
+                for (auto i = std::size_t (); i < pixels; ++i)
+                {
+                    counts[i] = (i / stretch) % 3 == 1
+                        ? static_cast<std::uint32_t> (random () % 256)
+                        : 256
+                        ;
+                }
+                CHECK (round_trips (counts));
+
+                for (auto i = std::size_t (); i < pixels; ++i)
+                {
+                    counts[i] = (i / stretch) % 3 == 1 ? 256 : static_cast<std::uint32_t> (random () % 256);
+                }
+                CHECK (round_trips (counts));
+            }
+
+            // Runs of different values back to back
+            for (auto i = std::size_t (); i < pixels; ++i)
+            {
+                counts[i] = static_cast<std::uint32_t> (i / 384);
+            }
+            CHECK (round_trips (counts));
+        }
+    }
+
+    FRACTAL_TEST (tile_codec_merges_constant_blocks)
+    {
+        std::vector<std::uint32_t> counts (64 * 64, 1024);
+        auto const tile = encode_tile (counts.data (), static_cast<std::uint32_t> (counts.size ()));
+
+        // The tag, a one byte varint and the count
+        CHECK (tile.bytes.size () == 6);
+    }
+}
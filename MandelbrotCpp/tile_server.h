@@ -0,0 +1,852 @@
+// ----------------------------------------------------------------------------------------------
+// Copyright (c) Mrten Rnge.
+// ----------------------------------------------------------------------------------------------
+// This source code is subject to terms and conditions of the Microsoft Public License. A
+// copy of the license can be found in the License.html file at the root of this distribution.
+// If you cannot locate the  Microsoft Public License, please send an email to
+// dlr@microsoft.com. By using this source code in any fashion, you are agreeing to be bound
+//  by the terms of the Microsoft Public License.
+// ----------------------------------------------------------------------------------------------
+// You must not remove this notice, or any other, from this software.
+// ----------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#ifdef _WIN32
+#   ifndef WIN32_LEAN_AND_MEAN
+#       define WIN32_LEAN_AND_MEAN
+#   endif
+#   ifndef NOMINMAX
+#       define NOMINMAX
+#   endif
+#   include <winsock2.h>
+#   include <ws2tcpip.h>
+#   pragma comment (lib, "Ws2_32.lib")
+#else
+#   include <arpa/inet.h>
+#   include <netinet/in.h>
+#   include <sys/socket.h>
+#   include <sys/time.h>
+#   include <unistd.h>
+#endif
+
+#include "benchmark.h"
+#include "formulas.h"
+#include "palette.h"
+#include "tile_cache.h"
+#include "tile_store.h"
+
+namespace fractal
+{
+    namespace details
+    {
+#ifdef _WIN32
+        using socket_handle = SOCKET;
+        socket_handle const invalid_socket = INVALID_SOCKET;
+        int const send_flags = 0;
+
+        inline void close_socket (socket_handle s) noexcept
+        {
+            closesocket (s);
+        }
+
+        inline void shutdown_socket (socket_handle s) noexcept
+        {
+            shutdown (s, SD_BOTH);
+        }
+
+        inline void set_receive_timeout (socket_handle s, unsigned int milliseconds) noexcept
+        {
+            DWORD timeout = milliseconds;
+            setsockopt (s, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<char const *> (&timeout), sizeof (timeout));
+        }
+
+        inline bool socket_startup () noexcept
+        {
+            static bool const started = [] ()
+            {
+                WSADATA data {};
+                return WSAStartup (MAKEWORD (2, 2), &data) == 0;
+            } ();
+            return started;
+        }
+#else
+        using socket_handle = int;
+        socket_handle const invalid_socket = -1;
+#   ifdef MSG_NOSIGNAL
+        int const send_flags = MSG_NOSIGNAL;
+#   else
+        int const send_flags = 0;
+#   endif
+
+        inline void close_socket (socket_handle s) noexcept
+        {
+            close (s);
+        }
+
+        inline void shutdown_socket (socket_handle s) noexcept
+        {
+            shutdown (s, SHUT_RDWR);
+        }
+
+        inline void set_receive_timeout (socket_handle s, unsigned int milliseconds) noexcept
+        {
+            timeval timeout {};
+            timeout.tv_sec  = static_cast<decltype (timeout.tv_sec)> (milliseconds / 1000);
+            timeout.tv_usec = static_cast<decltype (timeout.tv_usec)> ((milliseconds % 1000) * 1000);
+            setsockopt (s, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof (timeout));
+        }
+
+        inline bool socket_startup () noexcept
+        {
+            return true;
+        }
+#endif
+
+        inline sockaddr_in loopback_address (unsigned short port) noexcept
+        {
+            sockaddr_in address {};
+            address.sin_family      = AF_INET;
+            address.sin_port        = htons (port);
+            address.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+            return address;
+        }
+
+        // Only the loopback interface is served, the server is for local tools
+        inline socket_handle listen_local (unsigned short port) noexcept
+        {
+            if (!socket_startup ())
+            {
+                return invalid_socket;
+            }
+
+            auto s = socket (AF_INET, SOCK_STREAM, IPPROTO_TCP);
+            if (s == invalid_socket)
+            {
+                return invalid_socket;
+            }
+
+            int reuse = 1;
+            setsockopt (s, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<char const *> (&reuse), sizeof (reuse));
+
+            auto address = loopback_address (port);
+            if (bind (s, reinterpret_cast<sockaddr const *> (&address), sizeof (address)) != 0 || listen (s, 64) != 0)
+            {
+                close_socket (s);
+                return invalid_socket;
+            }
+
+            return s;
+        }
+
+        inline socket_handle connect_local (unsigned short port) noexcept
+        {
+            if (!socket_startup ())
+            {
+                return invalid_socket;
+            }
+
+            auto s = socket (AF_INET, SOCK_STREAM, IPPROTO_TCP);
+            if (s == invalid_socket)
+            {
+                return invalid_socket;
+            }
+
+            auto address = loopback_address (port);
+            if (connect (s, reinterpret_cast<sockaddr const *> (&address), sizeof (address)) != 0)
+            {
+                close_socket (s);
+                return invalid_socket;
+            }
+
+            return s;
+        }
+
+        inline bool send_all (socket_handle s, char const * data, std::size_t size) noexcept
+        {
+            while (size > 0)
+            {
+                auto chunk  = static_cast<int> (std::min<std::size_t> (size, 1U << 20));
+                auto sent   = send (s, data, chunk, send_flags);
+                if (sent <= 0)
+                {
+                    return false;
+                }
+                data += sent;
+                size -= static_cast<std::size_t> (sent);
+            }
+            return true;
+        }
+
+        // Reads until the blank line that ends the request head, the body (if any) is ignored
+        inline bool receive_head (socket_handle s, std::string & head)
+        {
+            char buffer[1024];
+            while (head.find ("\r\n\r\n") == std::string::npos)
+            {
+                if (head.size () > 8192)
+                {
+                    return false;
+                }
+
+                auto received = recv (s, buffer, static_cast<int> (sizeof (buffer)), 0);
+                if (received <= 0)
+                {
+                    return false;
+                }
+                head.append (buffer, static_cast<std::size_t> (received));
+            }
+            return true;
+        }
+
+        inline void put_u16 (std::vector<char> & out, std::uint32_t value)
+        {
+            out.push_back (static_cast<char> (value & 0xFF));
+            out.push_back (static_cast<char> ((value >> 8) & 0xFF));
+        }
+
+        inline void put_u32 (std::vector<char> & out, std::uint32_t value)
+        {
+            put_u16 (out, value & 0xFFFF);
+            put_u16 (out, value >> 16);
+        }
+    }
+
+    // 32 bit top-down BMP, the simplest image format every browser shows
+    inline std::vector<char> encode_bmp (std::uint32_t const * rgba, unsigned int width, unsigned int height)
+    {
+        auto const header_size  = 14U + 40U;
+        auto const pixel_size   = width * height * 4U;
+
+        std::vector<char> result;
+        result.reserve (header_size + pixel_size);
+
+        // BITMAPFILEHEADER
+        result.push_back ('B');
+        result.push_back ('M');
+        details::put_u32 (result, header_size + pixel_size);
+        details::put_u32 (result, 0);
+        details::put_u32 (result, header_size);
+
+        // BITMAPINFOHEADER, negative height means the first row is the top one
+        details::put_u32 (result, 40);
+        details::put_u32 (result, width);
+        details::put_u32 (result, static_cast<std::uint32_t> (-static_cast<std::int32_t> (height)));
+        details::put_u16 (result, 1);
+        details::put_u16 (result, 32);
+        details::put_u32 (result, 0);
+        details::put_u32 (result, pixel_size);
+        details::put_u32 (result, 2835);
+        details::put_u32 (result, 2835);
+        details::put_u32 (result, 0);
+        details::put_u32 (result, 0);
+
+        // BGRA byte order
+        for (auto i = 0U; i < width * height; ++i)
+        {
+            auto const color = rgba[i];
+            result.push_back (static_cast<char> ((color >> 16) & 0xFF));
+            result.push_back (static_cast<char> ((color >> 8 ) & 0xFF));
+            result.push_back (static_cast<char> ( color        & 0xFF));
+            result.push_back (static_cast<char> ((color >> 24) & 0xFF));
+        }
+
+        return result;
+    }
+
+    // Slippy map addressing: level z splits the square of side 4 around (-0.5, 0) into
+    //  2^z by 2^z tiles, x grows with the real part and y with the imaginary part
+    struct tile_address
+    {
+        unsigned int    z   ;
+        std::uint64_t   x   ;
+        std::uint64_t   y   ;
+    };
+
+    // Parses "/z/x/y" with an optional ".bmp" extension
+    inline bool parse_tile_path (std::string const & path, tile_address & address)
+    {
+        unsigned int        z       = 0;
+        unsigned long long  x       = 0;
+        unsigned long long  y       = 0;
+        char                rest[8] {};
+
+        auto fields = std::sscanf (path.c_str (), "/%u/%llu/%llu%7s", &z, &x, &y, rest);
+        if (fields < 3 || (fields == 4 && std::strcmp (rest, ".bmp") != 0) || z > 60)
+        {
+            return false;
+        }
+
+        auto const tiles = std::uint64_t (1) << z;
+        if (x >= tiles || y >= tiles)
+        {
+            return false;
+        }
+
+        address.z = z;
+        address.x = x;
+        address.y = y;
+        return true;
+    }
+
+    struct tile_server_options
+    {
+        unsigned short              port            = 8080                      ;
+        unsigned int                tile_size       = 256                       ;
+        unsigned int                iter            = 512                       ;
+        formula                     tile_formula    = formula::mandelbrot2      ;
+        // Connections are served by this many threads, each tile render is parallel itself
+        unsigned int                workers         = 4                         ;
+        std::size_t                 cache_bytes     = std::size_t (64) << 20    ;
+        // A client that sends nothing for this long is dropped, so it cannot hold a worker
+        unsigned int                idle_timeout_ms = 10000                     ;
+        std::vector<std::uint32_t>  colors          ;
+        // Renders the escape counts of a tile instead of the formula kernels when set
+        std::function<void (formula_view const &, std::uint32_t *)>  renderer   ;
+    };
+
+    // Serves GET /z/x/y.bmp on the loopback interface. Tiles come from the in-memory cache,
+    //  then the optional disk store, then the formula kernels. Concurrent requests for a
+    //  tile that is being rendered wait for that render instead of starting their own.
+    struct tile_server
+    {
+        using ptr       = std::unique_ptr<tile_server>;
+        using counts    = std::shared_ptr<std::vector<std::uint32_t> const>;
+
+        static ptr open (tile_server_options options, tile_store::ptr store)
+        {
+            auto listener = details::listen_local (options.port);
+            if (listener == details::invalid_socket)
+            {
+                return nullptr;
+            }
+
+            return ptr (new tile_server (std::move (options), std::move (store), listener));
+        }
+
+        // Connections being served are shut down, a client keeping one open idle or not
+        //  reading the response would keep its worker from ever being joined otherwise
+        ~tile_server () noexcept
+        {
+            {
+                std::lock_guard<std::mutex> lock (m_connections_lock);
+                m_stopping = true;
+                for (auto connection : m_serving)
+                {
+                    details::shutdown_socket (connection);
+                }
+            }
+
+            details::shutdown_socket (m_listener);
+            details::close_socket (m_listener);
+            m_connection_ready.notify_all ();
+
+            m_acceptor.join ();
+            for (auto & worker : m_workers)
+            {
+                worker.join ();
+            }
+
+            for (auto connection : m_connections)
+            {
+                details::close_socket (connection);
+            }
+        }
+
+        inline unsigned short port () const noexcept
+        {
+            return m_options.port;
+        }
+
+        inline tile_server_options const & options () const noexcept
+        {
+            return m_options;
+        }
+
+        // The escape counts of a tile, tile_size * tile_size values. Throws what the render
+        //  threw, to every request that waited for that render as well.
+        counts tile (tile_address const & address)
+        {
+            auto const key  = key_of (address);
+            auto const size = static_cast<std::size_t> (key.width) * key.height;
+
+            std::unique_lock<std::mutex> lock (m_tiles_lock);
+            ++m_requests;
+
+            std::vector<std::uint32_t> found (size);
+            if (m_cache.find (key, found.data ()))
+            {
+                return std::make_shared<std::vector<std::uint32_t> const> (std::move (found));
+            }
+
+            if (m_store && m_store->find (key, found.data ()))
+            {
+                ++m_disk_hits;
+                m_cache.insert (key, found.data ());
+                return std::make_shared<std::vector<std::uint32_t> const> (std::move (found));
+            }
+
+            auto rendering = m_rendering.find (key);
+            if (rendering != m_rendering.end ())
+            {
+                ++m_coalesced;
+                auto pending = rendering->second;
+                m_rendered.wait (lock, [&] () { return pending->done; });
+                if (pending->error)
+                {
+                    std::rethrow_exception (pending->error);
+                }
+                return pending->result;
+            }
+
+            auto pending = std::make_shared<pending_tile> ();
+            m_rendering[key] = pending;
+
+            // Called with the lock held, however the render ends the requests coalesced
+            //  onto it are released and the next request for the tile starts over
+            auto const settle = [&] (counts result, std::exception_ptr error)
+            {
+                pending->result = std::move (result);
+                pending->error  = error;
+                pending->done   = true;
+                m_rendering.erase (key);
+            };
+
+            lock.unlock ();
+
+            counts result;
+            try
+            {
+                result = render (key);
+
+                lock.lock ();
+                ++m_renders;
+
+                m_cache.insert (key, result->data ());
+                if (m_store)
+                {
+                    m_store->insert (key, result->data ());
+                }
+            }
+            catch (...)
+            {
+                if (!lock.owns_lock ())
+                {
+                    lock.lock ();
+                }
+                settle (nullptr, std::current_exception ());
+                lock.unlock ();
+                m_rendered.notify_all ();
+                throw;
+            }
+
+            settle (result, nullptr);
+
+            lock.unlock ();
+            m_rendered.notify_all ();
+
+            return result;
+        }
+
+        struct statistics
+        {
+            std::uint64_t   requests    ;
+            std::uint64_t   renders     ;
+            std::uint64_t   coalesced   ;
+            std::uint64_t   memory_hits ;
+            std::uint64_t   disk_hits   ;
+        };
+
+        statistics stats () const
+        {
+            std::lock_guard<std::mutex> lock (m_tiles_lock);
+            return statistics {m_requests, m_renders, m_coalesced, m_cache.hits (), m_disk_hits};
+        }
+
+    private:
+        struct pending_tile
+        {
+            bool                done    = false ;
+            counts              result          ;
+            std::exception_ptr  error           ;
+        };
+
+        tile_server (tile_server_options options, tile_store::ptr store, details::socket_handle listener)
+            :   m_options   (std::move (options))
+            ,   m_store     (std::move (store))
+            ,   m_cache     (m_options.cache_bytes)
+            ,   m_listener  (listener)
+        {
+            auto workers = m_options.workers > 0 ? m_options.workers : 1;
+            for (auto worker = 0U; worker < workers; ++worker)
+            {
+                m_workers.emplace_back ([this] () { serve (); });
+            }
+
+            m_acceptor = std::thread ([this] () { accept (); });
+        }
+
+        tile_key key_of (tile_address const & address) const noexcept
+        {
+            auto const tiles    = static_cast<double> (std::uint64_t (1) << address.z);
+            auto const side     = 4 / tiles;
+            auto const size     = m_options.tile_size;
+
+            tile_key key        {}                                                      ;
+            key.center_x        = -2.5 + (static_cast<double> (address.x) + 0.5) * side ;
+            key.center_y        = -2.0 + (static_cast<double> (address.y) + 0.5) * side ;
+            key.zoom            = 1 / side                                              ;
+            key.iter            = m_options.iter                                        ;
+            // Offset so formula library tiles never collide with the AMP formula ids
+            key.formula         = 0x100 + static_cast<unsigned int> (m_options.tile_formula);
+            key.width           = size                                                  ;
+            key.height          = size                                                  ;
+
+            auto p = required_precision (key.center_x, key.center_y, key.zoom, size, size);
+            key.precision       = static_cast<unsigned int> (p < precision::float64 ? precision::float64 : p);
+
+            return key;
+        }
+
+        counts render (tile_key const & key) const
+        {
+            auto result = std::make_shared<std::vector<std::uint32_t>> (static_cast<std::size_t> (key.width) * key.height);
+
+            formula_view view;
+            view.center_x   = key.center_x  ;
+            view.center_y   = key.center_y  ;
+            view.zoom       = key.zoom      ;
+            view.width      = key.width     ;
+            view.height     = key.height    ;
+            view.iter       = key.iter      ;
+
+            if (m_options.renderer)
+            {
+                m_options.renderer (view, result->data ());
+                return result;
+            }
+
+            auto kernel = select_kernel (m_options.tile_formula, static_cast<precision> (key.precision));
+            if (kernel)
+            {
+                render_formula (view, kernel, result->data ());
+            }
+
+            return result;
+        }
+
+        void accept ()
+        {
+            for (;;)
+            {
+                auto connection = ::accept (m_listener, nullptr, nullptr);
+
+                std::lock_guard<std::mutex> lock (m_connections_lock);
+                if (m_stopping)
+                {
+                    if (connection != details::invalid_socket)
+                    {
+                        details::close_socket (connection);
+                    }
+                    return;
+                }
+
+                if (connection != details::invalid_socket)
+                {
+                    details::set_receive_timeout (connection, m_options.idle_timeout_ms);
+                    m_connections.push_back (connection);
+                    m_connection_ready.notify_one ();
+                }
+            }
+        }
+
+        void serve ()
+        {
+            for (;;)
+            {
+                details::socket_handle connection;
+                {
+                    std::unique_lock<std::mutex> lock (m_connections_lock);
+                    m_connection_ready.wait (lock, [this] () { return m_stopping || !m_connections.empty (); });
+                    if (m_stopping)
+                    {
+                        return;
+                    }
+
+                    connection = m_connections.front ();
+                    m_connections.pop_front ();
+                    m_serving.push_back (connection);
+                }
+
+                respond (connection);
+
+                {
+                    std::lock_guard<std::mutex> lock (m_connections_lock);
+                    m_serving.erase (std::find (m_serving.begin (), m_serving.end (), connection));
+                }
+                details::close_socket (connection);
+            }
+        }
+
+        void respond (details::socket_handle connection)
+        {
+            std::string head;
+            if (!details::receive_head (connection, head))
+            {
+                return;
+            }
+
+            char method[8]  {};
+            char path[256]  {};
+            tile_address address {};
+
+            if (std::sscanf (head.c_str (), "%7s %255s", method, path) != 2 || std::strcmp (method, "GET") != 0)
+            {
+                send_status (connection, "405 Method Not Allowed");
+                return;
+            }
+
+            if (!parse_tile_path (path, address))
+            {
+                send_status (connection, "404 Not Found");
+                return;
+            }
+
+            counts tile_counts;
+            try
+            {
+                tile_counts = tile (address);
+            }
+            catch (...)
+            {
+                send_status (connection, "500 Internal Server Error");
+                return;
+            }
+
+            auto const size         = m_options.tile_size;
+            auto const palette      = cyclic_palette (m_options.colors, 0, m_options.iter);
+
+            std::vector<std::uint32_t> pixels (tile_counts->size ());
+            for (auto i = std::size_t (); i < pixels.size (); ++i)
+            {
+                pixels[i] = m_options.colors.empty ()
+                    ? ((*tile_counts)[i] + 1 >= m_options.iter ? opaque_black : 0xFFFFFFFFU)
+                    : palette ((*tile_counts)[i])
+                    ;
+            }
+
+            auto const body = encode_bmp (pixels.data (), size, size);
+
+            char header[256];
+            auto header_size = std::snprintf (
+                    header
+                ,   sizeof (header)
+                ,   "HTTP/1.1 200 OK\r\nContent-Type: image/bmp\r\nContent-Length: %u\r\nConnection: close\r\n\r\n"
+                ,   static_cast<unsigned int> (body.size ())
+                );
+
+            if (details::send_all (connection, header, static_cast<std::size_t> (header_size)))
+            {
+                details::send_all (connection, body.data (), body.size ());
+            }
+        }
+
+        static void send_status (details::socket_handle connection, char const * status)
+        {
+            char header[256];
+            auto header_size = std::snprintf (
+                    header
+                ,   sizeof (header)
+                ,   "HTTP/1.1 %s\r\nContent-Length: 0\r\nConnection: close\r\n\r\n"
+                ,   status
+                );
+
+            details::send_all (connection, header, static_cast<std::size_t> (header_size));
+        }
+
+        tile_server_options                                                             m_options           ;
+        tile_store::ptr                                                                 m_store             ;
+
+        mutable std::mutex                                                              m_tiles_lock        ;
+        std::condition_variable                                                         m_rendered          ;
+        tile_cache                                                                      m_cache             ;
+        std::unordered_map<tile_key, std::shared_ptr<pending_tile>, tile_key_hash>      m_rendering         ;
+        std::uint64_t                                                                   m_requests      = 0 ;
+        std::uint64_t                                                                   m_renders       = 0 ;
+        std::uint64_t                                                                   m_coalesced     = 0 ;
+        std::uint64_t                                                                   m_disk_hits     = 0 ;
+
+        details::socket_handle                                                          m_listener          ;
+        std::mutex                                                                      m_connections_lock  ;
+        std::condition_variable                                                         m_connection_ready  ;
+        std::deque<details::socket_handle>                                              m_connections       ;
+        // Taken by a worker, shut down by the destructor to unblock it
+        std::vector<details::socket_handle>                                             m_serving           ;
+        bool                                                                            m_stopping      = false;
+        std::thread                                                                     m_acceptor          ;
+        std::vector<std::thread>                                                        m_workers           ;
+    };
+
+    struct load_test_result
+    {
+        std::size_t     succeeded   = 0;
+        std::size_t     failed      = 0;
+        double          seconds     = 0;
+        double          p50_ms      = 0;
+        double          p99_ms      = 0;
+    };
+
+    // Fires requests GET requests from clients concurrent connections against a server on
+    //  localhost. Tiles cycle through the first distinct tiles of one level, so fewer
+    //  distinct tiles than clients makes clients ask for the same tile at the same time.
+    inline load_test_result tile_load_test (
+            unsigned short  port
+        ,   unsigned int    level
+        ,   std::size_t     distinct
+        ,   std::size_t     requests
+        ,   unsigned int    clients
+        )
+    {
+        std::atomic<std::size_t> next {0};
+        std::vector<std::vector<double>> latencies (clients);
+        std::vector<std::size_t> failures (clients);
+
+        auto const tiles = std::uint64_t (1) << level;
+
+        auto const seconds = measure_ms (1, [&] ()
+        {
+            std::vector<std::thread> threads;
+            for (auto client = 0U; client < clients; ++client)
+            {
+                threads.emplace_back ([&, client] ()
+                {
+                    for (auto request = next++; request < requests; request = next++)
+                    {
+                        auto const tile = static_cast<std::uint64_t> (request % distinct) % (tiles * tiles);
+
+                        char head[128];
+                        auto size = std::snprintf (
+                                head
+                            ,   sizeof (head)
+                            ,   "GET /%u/%llu/%llu.bmp HTTP/1.1\r\nHost: localhost\r\n\r\n"
+                            ,   level
+                            ,   static_cast<unsigned long long> (tile % tiles)
+                            ,   static_cast<unsigned long long> (tile / tiles)
+                            );
+
+                        auto const before = std::chrono::steady_clock::now ();
+
+                        auto connection = details::connect_local (port);
+                        auto ok         = connection != details::invalid_socket
+                            && details::send_all (connection, head, static_cast<std::size_t> (size));
+
+                        std::string response;
+                        char buffer[16384];
+                        for (int received; ok && (received = recv (connection, buffer, static_cast<int> (sizeof (buffer)), 0)) > 0;)
+                        {
+                            response.append (buffer, static_cast<std::size_t> (received));
+                        }
+
+                        if (connection != details::invalid_socket)
+                        {
+                            details::close_socket (connection);
+                        }
+
+                        auto const after = std::chrono::steady_clock::now ();
+
+                        if (ok && response.compare (0, 12, "HTTP/1.1 200") == 0)
+                        {
+                            latencies[client].push_back (std::chrono::duration<double, std::milli> (after - before).count ());
+                        }
+                        else
+                        {
+                            ++failures[client];
+                        }
+                    }
+                });
+            }
+
+            for (auto & thread : threads)
+            {
+                thread.join ();
+            }
+        }) / 1000;
+
+        load_test_result result;
+        result.seconds = seconds;
+
+        std::vector<double> all;
+        for (auto client = 0U; client < clients; ++client)
+        {
+            all.insert (all.end (), latencies[client].begin (), latencies[client].end ());
+            result.failed += failures[client];
+        }
+        result.succeeded = all.size ();
+
+        if (!all.empty ())
+        {
+            std::sort (all.begin (), all.end ());
+            result.p50_ms = all[all.size () / 2];
+            result.p99_ms = all[std::min (all.size () - 1, all.size () * 99 / 100)];
+        }
+
+        return result;
+    }
+
+    // A cold pass over a whole level (every tile rendered once), the same pass warm from
+    //  the cache, and all clients asking for one uncached deep tile at once
+    inline void benchmark_tile_server (benchmark_report & report, unsigned short port, unsigned int level = 3, unsigned int clients = 16)
+    {
+        auto const tiles = std::size_t (1) << (2 * level);
+
+        struct pass
+        {
+            char const *    name        ;
+            unsigned int    level       ;
+            std::size_t     distinct    ;
+            std::size_t     requests    ;
+        };
+
+        pass const passes[] =
+        {
+                {"cold level"   , level     , tiles , 4 * tiles }
+            ,   {"warm level"   , level     , tiles , 4 * tiles }
+            ,   {"one deep tile", level + 9 , 1     , clients   }
+        };
+
+        char name[96];
+        for (auto const & p : passes)
+        {
+            auto result = tile_load_test (port, p.level, p.distinct, p.requests, clients);
+
+            std::snprintf (
+                    name
+                ,   sizeof (name)
+                ,   "%s, p50 %.1f ms, p99 %.1f ms, %u failed"
+                ,   p.name
+                ,   result.p50_ms
+                ,   result.p99_ms
+                ,   static_cast<unsigned int> (result.failed)
+                );
+
+            report.add ("tile server requests", name, result.seconds * 1000, static_cast<double> (result.succeeded));
+        }
+    }
+}
@@ -0,0 +1,176 @@
+// ----------------------------------------------------------------------------------------------
+// Copyright (c) Mrten Rnge.
+// ----------------------------------------------------------------------------------------------
+// This source code is subject to terms and conditions of the Microsoft Public License. A
+// copy of the license can be found in the License.html file at the root of this distribution.
+// If you cannot locate the  Microsoft Public License, please send an email to
+// dlr@microsoft.com. By using this source code in any fashion, you are agreeing to be bound
+//  by the terms of the Microsoft Public License.
+// ----------------------------------------------------------------------------------------------
+// You must not remove this notice, or any other, from this software.
+// ----------------------------------------------------------------------------------------------
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "tile_server.h"
+#include "tests.h"
+
+namespace
+{
+    using namespace fractal;
+
+    // Ports in use by something else are skipped
+    tile_server::ptr open_server (tile_server_options options)
+    {
+        for (unsigned short port = 28080; port < 28180; ++port)
+        {
+            options.port = port;
+            if (auto server = tile_server::open (options, nullptr))
+            {
+                return server;
+            }
+        }
+        return nullptr;
+    }
+
+    tile_server_options small_tiles ()
+    {
+        tile_server_options options;
+        options.tile_size   = 32;
+        options.iter        = 64;
+        options.workers     = 2;
+        return options;
+    }
+
+    // Destroys the server on a thread of its own, true if that finished in time. A hung
+    //  destructor is left behind on its detached thread.
+    bool stops_within (tile_server::ptr server, std::chrono::milliseconds limit)
+    {
+        auto stopped = std::make_shared<std::promise<void>> ();
+        auto done    = stopped->get_future ();
+
+        std::thread ([stopped] (tile_server::ptr s) { s.reset (); stopped->set_value (); }, std::move (server)).detach ();
+
+        return done.wait_for (limit) == std::future_status::ready;
+    }
+
+    FRACTAL_TEST (tile_server_serves_tiles)
+    {
+        auto server = open_server (small_tiles ());
+        CHECK (server);
+
+        auto const result = tile_load_test (server->port (), 2, 4, 16, 4);
+        CHECK (result.succeeded == 16);
+        CHECK (result.failed == 0);
+        CHECK (server->stats ().renders == 4);
+    }
+
+    // A keep-alive client that connects and never sends a request used to keep its worker
+    //  blocked in recv, and the destructor joining it, forever
+    FRACTAL_TEST (tile_server_stops_with_idle_clients)
+    {
+        auto server = open_server (small_tiles ());
+        CHECK (server);
+
+        std::vector<details::socket_handle> idle;
+        for (auto i = 0; i < 3; ++i)
+        {
+            idle.push_back (details::connect_local (server->port ()));
+            CHECK (idle.back () != details::invalid_socket);
+        }
+
+        // Let the workers pick the connections up and block on them
+        std::this_thread::sleep_for (std::chrono::milliseconds (200));
+
+        CHECK (stops_within (std::move (server), std::chrono::seconds (5)));
+
+        for (auto s : idle)
+        {
+            details::close_socket (s);
+        }
+    }
+
+    FRACTAL_TEST (tile_server_drops_idle_clients_after_timeout)
+    {
+        auto options = small_tiles ();
+        options.workers         = 1;
+        options.idle_timeout_ms = 100;
+
+        auto server = open_server (options);
+        CHECK (server);
+
+        auto idle = details::connect_local (server->port ());
+        CHECK (idle != details::invalid_socket);
+
+        // The only worker is free again once the idle client timed out
+        auto const result = tile_load_test (server->port (), 1, 1, 1, 1);
+        CHECK (result.succeeded == 1);
+
+        details::close_socket (idle);
+    }
+
+    // Requests coalesced onto a render that throws used to wait forever
+    FRACTAL_TEST (tile_server_failed_render_releases_waiters)
+    {
+        auto const waiters = 3U;
+
+        tile_server * serving = nullptr;
+        std::atomic<int> renders {0};
+
+        auto options = small_tiles ();
+        options.renderer = [&] (formula_view const & view, std::uint32_t * counts)
+        {
+            if (renders++ == 0)
+            {
+                // Hold the render until the other requests are waiting on it, then fail
+                while (serving->stats ().coalesced < waiters)
+                {
+                    std::this_thread::yield ();
+                }
+                throw std::runtime_error ("render failed");
+            }
+
+            std::fill (counts, counts + static_cast<std::size_t> (view.width) * view.height, 1U);
+        };
+
+        auto server = open_server (options);
+        CHECK (server);
+        serving = server.get ();
+
+        tile_address const address {3, 1, 2};
+
+        std::atomic<int> failures {0};
+        std::vector<std::future<void>> requests;
+        for (auto i = 0U; i <= waiters; ++i)
+        {
+            requests.push_back (std::async (std::launch::async, [&] ()
+            {
+                try
+                {
+                    server->tile (address);
+                }
+                catch (std::runtime_error const &)
+                {
+                    ++failures;
+                }
+            }));
+        }
+
+        for (auto & request : requests)
+        {
+            CHECK (request.wait_for (std::chrono::seconds (5)) == std::future_status::ready);
+        }
+        CHECK (failures == static_cast<int> (waiters + 1));
+
+        // The failed render is forgotten, the next request renders the tile again
+        auto const counts = server->tile (address);
+        CHECK (counts && (*counts)[0] == 1);
+        CHECK (renders == 2);
+    }
+}
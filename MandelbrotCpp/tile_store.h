@@ -0,0 +1,554 @@
+// ----------------------------------------------------------------------------------------------
+// Copyright (c) Mrten Rnge.
+// ----------------------------------------------------------------------------------------------
+// This source code is subject to terms and conditions of the Microsoft Public License. A
+// copy of the license can be found in the License.html file at the root of this distribution.
+// If you cannot locate the  Microsoft Public License, please send an email to
+// dlr@microsoft.com. By using this source code in any fashion, you are agreeing to be bound
+//  by the terms of the Microsoft Public License.
+// ----------------------------------------------------------------------------------------------
+// You must not remove this notice, or any other, from this software.
+// ----------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <vector>
+
+#include "mapped_file.h"
+
+namespace fractal
+{
+    // Everything an iteration tile depends on. Two renders with equal keys produce
+    //  identical iteration counts so the key is compared bitwise.
+    struct tile_key
+    {
+        double          center_x    ;
+        double          center_y    ;
+        double          zoom        ;
+        double          param_x     ;
+        double          param_y     ;
+        std::uint32_t   iter        ;
+        std::uint32_t   formula     ;
+        std::uint32_t   precision   ;
+        std::uint32_t   width       ;
+        std::uint32_t   height      ;
+        std::uint32_t   reserved    ;
+    };
+
+    static_assert (sizeof (tile_key) == 64, "tile_key must not contain padding");
+
+    inline bool operator== (tile_key const & l, tile_key const & r) noexcept
+    {
+        return std::memcmp (&l, &r, sizeof (tile_key)) == 0;
+    }
+
+    inline std::uint64_t hash_key (tile_key const & key) noexcept
+    {
+        // FNV-1a, 0 is reserved for empty index slots
+        auto bytes  = reinterpret_cast<unsigned char const *> (&key);
+        auto hash   = 14695981039346656037ULL;
+
+        for (auto iter = 0U; iter < sizeof (tile_key); ++iter)
+        {
+            hash ^= bytes[iter];
+            hash *= 1099511628211ULL;
+        }
+
+        return hash == 0 ? 1 : hash;
+    }
+
+    // Persistent store of iteration tiles shared between processes.
+    //
+    //  tiles.dat   header followed by append-only records (key + iteration counts)
+    //  tiles.idx   header followed by an open addressing hash table of slots pointing into tiles.dat
+    //
+    //  Appends are serialized with a file lock. A record is flushed to disk before the data
+    //  header is advanced past it and the slot pointing to it is published last so a crash
+    //  at any point leaves at worst an orphaned record, never a slot referencing torn data.
+    //  Readers take no file locks.
+    //
+    //  Inserts are queued and written by a thread of the store, the flushes never hold up
+    //  the caller. Within a process the data mapping is shared between finds and that
+    //  thread and only exclusively locked to remap it, when either side sees the file grow.
+    //  Nothing is ever evicted, once the data file reaches max_bytes or the index has no
+    //  free slot left the store reports full and new tiles are dropped.
+    struct tile_store
+    {
+        using ptr = std::unique_ptr<tile_store>;
+
+        ~tile_store () noexcept
+        {
+            if (!m_thread.joinable ())
+            {
+                return;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock (m_lock);
+                m_stopping = true;
+            }
+            m_changed.notify_all ();
+            m_thread.join ();
+        }
+
+        static ptr open (
+                native_path const & index_path
+            ,   native_path const & data_path
+            ,   std::uint32_t       capacity    = 1U << 16
+            ,   std::uint64_t       max_bytes   = 1ULL << 32
+            )
+        {
+            // Capacity must be a power of 2 for the probe mask
+            if (capacity == 0 || (capacity & (capacity - 1)) != 0)
+            {
+                return nullptr;
+            }
+
+            ptr result (new tile_store ());
+
+            result->m_max_bytes = max_bytes;
+            result->m_index     = mapped_file::open (index_path, sizeof (index_header) + capacity * sizeof (index_slot));
+            result->m_data      = mapped_file::open (data_path , initial_data_size);
+
+            if (!result->m_index || !result->m_data)
+            {
+                return nullptr;
+            }
+
+            if (!result->m_index->lock ())
+            {
+                return nullptr;
+            }
+
+            auto initialized = result->initialize (capacity);
+
+            result->m_index->unlock ();
+
+            if (!initialized)
+            {
+                return nullptr;
+            }
+
+            result->m_thread = std::thread ([store = result.get ()] () { store->run (); });
+
+            return result;
+        }
+
+        // Copies the key.width*key.height iteration counts stored for key to iterations,
+        //  false if there are none. Tiles still waiting to be written are found as well.
+        bool find (tile_key const & key, std::uint32_t * iterations)
+        {
+            {
+                std::lock_guard<std::mutex> lock (m_lock);
+                for (auto const & queued : m_jobs)
+                {
+                    if (queued.key == key)
+                    {
+                        std::memcpy (iterations, queued.iterations.data (), queued.iterations.size () * sizeof (std::uint32_t));
+                        return true;
+                    }
+                }
+            }
+
+            for (;;)
+            {
+                auto stale = false;
+                {
+                    std::shared_lock<std::shared_timed_mutex> mapping (m_mapping_lock);
+                    if (auto rec = locate (key, stale))
+                    {
+                        std::memcpy (iterations, rec + 1, static_cast<std::size_t> (rec->payload_size));
+                        return true;
+                    }
+                }
+
+                // The record is past the end of our mapping, the file was grown by another
+                //  process. Retried only while the remap actually picks up more of it.
+                if (!stale || !refresh ())
+                {
+                    return false;
+                }
+            }
+        }
+
+        // Queues the width*height iteration counts for key to be appended. Returns false
+        //  when the store is full or already has queue_limit tiles waiting, the render
+        //  simply isn't persisted then. A write the disk refuses is dropped the same way.
+        bool insert (tile_key const & key, std::uint32_t const * iterations)
+        {
+            if (full ())
+            {
+                return false;
+            }
+
+            std::lock_guard<std::mutex> lock (m_lock);
+            if (m_jobs.size () >= queue_limit)
+            {
+                return false;
+            }
+
+            for (auto const & queued : m_jobs)
+            {
+                if (queued.key == key)
+                {
+                    return true;
+                }
+            }
+
+            auto const size = static_cast<std::size_t> (key.width) * key.height;
+            m_jobs.push_back (job {key, std::vector<std::uint32_t> (iterations, iterations + size)});
+            m_changed.notify_all ();
+
+            return true;
+        }
+
+        // Blocks until every queued tile is written or dropped
+        void wait ()
+        {
+            std::unique_lock<std::mutex> lock (m_lock);
+            m_changed.wait (lock, [this] () { return m_jobs.empty (); });
+        }
+
+        // True once a tile was dropped for lack of room, from then on nothing new is kept
+        bool full () const noexcept
+        {
+            return m_full.load (std::memory_order_relaxed);
+        }
+
+    private:
+        struct job
+        {
+            tile_key                    key         ;
+            std::vector<std::uint32_t>  iterations  ;
+        };
+
+        // Writes the queued tiles, front first. A tile stays queued until it is on disk so
+        //  a find in between still sees it.
+        void run ()
+        {
+            std::unique_lock<std::mutex> lock (m_lock);
+            for (;;)
+            {
+                m_changed.wait (lock, [this] () { return m_stopping || !m_jobs.empty (); });
+                if (m_jobs.empty ())
+                {
+                    return;
+                }
+
+                auto & next = m_jobs.front ();
+
+                lock.unlock ();
+                if (m_index->lock ())
+                {
+                    write_locked (next.key, next.iterations.data ());
+                    m_index->unlock ();
+                }
+                lock.lock ();
+
+                m_jobs.pop_front ();
+                m_changed.notify_all ();
+            }
+        }
+
+        bool write_locked (tile_key const & key, std::uint32_t const * iterations)
+        {
+            // Another process might have added it while we were rendering
+            if (contains (key))
+            {
+                return true;
+            }
+
+            auto slot = free_slot (hash_key (key));
+            if (!slot)
+            {
+                m_full.store (true, std::memory_order_relaxed);
+                return false;
+            }
+
+            auto payload_size   = static_cast<std::uint64_t> (key.width) * key.height * sizeof (std::uint32_t);
+            auto record_size    = align (sizeof (tile_record) + payload_size);
+
+            std::uint64_t offset, mapped;
+            {
+                std::shared_lock<std::shared_timed_mutex> mapping (m_mapping_lock);
+                offset = data ()->end.load (std::memory_order_acquire);
+                mapped = m_data->size ();
+            }
+            auto end            = offset + record_size;
+
+            if (end > m_max_bytes)
+            {
+                m_full.store (true, std::memory_order_relaxed);
+                return false;
+            }
+
+            if (end > mapped)
+            {
+                std::lock_guard<std::shared_timed_mutex> mapping (m_mapping_lock);
+
+                auto grown = m_data->size () * 2;
+                if (!m_data->grow (grown < end ? end : (grown < m_max_bytes ? grown : m_max_bytes)))
+                {
+                    return false;
+                }
+            }
+
+            {
+                std::shared_lock<std::shared_timed_mutex> mapping (m_mapping_lock);
+
+                auto rec            = reinterpret_cast<tile_record *> (m_data->data () + offset);
+                rec->magic          = record_magic  ;
+                rec->payload_size   = payload_size  ;
+                rec->key            = key           ;
+                std::memcpy (rec + 1, iterations, static_cast<std::size_t> (payload_size));
+
+                if (!m_data->flush (offset, record_size))
+                {
+                    return false;
+                }
+
+                data ()->end.store (end, std::memory_order_release);
+                if (!m_data->flush (0, sizeof (data_header)))
+                {
+                    return false;
+                }
+            }
+
+            slot->offset    = offset        ;
+            slot->size      = record_size   ;
+            slot->hash.store (hash_key (key), std::memory_order_release);
+
+            auto slot_offset = reinterpret_cast<unsigned char *> (slot) - m_index->data ();
+            return m_index->flush (static_cast<std::uint64_t> (slot_offset), sizeof (index_slot));
+        }
+
+        bool contains (tile_key const & key)
+        {
+            for (;;)
+            {
+                auto stale = false;
+                {
+                    std::shared_lock<std::shared_timed_mutex> mapping (m_mapping_lock);
+                    if (locate (key, stale))
+                    {
+                        return true;
+                    }
+                }
+
+                if (!stale || !refresh ())
+                {
+                    return false;
+                }
+            }
+        }
+
+        static std::uint64_t const index_magic      = 0x5844494C49544D46ULL;  // "FMTILIDX"
+        static std::uint64_t const data_magic       = 0x5441444C49544D46ULL;  // "FMTILDAT"
+        static std::uint64_t const record_magic     = 0x4443524C49544D46ULL;  // "FMTILRCD"
+        static std::uint32_t const version          = 1                     ;
+        static std::uint64_t const alignment        = 64                    ;
+        static std::uint64_t const initial_data_size= 64ULL << 20           ;
+        static std::size_t   const queue_limit      = 4                     ;
+
+        struct index_header
+        {
+            std::uint64_t               magic       ;
+            std::uint32_t               version     ;
+            std::uint32_t               capacity    ;
+            unsigned char               padding[48] ;
+        };
+
+        struct index_slot
+        {
+            std::atomic<std::uint64_t>  hash        ;
+            std::uint64_t               offset      ;
+            std::uint64_t               size        ;
+            std::uint64_t               reserved    ;
+        };
+
+        struct data_header
+        {
+            std::uint64_t               magic       ;
+            std::uint64_t               version     ;
+            std::atomic<std::uint64_t>  end         ;
+            unsigned char               padding[40] ;
+        };
+
+        // Padded so the iteration counts following it stay 64 byte aligned
+        struct tile_record
+        {
+            std::uint64_t               magic       ;
+            std::uint64_t               payload_size;
+            tile_key                    key         ;
+            unsigned char               padding[48] ;
+        };
+
+        static_assert (sizeof (index_header) == alignment     , "index_header must be one cache line");
+        static_assert (sizeof (data_header ) == alignment     , "data_header must be one cache line" );
+        static_assert (sizeof (tile_record ) == 2 * alignment , "tile_record must keep payload aligned");
+
+        tile_store () noexcept                          = default;
+        tile_store (tile_store const &)                 = delete;
+        tile_store& operator= (tile_store const &)      = delete;
+
+        static constexpr std::uint64_t align (std::uint64_t size) noexcept
+        {
+            return (size + alignment - 1) / alignment * alignment;
+        }
+
+        index_header * index () const noexcept
+        {
+            return reinterpret_cast<index_header *> (m_index->data ());
+        }
+
+        index_slot * index_slots () const noexcept
+        {
+            return reinterpret_cast<index_slot *> (m_index->data () + sizeof (index_header));
+        }
+
+        data_header * data () const noexcept
+        {
+            return reinterpret_cast<data_header *> (m_data->data ());
+        }
+
+        bool initialize (std::uint32_t capacity)
+        {
+            auto ih = index ();
+            auto dh = data ();
+
+            // Fresh files are zero filled
+            if (ih->magic == 0)
+            {
+                ih->version     = version   ;
+                ih->capacity    = capacity  ;
+                ih->magic       = index_magic;
+                m_index->flush (0, sizeof (index_header));
+            }
+
+            if (dh->magic == 0)
+            {
+                dh->version     = version   ;
+                dh->end.store (sizeof (data_header), std::memory_order_release);
+                dh->magic       = data_magic;
+                m_data->flush (0, sizeof (data_header));
+            }
+
+            return
+                    ih->magic   == index_magic
+                &&  ih->version == version
+                &&  dh->magic   == data_magic
+                &&  dh->version == version
+                &&  sizeof (index_header) + ih->capacity * sizeof (index_slot) <= m_index->size ()
+                ;
+        }
+
+        index_slot * free_slot (std::uint64_t hash) const noexcept
+        {
+            auto header = index ();
+            auto slots  = index_slots ();
+            auto mask   = header->capacity - 1;
+
+            for (auto probe = 0U; probe < header->capacity; ++probe)
+            {
+                auto & slot = slots[(hash + probe) & mask];
+                if (slot.hash.load (std::memory_order_acquire) == 0)
+                {
+                    return &slot;
+                }
+            }
+
+            return nullptr;
+        }
+
+        // The record stored for key, nullptr if there is none. Needs m_mapping_lock held
+        //  at least shared. A slot pointing past the mapping sets stale, the mapping needs
+        //  a refresh before that record can be read.
+        tile_record const * locate (tile_key const & key, bool & stale) const noexcept
+        {
+            auto hash   = hash_key (key);
+            auto header = index ();
+            auto slots  = index_slots ();
+            auto mask   = header->capacity - 1;
+
+            for (auto probe = 0U; probe < header->capacity; ++probe)
+            {
+                auto & slot = slots[(hash + probe) & mask];
+                auto h      = slot.hash.load (std::memory_order_acquire);
+
+                if (h == 0)
+                {
+                    return nullptr;
+                }
+
+                if (h != hash)
+                {
+                    continue;
+                }
+
+                if (slot.offset + slot.size > m_data->size ())
+                {
+                    stale = true;
+                    continue;
+                }
+
+                auto rec = record_at (slot.offset, slot.size);
+                if (rec && rec->key == key)
+                {
+                    return rec;
+                }
+            }
+
+            return nullptr;
+        }
+
+        // Remaps the data file if another process grew it, false if there was nothing
+        //  new to map or the remap failed
+        bool refresh ()
+        {
+            std::lock_guard<std::shared_timed_mutex> mapping (m_mapping_lock);
+
+            auto const before = m_data->size ();
+            return m_data->refresh () && m_data->size () > before;
+        }
+
+        tile_record const * record_at (std::uint64_t offset, std::uint64_t size) const noexcept
+        {
+            if (offset + size > m_data->size () || size < sizeof (tile_record))
+            {
+                return nullptr;
+            }
+
+            auto rec = reinterpret_cast<tile_record const *> (m_data->data () + offset);
+
+            if (rec->magic != record_magic || sizeof (tile_record) + rec->payload_size > size)
+            {
+                return nullptr;
+            }
+
+            return rec;
+        }
+
+        mapped_file::ptr                m_index                 ;
+        mapped_file::ptr                m_data                  ;
+        std::uint64_t                   m_max_bytes     = 0     ;
+        std::atomic<bool>               m_full          {false} ;
+
+        // Held exclusively only to remap m_data
+        mutable std::shared_timed_mutex m_mapping_lock          ;
+
+        std::mutex                      m_lock                  ;
+        std::condition_variable         m_changed               ;
+        std::deque<job>                 m_jobs                  ;
+        bool                            m_stopping      = false ;
+        std::thread                     m_thread                ;
+    };
+}
@@ -0,0 +1,193 @@
+// ----------------------------------------------------------------------------------------------
+// Copyright (c) Mrten Rnge.
+// ----------------------------------------------------------------------------------------------
+// This source code is subject to terms and conditions of the Microsoft Public License. A
+// copy of the license can be found in the License.html file at the root of this distribution.
+// If you cannot locate the  Microsoft Public License, please send an email to
+// dlr@microsoft.com. By using this source code in any fashion, you are agreeing to be bound
+//  by the terms of the Microsoft Public License.
+// ----------------------------------------------------------------------------------------------
+// You must not remove this notice, or any other, from this software.
+// ----------------------------------------------------------------------------------------------
+
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include "tile_store.h"
+#include "tests.h"
+
+namespace
+{
+    using namespace fractal;
+
+    // Large enough that a few of them outgrow the initial data mapping
+    std::uint32_t const big_side = 1024;
+
+    tile_key key_of (std::uint32_t index, std::uint32_t side)
+    {
+        tile_key key {};
+        key.center_x    = index ;
+        key.zoom        = 1     ;
+        key.iter        = 256   ;
+        key.width       = side  ;
+        key.height      = side  ;
+        return key;
+    }
+
+    std::vector<std::uint32_t> counts_of (std::uint32_t index, std::uint32_t side)
+    {
+        std::vector<std::uint32_t> counts (static_cast<std::size_t> (side) * side);
+        for (auto i = std::size_t (); i < counts.size (); ++i)
+        {
+            counts[i] = static_cast<std::uint32_t> (i) ^ index;
+        }
+        return counts;
+    }
+
+    struct scratch_store
+    {
+        explicit scratch_store (char const * name)
+            :   index   (tests::scratch_path ((std::string (name) + ".idx").c_str ()))
+            ,   data    (tests::scratch_path ((std::string (name) + ".dat").c_str ()))
+        {
+            clear ();
+        }
+
+        ~scratch_store ()
+        {
+            clear ();
+        }
+
+        void clear ()
+        {
+            tests::remove_scratch (index);
+            tests::remove_scratch (data);
+        }
+
+        native_path const index ;
+        native_path const data  ;
+    };
+
+    FRACTAL_TEST (tile_store_finds_queued_and_written_tiles)
+    {
+        scratch_store files ("queued");
+        auto store = tile_store::open (files.index, files.data);
+        CHECK (store);
+
+        auto const counts = counts_of (1, 64);
+        std::vector<std::uint32_t> found (counts.size ());
+
+        CHECK (!store->find (key_of (1, 64), found.data ()));
+        CHECK (store->insert (key_of (1, 64), counts.data ()));
+
+        // Whether the writer got to it yet or not
+        CHECK (store->find (key_of (1, 64), found.data ()));
+        CHECK (found == counts);
+
+        store->wait ();
+        found.assign (found.size (), 0);
+        CHECK (store->find (key_of (1, 64), found.data ()));
+        CHECK (found == counts);
+    }
+
+    // A second store on the same files stands in for a second process, it keeps its
+    //  smaller mapping while the first grows the data file
+    FRACTAL_TEST (tile_store_reads_across_growth_by_another_store)
+    {
+        scratch_store files ("growth");
+        auto writer = tile_store::open (files.index, files.data);
+        auto reader = tile_store::open (files.index, files.data);
+        CHECK (writer && reader);
+
+        auto const tiles = 20U;
+        for (auto i = 0U; i < tiles; ++i)
+        {
+            auto const counts = counts_of (i, big_side);
+            while (!writer->insert (key_of (i, big_side), counts.data ()))
+            {
+                writer->wait ();
+            }
+        }
+        writer->wait ();
+        CHECK (!writer->full ());
+
+        std::vector<std::uint32_t> found (static_cast<std::size_t> (big_side) * big_side);
+        for (auto i = 0U; i < tiles; ++i)
+        {
+            CHECK (reader->find (key_of (i, big_side), found.data ()));
+            CHECK (found == counts_of (i, big_side));
+        }
+    }
+
+    // Finds on the store that is growing its own mapping used to read through the pointer
+    //  the remap had just unmapped
+    FRACTAL_TEST (tile_store_find_races_growth)
+    {
+        scratch_store files ("race");
+        auto store = tile_store::open (files.index, files.data);
+        CHECK (store);
+
+        auto const first = counts_of (0, big_side);
+        CHECK (store->insert (key_of (0, big_side), first.data ()));
+        store->wait ();
+
+        std::atomic<bool>   stop        {false} ;
+        std::atomic<bool>   mismatch    {false} ;
+        std::thread reader ([&] ()
+        {
+            std::vector<std::uint32_t> found (first.size ());
+            while (!stop.load ())
+            {
+                if (!store->find (key_of (0, big_side), found.data ()) || found != first)
+                {
+                    mismatch = true;
+                }
+            }
+        });
+
+        for (auto i = 1U; i < 20U; ++i)
+        {
+            auto const counts = counts_of (i, big_side);
+            while (!store->insert (key_of (i, big_side), counts.data ()))
+            {
+                store->wait ();
+            }
+        }
+        store->wait ();
+
+        stop = true;
+        reader.join ();
+
+        CHECK (!mismatch.load ());
+    }
+
+    FRACTAL_TEST (tile_store_reports_full)
+    {
+        scratch_store files ("full");
+        auto store = tile_store::open (files.index, files.data, 1U << 4, 1ULL << 20);
+        CHECK (store);
+
+        auto const counts = counts_of (0, 256);
+        auto kept = 0U;
+        for (auto i = 0U; i < 8U && !store->full (); ++i)
+        {
+            if (store->insert (key_of (i, 256), counts.data ()))
+            {
+                store->wait ();
+                kept += !store->full ();
+            }
+        }
+
+        // 256 KB tiles in a 1 MB store, the header takes the room of the fourth
+        CHECK (store->full ());
+        CHECK (kept == 3);
+        CHECK (!store->insert (key_of (100, 256), counts.data ()));
+
+        std::vector<std::uint32_t> found (counts.size ());
+        CHECK (store->find (key_of (0, 256), found.data ()));
+        CHECK (!store->find (key_of (3, 256), found.data ()));
+    }
+}
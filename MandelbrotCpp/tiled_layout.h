@@ -0,0 +1,451 @@
+// ----------------------------------------------------------------------------------------------
+// Copyright (c) Mrten Rnge.
+// ----------------------------------------------------------------------------------------------
+// This source code is subject to terms and conditions of the Microsoft Public License. A
+// copy of the license can be found in the License.html file at the root of this distribution.
+// If you cannot locate the  Microsoft Public License, please send an email to
+// dlr@microsoft.com. By using this source code in any fashion, you are agreeing to be bound
+//  by the terms of the Microsoft Public License.
+// ----------------------------------------------------------------------------------------------
+// You must not remove this notice, or any other, from this software.
+// ----------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "benchmark.h"
+#include "escape_time.h"
+#include "formulas.h"
+#include "palette.h"
+
+namespace fractal
+{
+    // Where the values of a width x height frame go when it is stored as square tiles,
+    //  each tile row major and the tiles row major too. A tile of 32 bit values is one
+    //  4 KiB page, so a 3x3 neighbourhood touches a single page (up to four at a tile
+    //  corner) instead of three rows a frame width apart. Edge tiles are padded to full
+    //  tiles, size () counts the padding.
+    struct tiled_layout
+    {
+        static unsigned int const   tile_shift  = 5                         ;
+        static unsigned int const   tile_size   = 1U << tile_shift          ;
+        static unsigned int const   tile_mask   = tile_size - 1             ;
+        static unsigned int const   tile_area   = tile_size * tile_size     ;
+
+        tiled_layout (unsigned int width, unsigned int height) noexcept
+            :   m_width     (width                                  )
+            ,   m_height    (height                                 )
+            ,   m_tiles_x   ((width  + tile_mask) >> tile_shift     )
+            ,   m_tiles_y   ((height + tile_mask) >> tile_shift     )
+        {
+        }
+
+        inline unsigned int width () const noexcept
+        {
+            return m_width;
+        }
+
+        inline unsigned int height () const noexcept
+        {
+            return m_height;
+        }
+
+        inline unsigned int tiles_x () const noexcept
+        {
+            return m_tiles_x;
+        }
+
+        inline unsigned int tiles_y () const noexcept
+        {
+            return m_tiles_y;
+        }
+
+        inline std::size_t size () const noexcept
+        {
+            return static_cast<std::size_t> (m_tiles_x) * m_tiles_y * tile_area;
+        }
+
+        // First value of tile (tx, ty)
+        inline std::size_t tile (unsigned int tx, unsigned int ty) const noexcept
+        {
+            return (static_cast<std::size_t> (ty) * m_tiles_x + tx) * tile_area;
+        }
+
+        inline std::size_t index (unsigned int x, unsigned int y) const noexcept
+        {
+            return tile (x >> tile_shift, y >> tile_shift) + ((y & tile_mask) << tile_shift) + (x & tile_mask);
+        }
+
+    private:
+        unsigned int    m_width     ;
+        unsigned int    m_height    ;
+        unsigned int    m_tiles_x   ;
+        unsigned int    m_tiles_y   ;
+    };
+
+    // render_formula into a tiled buffer of layout.size () counts. Rows are rendered a
+    //  band of tile_size at a time into a scratch band and scattered, the kernels stay
+    //  row kernels and the coordinates stay exact at any precision.
+    inline void render_tiled (
+            formula_view const &    view
+        ,   row_kernel              kernel
+        ,   tiled_layout const &    layout
+        ,   std::uint32_t *         counts
+        )
+    {
+        auto const size = tiled_layout::tile_size;
+
+        parallel_for_rows (layout.tiles_y (), [&] (unsigned int ty)
+        {
+            auto const top  = ty * size;
+            auto const rows = std::min (size, view.height - top);
+
+            std::vector<std::uint32_t> band (static_cast<std::size_t> (view.width) * rows);
+            for (auto row = 0U; row < rows; ++row)
+            {
+                kernel (view, top + row, band.data () + static_cast<std::size_t> (row) * view.width);
+            }
+
+            for (auto tx = 0U; tx < layout.tiles_x (); ++tx)
+            {
+                auto const left     = tx * size;
+                auto const columns  = std::min (size, view.width - left);
+                auto const tile     = counts + layout.tile (tx, ty);
+
+                for (auto row = 0U; row < rows; ++row)
+                {
+                    auto const source = band.data () + static_cast<std::size_t> (row) * view.width + left;
+                    std::copy (source, source + columns, tile + row * size);
+                }
+            }
+        });
+    }
+
+    // Writes map (tiled[i]) into a row major frame, the only place a tiled frame is turned
+    //  back into rows. Each tile row is a contiguous run of tile_size in and out, so the
+    //  inner loop vectorizes, as a gather when map is a table lookup.
+    template<typename T, typename U, typename TMap>
+    void detile (
+            tiled_layout const &    layout
+        ,   T const *               tiled
+        ,   U *                     linear
+        ,   TMap const &            map
+        )
+    {
+        auto const size     = tiled_layout::tile_size;
+        auto const width    = layout.width ();
+
+        parallel_for_rows (layout.tiles_y (), [&] (unsigned int ty)
+        {
+            auto const top  = ty * size;
+            auto const rows = std::min (size, layout.height () - top);
+
+            // Output row by output row, the writes stream and the band's tiles stay in cache
+            for (auto row = 0U; row < rows; ++row)
+            {
+                auto const target = linear + static_cast<std::size_t> (top + row) * width;
+
+                for (auto tx = 0U; tx < layout.tiles_x (); ++tx)
+                {
+                    auto const left     = tx * size;
+                    auto const columns  = std::min (size, width - left);
+                    auto const source   = tiled + layout.tile (tx, ty) + row * size;
+                    auto const out      = target + left;
+
+                    for (auto x = 0U; x < columns; ++x)
+                    {
+                        out[x] = map (source[x]);
+                    }
+                }
+            }
+        });
+    }
+
+    template<typename T>
+    void detile (tiled_layout const & layout, T const * tiled, T * linear)
+    {
+        detile (layout, tiled, linear, [] (T value) {return value;});
+    }
+
+    namespace details
+    {
+        inline bool differs (std::uint32_t a, std::uint32_t b, std::uint32_t threshold) noexcept
+        {
+            return (a > b ? a - b : b - a) > threshold;
+        }
+
+        // 8 neighbours of p, a row apart by stride
+        inline bool edge_at (std::uint32_t const * p, std::size_t stride, std::uint32_t threshold) noexcept
+        {
+            auto const v = *p;
+            auto const a = p - stride;
+            auto const b = p + stride;
+            return
+                    differs (a[-1], v, threshold) | differs (a[0], v, threshold) | differs (a[1], v, threshold)
+                |   differs (p[-1], v, threshold)                                | differs (p[1], v, threshold)
+                |   differs (b[-1], v, threshold) | differs (b[0], v, threshold) | differs (b[1], v, threshold)
+                ;
+        }
+
+        // Same at the frame border, neighbours outside the frame are the pixel itself
+        template<typename TAt>
+        inline bool edge_clamped (TAt const & at, unsigned int x, unsigned int y, unsigned int width, unsigned int height, std::uint32_t threshold) noexcept
+        {
+            auto const x0   = x > 0 ? x - 1 : x;
+            auto const x1   = x + 1 < width ? x + 1 : x;
+            auto const y0   = y > 0 ? y - 1 : y;
+            auto const y1   = y + 1 < height ? y + 1 : y;
+            auto const v    = at (x, y);
+
+            auto edge = false;
+            for (auto ny = y0; ny <= y1; ++ny)
+            {
+                for (auto nx = x0; nx <= x1; ++nx)
+                {
+                    edge |= differs (at (nx, ny), v, threshold);
+                }
+            }
+            return edge;
+        }
+
+        // A run of columns pixels starting at p, frame pixel (x, y), rows stride apart.
+        //  Pixels whose neighbourhood leaves the run's rows or columns go through at.
+        template<typename TAt>
+        std::size_t mark_run (
+                TAt const &             at
+            ,   std::uint32_t const *   p
+            ,   std::size_t             stride
+            ,   unsigned int            columns
+            ,   bool                    inner
+            ,   unsigned int            x
+            ,   unsigned int            y
+            ,   unsigned int            width
+            ,   unsigned int            height
+            ,   std::uint32_t           threshold
+            ,   std::uint8_t *          out
+            ) noexcept
+        {
+            auto marked = std::size_t ();
+
+            auto const clamped = [&] (unsigned int i)
+            {
+                auto const edge = edge_clamped (at, x + i, y, width, height, threshold);
+                out[i]  = edge;
+                marked  += edge;
+            };
+
+            if (!inner || columns < 3)
+            {
+                for (auto i = 0U; i < columns; ++i)
+                {
+                    clamped (i);
+                }
+                return marked;
+            }
+
+            clamped (0);
+            for (auto i = 1U; i + 1 < columns; ++i)
+            {
+                auto const edge = edge_at (p + i, stride, threshold);
+                out[i]  = edge;
+                marked  += edge;
+            }
+            clamped (columns - 1);
+
+            return marked;
+        }
+    }
+
+    // The neighbour test of render_antialiased on escape counts: edges is 1 where any of
+    //  the 8 neighbours differs by more than threshold. Row major, returns the pixels marked.
+    inline std::size_t mark_edges (
+            std::uint32_t const *   counts
+        ,   unsigned int            width
+        ,   unsigned int            height
+        ,   std::uint32_t           threshold
+        ,   std::uint8_t *          edges
+        )
+    {
+        std::vector<std::size_t> marked (height);
+
+        auto const at = [=] (unsigned int x, unsigned int y)
+        {
+            return counts[static_cast<std::size_t> (y) * width + x];
+        };
+
+        parallel_for_rows (height, [&] (unsigned int y)
+        {
+            auto const offset = static_cast<std::size_t> (y) * width;
+
+            marked[y] = details::mark_run (
+                    at
+                ,   counts + offset
+                ,   width
+                ,   width
+                ,   y > 0 && y + 1 < height
+                ,   0
+                ,   y
+                ,   width
+                ,   height
+                ,   threshold
+                ,   edges + offset
+                );
+        });
+
+        auto result = std::size_t ();
+        for (auto count : marked)
+        {
+            result += count;
+        }
+        return result;
+    }
+
+    // Same on a tiled frame, edges in the same layout. Each tile is copied with a one
+    //  pixel apron from its neighbours into a buffer that stays in L1, so every pixel of
+    //  the tile takes the fast path.
+    inline std::size_t mark_edges (
+            tiled_layout const &    layout
+        ,   std::uint32_t const *   counts
+        ,   std::uint32_t           threshold
+        ,   std::uint8_t *          edges
+        )
+    {
+        auto const size     = tiled_layout::tile_size;
+        auto const stride   = size + 2;
+        auto const width    = layout.width ();
+        auto const height   = layout.height ();
+
+        std::vector<std::size_t> marked (layout.tiles_y ());
+
+        parallel_for_rows (layout.tiles_y (), [&] (unsigned int ty)
+        {
+            auto const top  = ty * size;
+            auto const rows = std::min (size, height - top);
+
+            std::uint32_t local[stride * stride];
+
+            auto sum = std::size_t ();
+            for (auto tx = 0U; tx < layout.tiles_x (); ++tx)
+            {
+                auto const left     = tx * size;
+                auto const columns  = std::min (size, width - left);
+                auto const before   = left > 0 ? left - 1 : left;
+                auto const after    = left + columns < width ? left + columns : left + columns - 1;
+
+                // Rows outside the frame repeat the border row, columns the border column
+                for (auto row = 0U; row < rows + 2; ++row)
+                {
+                    auto const y        = std::min (std::max (top + row, 1U) - 1, height - 1);
+                    auto const source   = counts + layout.index (left, y);
+                    auto const target   = local + row * stride;
+
+                    target[0]           = counts[layout.index (before, y)];
+                    std::copy (source, source + columns, target + 1);
+                    target[columns + 1] = counts[layout.index (after, y)];
+                }
+
+                // A local threshold, the edge stores could alias the captured one
+                auto const limit    = threshold;
+                auto const out      = edges + layout.tile (tx, ty);
+                for (auto row = 0U; row < rows; ++row)
+                {
+                    auto const p = local + (row + 1) * stride + 1;
+                    auto const o = out + row * size;
+
+                    for (auto x = 0U; x < columns; ++x)
+                    {
+                        auto const edge = details::edge_at (p + x, stride, limit);
+                        o[x]    = edge;
+                        sum     += edge;
+                    }
+                }
+            }
+            marked[ty] = sum;
+        });
+
+        auto result = std::size_t ();
+        for (auto count : marked)
+        {
+            result += count;
+        }
+        return result;
+    }
+
+    // Times the neighbour heavy passes with row major and tiled buffers. A tiled frame
+    //  pays for the scatter when it is rendered and for the detile when it is shown,
+    //  so the output pass compares coloring in place with coloring while detiling.
+    inline void benchmark_layouts (
+            benchmark_report &                  report
+        ,   formula_view const &                view
+        ,   formula                             f
+        ,   precision                           p
+        ,   std::vector<std::uint32_t> const &  colors
+        ,   unsigned int                        repeats = 3
+        )
+    {
+        auto const kernel = select_kernel (f, p);
+        if (!kernel || view.width == 0 || view.height == 0)
+        {
+            return;
+        }
+
+        auto const pixels   = static_cast<std::size_t> (view.width) * view.height;
+        auto const layout   = tiled_layout (view.width, view.height);
+        auto const size     = std::to_string (view.width) + "x" + std::to_string (view.height);
+
+        std::vector<std::uint32_t>  linear      (pixels);
+        std::vector<std::uint32_t>  tiled       (layout.size ());
+        std::vector<std::uint8_t>   edges       (layout.size ());
+        std::vector<std::uint32_t>  rgba        (pixels);
+
+        auto ms = measure_ms (repeats, [&] ()
+        {
+            render_formula (view, kernel, linear.data ());
+        });
+        report.add ("layout render " + size, "row major", ms, static_cast<double> (pixels));
+
+        ms = measure_ms (repeats, [&] ()
+        {
+            render_tiled (view, kernel, layout, tiled.data ());
+        });
+        report.add ("layout render " + size, "tiled", ms, static_cast<double> (pixels));
+
+        ms = measure_ms (repeats, [&] ()
+        {
+            mark_edges (linear.data (), view.width, view.height, 0, edges.data ());
+        });
+        report.add ("layout edges " + size, "row major", ms, static_cast<double> (pixels));
+
+        ms = measure_ms (repeats, [&] ()
+        {
+            mark_edges (layout, tiled.data (), 0, edges.data ());
+        });
+        report.add ("layout edges " + size, "tiled", ms, static_cast<double> (pixels));
+
+        auto const palette = cyclic_palette (colors, 0, view.iter);
+
+        ms = measure_ms (repeats, [&] ()
+        {
+            parallel_for_rows (view.height, [&] (unsigned int y)
+            {
+                auto const offset = static_cast<std::size_t> (y) * view.width;
+                for (auto x = 0U; x < view.width; ++x)
+                {
+                    rgba[offset + x] = palette (linear[offset + x]);
+                }
+            });
+        });
+        report.add ("layout output " + size, "row major", ms, static_cast<double> (pixels));
+
+        ms = measure_ms (repeats, [&] ()
+        {
+            detile (layout, tiled.data (), rgba.data (), palette);
+        });
+        report.add ("layout output " + size, "detile", ms, static_cast<double> (pixels));
+    }
+}